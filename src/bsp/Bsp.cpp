@@ -14,7 +14,11 @@
 #include <float.h>
 #include "Wad.h"
 #include <unordered_set>
+#include <unordered_map>
+#include <climits>
 #include "Renderer.h"
+#include "LumpBuilder.h"
+#include "Trace.h"
 
 typedef map< string, vec3 > mapStringToVector;
 
@@ -161,21 +165,16 @@ void Bsp::get_model_vertex_bounds(int modelIdx, vec3& mins, vec3& maxs) {
 
 	if (!model.nFaces) {
 		// use the clipping hull "faces" instead
-		Clipper clipper;
-		vector<NodeVolumeCuts> solidNodes = get_model_leaf_volume_cuts(modelIdx, 0, CONTENTS_SOLID);
-		if (solidNodes.empty()) {
-			solidNodes = get_model_leaf_volume_cuts(modelIdx, 3, CONTENTS_SOLID);
-		}
-		if (solidNodes.empty()) {
-			solidNodes = get_model_leaf_volume_cuts(modelIdx, 1, CONTENTS_SOLID);
+		vector<CMesh> solidMeshes;
+		get_model_leaf_volumes(modelIdx, 0, CONTENTS_SOLID, solidMeshes);
+		if (solidMeshes.empty()) {
+			get_model_leaf_volumes(modelIdx, 3, CONTENTS_SOLID, solidMeshes);
 		}
-		if (solidNodes.empty()) {
-			solidNodes = get_model_leaf_volume_cuts(modelIdx, 2, CONTENTS_SOLID);
+		if (solidMeshes.empty()) {
+			get_model_leaf_volumes(modelIdx, 1, CONTENTS_SOLID, solidMeshes);
 		}
-
-		vector<CMesh> solidMeshes;
-		for (int k = 0; k < solidNodes.size(); k++) {
-			solidMeshes.push_back(clipper.clip(solidNodes[k].cuts));
+		if (solidMeshes.empty()) {
+			get_model_leaf_volumes(modelIdx, 2, CONTENTS_SOLID, solidMeshes);
 		}
 
 		for (int m = 0; m < solidMeshes.size(); m++) {
@@ -336,97 +335,83 @@ void Bsp::getNodePlanes(int iNode, vector<int>& nodePlanes) {
 	}
 }
 
-vector<NodeVolumeCuts> Bsp::get_model_leaf_volume_cuts(int modelIdx, int hullIdx, int16_t contents) {
-	vector<NodeVolumeCuts> modelVolumeCuts;
+void Bsp::get_model_leaf_volumes(int modelIdx, int hullIdx, int16_t contents, vector<CMesh>& output) {
+	TRACE_SCOPE("get_model_leaf_volumes");
 
-	if (hullIdx >= 0 && hullIdx < MAX_MAP_HULLS)
-	{
-		int nodeIdx = models[modelIdx].iHeadnodes[hullIdx];
-		bool is_valid_node = false;
-		
-		if (hullIdx == 0) {
-			is_valid_node = nodeIdx >= 0 && nodeIdx < nodeCount;
-		}
-		else {
-			is_valid_node = nodeIdx >= 0 && nodeIdx < clipnodeCount;
-		}
+	if (modelIdx < 0 || modelIdx >= modelCount || hullIdx < 0 || hullIdx >= MAX_MAP_HULLS) {
+		return;
+	}
 
-		if (nodeIdx >= 0 && is_valid_node) {
-			vector<BSPPLANE> clipOrder;
-			if (hullIdx == 0) {
-				get_node_leaf_cuts(nodeIdx, clipOrder, modelVolumeCuts, contents);
-			}
-			else {
-				get_clipnode_leaf_cuts(nodeIdx, clipOrder, modelVolumeCuts, contents);
-			}
-		}
+	int nodeIdx = models[modelIdx].iHeadnodes[hullIdx];
+	int maxNodes = hullIdx == 0 ? nodeCount : clipnodeCount;
+
+	if (nodeIdx < 0 || nodeIdx >= maxNodes) {
+		return;
 	}
-	return modelVolumeCuts;
+
+	// stack of node volumes along the current path. A volume is only copied where both sides of a
+	// node lead to wanted leaves, and the copies reuse the buffers left over from earlier branches.
+	Clipper clipper;
+	vector<CMesh> volumes;
+	volumes.push_back(clipper.createMaxSizeVolume());
+
+	get_leaf_volumes(nodeIdx, hullIdx != 0, contents, 0, volumes, output);
 }
 
-void Bsp::get_clipnode_leaf_cuts(int iNode, vector<BSPPLANE>& clipOrder, vector<NodeVolumeCuts>& output, int16_t contents) {
-	BSPCLIPNODE& node = clipnodes[iNode];
+void Bsp::get_leaf_volumes(int iNode, bool isClipnode, int16_t contents, int depth, vector<CMesh>& volumes, vector<CMesh>& output) {
+	int iPlane = isClipnode ? clipnodes[iNode].iPlane : nodes[iNode].iPlane;
 
-	if (node.iPlane < 0) {
+	if (iPlane < 0) {
 		return;
 	}
 
+	int children[2];
+	bool wanted[2];
 	for (int i = 0; i < 2; i++) {
-		BSPPLANE plane = planes[node.iPlane];
-		if (i != 0) {
-			plane.vNormal = plane.vNormal.invert();
-			plane.fDist = -plane.fDist;
+		children[i] = isClipnode ? clipnodes[iNode].iChildren[i] : nodes[iNode].iChildren[i];
+		if (children[i] >= 0) {
+			wanted[i] = true;
 		}
-		clipOrder.push_back(plane);
-
-		if (node.iChildren[i] >= 0) {
-			get_clipnode_leaf_cuts(node.iChildren[i], clipOrder, output, contents);
-		}
-		else if (node.iChildren[i] == contents) {
-			NodeVolumeCuts nodeVolumeCuts;
-			nodeVolumeCuts.nodeIdx = iNode;
-
-			// reverse order of branched planes = order of cuts to the world which define this node's volume
-			// https://qph.fs.quoracdn.net/main-qimg-2a8faad60cc9d437b58a6e215e6e874d
-			for (int k = clipOrder.size() - 1; k >= 0; k--) {
-				nodeVolumeCuts.cuts.push_back(clipOrder[k]);
-			}
-
-			output.push_back(nodeVolumeCuts);
+		else {
+			wanted[i] = (isClipnode ? children[i] : leaves[~children[i]].nContents) == contents;
 		}
-
-		clipOrder.pop_back();
 	}
-}
 
-void Bsp::get_node_leaf_cuts(int iNode, vector<BSPPLANE>& clipOrder, vector<NodeVolumeCuts>& output, int16_t contents) {
-	BSPNODE& node = nodes[iNode];
+	Clipper clipper;
 
 	for (int i = 0; i < 2; i++) {
-		BSPPLANE plane = planes[node.iPlane];
+		if (!wanted[i]) {
+			continue;
+		}
+
+		BSPPLANE plane = planes[iPlane];
 		if (i != 0) {
 			plane.vNormal = plane.vNormal.invert();
 			plane.fDist = -plane.fDist;
 		}
-		clipOrder.push_back(plane);
 
-		if (node.iChildren[i] >= 0) {
-			get_node_leaf_cuts(node.iChildren[i], clipOrder, output, contents);
-		}
-		else if (leaves[~node.iChildren[i]].nContents == contents) {
-			NodeVolumeCuts nodeVolumeCuts;
-			nodeVolumeCuts.nodeIdx = iNode;
-
-			// reverse order of branched planes = order of cuts to the world which define this node's volume
-			// https://qph.fs.quoracdn.net/main-qimg-2a8faad60cc9d437b58a6e215e6e874d
-			for (int k = clipOrder.size() - 1; k >= 0; k--) {
-				nodeVolumeCuts.cuts.push_back(clipOrder[k]);
+		// the last child to use this node's volume can clip it in place. The front child gets
+		// a copy if the back child needs the volume too. Deeper calls may resize the volume list,
+		// so don't hold references to it.
+		int slot = depth;
+		if (i == 0 && wanted[1]) {
+			slot = depth + 1;
+			if (volumes.size() <= slot) {
+				volumes.resize(slot + 1);
 			}
+			volumes[slot] = volumes[depth];
+		}
 
-			output.push_back(nodeVolumeCuts);
+		if (!clipper.clip(volumes[slot], plane)) {
+			continue; // no space on this side of the plane
 		}
 
-		clipOrder.pop_back();
+		if (children[i] >= 0) {
+			get_leaf_volumes(children[i], isClipnode, contents, slot, volumes, output);
+		}
+		else {
+			output.push_back(std::move(volumes[slot]));
+		}
 	}
 }
 
@@ -1162,6 +1147,8 @@ void Bsp::replace_lumps(LumpState& state) {
 		delete[] lumps[i];
 		lumps[i] = new byte[state.lumpLen[i]];
 		memcpy(lumps[i], state.lumps[i], state.lumpLen[i]);
+		lumpBuffers[i] = lumps[i];
+		lumpCapacity[i] = state.lumpLen[i];
 		header.lump[i].nLength = state.lumpLen[i];
 
 		if (i == LUMP_ENTITIES) {
@@ -1387,6 +1374,7 @@ int Bsp::remove_unused_visdata(STRUCTREMAP* remap, BSPLEAF* oldLeaves, int oldLe
 }
 
 STRUCTCOUNT Bsp::remove_unused_model_structures() {
+	TRACE_SCOPE("remove_unused_model_structures");
 	int oldVisLeafCount = 0;
 	count_leaves(models[0].iHeadnodes[0], oldVisLeafCount);
 	//oldVisLeafCount = models[0].nVisLeafs;
@@ -1521,6 +1509,424 @@ STRUCTCOUNT Bsp::remove_unused_model_structures() {
 	return removeCount;
 }
 
+static uint64_t weld_cell_key(int x, int y, int z) {
+	return ((uint64_t)(x & 0x1FFFFF) << 42) | ((uint64_t)(y & 0x1FFFFF) << 21) | (uint64_t)(z & 0x1FFFFF);
+}
+
+STRUCTCOUNT Bsp::weld_vertices(float epsilon) {
+	TRACE_SCOPE("weld_vertices");
+	STRUCTCOUNT removeCount;
+	memset(&removeCount, 0, sizeof(STRUCTCOUNT));
+
+	if (vertCount == 0 || edgeCount == 0)
+		return removeCount;
+
+	// find a vertex to weld to using a hash grid. Cells are at least as large as the epsilon
+	// so only the neighboring cells need to be checked. The first vertex in a cluster wins.
+	float cellSize = max(epsilon, 1.0f);
+	float epsilonSq = epsilon * epsilon;
+	unordered_map<uint64_t, int> cellHeads; // first unwelded vertex in each cell
+	vector<int> cellNext(vertCount, -1); // next unwelded vertex in the same cell
+	vector<int> weldTarget(vertCount);
+	cellHeads.reserve(vertCount);
+
+	for (int i = 0; i < vertCount; i++) {
+		int cx = (int)floor(verts[i].x / cellSize);
+		int cy = (int)floor(verts[i].y / cellSize);
+		int cz = (int)floor(verts[i].z / cellSize);
+		weldTarget[i] = i;
+
+		for (int n = 0; n < 27 && weldTarget[i] == i; n++) {
+			auto cell = cellHeads.find(weld_cell_key(cx + n % 3 - 1, cy + (n / 3) % 3 - 1, cz + n / 9 - 1));
+			if (cell == cellHeads.end())
+				continue;
+
+			for (int k = cell->second; k != -1; k = cellNext[k]) {
+				if ((verts[k] - verts[i]).lengthSquared() <= epsilonSq) {
+					weldTarget[i] = k;
+					break;
+				}
+			}
+		}
+
+		if (weldTarget[i] == i) {
+			uint64_t key = weld_cell_key(cx, cy, cz);
+			auto cell = cellHeads.find(key);
+			if (cell != cellHeads.end()) {
+				cellNext[i] = cell->second;
+				cell->second = i;
+			}
+			else {
+				cellHeads[key] = i;
+			}
+		}
+	}
+
+	// Move the welded vertexes and undo welds that would collapse a face edge or change
+	// face extents (which would invalidate the lightmap). Undoing a weld only moves vertexes
+	// back to where they were, but that can change extents of other faces, so repeat until stable.
+	vector<int> oldExtents(faceCount * 4);
+	for (int i = 0; i < faceCount; i++) {
+		GetFaceExtents(this, i, &oldExtents[i * 4], &oldExtents[i * 4 + 2]);
+	}
+
+	vector<vec3> oldVerts(verts, verts + vertCount);
+	for (int i = 0; i < vertCount; i++) {
+		verts[i] = oldVerts[weldTarget[i]];
+	}
+
+	vector<int> faceVerts;
+	bool changed = true;
+	while (changed) {
+		changed = false;
+
+		for (int i = 0; i < faceCount; i++) {
+			BSPFACE& face = faces[i];
+
+			faceVerts.clear();
+			bool anyWelded = false;
+			for (int e = 0; e < face.nEdges; e++) {
+				int32_t edgeIdx = surfedges[face.iFirstEdge + e];
+				int v = edgeIdx >= 0 ? edges[edgeIdx].iVertex[0] : edges[-edgeIdx].iVertex[1];
+				anyWelded |= weldTarget[v] != v;
+				faceVerts.push_back(v);
+			}
+
+			if (!anyWelded)
+				continue;
+
+			bool valid = true;
+			for (int a = 0; a < faceVerts.size() && valid; a++) {
+				for (int b = a + 1; b < faceVerts.size(); b++) {
+					if (faceVerts[a] != faceVerts[b] && weldTarget[faceVerts[a]] == weldTarget[faceVerts[b]]) {
+						valid = false;
+						break;
+					}
+				}
+			}
+
+			if (valid) {
+				int extents[4];
+				GetFaceExtents(this, i, &extents[0], &extents[2]);
+				valid = memcmp(extents, &oldExtents[i * 4], sizeof(extents)) == 0;
+			}
+
+			if (!valid) {
+				for (int k = 0; k < faceVerts.size(); k++) {
+					int v = faceVerts[k];
+					if (weldTarget[v] != v) {
+						weldTarget[v] = v;
+						verts[v] = oldVerts[v];
+						changed = true;
+					}
+				}
+			}
+		}
+	}
+
+	vector<int> vertRemap(vertCount);
+	vector<vec3> newVerts;
+	newVerts.reserve(vertCount);
+	for (int i = 0; i < vertCount; i++) {
+		if (weldTarget[i] == i) {
+			vertRemap[i] = newVerts.size();
+			newVerts.push_back(verts[i]);
+		}
+		else {
+			vertRemap[i] = vertRemap[weldTarget[i]];
+		}
+	}
+
+	// Rebuild edges from the surfedges, one edge per vertex pair.
+	// Faces that walk an edge backwards use a negative surfedge.
+	vector<BSPEDGE> newEdges;
+	unordered_map<uint32_t, int> edgeLookup; // (min vertex, max vertex) -> edge index
+	newEdges.reserve(edgeCount);
+	edgeLookup.reserve(edgeCount);
+
+	// first edge is never used but maps break without it?
+	newEdges.push_back(BSPEDGE(vertRemap[edges[0].iVertex[0]], vertRemap[edges[0].iVertex[1]]));
+
+	for (int i = 0; i < surfedgeCount; i++) {
+		int32_t edgeIdx = surfedges[i];
+		BSPEDGE& edge = edges[abs(edgeIdx)];
+		uint16_t v0 = vertRemap[edge.iVertex[edgeIdx >= 0 ? 0 : 1]];
+		uint16_t v1 = vertRemap[edge.iVertex[edgeIdx >= 0 ? 1 : 0]];
+		uint32_t key = ((uint32_t)min(v0, v1) << 16) | max(v0, v1);
+
+		auto existing = edgeLookup.find(key);
+		if (existing != edgeLookup.end()) {
+			int idx = existing->second;
+			surfedges[i] = newEdges[idx].iVertex[0] == v0 ? idx : -idx;
+			continue;
+		}
+
+		edgeLookup[key] = newEdges.size();
+		surfedges[i] = newEdges.size();
+		newEdges.push_back(BSPEDGE(v0, v1));
+	}
+
+	removeCount.verts = vertCount - newVerts.size();
+	removeCount.edges = edgeCount - newEdges.size();
+
+	int vertLumpSize = newVerts.size() * sizeof(vec3);
+	byte* vertLump = new byte[vertLumpSize];
+	memcpy(vertLump, &newVerts[0], vertLumpSize);
+	replace_lump(LUMP_VERTICES, vertLump, vertLumpSize);
+
+	int edgeLumpSize = newEdges.size() * sizeof(BSPEDGE);
+	byte* edgeLump = new byte[edgeLumpSize];
+	memcpy(edgeLump, &newEdges[0], edgeLumpSize);
+	replace_lump(LUMP_EDGES, edgeLump, edgeLumpSize);
+
+	return removeCount;
+}
+
+static uint64_t plane_cell_key(int nx, int ny, int nz, int dist) {
+	int cell[4] = { nx, ny, nz, dist };
+	return hashData(cell, sizeof(cell));
+}
+
+// returns the index of the first plane equal to each plane, within the epsilons used by the compiler.
+// Planes facing the other way are returned as ~index. Planes are hashed on a grid so this
+// doesn't need to compare every pair.
+static vector<int> find_equal_planes(const BSPPLANE* planes, int planeCount) {
+	const float normalEpsilon = 0.00001f;
+	const float distEpsilon = 0.01f;
+
+	vector<int> remap(planeCount);
+	unordered_multimap<uint64_t, int> lookup;
+	lookup.reserve(planeCount);
+
+	for (int i = 0; i < planeCount; i++) {
+		const BSPPLANE& plane = planes[i];
+		int nx = (int)floor(plane.vNormal.x / normalEpsilon + 0.5f);
+		int ny = (int)floor(plane.vNormal.y / normalEpsilon + 0.5f);
+		int nz = (int)floor(plane.vNormal.z / normalEpsilon + 0.5f);
+		int dist = (int)floor(plane.fDist / distEpsilon + 0.5f);
+		remap[i] = i;
+
+		// distances drift more than normals, so check the neighboring distance cells too
+		for (int flip = 0; flip < 2 && remap[i] == i; flip++) {
+			float s = flip ? -1 : 1;
+			int is = flip ? -1 : 1;
+
+			for (int k = -1; k <= 1 && remap[i] == i; k++) {
+				auto range = lookup.equal_range(plane_cell_key(nx * is, ny * is, nz * is, dist * is + k));
+
+				for (auto it = range.first; it != range.second; ++it) {
+					const BSPPLANE& other = planes[it->second];
+					if (fabs(other.fDist - plane.fDist * s) <= distEpsilon
+						&& fabs(other.vNormal.x - plane.vNormal.x * s) <= normalEpsilon
+						&& fabs(other.vNormal.y - plane.vNormal.y * s) <= normalEpsilon
+						&& fabs(other.vNormal.z - plane.vNormal.z * s) <= normalEpsilon) {
+						remap[i] = flip ? ~it->second : it->second;
+						break;
+					}
+				}
+			}
+		}
+
+		if (remap[i] == i) {
+			lookup.insert(make_pair(plane_cell_key(nx, ny, nz, dist), i));
+		}
+	}
+
+	return remap;
+}
+
+// builds a new clipnode lump where identical subtrees are stored only once
+struct ClipnodeSharer {
+	Bsp* map;
+	vector<int> newIndex; // new index or contents for each old clipnode, or INT_MAX if not visited yet
+	vector<BSPCLIPNODE> newClipnodes;
+	unordered_map<uint64_t, int> lookup; // (plane, child 0, child 1) -> new clipnode index
+
+	int16_t share(int iNode) {
+		if (newIndex[iNode] != INT_MAX)
+			return newIndex[iNode];
+
+		BSPCLIPNODE& node = map->clipnodes[iNode];
+		int16_t children[2];
+		for (int i = 0; i < 2; i++) {
+			children[i] = node.iChildren[i] >= 0 ? share(node.iChildren[i]) : node.iChildren[i];
+		}
+
+		// both sides lead to the same place, so the split does nothing
+		if (children[0] == children[1]) {
+			newIndex[iNode] = children[0];
+			return children[0];
+		}
+
+		int iPlane = node.iPlane;
+		uint64_t key = ((uint64_t)(uint32_t)iPlane << 32) | ((uint32_t)(uint16_t)children[0] << 16) | (uint16_t)children[1];
+
+		auto existing = lookup.find(key);
+		if (existing != lookup.end()) {
+			newIndex[iNode] = existing->second;
+			return existing->second;
+		}
+
+		BSPCLIPNODE newNode;
+		newNode.iPlane = iPlane;
+		newNode.iChildren[0] = children[0];
+		newNode.iChildren[1] = children[1];
+
+		int idx = newClipnodes.size();
+		newClipnodes.push_back(newNode);
+		lookup[key] = idx;
+		newIndex[iNode] = idx;
+		return idx;
+	}
+};
+
+STRUCTCOUNT Bsp::share_clipnodes() {
+	TRACE_SCOPE("share_clipnodes");
+	STRUCTCOUNT removeCount;
+	memset(&removeCount, 0, sizeof(STRUCTCOUNT));
+
+	if (clipnodeCount == 0)
+		return removeCount;
+
+	// equal planes need equal indexes for equal subtrees to hash the same
+	removeCount = merge_duplicate_planes();
+
+	ClipnodeSharer sharer;
+	sharer.map = this;
+	sharer.newIndex.resize(clipnodeCount, INT_MAX);
+	sharer.newClipnodes.reserve(clipnodeCount);
+	sharer.lookup.reserve(clipnodeCount);
+
+	// children are added before their parents, so a hull's nodes end up close together
+	for (int i = 0; i < modelCount; i++) {
+		for (int k = 1; k < MAX_MAP_HULLS; k++) {
+			int& headnode = models[i].iHeadnodes[k];
+			if (headnode >= 0 && headnode < clipnodeCount) {
+				headnode = sharer.share(headnode);
+			}
+		}
+	}
+
+	removeCount.clipnodes = clipnodeCount - sharer.newClipnodes.size();
+
+	int lumpSize = sharer.newClipnodes.size() * sizeof(BSPCLIPNODE);
+	byte* newLump = new byte[lumpSize];
+	if (lumpSize)
+		memcpy(newLump, &sharer.newClipnodes[0], lumpSize);
+	replace_lump(LUMP_CLIPNODES, newLump, lumpSize);
+
+	removeCount.planes += remove_unused_planes();
+
+	return removeCount;
+}
+
+STRUCTCOUNT Bsp::merge_duplicate_planes() {
+	TRACE_SCOPE("merge_duplicate_planes");
+	STRUCTCOUNT removeCount;
+	memset(&removeCount, 0, sizeof(STRUCTCOUNT));
+
+	vector<int> remap = find_equal_planes(planes, planeCount);
+
+	// The engine tests axial planes with a single coordinate and assumes the normal points along
+	// the positive axis. A kept plane that faces the other way is flipped, along with everything
+	// that was merged into it, so a node never ends up on a backwards axial plane.
+	for (int i = 0; i < planeCount; i++) {
+		BSPPLANE& plane = planes[i];
+		if (remap[i] != i || plane.nType > PLANE_Z) {
+			continue;
+		}
+
+		float axis = plane.nType == PLANE_X ? plane.vNormal.x : (plane.nType == PLANE_Y ? plane.vNormal.y : plane.vNormal.z);
+		if (axis < 0) {
+			plane.vNormal = plane.vNormal.invert();
+			plane.fDist = -plane.fDist;
+			remap[i] = ~i;
+		}
+	}
+	for (int i = 0; i < planeCount; i++) {
+		int iPlane = remap[i] < 0 ? ~remap[i] : remap[i];
+		if (iPlane != i && remap[iPlane] < 0) {
+			remap[i] = ~remap[i];
+		}
+	}
+
+	// flipped planes swap which child is in front
+	for (int i = 0; i < nodeCount; i++) {
+		int iPlane = remap[nodes[i].iPlane];
+		if (iPlane < 0) {
+			nodes[i].iPlane = ~iPlane;
+			std::swap(nodes[i].iChildren[0], nodes[i].iChildren[1]);
+		}
+		else {
+			nodes[i].iPlane = iPlane;
+		}
+	}
+	for (int i = 0; i < clipnodeCount; i++) {
+		int iPlane = remap[clipnodes[i].iPlane];
+		if (iPlane < 0) {
+			clipnodes[i].iPlane = ~iPlane;
+			std::swap(clipnodes[i].iChildren[0], clipnodes[i].iChildren[1]);
+		}
+		else {
+			clipnodes[i].iPlane = iPlane;
+		}
+	}
+	for (int i = 0; i < faceCount; i++) {
+		int iPlane = remap[faces[i].iPlane];
+		if (iPlane < 0) {
+			faces[i].iPlane = ~iPlane;
+			faces[i].nPlaneSide = !faces[i].nPlaneSide;
+		}
+		else {
+			faces[i].iPlane = iPlane;
+		}
+	}
+
+	removeCount.planes = remove_unused_planes();
+
+	return removeCount;
+}
+
+int Bsp::remove_unused_planes() {
+	vector<int> newIndex(planeCount, -1);
+
+	for (int i = 0; i < nodeCount; i++) {
+		newIndex[nodes[i].iPlane] = 0;
+	}
+	for (int i = 0; i < clipnodeCount; i++) {
+		newIndex[clipnodes[i].iPlane] = 0;
+	}
+	for (int i = 0; i < faceCount; i++) {
+		newIndex[faces[i].iPlane] = 0;
+	}
+
+	int newPlaneCount = 0;
+	for (int i = 0; i < planeCount; i++) {
+		if (newIndex[i] != -1) {
+			newIndex[i] = newPlaneCount;
+			planes[newPlaneCount++] = planes[i];
+		}
+	}
+
+	int removed = planeCount - newPlaneCount;
+	if (!removed)
+		return 0;
+
+	for (int i = 0; i < nodeCount; i++) {
+		nodes[i].iPlane = newIndex[nodes[i].iPlane];
+	}
+	for (int i = 0; i < clipnodeCount; i++) {
+		clipnodes[i].iPlane = newIndex[clipnodes[i].iPlane];
+	}
+	for (int i = 0; i < faceCount; i++) {
+		faces[i].iPlane = newIndex[faces[i].iPlane];
+	}
+
+	resize_lump(LUMP_PLANES, newPlaneCount * sizeof(BSPPLANE));
+
+	return removed;
+}
+
 bool Bsp::has_hull2_ents() {
 	// monsters that use hull 2 by default
 	static set<string> largeMonsters{
@@ -1784,7 +2190,7 @@ STRUCTCOUNT Bsp::delete_unused_hulls(bool noProgress) {
 	return removed;
 }
 
-void Bsp::delete_oob_nodes(int iNode, int16_t* parentBranch, vector<BSPPLANE>& clipOrder, int oobFlags, 
+void Bsp::delete_oob_nodes(int iNode, int16_t* parentBranch, CMesh& volume, int oobFlags, 
 	bool* oobHistory, bool isFirstPass, int& removedNodes) {
 	BSPNODE& node = nodes[iNode];
 	float oob_coord = g_limits.max_mapboundary;
@@ -1794,6 +2200,7 @@ void Bsp::delete_oob_nodes(int iNode, int16_t* parentBranch, vector<BSPPLANE>& c
 	}
 
 	bool isoob = isFirstPass ? true : oobHistory[iNode];
+	Clipper clipper;
 
 	for (int i = 0; i < 2; i++) {
 		BSPPLANE plane = planes[node.iPlane];
@@ -1801,24 +2208,21 @@ void Bsp::delete_oob_nodes(int iNode, int16_t* parentBranch, vector<BSPPLANE>& c
 			plane.vNormal = plane.vNormal.invert();
 			plane.fDist = -plane.fDist;
 		}
-		clipOrder.push_back(plane);
+
+		CMesh nodeVolume;
+		if (isFirstPass) {
+			nodeVolume = volume;
+			clipper.clip(nodeVolume, plane);
+		}
 
 		if (node.iChildren[i] >= 0) {
-			delete_oob_nodes(node.iChildren[i], &node.iChildren[i], clipOrder, oobFlags, oobHistory, 
+			delete_oob_nodes(node.iChildren[i], &node.iChildren[i], nodeVolume, oobFlags, oobHistory, 
 				isFirstPass, removedNodes);
 			if (node.iChildren[i] >= 0) {
 				isoob = false; // children weren't empty, so this node isn't empty either
 			}
 		}
 		else if (isFirstPass) {
-			vector<BSPPLANE> cuts;
-			for (int k = clipOrder.size() - 1; k >= 0; k--) {
-				cuts.push_back(clipOrder[k]);
-			}
-
-			Clipper clipper;
-			CMesh nodeVolume = clipper.clip(cuts);
-
 			for (int k = 0; k < nodeVolume.verts.size(); k++) {
 				if (!nodeVolume.verts[k].visible)
 					continue;
@@ -1836,8 +2240,6 @@ void Bsp::delete_oob_nodes(int iNode, int16_t* parentBranch, vector<BSPPLANE>& c
 				}
 			}
 		}
-
-		clipOrder.pop_back();
 	}
 
 	if (isFirstPass) {
@@ -1855,7 +2257,7 @@ void Bsp::delete_oob_nodes(int iNode, int16_t* parentBranch, vector<BSPPLANE>& c
 	}
 }
 
-void Bsp::delete_oob_clipnodes(int iNode, int16_t* parentBranch, vector<BSPPLANE>& clipOrder, int oobFlags, 
+void Bsp::delete_oob_clipnodes(int iNode, int16_t* parentBranch, CMesh& volume, int oobFlags, 
 	bool* oobHistory, bool isFirstPass, int& removedNodes)  {
 	BSPCLIPNODE& node = clipnodes[iNode];
 	float oob_coord = g_limits.max_mapboundary;
@@ -1865,6 +2267,7 @@ void Bsp::delete_oob_clipnodes(int iNode, int16_t* parentBranch, vector<BSPPLANE
 	}
 
 	bool isoob = isFirstPass ? true : oobHistory[iNode];
+	Clipper clipper;
 
 	for (int i = 0; i < 2; i++) {
 		BSPPLANE plane = planes[node.iPlane];
@@ -1872,24 +2275,21 @@ void Bsp::delete_oob_clipnodes(int iNode, int16_t* parentBranch, vector<BSPPLANE
 			plane.vNormal = plane.vNormal.invert();
 			plane.fDist = -plane.fDist;
 		}
-		clipOrder.push_back(plane);
+
+		CMesh nodeVolume;
+		if (isFirstPass) {
+			nodeVolume = volume;
+			clipper.clip(nodeVolume, plane);
+		}
 
 		if (node.iChildren[i] >= 0) {
-			delete_oob_clipnodes(node.iChildren[i], &node.iChildren[i], clipOrder, oobFlags, 
+			delete_oob_clipnodes(node.iChildren[i], &node.iChildren[i], nodeVolume, oobFlags, 
 				oobHistory, isFirstPass, removedNodes);
 			if (node.iChildren[i] >= 0) {
 				isoob = false; // children weren't empty, so this node isn't empty either
 			}
 		}
 		else if (isFirstPass) {
-			vector<BSPPLANE> cuts;
-			for (int k = clipOrder.size() - 1; k >= 0; k--) {
-				cuts.push_back(clipOrder[k]);
-			}
-			
-			Clipper clipper;
-			CMesh nodeVolume = clipper.clip(cuts);
-
 			vec3 mins(FLT_MAX, FLT_MAX, FLT_MAX);
 			vec3 maxs(-FLT_MAX, -FLT_MAX, -FLT_MAX);
 
@@ -1912,8 +2312,6 @@ void Bsp::delete_oob_clipnodes(int iNode, int16_t* parentBranch, vector<BSPPLANE
 				isoob = false; // node can't be empty if both children aren't oob
 			}
 		}
-
-		clipOrder.pop_back();
 	}
 
 	// clipnodes are reused in the BSP tree. Some paths to the same node involve more plane intersections
@@ -1944,7 +2342,8 @@ void Bsp::delete_oob_data(int clipFlags) {
 
 	// remove OOB nodes and clipnodes
 	{
-		vector<BSPPLANE> clipOrder;
+		Clipper clipper;
+		CMesh worldVolume = clipper.createMaxSizeVolume();
 
 		bool* oobMarks = new bool[nodeCount];
 		
@@ -1953,20 +2352,24 @@ void Bsp::delete_oob_data(int clipFlags) {
 		do {
 			removedNodes = 0;
 			memset(oobMarks, 1, nodeCount * sizeof(bool)); // assume everything is oob at first
-			delete_oob_nodes(worldmodel.iHeadnodes[0], NULL, clipOrder, clipFlags, oobMarks, true, removedNodes);
-			delete_oob_nodes(worldmodel.iHeadnodes[0], NULL, clipOrder, clipFlags, oobMarks, false, removedNodes);
+			delete_oob_nodes(worldmodel.iHeadnodes[0], NULL, worldVolume, clipFlags, oobMarks, true, removedNodes);
+			delete_oob_nodes(worldmodel.iHeadnodes[0], NULL, worldVolume, clipFlags, oobMarks, false, removedNodes);
 		} while (removedNodes);
 		delete[] oobMarks;
 
 		oobMarks = new bool[clipnodeCount];
 		for (int i = 1; i < MAX_MAP_HULLS; i++) {
+			if (worldmodel.iHeadnodes[i] < 0) {
+				continue; // hull is empty
+			}
+
 			// collect oob data, then actually remove the nodes
 			int removedNodes = 0;
 			do {
 				removedNodes = 0;
 				memset(oobMarks, 1, clipnodeCount * sizeof(bool)); // assume everything is oob at first
-				delete_oob_clipnodes(worldmodel.iHeadnodes[i], NULL, clipOrder, clipFlags, oobMarks, true, removedNodes);
-				delete_oob_clipnodes(worldmodel.iHeadnodes[i], NULL, clipOrder, clipFlags, oobMarks, false, removedNodes);
+				delete_oob_clipnodes(worldmodel.iHeadnodes[i], NULL, worldVolume, clipFlags, oobMarks, true, removedNodes);
+				delete_oob_clipnodes(worldmodel.iHeadnodes[i], NULL, worldVolume, clipFlags, oobMarks, false, removedNodes);
 			} while (removedNodes);
 		}
 		delete[] oobMarks;
@@ -2147,7 +2550,7 @@ void Bsp::delete_oob_data(int clipFlags) {
 }
 
 
-void Bsp::delete_box_nodes(int iNode, int16_t* parentBranch, vector<BSPPLANE>& clipOrder,
+void Bsp::delete_box_nodes(int iNode, int16_t* parentBranch, CMesh& volume,
 	vec3 clipMins, vec3 clipMaxs, bool* oobHistory, bool isFirstPass, int& removedNodes) {
 	BSPNODE& node = nodes[iNode];
 	float oob_coord = g_limits.max_mapboundary;
@@ -2157,6 +2560,7 @@ void Bsp::delete_box_nodes(int iNode, int16_t* parentBranch, vector<BSPPLANE>& c
 	}
 
 	bool isoob = isFirstPass ? true : oobHistory[iNode];
+	Clipper clipper;
 
 	for (int i = 0; i < 2; i++) {
 		BSPPLANE plane = planes[node.iPlane];
@@ -2164,24 +2568,21 @@ void Bsp::delete_box_nodes(int iNode, int16_t* parentBranch, vector<BSPPLANE>& c
 			plane.vNormal = plane.vNormal.invert();
 			plane.fDist = -plane.fDist;
 		}
-		clipOrder.push_back(plane);
+
+		CMesh nodeVolume;
+		if (isFirstPass) {
+			nodeVolume = volume;
+			clipper.clip(nodeVolume, plane);
+		}
 
 		if (node.iChildren[i] >= 0) {
-			delete_box_nodes(node.iChildren[i], &node.iChildren[i], clipOrder, clipMins, clipMaxs, 
+			delete_box_nodes(node.iChildren[i], &node.iChildren[i], nodeVolume, clipMins, clipMaxs, 
 				oobHistory, isFirstPass, removedNodes);
 			if (node.iChildren[i] >= 0) {
 				isoob = false; // children weren't empty, so this node isn't empty either
 			}
 		}
 		else if (isFirstPass) {
-			vector<BSPPLANE> cuts;
-			for (int k = clipOrder.size() - 1; k >= 0; k--) {
-				cuts.push_back(clipOrder[k]);
-			}
-
-			Clipper clipper;
-			CMesh nodeVolume = clipper.clip(cuts);
-
 			for (int k = 0; k < nodeVolume.verts.size(); k++) {
 				if (!nodeVolume.verts[k].visible)
 					continue;
@@ -2192,8 +2593,6 @@ void Bsp::delete_box_nodes(int iNode, int16_t* parentBranch, vector<BSPPLANE>& c
 				}
 			}
 		}
-
-		clipOrder.pop_back();
 	}
 
 	if (isFirstPass) {
@@ -2211,7 +2610,7 @@ void Bsp::delete_box_nodes(int iNode, int16_t* parentBranch, vector<BSPPLANE>& c
 	}
 }
 
-void Bsp::delete_box_clipnodes(int iNode, int16_t* parentBranch, vector<BSPPLANE>& clipOrder,
+void Bsp::delete_box_clipnodes(int iNode, int16_t* parentBranch, CMesh& volume,
 	vec3 clipMins, vec3 clipMaxs, bool* oobHistory, bool isFirstPass, int& removedNodes) {
 	BSPCLIPNODE& node = clipnodes[iNode];
 	float oob_coord = g_limits.max_mapboundary;
@@ -2221,6 +2620,7 @@ void Bsp::delete_box_clipnodes(int iNode, int16_t* parentBranch, vector<BSPPLANE
 	}
 
 	bool isoob = isFirstPass ? true : oobHistory[iNode];
+	Clipper clipper;
 
 	for (int i = 0; i < 2; i++) {
 		BSPPLANE plane = planes[node.iPlane];
@@ -2228,24 +2628,21 @@ void Bsp::delete_box_clipnodes(int iNode, int16_t* parentBranch, vector<BSPPLANE
 			plane.vNormal = plane.vNormal.invert();
 			plane.fDist = -plane.fDist;
 		}
-		clipOrder.push_back(plane);
+
+		CMesh nodeVolume;
+		if (isFirstPass) {
+			nodeVolume = volume;
+			clipper.clip(nodeVolume, plane);
+		}
 
 		if (node.iChildren[i] >= 0) {
-			delete_box_clipnodes(node.iChildren[i], &node.iChildren[i], clipOrder, clipMins, clipMaxs,
+			delete_box_clipnodes(node.iChildren[i], &node.iChildren[i], nodeVolume, clipMins, clipMaxs,
 				oobHistory, isFirstPass, removedNodes);
 			if (node.iChildren[i] >= 0) {
 				isoob = false; // children weren't empty, so this node isn't empty either
 			}
 		}
 		else if (isFirstPass) {
-			vector<BSPPLANE> cuts;
-			for (int k = clipOrder.size() - 1; k >= 0; k--) {
-				cuts.push_back(clipOrder[k]);
-			}
-
-			Clipper clipper;
-			CMesh nodeVolume = clipper.clip(cuts);
-
 			vec3 mins(FLT_MAX, FLT_MAX, FLT_MAX);
 			vec3 maxs(-FLT_MAX, -FLT_MAX, -FLT_MAX);
 
@@ -2261,8 +2658,6 @@ void Bsp::delete_box_clipnodes(int iNode, int16_t* parentBranch, vector<BSPPLANE
 				isoob = false; // node can't be empty if both children aren't in the clip box
 			}
 		}
-
-		clipOrder.pop_back();
 	}
 
 	if (isFirstPass) {
@@ -2287,7 +2682,8 @@ void Bsp::delete_box_data(vec3 clipMins, vec3 clipMaxs) {
 
 	// remove nodes and clipnodes in the clipping box
 	{
-		vector<BSPPLANE> clipOrder;
+		Clipper clipper;
+		CMesh worldVolume = clipper.createMaxSizeVolume();
 
 		bool* oobMarks = new bool[nodeCount];
 
@@ -2296,20 +2692,24 @@ void Bsp::delete_box_data(vec3 clipMins, vec3 clipMaxs) {
 		do {
 			removedNodes = 0;
 			memset(oobMarks, 1, nodeCount * sizeof(bool)); // assume everything is oob at first
-			delete_box_nodes(worldmodel.iHeadnodes[0], NULL, clipOrder, clipMins, clipMaxs, oobMarks, true, removedNodes);
-			delete_box_nodes(worldmodel.iHeadnodes[0], NULL, clipOrder, clipMins, clipMaxs, oobMarks, false, removedNodes);
+			delete_box_nodes(worldmodel.iHeadnodes[0], NULL, worldVolume, clipMins, clipMaxs, oobMarks, true, removedNodes);
+			delete_box_nodes(worldmodel.iHeadnodes[0], NULL, worldVolume, clipMins, clipMaxs, oobMarks, false, removedNodes);
 		} while (removedNodes);
 		delete[] oobMarks;
 
 		oobMarks = new bool[clipnodeCount];
 		for (int i = 1; i < MAX_MAP_HULLS; i++) {
+			if (worldmodel.iHeadnodes[i] < 0) {
+				continue; // hull is empty
+			}
+
 			// collect oob data, then actually remove the nodes
 			int removedNodes = 0;
 			do {
 				removedNodes = 0;
 				memset(oobMarks, 1, clipnodeCount * sizeof(bool)); // assume everything is oob at first
-				delete_box_clipnodes(worldmodel.iHeadnodes[i], NULL, clipOrder, clipMins, clipMaxs, oobMarks, true, removedNodes);
-				delete_box_clipnodes(worldmodel.iHeadnodes[i], NULL, clipOrder, clipMins, clipMaxs, oobMarks, false, removedNodes);
+				delete_box_clipnodes(worldmodel.iHeadnodes[i], NULL, worldVolume, clipMins, clipMaxs, oobMarks, true, removedNodes);
+				delete_box_clipnodes(worldmodel.iHeadnodes[i], NULL, worldVolume, clipMins, clipMaxs, oobMarks, false, removedNodes);
 			} while (removedNodes);
 		}
 		delete[] oobMarks;
@@ -2833,31 +3233,28 @@ bool Bsp::subdivide_face(int faceIdx) {
 	uint16_t* newMarkSurfs = new uint16_t[totalMarks];
 	memcpy(newMarkSurfs, marksurfs, marksurfCount * sizeof(uint16_t));
 
-	BSPEDGE* newEdges = new BSPEDGE[edgeCount + addVerts];
-	memcpy(newEdges, edges, edgeCount * sizeof(BSPEDGE));
-
-	vec3* newVerts = new vec3[vertCount + addVerts];
-	memcpy(newVerts, verts, vertCount * sizeof(vec3));
-
-	int32_t* newSurfEdges = new int32_t[surfedgeCount + addVerts];
-	memcpy(newSurfEdges, surfedges, surfedgeCount * sizeof(int32_t));
+	LumpBuilder lumpBuilder(this);
+	int firstEdge, firstVert, firstSurfedge;
+	BSPEDGE* newEdges = lumpBuilder.add<BSPEDGE>(LUMP_EDGES, addVerts, firstEdge);
+	vec3* newVerts = lumpBuilder.add<vec3>(LUMP_VERTICES, addVerts, firstVert);
+	int32_t* newSurfEdges = lumpBuilder.add<int32_t>(LUMP_SURFEDGES, addVerts, firstSurfedge);
 
 	int oldSurfBegin = face.iFirstEdge;
 	int oldSurfEnd = face.iFirstEdge + face.nEdges;
 
-	BSPEDGE* edgePtr = newEdges + edgeCount;
-	vec3* vertPtr = newVerts + vertCount;
-	int32_t* surfedgePtr = newSurfEdges + surfedgeCount;
+	BSPEDGE* edgePtr = newEdges;
+	vec3* vertPtr = newVerts;
+	int32_t* surfedgePtr = newSurfEdges;
 
 	for (int k = 0; k < 2; k++) {
 		vector<vec3>& cutPoly = polys[k];
 
 		newFaces[faceIdx + k] = faces[faceIdx];
-		newFaces[faceIdx + k].iFirstEdge = surfedgePtr - newSurfEdges;
+		newFaces[faceIdx + k].iFirstEdge = firstSurfedge + (surfedgePtr - newSurfEdges);
 		newFaces[faceIdx + k].nEdges = cutPoly.size();
 
-		int vertOffset = vertPtr - newVerts;
-		int edgeOffset = edgePtr - newEdges;
+		int vertOffset = firstVert + (vertPtr - newVerts);
+		int edgeOffset = firstEdge + (edgePtr - newEdges);
 
 		for (int i = 0; i < cutPoly.size(); i++) {
 			edgePtr->iVertex[0] = vertOffset + i;
@@ -2921,9 +3318,7 @@ bool Bsp::subdivide_face(int faceIdx) {
 
 	replace_lump(LUMP_MARKSURFACES, newMarkSurfs, totalMarks * sizeof(uint16_t));
 	replace_lump(LUMP_FACES, newFaces, (faceCount + 1)*sizeof(BSPFACE));
-	replace_lump(LUMP_EDGES, newEdges, (edgeCount + addVerts)*sizeof(BSPEDGE));
-	replace_lump(LUMP_SURFEDGES, newSurfEdges, (surfedgeCount + addVerts) * sizeof(int32_t));
-	replace_lump(LUMP_VERTICES, newVerts, (vertCount + addVerts) * sizeof(vec3));
+	lumpBuilder.commit();
 
 	return true;
 }
@@ -3421,10 +3816,7 @@ bool Bsp::embed_texture(int textureId, vector<Wad*>& wads) {
 			logf("Embedded texture %s from wad %s\n", tex.szName, wads[k]->filename.c_str());
 
 			delete wadTex;
-			delete[] lumps[LUMP_TEXTURES];
-			lumps[LUMP_TEXTURES] = newTexData;
-			header.lump[LUMP_TEXTURES].nLength += texDataSz;
-			update_lump_pointers();
+			replace_lump(LUMP_TEXTURES, newTexData, header.lump[LUMP_TEXTURES].nLength + texDataSz);
 			embedded = true;
 
 			break;
@@ -3492,10 +3884,7 @@ bool Bsp::unembed_texture(int textureId, vector<Wad*>& wads) {
 	memcpy(newTexData + endOffset, lumps[LUMP_TEXTURES] + endOffset + texDataSz, newTexBufferSz - endOffset);
 
 	logf("Unembedded texture %s\n", tex.szName);
-	delete[] lumps[LUMP_TEXTURES];
-	lumps[LUMP_TEXTURES] = newTexData;
-	header.lump[LUMP_TEXTURES].nLength -= texDataSz;
-	update_lump_pointers();
+	replace_lump(LUMP_TEXTURES, newTexData, header.lump[LUMP_TEXTURES].nLength - texDataSz);
 
 	return true;
 }
@@ -3536,10 +3925,7 @@ int Bsp::add_texture_from_wad(WADTEX* tex) {
 
 	memcpy(dstData, &newTex, sizeof(BSPMIPTEX));
 
-	delete[] lumps[LUMP_TEXTURES];
-	lumps[LUMP_TEXTURES] = newTexData;
-	header.lump[LUMP_TEXTURES].nLength += addedSz;
-	update_lump_pointers();
+	replace_lump(LUMP_TEXTURES, newTexData, header.lump[LUMP_TEXTURES].nLength + addedSz);
 
 	return textureCount-1;
 }
@@ -4107,9 +4493,12 @@ bool Bsp::shift_lightstyles(uint32_t shift) {
 			}
 		}
 	}
+
+	return true;
 }
 
 void Bsp::write(string path) {
+	TRACE_SCOPE("write");
 	if (path.rfind(".bsp") != path.size() - 4) {
 		path = path + ".bsp";
 	}
@@ -4139,6 +4528,7 @@ void Bsp::write(string path) {
 
 bool Bsp::load_lumps(string fpath)
 {
+	TRACE_SCOPE("load_lumps");
 	bool valid = true;
 
 	// Read all BSP Data
@@ -4182,11 +4572,14 @@ bool Bsp::load_lumps(string fpath)
 	
 	fin.close();
 
+	TRACE_COUNTER("bsp bytes loaded", size);
+
 	return valid;
 }
 
 void Bsp::load_ents()
 {
+	TRACE_SCOPE("load_ents");
 	for (int i = 0; i < ents.size(); i++)
 		delete ents[i];
 	ents.clear();
@@ -4379,6 +4772,12 @@ bool Bsp::validate_vis_data() {
 }
 
 bool Bsp::validate() {
+	static vector<Wad*> emptyWads;
+	return validate(g_app && g_app->mapRenderer ? g_app->mapRenderer->wads : emptyWads);
+}
+
+bool Bsp::validate(vector<Wad*>& wads) {
+	TRACE_SCOPE("validate");
 	bool isValid = true;
 
 	if (planeCount > g_limits.max_planes) logf("Overflowed Planes !!!\n");
@@ -4630,9 +5029,6 @@ bool Bsp::validate() {
 		logf("%d entities have origins that may cause problems (see \"Zero Entity Origins\" tool)\n", badOriginCount);
 	}
 
-	static vector<Wad*> emptyWads;
-	vector<Wad*>& wads = g_app->mapRenderer ? g_app->mapRenderer->wads : emptyWads;
-
 	int missing_textures = 0;
 
 	for (int i = 0; i < textureCount; i++) {
@@ -5638,19 +6034,13 @@ int Bsp::add_texture(const char* name, byte* data, int width, int height) {
 }
 
 int Bsp::create_leaf(int contents) {
-	BSPLEAF* newLeaves = new BSPLEAF[leafCount + 1];
-	memcpy(newLeaves, leaves, leafCount * sizeof(BSPLEAF));
-
-	BSPLEAF& newLeaf = newLeaves[leafCount];
-	memset(&newLeaf, 0, sizeof(BSPLEAF));
+	int newLeafIdx = leafCount;
+	resize_lump(LUMP_LEAVES, (leafCount + 1) * sizeof(BSPLEAF));
 
+	BSPLEAF& newLeaf = leaves[newLeafIdx];
 	newLeaf.nVisOffset = -1;
 	newLeaf.nContents = contents;
 
-	int newLeafIdx = leafCount;
-	
-	replace_lump(LUMP_LEAVES, newLeaves, (leafCount+1) * sizeof(BSPLEAF));
-
 	return newLeafIdx;
 }
 
@@ -5668,47 +6058,42 @@ void Bsp::create_node_box(vec3 min, vec3 max, BSPMODEL* targetModel, int texture
 		  0---0>--1     +--x
 	*/
 
+	LumpBuilder lumpBuilder(this);
+
 	// add new verts (1 for each cube corner)
-	int startVert = vertCount;
+	int startVert;
 	{
-		vec3* newVerts = new vec3[vertCount + 8];
-		memcpy(newVerts, verts, vertCount * sizeof(vec3));
+		vec3* newVerts = lumpBuilder.add<vec3>(LUMP_VERTICES, 8, startVert);
 
-		newVerts[vertCount + 0] = vec3(min.x, min.y, min.z); // front-left-bottom
-		newVerts[vertCount + 1] = vec3(max.x, min.y, min.z); // front-right-bottom
-		newVerts[vertCount + 2] = vec3(max.x, max.y, min.z); // back-right-bottom
-		newVerts[vertCount + 3] = vec3(min.x, max.y, min.z); // back-left-bottom
+		newVerts[0] = vec3(min.x, min.y, min.z); // front-left-bottom
+		newVerts[1] = vec3(max.x, min.y, min.z); // front-right-bottom
+		newVerts[2] = vec3(max.x, max.y, min.z); // back-right-bottom
+		newVerts[3] = vec3(min.x, max.y, min.z); // back-left-bottom
 
-		newVerts[vertCount + 4] = vec3(min.x, min.y, max.z); // front-left-top
-		newVerts[vertCount + 5] = vec3(max.x, min.y, max.z); // front-right-top
-		newVerts[vertCount + 6] = vec3(max.x, max.y, max.z); // back-right-top
-		newVerts[vertCount + 7] = vec3(min.x, max.y, max.z); // back-left-top
-
-		replace_lump(LUMP_VERTICES, newVerts, (vertCount + 8) * sizeof(vec3));
+		newVerts[4] = vec3(min.x, min.y, max.z); // front-left-top
+		newVerts[5] = vec3(max.x, min.y, max.z); // front-right-top
+		newVerts[6] = vec3(max.x, max.y, max.z); // back-right-top
+		newVerts[7] = vec3(min.x, max.y, max.z); // back-left-top
 	}
 
 	// add new edges (minimum needed to refrence every vertex once)
-	int startEdge = edgeCount;
+	int startEdge;
 	{
-		BSPEDGE* newEdges = new BSPEDGE[edgeCount + 8];
-		memcpy(newEdges, edges, edgeCount * sizeof(BSPEDGE));
+		BSPEDGE* newEdges = lumpBuilder.add<BSPEDGE>(LUMP_EDGES, 8, startEdge);
 
 		// defining an edge for every vertex because otherwise hlrad crashes, even though
 		// only 4 edges are required to reference every vertex on the cube
 		for (int i = 0; i < 8; i++) {
-			newEdges[startEdge + i] = BSPEDGE(startVert + i, startVert + i);
+			newEdges[i] = BSPEDGE(startVert + i, startVert + i);
 		}
-
-		replace_lump(LUMP_EDGES, newEdges, (edgeCount + 8) * sizeof(BSPEDGE));
 	}
 
 	// add new surfedges (vertex lookups into edges which define the faces, 4 per face, clockwise order)
-	int startSurfedge = surfedgeCount;
+	int startSurfedge;
 	{
-		int32_t* newSurfedges = new int32_t[surfedgeCount + 24];
-		memcpy(newSurfedges, surfedges, surfedgeCount * sizeof(int32_t));
+		int32_t* newSurfedges = lumpBuilder.add<int32_t>(LUMP_SURFEDGES, 24, startSurfedge);
 
-		int32_t surfEdgeIdx = startSurfedge;
+		int32_t surfEdgeIdx = 0;
 
 		// left face
 		newSurfedges[surfEdgeIdx++] = startEdge + 7;
@@ -5745,31 +6130,25 @@ void Bsp::create_node_box(vec3 min, vec3 max, BSPMODEL* targetModel, int texture
 		newSurfedges[surfEdgeIdx++] = startEdge + 6;
 		newSurfedges[surfEdgeIdx++] = startEdge + 5;
 		newSurfedges[surfEdgeIdx++] = startEdge + 4;
-		
-		replace_lump(LUMP_SURFEDGES, newSurfedges, (surfedgeCount + 24) * sizeof(int32_t));
 	}
 
 	// add new planes (1 for each face/node)
-	int startPlane = planeCount;
+	int startPlane;
 	{
-		BSPPLANE* newPlanes = new BSPPLANE[planeCount + 6];
-		memcpy(newPlanes, planes, planeCount * sizeof(BSPPLANE));
+		BSPPLANE* newPlanes = lumpBuilder.add<BSPPLANE>(LUMP_PLANES, 6, startPlane);
 
 		// normals are inverted later using nPlaneSide
-		newPlanes[startPlane + 0] = { vec3(1, 0, 0), min.x, PLANE_X }; // left
-		newPlanes[startPlane + 1] = { vec3(1, 0, 0), max.x, PLANE_X }; // right
-		newPlanes[startPlane + 2] = { vec3(0, 1, 0), min.y, PLANE_Y }; // front
-		newPlanes[startPlane + 3] = { vec3(0, 1, 0), max.y, PLANE_Y }; // back
-		newPlanes[startPlane + 4] = { vec3(0, 0, 1), min.z, PLANE_Z }; // bottom
-		newPlanes[startPlane + 5] = { vec3(0, 0, 1), max.z, PLANE_Z }; // top
-
-		replace_lump(LUMP_PLANES, newPlanes, (planeCount + 6) * sizeof(BSPPLANE));
+		newPlanes[0] = { vec3(1, 0, 0), min.x, PLANE_X }; // left
+		newPlanes[1] = { vec3(1, 0, 0), max.x, PLANE_X }; // right
+		newPlanes[2] = { vec3(0, 1, 0), min.y, PLANE_Y }; // front
+		newPlanes[3] = { vec3(0, 1, 0), max.y, PLANE_Y }; // back
+		newPlanes[4] = { vec3(0, 0, 1), min.z, PLANE_Z }; // bottom
+		newPlanes[5] = { vec3(0, 0, 1), max.z, PLANE_Z }; // top
 	}
 
-	int startTexinfo = texinfoCount;
+	int startTexinfo;
 	{
-		BSPTEXTUREINFO* newTexinfos = new BSPTEXTUREINFO[texinfoCount + 6];
-		memcpy(newTexinfos, texinfos, texinfoCount * sizeof(BSPTEXTUREINFO));
+		BSPTEXTUREINFO* newTexinfos = lumpBuilder.add<BSPTEXTUREINFO>(LUMP_TEXINFO, 6, startTexinfo);
 
 		static vec3 faceUp[6] {
 			vec3(0, 0, -1),	// left
@@ -5789,7 +6168,7 @@ void Bsp::create_node_box(vec3 min, vec3 max, BSPMODEL* targetModel, int texture
 		};
 
 		for (int i = 0; i < 6; i++) {
-			BSPTEXTUREINFO& info = newTexinfos[startTexinfo + i];
+			BSPTEXTUREINFO& info = newTexinfos[i];
 			info.iMiptex = textureIdx;
 			info.nFlags = TEX_SPECIAL;
 			info.shiftS = 0;
@@ -5798,18 +6177,15 @@ void Bsp::create_node_box(vec3 min, vec3 max, BSPMODEL* targetModel, int texture
 			info.vS = faceRt[i];
 			// TODO: fit texture to face
 		}
-
-		replace_lump(LUMP_TEXINFO, newTexinfos, (texinfoCount + 6) * sizeof(BSPTEXTUREINFO));
 	}
 
 	// add new faces
-	int startFace = faceCount;
+	int startFace;
 	{
-		BSPFACE* newFaces = new BSPFACE[faceCount + 6];
-		memcpy(newFaces, faces, faceCount * sizeof(BSPFACE));
+		BSPFACE* newFaces = lumpBuilder.add<BSPFACE>(LUMP_FACES, 6, startFace);
 
 		for (int i = 0; i < 6; i++) {
-			BSPFACE& face = newFaces[faceCount + i];
+			BSPFACE& face = newFaces[i];
 			face.iFirstEdge = startSurfedge + i * 4;
 			face.iPlane = startPlane + i;
 			face.nEdges = 4;
@@ -5818,8 +6194,6 @@ void Bsp::create_node_box(vec3 min, vec3 max, BSPMODEL* targetModel, int texture
 			face.nLightmapOffset = 0; // TODO: Lighting
 			memset(face.nStyles, 255, 4);
 		}
-
-		replace_lump(LUMP_FACES, newFaces, (faceCount + 6) * sizeof(BSPFACE));
 	}
 
 	// Submodels don't use leaves like the world does. Everything except nContents is ignored.
@@ -5846,23 +6220,19 @@ void Bsp::create_node_box(vec3 min, vec3 max, BSPMODEL* targetModel, int texture
 	}
 	
 	// add new nodes
-	int startNode = nodeCount;
+	int startNode;
 	{
-		BSPNODE* newNodes = new BSPNODE[nodeCount + 6];
-		memcpy(newNodes, nodes, nodeCount * sizeof(BSPNODE));
-
-		int16 nodeIdx = nodeCount;
+		BSPNODE* newNodes = lumpBuilder.add<BSPNODE>(LUMP_NODES, 6, startNode);
 
 		for (int k = 0; k < 6; k++) {
-			BSPNODE& node = newNodes[nodeCount + k];
-			memset(&node, 0, sizeof(BSPNODE));
+			BSPNODE& node = newNodes[k];
 
 			node.firstFace = startFace + k; // face required for decals
 			node.nFaces = 1;
 			node.iPlane = startPlane + k;
 			// node mins/maxs don't matter for submodels. Leave them at 0.
 
-			int16 insideContents = k == 5 ? ~sharedSolidLeaf : (int16)(nodeCount + k+1);
+			int16 insideContents = k == 5 ? ~sharedSolidLeaf : (int16)(startNode + k+1);
 			int16 outsideContents = ~anyEmptyLeaf;
 
 			// can't have negative normals on planes so children are swapped instead
@@ -5875,10 +6245,10 @@ void Bsp::create_node_box(vec3 min, vec3 max, BSPMODEL* targetModel, int texture
 				node.iChildren[1] = insideContents;
 			}
 		}
-
-		replace_lump(LUMP_NODES, newNodes, (nodeCount + 6) * sizeof(BSPNODE));
 	}
 
+	lumpBuilder.commit();
+
 	targetModel->iHeadnodes[0] = startNode;
 	targetModel->iFirstFace = startFace;
 	targetModel->nFaces = 6;
@@ -5899,36 +6269,33 @@ void Bsp::create_node_box(vec3 min, vec3 max, BSPMODEL* targetModel, int texture
 }
 
 void Bsp::create_nodes(Solid& solid, BSPMODEL* targetModel) {
+	LumpBuilder lumpBuilder(this);
 
 	vector<int> newVertIndexes;
-	int startVert = vertCount;
+	int startVert;
 	{
-		vec3* newVerts = new vec3[vertCount + solid.hullVerts.size()];
-		memcpy(newVerts, verts, vertCount * sizeof(vec3));
+		vec3* newVerts = lumpBuilder.add<vec3>(LUMP_VERTICES, solid.hullVerts.size(), startVert);
 
 		for (int i = 0; i < solid.hullVerts.size(); i++) {
-			newVerts[vertCount + i] = solid.hullVerts[i].pos;
-			newVertIndexes.push_back(vertCount + i);
+			newVerts[i] = solid.hullVerts[i].pos;
+			newVertIndexes.push_back(startVert + i);
 		}
-
-		replace_lump(LUMP_VERTICES, newVerts, (vertCount + solid.hullVerts.size()) * sizeof(vec3));
 	}
 
 	// add new edges (not actually edges - just an indirection layer for the verts)
 	// TODO: subdivide >512
-	int startEdge = edgeCount;
+	int startEdge;
 	map<int, int32_t> vertToSurfedge;
 	{
 		int addEdges = (solid.hullVerts.size() + 1) / 2;
 
-		BSPEDGE* newEdges = new BSPEDGE[edgeCount + addEdges];
-		memcpy(newEdges, edges, edgeCount * sizeof(BSPEDGE));
+		BSPEDGE* newEdges = lumpBuilder.add<BSPEDGE>(LUMP_EDGES, addEdges, startEdge);
 
 		int idx = 0;
 		for (int i = 0; i < solid.hullVerts.size(); i += 2) {
 			int v0 = i;
 			int v1 = (i+1) % solid.hullVerts.size();
-			newEdges[startEdge + idx] = BSPEDGE(newVertIndexes[v0], newVertIndexes[v1]);
+			newEdges[idx] = BSPEDGE(newVertIndexes[v0], newVertIndexes[v1]);
 
 			vertToSurfedge[v0] = startEdge + idx;
 			if (v1 > 0) {
@@ -5937,53 +6304,45 @@ void Bsp::create_nodes(Solid& solid, BSPMODEL* targetModel) {
 
 			idx++;
 		}
-		replace_lump(LUMP_EDGES, newEdges, (edgeCount + addEdges) * sizeof(BSPEDGE));
 	}
 
 	// add new surfedges (2 for each edge)
-	int startSurfedge = surfedgeCount;
+	int startSurfedge;
 	{
 		int addSurfedges = 0;
 		for (int i = 0; i < solid.faces.size(); i++) {
 			addSurfedges += solid.faces[i].verts.size();
 		}
 
-		int32_t* newSurfedges = new int32_t[surfedgeCount + addSurfedges];
-		memcpy(newSurfedges, surfedges, surfedgeCount * sizeof(int32_t));
+		int32_t* newSurfedges = lumpBuilder.add<int32_t>(LUMP_SURFEDGES, addSurfedges, startSurfedge);
 
 		int idx = 0;
 		for (int i = 0; i < solid.faces.size(); i++) {
 			for (int k = 0; k < solid.faces[i].verts.size(); k++) {
-				newSurfedges[startSurfedge + idx++] = vertToSurfedge[solid.faces[i].verts[k]];
+				newSurfedges[idx++] = vertToSurfedge[solid.faces[i].verts[k]];
 			}
 		}
-
-		replace_lump(LUMP_SURFEDGES, newSurfedges, (surfedgeCount + addSurfedges) * sizeof(int32_t));
 	}
 
 	// add new planes (1 for each face/node)
 	// TODO: reuse existing planes (maybe not until shared stuff can be split when editing solids)
-	int startPlane = planeCount;
+	int startPlane;
 	{
-		BSPPLANE* newPlanes = new BSPPLANE[planeCount + solid.faces.size()];
-		memcpy(newPlanes, planes, planeCount * sizeof(BSPPLANE));
+		BSPPLANE* newPlanes = lumpBuilder.add<BSPPLANE>(LUMP_PLANES, solid.faces.size(), startPlane);
 
 		for (int i = 0; i < solid.faces.size(); i++) {
-			newPlanes[startPlane + i] = solid.faces[i].plane;
+			newPlanes[i] = solid.faces[i].plane;
 		}
-
-		replace_lump(LUMP_PLANES, newPlanes, (planeCount + solid.faces.size()) * sizeof(BSPPLANE));
 	}
 
 	// add new faces
-	int startFace = faceCount;
+	int startFace;
 	{
-		BSPFACE* newFaces = new BSPFACE[faceCount + solid.faces.size()];
-		memcpy(newFaces, faces, faceCount * sizeof(BSPFACE));
+		BSPFACE* newFaces = lumpBuilder.add<BSPFACE>(LUMP_FACES, solid.faces.size(), startFace);
 
 		int surfedgeOffset = 0;
 		for (int i = 0; i < solid.faces.size(); i++) {
-			BSPFACE& face = newFaces[faceCount + i];
+			BSPFACE& face = newFaces[i];
 			face.iFirstEdge = startSurfedge + surfedgeOffset;
 			face.iPlane = startPlane + i;
 			face.nEdges = solid.faces[i].verts.size();
@@ -5995,8 +6354,6 @@ void Bsp::create_nodes(Solid& solid, BSPMODEL* targetModel) {
 
 			surfedgeOffset += face.nEdges;
 		}
-
-		replace_lump(LUMP_FACES, newFaces, (faceCount + solid.faces.size()) * sizeof(BSPFACE));
 	}
 
 	//TODO: move to common function
@@ -6017,23 +6374,19 @@ void Bsp::create_nodes(Solid& solid, BSPMODEL* targetModel) {
 	}
 
 	// add new nodes
-	int startNode = nodeCount;
+	int startNode;
 	{
-		BSPNODE* newNodes = new BSPNODE[nodeCount + solid.faces.size()];
-		memcpy(newNodes, nodes, nodeCount * sizeof(BSPNODE));
-
-		int16 nodeIdx = nodeCount;
+		BSPNODE* newNodes = lumpBuilder.add<BSPNODE>(LUMP_NODES, solid.faces.size(), startNode);
 
 		for (int k = 0; k < solid.faces.size(); k++) {
-			BSPNODE& node = newNodes[nodeCount + k];
-			memset(&node, 0, sizeof(BSPNODE));
+			BSPNODE& node = newNodes[k];
 
 			node.firstFace = startFace + k; // face required for decals
 			node.nFaces = 1;
 			node.iPlane = startPlane + k;
 			// node mins/maxs don't matter for submodels. Leave them at 0.
 
-			int16 insideContents = k == solid.faces.size()-1 ? ~sharedSolidLeaf : (int16)(nodeCount + k + 1);
+			int16 insideContents = k == solid.faces.size()-1 ? ~sharedSolidLeaf : (int16)(startNode + k + 1);
 			int16 outsideContents = ~anyEmptyLeaf;
 
 			// can't have negative normals on planes so children are swapped instead
@@ -6046,10 +6399,10 @@ void Bsp::create_nodes(Solid& solid, BSPMODEL* targetModel) {
 				node.iChildren[1] = insideContents;
 			}
 		}
-
-		replace_lump(LUMP_NODES, newNodes, (nodeCount + solid.faces.size()) * sizeof(BSPNODE));
 	}
 
+	lumpBuilder.commit();
+
 	targetModel->iHeadnodes[0] = startNode;
 	targetModel->iHeadnodes[1] = CONTENTS_EMPTY;
 	targetModel->iHeadnodes[2] = CONTENTS_EMPTY;
@@ -6118,15 +6471,10 @@ int Bsp::create_clipnode_box(vec3 mins, vec3 maxs, BSPMODEL* targetModel, int ta
 		}
 	}
 
-	BSPPLANE* newPlanes = new BSPPLANE[planeCount + addPlanes.size()];
-	memcpy(newPlanes, planes, planeCount * sizeof(BSPPLANE));
-	memcpy(newPlanes + planeCount, &addPlanes[0], addPlanes.size() * sizeof(BSPPLANE));
-	replace_lump(LUMP_PLANES, newPlanes, (planeCount + addPlanes.size()) * sizeof(BSPPLANE));
-
-	BSPCLIPNODE* newClipnodes = new BSPCLIPNODE[clipnodeCount + addNodes.size()];
-	memcpy(newClipnodes, clipnodes, clipnodeCount * sizeof(BSPCLIPNODE));
-	memcpy(newClipnodes + clipnodeCount, &addNodes[0], addNodes.size() * sizeof(BSPCLIPNODE));
-	replace_lump(LUMP_CLIPNODES, newClipnodes, (clipnodeCount + addNodes.size()) * sizeof(BSPCLIPNODE));
+	LumpBuilder lumpBuilder(this);
+	lumpBuilder.append(LUMP_PLANES, addPlanes.data(), addPlanes.size());
+	lumpBuilder.append(LUMP_CLIPNODES, addNodes.data(), addNodes.size());
+	lumpBuilder.commit();
 
 	return solidNodeIdx;
 }
@@ -6167,50 +6515,26 @@ void Bsp::simplify_model_collision(int modelIdx, int hullIdx) {
 }
 
 int Bsp::create_clipnode() {
-	BSPCLIPNODE* newNodes = new BSPCLIPNODE[clipnodeCount + 1];
-	memcpy(newNodes, clipnodes, clipnodeCount * sizeof(BSPCLIPNODE));
-
-	BSPCLIPNODE* newNode = &newNodes[clipnodeCount];
-	memset(newNode, 0, sizeof(BSPCLIPNODE));
-
-	replace_lump(LUMP_CLIPNODES, newNodes, (clipnodeCount + 1) * sizeof(BSPCLIPNODE));
+	resize_lump(LUMP_CLIPNODES, (clipnodeCount + 1) * sizeof(BSPCLIPNODE));
 
 	return clipnodeCount-1;
 }
 
 int Bsp::create_plane() {
-	BSPPLANE* newPlanes = new BSPPLANE[planeCount + 1];
-	memcpy(newPlanes, planes, planeCount * sizeof(BSPPLANE));
-
-	BSPPLANE& newPlane = newPlanes[planeCount];
-	memset(&newPlane, 0, sizeof(BSPPLANE));
-
-	replace_lump(LUMP_PLANES, newPlanes, (planeCount + 1) * sizeof(BSPPLANE));
+	resize_lump(LUMP_PLANES, (planeCount + 1) * sizeof(BSPPLANE));
 
 	return planeCount - 1;
 }
 
 int Bsp::create_model() {
-	BSPMODEL* newModels = new BSPMODEL[modelCount + 1];
-	memcpy(newModels, models, modelCount * sizeof(BSPMODEL));
-
-	BSPMODEL& newModel = newModels[modelCount];
-	memset(&newModel, 0, sizeof(BSPMODEL));
-
 	int newModelIdx = modelCount;
-	replace_lump(LUMP_MODELS, newModels, (modelCount + 1) * sizeof(BSPMODEL));
+	resize_lump(LUMP_MODELS, (modelCount + 1) * sizeof(BSPMODEL));
 
 	return newModelIdx;
 }
 
 int Bsp::create_texinfo() {
-	BSPTEXTUREINFO* newTexinfos = new BSPTEXTUREINFO[texinfoCount + 1];
-	memcpy(newTexinfos, texinfos, texinfoCount * sizeof(BSPTEXTUREINFO));
-
-	BSPTEXTUREINFO& newTexinfo = newTexinfos[texinfoCount];
-	memset(&newTexinfo, 0, sizeof(BSPTEXTUREINFO));
-
-	replace_lump(LUMP_TEXINFO, newTexinfos, (texinfoCount + 1) * sizeof(BSPTEXTUREINFO));
+	resize_lump(LUMP_TEXINFO, (texinfoCount + 1) * sizeof(BSPTEXTUREINFO));
 
 	return texinfoCount - 1;
 }
@@ -6337,24 +6661,17 @@ int Bsp::duplicate_model(int modelIdx) {
 
 	// MAYBE TODO: duplicate leaves(?) + marksurfs + recacl vis + update undo command lumps
 
-	if (newClipnodes.size())
-		append_lump(LUMP_CLIPNODES, &newClipnodes[0], sizeof(BSPCLIPNODE) * newClipnodes.size());
-	if (newEdges.size())
-		append_lump(LUMP_EDGES, &newEdges[0], sizeof(BSPEDGE) * newEdges.size());
-	if (newFaces.size())
-		append_lump(LUMP_FACES, &newFaces[0], sizeof(BSPFACE) * newFaces.size());
-	if (newNodes.size())
-		append_lump(LUMP_NODES, &newNodes[0], sizeof(BSPNODE) * newNodes.size());
-	if (newPlanes.size())
-		append_lump(LUMP_PLANES, &newPlanes[0], sizeof(BSPPLANE) * newPlanes.size());
-	if (newSurfedges.size())
-		append_lump(LUMP_SURFEDGES, &newSurfedges[0], sizeof(int32_t) * newSurfedges.size());
-	if (newTexinfo.size())
-		append_lump(LUMP_TEXINFO, &newTexinfo[0], sizeof(BSPTEXTUREINFO) * newTexinfo.size());
-	if (newVerts.size())
-		append_lump(LUMP_VERTICES, &newVerts[0], sizeof(vec3) * newVerts.size());
-	if (newLightmaps.size())
-		append_lump(LUMP_LIGHTING, &newLightmaps[0], sizeof(COLOR3) * newLightmaps.size());
+	LumpBuilder lumpBuilder(this);
+	lumpBuilder.append(LUMP_CLIPNODES, newClipnodes.data(), newClipnodes.size());
+	lumpBuilder.append(LUMP_EDGES, newEdges.data(), newEdges.size());
+	lumpBuilder.append(LUMP_FACES, newFaces.data(), newFaces.size());
+	lumpBuilder.append(LUMP_NODES, newNodes.data(), newNodes.size());
+	lumpBuilder.append(LUMP_PLANES, newPlanes.data(), newPlanes.size());
+	lumpBuilder.append(LUMP_SURFEDGES, newSurfedges.data(), newSurfedges.size());
+	lumpBuilder.append(LUMP_TEXINFO, newTexinfo.data(), newTexinfo.size());
+	lumpBuilder.append(LUMP_VERTICES, newVerts.data(), newVerts.size());
+	lumpBuilder.append(LUMP_LIGHTING, newLightmaps.data(), newLightmaps.size());
+	lumpBuilder.commit();
 
 	int newModelIdx = create_model();
 	BSPMODEL& oldModel = models[modelIdx];
@@ -6734,10 +7051,8 @@ void Bsp::write_csg_outputs(string path) {
 		flipped.fDist = -flipped.fDist;
 		newPlanes[numPlanes + i] = flipped;
 	}
-	delete [] lumps[LUMP_PLANES];
-	lumps[LUMP_PLANES] = (byte*)newPlanes;
 	numPlanes *= 2;
-	header.lump[LUMP_PLANES].nLength = numPlanes * sizeof(BSPPLANE);
+	replace_lump(LUMP_PLANES, newPlanes, numPlanes * sizeof(BSPPLANE));
 	thisPlanes = newPlanes;
 
 	ofstream pln_file(path + name + ".pln", ios::out | ios::binary | ios::trunc);
@@ -6934,16 +7249,43 @@ void Bsp::update_lump_pointers() {
 void Bsp::replace_lump(int lumpIdx, void* newData, int newLength) {
 	delete[] lumps[lumpIdx];
 	lumps[lumpIdx] = (byte*)newData;
+	lumpBuffers[lumpIdx] = (byte*)newData;
+	lumpCapacity[lumpIdx] = newLength;
 	header.lump[lumpIdx].nLength = newLength;
 	update_lump_pointers();
 }
 
 void Bsp::append_lump(int lumpIdx, void* newData, int appendLength) {
 	int oldLen = header.lump[lumpIdx].nLength;
-	byte* newLump = new byte[oldLen + appendLength];
-	
-	memcpy(newLump, lumps[lumpIdx], oldLen);
-	memcpy(newLump + oldLen, newData, appendLength);
+	resize_lump(lumpIdx, oldLen + appendLength, false);
+	memcpy(lumps[lumpIdx] + oldLen, newData, appendLength);
+	update_lump_pointers();
+}
+
+void Bsp::resize_lump(int lumpIdx, int newLength, bool updatePointers) {
+	int oldLen = header.lump[lumpIdx].nLength;
+	int capacity = lumps[lumpIdx] && lumps[lumpIdx] == lumpBuffers[lumpIdx] ? lumpCapacity[lumpIdx] : oldLen;
+
+	if (!lumps[lumpIdx] || newLength > capacity) {
+		int newCapacity = max(newLength, capacity + capacity / 2 + 64);
+		byte* newLump = new byte[newCapacity];
+		if (lumps[lumpIdx]) {
+			memcpy(newLump, lumps[lumpIdx], min(oldLen, newLength));
+		}
+
+		delete[] lumps[lumpIdx];
+		lumps[lumpIdx] = newLump;
+		lumpBuffers[lumpIdx] = newLump;
+		lumpCapacity[lumpIdx] = newCapacity;
+	}
 
-	replace_lump(lumpIdx, newLump, oldLen + appendLength);
+	if (newLength > oldLen) {
+		memset(lumps[lumpIdx] + oldLen, 0, newLength - oldLen);
+	}
+
+	header.lump[lumpIdx].nLength = newLength;
+
+	if (updatePointers) {
+		update_lump_pointers();
+	}
 }
@@ -11,6 +11,7 @@
 class Entity;
 class Wad;
 struct WADTEX;
+struct CMesh;
 
 #define OOB_CLIP_X 1
 #define OOB_CLIP_X_NEG 2
@@ -139,10 +140,11 @@ public:
 	// true if the center of this face is touching an empty leaf
 	bool isInteriorFace(const Polygon3D& poly, int hull);
 
-	// get cuts required to create bounding volumes for each solid leaf in the model
-	vector<NodeVolumeCuts> get_model_leaf_volume_cuts(int modelIdx, int hullIdx, int16_t contents);
-	void get_clipnode_leaf_cuts(int iNode, vector<BSPPLANE>& clipOrder, vector<NodeVolumeCuts>& output, int16_t contents);
-	void get_node_leaf_cuts(int iNode, vector<BSPPLANE>& clipOrder, vector<NodeVolumeCuts>& output, int16_t contents);
+	// get bounding volumes for each leaf in the model with the given contents. Each node's volume
+	// is clipped once and shared by its children, instead of clipping every leaf from scratch.
+	// Leaves with no volume are skipped.
+	void get_model_leaf_volumes(int modelIdx, int hullIdx, int16_t contents, vector<CMesh>& output);
+	void get_leaf_volumes(int iNode, bool isClipnode, int16_t contents, int depth, vector<CMesh>& volumes, vector<CMesh>& output);
 
 	// this a cheat to recalculate plane normals after scaling a solid. Really I should get the plane
 	// intersection code working for nonconvex solids, but that's looking like a ton of work.
@@ -182,6 +184,21 @@ public:
 
 	// delete structures not used by the map (needed after deleting models/hulls)
 	STRUCTCOUNT remove_unused_model_structures();
+
+	// merges vertexes closer than epsilon and shares edges between faces, in about linear time.
+	// Welds that would change a face's lightmap extents or collapse one of its edges are skipped.
+	// Edges not referenced by a face are dropped.
+	STRUCTCOUNT weld_vertices(float epsilon=0);
+
+	// stores identical clipnode subtrees only once, sharing them between hulls and models.
+	// Duplicate planes are merged first. Unreachable clipnodes are dropped.
+	STRUCTCOUNT share_clipnodes();
+
+	// merges planes that are equal within the compiler's epsilons, including ones facing the other way,
+	// then deletes planes that nothing uses. Axial planes are made to face the positive axis.
+	// Runs in about linear time. Not run after editor transforms, only by Clean/Optimize.
+	STRUCTCOUNT merge_duplicate_planes();
+
 	void delete_model(int modelIdx);
 
 	// conditionally deletes hulls for entities that aren't using them
@@ -190,17 +207,18 @@ public:
 	// deletes data outside the map bounds
 	void delete_oob_data(int clipFlags);
 
-	void delete_oob_clipnodes(int iNode, int16_t* parentBranch, vector<BSPPLANE>& clipOrder, 
+	// volume = the space covered by iNode. Only used in the first pass.
+	void delete_oob_clipnodes(int iNode, int16_t* parentBranch, CMesh& volume, 
 		int oobFlags, bool* oobHistory, bool isFirstPass, int& removedNodes);
 	
-	void delete_oob_nodes(int iNode, int16_t* parentBranch, vector<BSPPLANE>& clipOrder, 
+	void delete_oob_nodes(int iNode, int16_t* parentBranch, CMesh& volume, 
 		int oobFlags, bool* oobHistory, bool isFirstPass, int& removedNodes);
 
 	// deletes data inside a bounding box
 	void delete_box_data(vec3 clipMins, vec3 clipMaxs);
-	void delete_box_clipnodes(int iNode, int16_t* parentBranch, vector<BSPPLANE>& clipOrder,
+	void delete_box_clipnodes(int iNode, int16_t* parentBranch, CMesh& volume,
 		vec3 clipMins, vec3 clipMaxs, bool* oobHistory, bool isFirstPass, int& removedNodes);
-	void delete_box_nodes(int iNode, int16_t* parentBranch, vector<BSPPLANE>& clipOrder,
+	void delete_box_nodes(int iNode, int16_t* parentBranch, CMesh& volume,
 		vec3 clipMins, vec3 clipMaxs, bool* oobHistory, bool isFirstPass, int& removedNodes);
 
 	// assumes contiguous leaves starting at 0. Only works for worldspawn, which is the only model which
@@ -279,8 +297,9 @@ public:
 	// returns true if the map has eny entities that make use of hull 2
 	bool has_hull2_ents();
 	
-	// check for bad indexes
-	bool validate();
+	// check for bad indexes. Textures that aren't embedded are searched for in the given WADs.
+	bool validate(vector<Wad*>& wads);
+	bool validate(); // uses the WADs loaded in the editor, if any
 
 	bool validate_vis_data();
 
@@ -306,6 +325,11 @@ public:
 	void replace_lump(int lumpIdx, void* newData, int newLength);
 	void append_lump(int lumpIdx, void* newData, int appendLength);
 
+	// change the length of a lump, keeping its contents. New bytes are zeroed.
+	// Buffers grow geometrically, so adding structures one at a time doesn't copy the whole lump each time.
+	// Pass updatePointers=false when resizing several lumps, then call update_lump_pointers once.
+	void resize_lump(int lumpIdx, int newLength, bool updatePointers=true);
+
 	bool is_invisible_solid(Entity* ent);
 
 	// replace a model's clipnode hull with a axis-aligned bounding box
@@ -357,10 +381,16 @@ private:
 	bool* pvsFaces = NULL; // flags which faces are marked for rendering in the PVS
 	int pvsFaceCount = 0;
 
+	// allocated size of each lump buffer. Only trusted while lumps[i] is still the buffer
+	// it was recorded for, otherwise the buffer is assumed to be exactly nLength bytes.
+	int lumpCapacity[HEADER_LUMPS] = {};
+	byte* lumpBuffers[HEADER_LUMPS] = {};
+
 	int remove_unused_lightmaps(bool* usedFaces);
 	int remove_unused_visdata(STRUCTREMAP* remap, BSPLEAF* oldLeaves, int oldLeafCount, int oldWorldspawnLeafCount); // called after removing unused leaves
 	int remove_unused_textures(bool* usedTextures, int* remappedIndexes);
 	int remove_unused_structs(int lumpIdx, bool* usedStructs, int* remappedIndexes);
+	int remove_unused_planes(); // planes not used by any node, clipnode, or face
 
 	void resize_lightmaps(LIGHTMAP* oldLightmaps, LIGHTMAP* newLightmaps);
 
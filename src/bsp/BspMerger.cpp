@@ -1,4 +1,5 @@
 #include "BspMerger.h"
+#include "Trace.h"
 #include <set>
 #include "vis.h"
 #include "Entity.h"
@@ -11,8 +12,25 @@ BspMerger::BspMerger() {
 
 }
 
+static uint64_t hash_texinfo(const BSPTEXTUREINFO& info) {
+	BSPTEXTUREINFO copy = info;
+	copy.iMiptex = 0;
+	return hashData(&copy, sizeof(BSPTEXTUREINFO));
+}
+
+static uint64_t texinfo_key(uint64_t infoHash, int miptex) {
+	return infoHash ^ ((uint64_t)(uint32_t)miptex * 0x9E3779B185EBCA87ULL);
+}
+
+static int percent(int count, int total) {
+	return total ? (int)((count * 100LL) / total) : 0;
+}
+
 MergeResult BspMerger::merge(vector<Bsp*> maps, vec3 gap, string output_name, bool noripent, bool noscript, bool nomove, int max_dim) {
+	TRACE_SCOPE("merge");
 	merge_max_dim = max_dim;
+	hashIndexes.clear();
+	memset(&dedupStats, 0, sizeof(MergeDedupStats));
 
 	MergeResult result;
 	result.fpath = "";
@@ -110,6 +128,12 @@ MergeResult BspMerger::merge(vector<Bsp*> maps, vec3 gap, string output_name, bo
 		}
 	}
 
+	logf("\nShared %d textures (%d%% of lookups) and %d texinfos (%d%%) between maps. %d hash collisions.\n",
+		dedupStats.texHits, percent(dedupStats.texHits, dedupStats.texLookups),
+		dedupStats.texinfoHits, percent(dedupStats.texinfoHits, dedupStats.texinfoLookups),
+		dedupStats.collisions);
+	hashIndexes.clear();
+
 	Bsp* output = layerStart.map;
 	output->zero_entity_origins("func_water");
 	output->zero_entity_origins("func_ladder");
@@ -280,6 +304,7 @@ typedef unordered_map< string, MAPBLOCK > mapStringToMapBlock;
 
 void BspMerger::update_map_series_entity_logic(Bsp* mergedMap, vector<MAPBLOCK>& sourceMaps, 
 		vector<Bsp*>& mapOrder, string output_name, string firstMapName, bool noscript) {
+	TRACE_SCOPE("update_map_series_entity_logic");
 	int originalEntCount = mergedMap->ents.size();
 	int renameCount = force_unique_ent_names_per_map(mergedMap);
 
@@ -873,6 +898,7 @@ int BspMerger::force_unique_ent_names_per_map(Bsp* mergedMap) {
 }
 
 bool BspMerger::merge(Bsp& mapA, Bsp& mapB) {
+	TRACE_SCOPE("merge_pair");
 	// TODO: Create a new map and store result there. Don't break mapA.
 
 	BSPPLANE separationPlane = separate(mapA, mapB);
@@ -970,9 +996,50 @@ bool BspMerger::merge(Bsp& mapA, Bsp& mapB) {
 
 	g_progress.clear();
 
+	hashIndexes.erase(&mapB); // mapB isn't merged into anything after this
+
+	TRACE_COUNTER("merged planes", mapA.planeCount);
+	TRACE_COUNTER("merged faces", mapA.faceCount);
+	TRACE_COUNTER("merged clipnodes", mapA.clipnodeCount);
+
 	return true;
 }
 
+MergeHashIndex& BspMerger::get_hash_index(Bsp& map) {
+	MergeHashIndex& index = hashIndexes[&map];
+
+	if (index.texHashes.size() != map.textureCount) {
+		index.texHashes.clear();
+		index.textures.clear();
+
+		for (int i = 0; i < map.textureCount; i++) {
+			int32_t offset = ((int32_t*)map.textures)[i + 1];
+			uint64_t hash = 0;
+
+			if (offset != -1) {
+				BSPMIPTEX* tex = (BSPMIPTEX*)(map.textures + offset);
+				hash = hashData(tex, getBspTextureSize(tex));
+				index.textures.insert(make_pair(hash, i));
+			}
+
+			index.texHashes.push_back(hash);
+		}
+	}
+
+	if (index.texinfoHashes.size() != map.texinfoCount) {
+		index.texinfoHashes.clear();
+		index.texinfos.clear();
+
+		for (int i = 0; i < map.texinfoCount; i++) {
+			uint64_t hash = hash_texinfo(map.texinfos[i]);
+			index.texinfoHashes.push_back(hash);
+			index.texinfos.insert(make_pair(texinfo_key(hash, map.texinfos[i].iMiptex), i));
+		}
+	}
+
+	return index;
+}
+
 BSPPLANE BspMerger::separate(Bsp& mapA, Bsp& mapB) {
 	BSPMODEL& thisWorld = mapA.models[0];
 	BSPMODEL& otherWorld = mapB.models[0];
@@ -998,6 +1065,7 @@ BSPPLANE BspMerger::separate(Bsp& mapA, Bsp& mapB) {
 
 void BspMerger::merge_ents(Bsp& mapA, Bsp& mapB)
 {
+	TRACE_SCOPE("merge_ents");
 	g_progress.update("Merging entities", mapA.ents.size() + mapB.ents.size());
 
 	int oldEntCount = mapA.ents.size();
@@ -1082,25 +1150,33 @@ void BspMerger::merge_ents(Bsp& mapA, Bsp& mapB)
 }
 
 void BspMerger::merge_planes(Bsp& mapA, Bsp& mapB) {
+	TRACE_SCOPE("merge_planes");
 	g_progress.update("Merging planes", mapA.planeCount + mapB.planeCount);
 
 	vector<BSPPLANE> mergedPlanes;
 	mergedPlanes.reserve(mapA.planeCount + mapB.planeCount);
 
+	unordered_multimap<uint64_t, int> planeLookup;
+	planeLookup.reserve(mapA.planeCount);
+
 	for (int i = 0; i < mapA.planeCount; i++) {
 		mergedPlanes.push_back(mapA.planes[i]);
+		planeLookup.insert(make_pair(hashData(&mapA.planes[i], sizeof(BSPPLANE)), i));
 		g_progress.tick();
 	}
 	for (int i = 0; i < mapB.planeCount; i++) {
-		bool isUnique = true;
-		for (int k = 0; k < mapA.planeCount; k++) {
-			if (memcmp(&mapB.planes[i], &mapA.planes[k], sizeof(BSPPLANE)) == 0) {
-				isUnique = false;
-				planeRemap.push_back(k);
-				break;
+		int match = -1;
+		auto range = planeLookup.equal_range(hashData(&mapB.planes[i], sizeof(BSPPLANE)));
+		for (auto it = range.first; it != range.second; ++it) {
+			if ((match == -1 || it->second < match) && memcmp(&mapB.planes[i], &mapA.planes[it->second], sizeof(BSPPLANE)) == 0) {
+				match = it->second;
 			}
 		}
-		if (isUnique) {
+
+		if (match != -1) {
+			planeRemap.push_back(match);
+		}
+		else {
 			planeRemap.push_back(mergedPlanes.size());
 			mergedPlanes.push_back(mapB.planes[i]);
 		}
@@ -1120,6 +1196,7 @@ void BspMerger::merge_planes(Bsp& mapA, Bsp& mapB) {
 }
 
 void BspMerger::merge_textures(Bsp& mapA, Bsp& mapB) {
+	TRACE_SCOPE("merge_textures");
 	uint32_t newTexCount = 0;
 
 	// temporary buffer for holding miptex + embedded textures (too big but doesn't matter)
@@ -1155,32 +1232,48 @@ void BspMerger::merge_textures(Bsp& mapA, Bsp& mapB) {
 		g_progress.tick();
 	}
 
+	MergeHashIndex& indexA = get_hash_index(mapA);
+	MergeHashIndex& indexB = get_hash_index(mapB);
+	vector<pair<uint64_t, int>> addedHashes; // only compare against mapA's textures, like before
+
 	uint otherMergeSz = (mapB.textureCount + 1) * sizeof(int32_t);
 	for (int i = 0; i < mapB.textureCount; i++) {
 		int32_t offset = ((int32_t*)mapB.textures)[i + 1];
 		
 		if (offset != -1) {
-			bool isUnique = true;
 			BSPMIPTEX* tex = (BSPMIPTEX*)(mapB.textures + offset);
 			int sz = getBspTextureSize(tex);
-
-			for (int k = 0; k < mapA.textureCount; k++) {
-				if (mipTexOffsets[k] == -1) {
+			uint64_t hash = indexB.texHashes[i];
+
+			// bytes are only compared when the hashes match. The lowest index wins if mapA has copies.
+			int match = -1;
+			auto range = indexA.textures.equal_range(hash);
+			for (auto it = range.first; it != range.second; it++) {
+				int k = it->second;
+				if (match != -1 && k > match) {
 					continue;
 				}
 				BSPMIPTEX* thisTex = (BSPMIPTEX*)(newMipTexData + mipTexOffsets[k]);
-				if (memcmp(tex, thisTex, sz) == 0) {
-					isUnique = false;
-					texRemap.push_back(k);
-					break;
+				if (getBspTextureSize(thisTex) == sz && memcmp(tex, thisTex, sz) == 0) {
+					match = k;
+				}
+				else {
+					dedupStats.collisions++;
 				}
 			}
+			dedupStats.texLookups++;
 
-			if (isUnique) {
+			if (match != -1) {
+				texRemap.push_back(match);
+				dedupStats.texHits++;
+			}
+			else {
 				mipTexOffsets[newTexCount] = (mipTexWritePtr - newMipTexData);
 				texRemap.push_back(newTexCount);
 				memcpy(mipTexWritePtr, tex, sz); // Note: won't work if pixel data isn't immediately after struct
 				mipTexWritePtr += sz;
+				indexA.texHashes.push_back(hash);
+				addedHashes.push_back(make_pair(hash, newTexCount));
 				newTexCount++;
 				otherMergeSz += sz;
 			}
@@ -1188,11 +1281,13 @@ void BspMerger::merge_textures(Bsp& mapA, Bsp& mapB) {
 		else {
 			mipTexOffsets[newTexCount] = -1;
 			texRemap.push_back(newTexCount);
+			indexA.texHashes.push_back(0);
 			newTexCount++;
 		}
 
 		g_progress.tick();
 	}
+	indexA.textures.insert(addedHashes.begin(), addedHashes.end());
 
 	int duplicates = newTexCount - (mapA.textureCount + mapB.textureCount);
 
@@ -1214,6 +1309,7 @@ void BspMerger::merge_textures(Bsp& mapA, Bsp& mapB) {
 }
 
 void BspMerger::merge_vertices(Bsp& mapA, Bsp& mapB) {
+	TRACE_SCOPE("merge_vertices");
 	thisVertCount = mapA.vertCount;
 	int totalVertCount = thisVertCount + mapB.vertCount;
 
@@ -1230,6 +1326,7 @@ void BspMerger::merge_vertices(Bsp& mapA, Bsp& mapB) {
 }
 
 void BspMerger::merge_texinfo(Bsp& mapA, Bsp& mapB) {
+	TRACE_SCOPE("merge_texinfo");
 	g_progress.update("Merging texinfos", mapA.texinfoCount + mapB.texinfoCount);
 
 	vector<BSPTEXTUREINFO> mergedInfo;
@@ -1240,25 +1337,46 @@ void BspMerger::merge_texinfo(Bsp& mapA, Bsp& mapB) {
 		g_progress.tick();
 	}
 
+	MergeHashIndex& indexA = get_hash_index(mapA);
+	MergeHashIndex& indexB = get_hash_index(mapB);
+	vector<pair<uint64_t, int>> addedKeys;
+
 	for (int i = 0; i < mapB.texinfoCount; i++) {
 		BSPTEXTUREINFO info = mapB.texinfos[i];
 		info.iMiptex = texRemap[info.iMiptex];
 
-		bool isUnique = true;
-		for (int k = 0; k < mapA.texinfoCount; k++) {
+		uint64_t hash = indexB.texinfoHashes[i];
+		uint64_t key = texinfo_key(hash, info.iMiptex);
+
+		int match = -1;
+		auto range = indexA.texinfos.equal_range(key);
+		for (auto it = range.first; it != range.second; it++) {
+			int k = it->second;
+			if (match != -1 && k > match) {
+				continue;
+			}
 			if (memcmp(&info, &mapA.texinfos[k], sizeof(BSPTEXTUREINFO)) == 0) {
-				texInfoRemap.push_back(k);
-				isUnique = false;
-				break;
+				match = k;
+			}
+			else {
+				dedupStats.collisions++;
 			}
 		}
+		dedupStats.texinfoLookups++;
 
-		if (isUnique) {
+		if (match != -1) {
+			texInfoRemap.push_back(match);
+			dedupStats.texinfoHits++;
+		}
+		else {
 			texInfoRemap.push_back(mergedInfo.size());
+			indexA.texinfoHashes.push_back(hash);
+			addedKeys.push_back(make_pair(key, (int)mergedInfo.size()));
 			mergedInfo.push_back(info);
 		}
 		g_progress.tick();
 	}
+	indexA.texinfos.insert(addedKeys.begin(), addedKeys.end());
 
 	int newLen = mergedInfo.size() * sizeof(BSPTEXTUREINFO);
 	int duplicates = mergedInfo.size() - (mapA.texinfoCount + mapB.texinfoCount);
@@ -1270,6 +1388,7 @@ void BspMerger::merge_texinfo(Bsp& mapA, Bsp& mapB) {
 }
 
 void BspMerger::merge_faces(Bsp& mapA, Bsp& mapB) {
+	TRACE_SCOPE("merge_faces");
 	thisFaceCount = mapA.faceCount;
 	otherFaceCount = mapB.faceCount;
 	thisWorldFaceCount = mapA.models[0].nFaces;
@@ -1314,6 +1433,7 @@ void BspMerger::merge_faces(Bsp& mapA, Bsp& mapB) {
 }
 
 void BspMerger::merge_leaves(Bsp& mapA, Bsp& mapB) {
+	TRACE_SCOPE("merge_leaves");
 	thisLeafCount = mapA.header.lump[LUMP_LEAVES].nLength / sizeof(BSPLEAF);
 	otherLeafCount = mapB.header.lump[LUMP_LEAVES].nLength / sizeof(BSPLEAF);
 
@@ -1367,6 +1487,7 @@ void BspMerger::merge_leaves(Bsp& mapA, Bsp& mapB) {
 }
 
 void BspMerger::merge_marksurfs(Bsp& mapA, Bsp& mapB) {
+	TRACE_SCOPE("merge_marksurfs");
 	thisMarkSurfCount = mapA.marksurfCount;
 	int totalSurfCount = thisMarkSurfCount + mapB.marksurfCount;
 
@@ -1395,6 +1516,7 @@ void BspMerger::merge_marksurfs(Bsp& mapA, Bsp& mapB) {
 }
 
 void BspMerger::merge_edges(Bsp& mapA, Bsp& mapB) {
+	TRACE_SCOPE("merge_edges");
 	thisEdgeCount = mapA.header.lump[LUMP_EDGES].nLength / sizeof(BSPEDGE);
 	int totalEdgeCount = thisEdgeCount + mapB.edgeCount;
 
@@ -1416,6 +1538,7 @@ void BspMerger::merge_edges(Bsp& mapA, Bsp& mapB) {
 }
 
 void BspMerger::merge_surfedges(Bsp& mapA, Bsp& mapB) {
+	TRACE_SCOPE("merge_surfedges");
 	thisSurfEdgeCount = mapA.surfedgeCount;
 	int totalSurfCount = thisSurfEdgeCount + mapB.surfedgeCount;
 
@@ -1436,6 +1559,7 @@ void BspMerger::merge_surfedges(Bsp& mapA, Bsp& mapB) {
 }
 
 void BspMerger::merge_nodes(Bsp& mapA, Bsp& mapB) {
+	TRACE_SCOPE("merge_nodes");
 	thisNodeCount = mapA.nodeCount;
 
 	g_progress.update("Merging nodes", thisNodeCount + mapB.nodeCount);
@@ -1493,6 +1617,7 @@ void BspMerger::merge_nodes(Bsp& mapA, Bsp& mapB) {
 }
 
 void BspMerger::merge_clipnodes(Bsp& mapA, Bsp& mapB) {
+	TRACE_SCOPE("merge_clipnodes");
 	thisClipnodeCount = mapA.clipnodeCount;
 
 	g_progress.update("Merging clipnodes", thisClipnodeCount + mapB.clipnodeCount);
@@ -1535,6 +1660,7 @@ void BspMerger::merge_clipnodes(Bsp& mapA, Bsp& mapB) {
 }
 
 void BspMerger::merge_models(Bsp& mapA, Bsp& mapB) {
+	TRACE_SCOPE("merge_models");
 	g_progress.update("Merging models", mapA.modelCount + mapB.modelCount);
 
 	vector<BSPMODEL> mergedModels;
@@ -1597,6 +1723,7 @@ void BspMerger::merge_models(Bsp& mapA, Bsp& mapB) {
 }
 
 void BspMerger::merge_vis(Bsp& mapA, Bsp& mapB) {
+	TRACE_SCOPE("merge_vis");
 	BSPLEAF* allLeaves = mapA.leaves; // combined with mapB's leaves earlier in merge_leaves
 
 	int thisVisLeaves = thisLeafCount - 1; // VIS ignores the shared solid leaf 0
@@ -1646,6 +1773,7 @@ void BspMerger::merge_vis(Bsp& mapA, Bsp& mapB) {
 }
 
 void BspMerger::merge_lighting(Bsp& mapA, Bsp& mapB) {
+	TRACE_SCOPE("merge_lighting");
 	COLOR3* thisRad = (COLOR3*)mapA.lightdata;
 	COLOR3* otherRad = (COLOR3*)mapB.lightdata;
 	bool freemem = false;
@@ -1709,6 +1837,7 @@ void BspMerger::merge_lighting(Bsp& mapA, Bsp& mapB) {
 }
 
 void BspMerger::create_merge_headnodes(Bsp& mapA, Bsp& mapB, BSPPLANE separationPlane) {
+	TRACE_SCOPE("create_merge_headnodes");
 	BSPMODEL& thisWorld = mapA.models[0];
 	BSPMODEL& otherWorld = mapB.models[0];
 
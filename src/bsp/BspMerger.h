@@ -1,6 +1,7 @@
 #pragma once
 #include "util.h"
 #include "Bsp.h"
+#include <unordered_map>
 
 struct MergeResult {
 	Bsp* map;
@@ -42,6 +43,25 @@ struct MAPBLOCK
 	}
 };
 
+// content hashes for a map's textures and texinfos. Kept for every map taking part in a merge, so
+// maps that are merged into several times (rows, layers) don't have their textures read again.
+struct MergeHashIndex {
+	vector<uint64_t> texHashes; // hash of the miptex + pixel data, per texture index. 0 = missing texture
+	unordered_multimap<uint64_t, int> textures; // texture hash -> texture index
+
+	// hash of the texinfo excluding iMiptex, since mapB's texture indexes are remapped before comparing
+	vector<uint64_t> texinfoHashes;
+	unordered_multimap<uint64_t, int> texinfos; // full texinfo hash -> texinfo index
+};
+
+struct MergeDedupStats {
+	int texLookups; // mapB textures searched for in mapA
+	int texHits; // hash matches that were confirmed duplicates
+	int texinfoLookups;
+	int texinfoHits;
+	int collisions; // hash matches that turned out to be different data
+};
+
 class BspMerger {
 public:
 	BspMerger();
@@ -94,6 +114,12 @@ private:
 
 	void create_merge_headnodes(Bsp& mapA, Bsp& mapB, BSPPLANE separationPlane);
 
+	// returns the hash index for the map, (re)building it if the map changed outside of merge_textures/texinfo
+	MergeHashIndex& get_hash_index(Bsp& map);
+
+	unordered_map<Bsp*, MergeHashIndex> hashIndexes;
+	MergeDedupStats dedupStats;
+
 
 	// remapped structure indexes for mapB when merging
 	vector<int> texRemap;
@@ -7,9 +7,12 @@
 #include "globals.h"
 #include "Renderer.h"
 #include <unordered_set>
+#include <atomic>
 
 using namespace std;
 
+static atomic<uint64_t> g_nextEntRevision(1);
+
 Entity::Entity(void)
 {
 }
@@ -118,6 +121,7 @@ void Entity::clearAllKeyvalues() {
 	keyOrder.clear();
 	keyvalues.clear();
 	cachedModelIdx = -2;
+	revision = g_nextEntRevision++;
 }
 
 void Entity::clearEmptyKeyvalues() {
@@ -720,6 +724,7 @@ string Entity::serialize() {
 }
 
 void Entity::clearCache() {
+	revision = g_nextEntRevision++;
 	cachedModelIdx = -2;
 	targetsCached = false;
 	drawCached = false;
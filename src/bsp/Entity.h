@@ -30,6 +30,7 @@ class Entity
 public:
 	vector<string> keyOrder;
 	bool hidden = false; // hidden in the 3d view
+	uint64_t revision = 0; // changes whenever keyvalues are edited. Unique across all entities.
 
 	// model rendering state updated whenever drawCached is false
 	bool drawCached; // origin, angles, sequence, and model are cached?
@@ -0,0 +1,48 @@
+#include "LumpBuilder.h"
+#include "Bsp.h"
+
+LumpBuilder::LumpBuilder(Bsp* map) {
+	this->map = map;
+}
+
+LumpBuilder::~LumpBuilder() {
+	commit();
+}
+
+int LumpBuilder::lumpLength(int lumpIdx) {
+	return map->header.lump[lumpIdx].nLength;
+}
+
+byte* LumpBuilder::reserve(int lumpIdx, int size, int& offset) {
+	vector<byte>& data = pending[lumpIdx];
+	int oldSize = data.size();
+
+	offset = lumpLength(lumpIdx) + oldSize;
+	if (size <= 0) {
+		return NULL; // &data[oldSize] would be past the end
+	}
+	data.resize(oldSize + size, 0);
+
+	return &data[oldSize];
+}
+
+void LumpBuilder::commit() {
+	bool changed = false;
+
+	for (int i = 0; i < HEADER_LUMPS; i++) {
+		if (pending[i].empty()) {
+			continue;
+		}
+
+		int oldLen = lumpLength(i);
+		map->resize_lump(i, oldLen + pending[i].size(), false);
+		memcpy(map->lumps[i] + oldLen, &pending[i][0], pending[i].size());
+
+		pending[i].clear();
+		changed = true;
+	}
+
+	if (changed) {
+		map->update_lump_pointers();
+	}
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include "bsptypes.h"
+#include <vector>
+#include <string.h>
+
+class Bsp;
+
+// Queues structures to be appended to several lumps, then adds them all in one pass.
+// Each lump is resized at most once per commit and the lump pointers are updated once,
+// instead of copying whole lumps for every structure added.
+//
+// Indexes returned here are the final indexes in the map after commit(). Don't resize the
+// same lumps by other means (create_plane, replace_lump, etc.) while data is still queued.
+class LumpBuilder {
+public:
+	LumpBuilder(Bsp* map);
+
+	// commits anything still queued
+	~LumpBuilder();
+
+	// queue count zeroed structs for the end of a lump and return them for filling in.
+	// The pointer is valid until the next add/append for the same lump.
+	// firstIdx is set to the index the first struct will have after committing.
+	template<class T> T* add(int lumpIdx, int count, int& firstIdx) {
+		int offset;
+		T* data = (T*)reserve(lumpIdx, count * sizeof(T), offset);
+		firstIdx = offset / sizeof(T);
+		return data;
+	}
+
+	// queue a copy of existing structs. Returns the index of the first struct after committing.
+	template<class T> int append(int lumpIdx, const T* data, int count) {
+		int firstIdx;
+		T* dst = add<T>(lumpIdx, count, firstIdx);
+		if (count > 0)
+			memcpy(dst, data, count * sizeof(T));
+		return firstIdx;
+	}
+
+	// number of structs the lump will have after committing
+	template<class T> int count(int lumpIdx) {
+		return (lumpLength(lumpIdx) + pending[lumpIdx].size()) / sizeof(T);
+	}
+
+	// copy queued data into the map's lumps
+	void commit();
+
+private:
+	Bsp* map;
+	std::vector<byte> pending[HEADER_LUMPS];
+
+	int lumpLength(int lumpIdx);
+
+	// returns zeroed space for size bytes at the end of the queued data, or NULL if size is 0.
+	// offset is set to the byte offset the data will have in the lump after committing.
+	byte* reserve(int lumpIdx, int size, int& offset);
+};
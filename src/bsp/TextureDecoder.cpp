@@ -0,0 +1,227 @@
+#include "TextureDecoder.h"
+#include "Bsp.h"
+#include "Wad.h"
+#include "util.h"
+#include "globals.h"
+#include "ThreadPool.h"
+#include <chrono>
+#include <string.h>
+
+static double secondsSince(chrono::steady_clock::time_point start) {
+	return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+static BSPMIPTEX getMiptexHeader(WADTEX* wadTex) {
+	BSPMIPTEX header;
+	memcpy(header.szName, wadTex->szName, MAXTEXTURENAME);
+	header.nWidth = wadTex->nWidth;
+	header.nHeight = wadTex->nHeight;
+	memcpy(header.nOffsets, wadTex->nOffsets, sizeof(header.nOffsets));
+	return header;
+}
+
+DecodedTexture::DecodedTexture() {
+	memset(name, 0, MAXTEXTURENAME);
+	width = height = 0;
+	source = TEX_SOURCE_MISSING;
+	data = NULL;
+	numMips = 0;
+	memset(mips, 0, sizeof(mips));
+}
+
+void DecodedTexture::free() {
+	delete[] data;
+	data = NULL;
+	for (int i = 0; i < numMips; i++) {
+		delete[] mips[i];
+		mips[i] = NULL;
+	}
+	numMips = 0;
+}
+
+TextureDecodeStats::TextureDecodeStats() {
+	memset(this, 0, sizeof(TextureDecodeStats));
+}
+
+void TextureDecodeStats::print() {
+	debugf("Decoded %d textures (%d embedded, %d wad, %d missing) in %.2fs on %d threads\n",
+		embeddedCount + wadCount, embeddedCount, wadCount, missingCount, totalTime, threadCount);
+	debugf("    %.1f megatexels, %.2fs decoding, %.2fs reading wads\n",
+		texelCount / (1000.0f * 1000.0f), decodeTime, wadSearchTime);
+}
+
+void decodePalettedTexels(const byte* src, const COLOR3* palette, COLOR3* dst, int count) {
+	// widen the palette so each lookup is a single load
+	uint32_t pal[256];
+	for (int i = 0; i < 256; i++) {
+		pal[i] = palette[i].r | (palette[i].g << 8) | (palette[i].b << 16);
+	}
+
+	byte* out = (byte*)dst;
+	int i = 0;
+
+	// 4 texels = 12 bytes = 3 words (little-endian, like the rest of the BSP code)
+	for (; i + 4 <= count; i += 4) {
+		uint32_t c0 = pal[src[i]];
+		uint32_t c1 = pal[src[i + 1]];
+		uint32_t c2 = pal[src[i + 2]];
+		uint32_t c3 = pal[src[i + 3]];
+
+		uint32_t w0 = c0 | (c1 << 24);
+		uint32_t w1 = (c1 >> 8) | (c2 << 16);
+		uint32_t w2 = (c2 >> 16) | (c3 << 8);
+
+		memcpy(out, &w0, 4);
+		memcpy(out + 4, &w1, 4);
+		memcpy(out + 8, &w2, 4);
+		out += 12;
+	}
+
+	for (; i < count; i++) {
+		dst[i] = palette[src[i]];
+	}
+}
+
+DecodedTexture TextureDecoder::decodeMiptex(const BSPMIPTEX& tex, const byte* mip0) {
+	DecodedTexture out;
+	memcpy(out.name, tex.szName, MAXTEXTURENAME);
+	out.name[MAXTEXTURENAME - 1] = 0;
+	out.width = tex.nWidth;
+	out.height = tex.nHeight;
+
+	int lastMipSize = (tex.nWidth / 8) * (tex.nHeight / 8);
+	const COLOR3* palette = (const COLOR3*)(mip0 + (tex.nOffsets[3] - tex.nOffsets[0]) + lastMipSize + 2);
+
+	int sz = tex.nWidth * tex.nHeight;
+	out.data = new uint8_t[sz * sizeof(COLOR3)];
+	decodePalettedTexels(mip0, palette, (COLOR3*)out.data, sz);
+
+	if (decodeMips) {
+		for (int m = 1; m < MIPLEVELS; m++) {
+			int mipWidth = tex.nWidth >> m;
+			int mipHeight = tex.nHeight >> m;
+
+			if (mipWidth == 0 || mipHeight == 0 || tex.nOffsets[m] <= tex.nOffsets[m - 1]) {
+				break;
+			}
+
+			const byte* mipSrc = mip0 + (tex.nOffsets[m] - tex.nOffsets[0]);
+			out.mips[m - 1] = new uint8_t[mipWidth * mipHeight * sizeof(COLOR3)];
+			decodePalettedTexels(mipSrc, palette, (COLOR3*)out.mips[m - 1], mipWidth * mipHeight);
+			out.numMips++;
+		}
+	}
+
+	return out;
+}
+
+void TextureDecoder::addStats(const DecodedTexture& tex, double searchTime, double decodeTime) {
+	lock_guard<mutex> lock(statMutex);
+
+	if (tex.source == TEX_SOURCE_EMBEDDED)
+		stats.embeddedCount++;
+	else if (tex.source == TEX_SOURCE_WAD)
+		stats.wadCount++;
+	else
+		stats.missingCount++;
+
+	if (tex.data) {
+		for (int m = 0; m <= tex.numMips; m++) {
+			stats.texelCount += (tex.width >> m) * (tex.height >> m);
+		}
+	}
+
+	stats.wadSearchTime += searchTime;
+	stats.decodeTime += decodeTime;
+}
+
+vector<DecodedTexture> TextureDecoder::decodeMapTextures(Bsp* map, vector<Wad*>& wads) {
+	auto startTime = chrono::steady_clock::now();
+	stats = TextureDecodeStats();
+	stats.threadCount = g_thread_pool->size();
+
+	vector<DecodedTexture> output(map->textureCount);
+
+	g_thread_pool->parallelFor(map->textureCount, [&](int i) {
+		int32_t texOffset = ((int32_t*)map->textures)[i + 1];
+		if (texOffset == -1) {
+			addStats(output[i], 0, 0);
+			return;
+		}
+
+		BSPMIPTEX& tex = *((BSPMIPTEX*)(map->textures + texOffset));
+		double searchTime = 0;
+
+		if (tex.nOffsets[0] <= 0) {
+			auto searchStart = chrono::steady_clock::now();
+
+			WADTEX* wadTex = NULL;
+			for (int k = 0; k < wads.size() && !wadTex; k++) {
+				if (wads[k]->hasTexture(tex.szName)) {
+					wadTex = wads[k]->readTexture(tex.szName);
+				}
+			}
+			searchTime = secondsSince(searchStart);
+
+			if (!wadTex) {
+				memcpy(output[i].name, tex.szName, MAXTEXTURENAME);
+				addStats(output[i], searchTime, 0);
+				return;
+			}
+
+			auto decodeStart = chrono::steady_clock::now();
+			output[i] = decodeMiptex(getMiptexHeader(wadTex), wadTex->data);
+			output[i].source = TEX_SOURCE_WAD;
+			double decodeTime = secondsSince(decodeStart);
+
+			delete[] wadTex->data;
+			delete wadTex;
+
+			addStats(output[i], searchTime, decodeTime);
+		}
+		else {
+			auto decodeStart = chrono::steady_clock::now();
+			output[i] = decodeMiptex(tex, map->textures + texOffset + tex.nOffsets[0]);
+			output[i].source = TEX_SOURCE_EMBEDDED;
+			addStats(output[i], 0, secondsSince(decodeStart));
+		}
+	});
+
+	stats.totalTime = secondsSince(startTime);
+
+	return output;
+}
+
+vector<DecodedTexture> TextureDecoder::decodeWadTextures(Wad* wad) {
+	auto startTime = chrono::steady_clock::now();
+	stats = TextureDecodeStats();
+	stats.threadCount = g_thread_pool->size();
+
+	int numTex = wad->header.nDir;
+	vector<DecodedTexture> output(numTex);
+
+	g_thread_pool->parallelFor(numTex, [&](int i) {
+		auto searchStart = chrono::steady_clock::now();
+		WADTEX* wadTex = wad->dirEntries[i].nType == 0x43 ? wad->readTexture(i) : NULL;
+		double searchTime = secondsSince(searchStart);
+
+		if (!wadTex) {
+			addStats(output[i], searchTime, 0);
+			return;
+		}
+
+		auto decodeStart = chrono::steady_clock::now();
+		output[i] = decodeMiptex(getMiptexHeader(wadTex), wadTex->data);
+		output[i].source = TEX_SOURCE_WAD;
+		double decodeTime = secondsSince(decodeStart);
+
+		delete[] wadTex->data;
+		delete wadTex;
+
+		addStats(output[i], searchTime, decodeTime);
+	});
+
+	stats.totalTime = secondsSince(startTime);
+
+	return output;
+}
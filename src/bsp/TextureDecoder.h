@@ -0,0 +1,75 @@
+#pragma once
+#include "types.h"
+#include "colors.h"
+#include "bsptypes.h"
+#include <vector>
+#include <string>
+#include <mutex>
+
+class Bsp;
+class Wad;
+
+enum texture_sources {
+	TEX_SOURCE_MISSING,
+	TEX_SOURCE_EMBEDDED,
+	TEX_SOURCE_WAD
+};
+
+struct DecodedTexture {
+	char name[MAXTEXTURENAME];
+	int width;
+	int height;
+	int source;
+
+	// allocated as uint8_t arrays of COLOR3 texels, so that a Texture can take and delete them
+	uint8_t* data; // full size RGB image, or NULL if the texture is missing
+	uint8_t* mips[MIPLEVELS - 1]; // smaller mip levels, if decodeMips was enabled
+	int numMips;
+
+	DecodedTexture();
+
+	// deletes the image data (not done automatically so ownership can be passed to a Texture)
+	void free();
+};
+
+struct TextureDecodeStats {
+	int embeddedCount;
+	int wadCount;
+	int missingCount;
+	int64 texelCount; // texels decoded, including mips
+	int threadCount;
+
+	double wadSearchTime; // seconds spent finding and reading textures from WADs (summed across threads)
+	double decodeTime; // seconds spent converting palette indexes to RGB (summed across threads)
+	double totalTime; // wall time for the whole batch
+
+	TextureDecodeStats();
+	void print();
+};
+
+// converts 8-bit palette indexes to RGB.
+// Works on 4 texels at a time, writing 3 words instead of 12 separate bytes.
+void decodePalettedTexels(const byte* src, const COLOR3* palette, COLOR3* dst, int count);
+
+// Converts paletted BSP/WAD textures to RGB, one task per texture on the shared thread pool.
+// Does not touch OpenGL, so it can be used without a window for benchmarking.
+class TextureDecoder {
+public:
+	bool decodeMips = true; // also decode the mip levels stored in the BSP/WAD
+	TextureDecodeStats stats;
+
+	// decodes every texture in the map. Textures not embedded in the BSP are read from the given WADs.
+	// output is indexed by miptex index.
+	std::vector<DecodedTexture> decodeMapTextures(Bsp* map, std::vector<Wad*>& wads);
+
+	// decodes every texture in a WAD
+	std::vector<DecodedTexture> decodeWadTextures(Wad* wad);
+
+	// decode a single texture. mip0 points to the first mip level, and the rest of the
+	// mip levels + palette follow it at the offsets given in the miptex header.
+	DecodedTexture decodeMiptex(const BSPMIPTEX& tex, const byte* mip0);
+
+private:
+	void addStats(const DecodedTexture& tex, double searchTime, double decodeTime);
+	std::mutex statMutex;
+};
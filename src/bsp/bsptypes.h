@@ -239,12 +239,6 @@ struct Solid {
 	vector<HullEdge> hullEdges; // for vertex manipulation (holds indexes into hullVerts)
 };
 
-// used to construct bounding volumes for solid leaves
-struct NodeVolumeCuts {
-	int nodeIdx;
-	vector<BSPPLANE> cuts; // cuts which define the leaf boundaries when applied to a bounding box, in order.
-};
-
 struct TraceResult
 {
 	int		fAllSolid;			// if true, plane is not valid
@@ -0,0 +1,254 @@
+#include "BatchCommand.h"
+#include "Bsp.h"
+#include "Wad.h"
+#include "remap.h"
+#include "util.h"
+#include "globals.h"
+#include "ThreadPool.h"
+#include <chrono>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <stdio.h>
+
+static bool globMatch(const char* pattern, const char* str) {
+	if (*pattern == '\0') {
+		return *str == '\0';
+	}
+	if (*pattern == '*') {
+		return globMatch(pattern + 1, str) || (*str && globMatch(pattern, str + 1));
+	}
+	if (*str && (*pattern == '?' || tolower(*pattern) == tolower(*str))) {
+		return globMatch(pattern + 1, str + 1);
+	}
+	return false;
+}
+
+static void addCount(ostringstream& json, const char* name, int count, bool& first) {
+	json << (first ? "" : ",") << "\"" << name << "\":" << count;
+	first = false;
+}
+
+static void addLimit(ostringstream& json, const char* name, int count, int max, bool& first, vector<string>& exceeded) {
+	json << (first ? "" : ",") << "{\"name\":\"" << name << "\",\"count\":" << count << ",\"max\":" << max
+		<< ",\"percent\":" << (max ? count / (float)max * 100.0f : 0) << "}";
+	first = false;
+
+	if (count > max) {
+		exceeded.push_back(name);
+	}
+}
+
+// allocblock usage is the only fractional count
+static void addLimit(ostringstream& json, const char* name, float count, int max, bool& first, vector<string>& exceeded) {
+	json << (first ? "" : ",") << "{\"name\":\"" << name << "\",\"count\":" << fixed << setprecision(2) << count
+		<< defaultfloat << setprecision(6) << ",\"max\":" << max
+		<< ",\"percent\":" << (max ? count / max * 100.0f : 0) << "}";
+	first = false;
+
+	if (count > max) {
+		exceeded.push_back(name);
+	}
+}
+
+BatchCommand::BatchCommand(string op) {
+	this->op = op;
+}
+
+BatchCommand::~BatchCommand() {
+	for (auto it = wadCache.begin(); it != wadCache.end(); ++it) {
+		delete it->second;
+	}
+}
+
+bool BatchCommand::isValidOp(string op) {
+	return op == "info" || op == "validate" || op == "limits" || op == "hulls";
+}
+
+vector<string> BatchCommand::findMaps(string pattern) {
+	vector<string> maps;
+
+	replaceAll(pattern, "\\", "/");
+	string dir = pattern;
+	string filePattern = "*.bsp";
+
+	if (!dirExists(pattern)) {
+		size_t lastSlash = pattern.find_last_of('/');
+		dir = lastSlash == string::npos ? "." : pattern.substr(0, lastSlash);
+		filePattern = lastSlash == string::npos ? pattern : pattern.substr(lastSlash + 1);
+
+		if (filePattern.find_first_of("*?") == string::npos) {
+			if (fileExists(pattern)) {
+				maps.push_back(pattern);
+			}
+			return maps;
+		}
+	}
+
+	if (dir.empty()) {
+		dir = "/";
+	}
+	else if (dir[dir.size() - 1] != '/') {
+		dir += "/";
+	}
+
+	vector<string> files = getDirFiles(dir);
+	sort(files.begin(), files.end());
+
+	for (int i = 0; i < files.size(); i++) {
+		if (globMatch(filePattern.c_str(), files[i].c_str())) {
+			maps.push_back(dir + files[i]);
+		}
+	}
+
+	return maps;
+}
+
+int BatchCommand::run(const vector<string>& mapPaths) {
+	int failed = 0;
+
+	g_thread_pool->parallelFor(mapPaths.size(), [&](int i) {
+		bool loaded;
+		string record = processMap(mapPaths[i], loaded) + "\n";
+
+		lock_guard<mutex> lock(outputMutex);
+		fwrite(record.c_str(), 1, record.size(), stdout);
+		fflush(stdout);
+		if (!loaded) {
+			failed++;
+		}
+	});
+
+	return failed;
+}
+
+vector<Wad*> BatchCommand::getWads(Bsp* map, vector<string>& missingWads) {
+	vector<string> wadNames = map->get_wad_names();
+	vector<Wad*> wads;
+
+	lock_guard<mutex> lock(wadMutex);
+
+	for (int i = 0; i < wadNames.size(); i++) {
+		string key = toLowerCase(wadNames[i]);
+		auto cached = wadCache.find(key);
+
+		if (cached == wadCache.end()) {
+			string path = findAsset(wadNames[i]);
+			Wad* wad = NULL;
+
+			if (!path.empty()) {
+				wad = new Wad(path);
+				if (!wad->readInfo()) {
+					delete wad;
+					wad = NULL;
+				}
+			}
+
+			cached = wadCache.insert(make_pair(key, wad)).first;
+		}
+
+		if (cached->second) {
+			wads.push_back(cached->second);
+		}
+		else {
+			missingWads.push_back(wadNames[i]);
+		}
+	}
+
+	return wads;
+}
+
+string BatchCommand::processMap(const string& path, bool& loaded) {
+	auto startTime = chrono::steady_clock::now();
+	ostringstream json;
+	string log;
+
+	json << "{\"map\":" << jsonString(path) << ",\"op\":" << jsonString(op);
+
+	{
+		ScopedLogCapture capture(log);
+		Bsp* map = new Bsp(path);
+		loaded = map->valid;
+
+		if (loaded && op == "info") {
+			bool first = true;
+			json << ",\"counts\":{";
+			addCount(json, "models", map->modelCount, first);
+			addCount(json, "planes", map->planeCount, first);
+			addCount(json, "vertexes", map->vertCount, first);
+			addCount(json, "nodes", map->nodeCount, first);
+			addCount(json, "texinfos", map->texinfoCount, first);
+			addCount(json, "faces", map->faceCount, first);
+			addCount(json, "clipnodes", map->clipnodeCount, first);
+			addCount(json, "leaves", map->leafCount, first);
+			addCount(json, "marksurfaces", map->marksurfCount, first);
+			addCount(json, "surfedges", map->surfedgeCount, first);
+			addCount(json, "edges", map->edgeCount, first);
+			addCount(json, "textures", map->textureCount, first);
+			addCount(json, "lightdata", map->lightDataLength, first);
+			addCount(json, "visdata", map->visDataLength, first);
+			addCount(json, "entities", map->ents.size(), first);
+			json << "}";
+		}
+		else if (loaded && op == "limits") {
+			vector<string> exceeded;
+			bool first = true;
+			json << ",\"limits\":[";
+			addLimit(json, "allocblocks", map->calc_allocblock_usage(), g_limits.max_allocblocks, first, exceeded);
+			addLimit(json, "models", map->modelCount, g_limits.max_models, first, exceeded);
+			addLimit(json, "planes", map->planeCount, g_limits.max_planes, first, exceeded);
+			addLimit(json, "vertexes", map->vertCount, g_limits.max_vertexes, first, exceeded);
+			addLimit(json, "nodes", map->nodeCount, g_limits.max_nodes, first, exceeded);
+			addLimit(json, "texinfos", map->texinfoCount, g_limits.max_texinfos, first, exceeded);
+			addLimit(json, "faces", map->faceCount, g_limits.max_faces, first, exceeded);
+			addLimit(json, "clipnodes", map->clipnodeCount, g_limits.max_clipnodes, first, exceeded);
+			addLimit(json, "leaves", map->leafCount, g_limits.max_leaves, first, exceeded);
+			addLimit(json, "marksurfaces", map->marksurfCount, g_limits.max_marksurfaces, first, exceeded);
+			addLimit(json, "surfedges", map->surfedgeCount, g_limits.max_surfedges, first, exceeded);
+			addLimit(json, "edges", map->edgeCount, g_limits.max_edges, first, exceeded);
+			addLimit(json, "textures", map->textureCount, g_limits.max_textures, first, exceeded);
+			addLimit(json, "lightdata", map->lightDataLength, g_limits.max_lightdata, first, exceeded);
+			addLimit(json, "visdata", map->visDataLength, g_limits.max_visdata, first, exceeded);
+			addLimit(json, "entities", (int)map->ents.size(), g_limits.max_entities, first, exceeded);
+			json << "],\"exceeded\":" << jsonStringList(exceeded);
+		}
+		else if (loaded && op == "validate") {
+			vector<string> missingWads;
+			vector<Wad*> wads = getWads(map, missingWads);
+
+			log.clear();
+			bool valid = map->validate(wads);
+
+			json << ",\"valid\":" << (valid ? "true" : "false");
+			json << ",\"missing_wads\":" << jsonStringList(missingWads);
+			json << ",\"messages\":" << jsonStringList(getLogLines(log));
+		}
+		else if (loaded && op == "hulls") {
+			json << ",\"hull2_ents\":" << (map->has_hull2_ents() ? "true" : "false");
+
+			// the map is thrown away after this, so it's ok to modify it
+			STRUCTCOUNT removed = map->delete_unused_hulls(true);
+
+			bool first = true;
+			json << ",\"deletable\":{";
+			addCount(json, "planes", removed.planes, first);
+			addCount(json, "nodes", removed.nodes, first);
+			addCount(json, "clipnodes", removed.clipnodes, first);
+			addCount(json, "leaves", removed.leaves, first);
+			addCount(json, "faces", removed.faces, first);
+			json << "}";
+		}
+
+		delete map;
+	}
+
+	if (!loaded) {
+		vector<string> lines = getLogLines(log);
+		json << ",\"error\":" << jsonString(lines.size() ? lines[0] : "failed to load");
+	}
+
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+	json << ",\"ok\":" << (loaded ? "true" : "false") << ",\"seconds\":" << seconds << "}";
+
+	return json.str();
+}
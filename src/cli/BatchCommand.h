@@ -0,0 +1,46 @@
+#pragma once
+#include "types.h"
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+
+class Bsp;
+class Wad;
+
+// Runs one read-only operation over many maps on the shared thread pool.
+// Prints one JSON object per map to stdout as soon as the map finishes. Maps are freed
+// after they're processed, so memory use depends on the thread count, not the map count.
+class BatchCommand {
+public:
+	// op is one of: info, validate, limits, hulls
+	BatchCommand(std::string op);
+
+	// frees the cached WADs
+	~BatchCommand();
+
+	// true if op is a known operation
+	static bool isValidOp(std::string op);
+
+	// returns the maps in a directory, or the files matching a pattern like "maps/*.bsp".
+	// Wildcards (* and ?) are only allowed in the file name and are case-insensitive.
+	static std::vector<std::string> findMaps(std::string pattern);
+
+	// returns the number of maps that failed to load
+	int run(const std::vector<std::string>& mapPaths);
+
+private:
+	std::string op;
+
+	// WADs are shared by most maps on a server, so each one is only read once per run.
+	// NULL if the WAD was missing or unreadable.
+	std::mutex wadMutex;
+	std::unordered_map<std::string, Wad*> wadCache; // keyed by lowercase WAD name
+
+	std::mutex outputMutex;
+
+	// loads the map, runs the operation, and returns the JSON record
+	std::string processMap(const std::string& path, bool& loaded);
+
+	std::vector<Wad*> getWads(Bsp* map, std::vector<std::string>& missingWads);
+};
@@ -0,0 +1,326 @@
+#include "BenchCommand.h"
+#include "Bsp.h"
+#include "VisCuller.h"
+#include "ClipnodeMeshBuilder.h"
+#include "FaceMeshBuilder.h"
+#include "Bvh.h"
+#include "util.h"
+#include "globals.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <chrono>
+#include <float.h>
+#include <string.h>
+#include <stdlib.h>
+
+BenchCommand::BenchCommand(string op, int samples) {
+	this->op = op;
+	this->samples = max(1, samples);
+}
+
+bool BenchCommand::isValidOp(string op) {
+	return op == "cull" || op == "pick" || op == "clipnodes" || op == "solids";
+}
+
+int BenchCommand::run(Bsp* map) {
+	if (op == "cull") {
+		return benchCulling(map);
+	}
+	else if (op == "pick") {
+		return benchPicking(map);
+	}
+	else if (op == "clipnodes") {
+		return benchClipnodes(map);
+	}
+	else if (op == "solids") {
+		return benchSolids(map);
+	}
+
+	logf("ERROR: unknown operation '%s'\n", op.c_str());
+	return 1;
+}
+
+int BenchCommand::benchCulling(Bsp* map) {
+	// same view as the editor's defaults
+	const float aspect = 16.0f / 9.0f;
+	const float fov = 75.0f;
+	const float zFar = 262144.0f;
+
+	if (map->modelCount <= 0 || map->leafCount <= 1) {
+		logf("ERROR: the map has no world leaves\n");
+		return 1;
+	}
+
+	// cameras go in empty leaves that have vis data, like a player would be
+	vector<int> cameraLeaves;
+	for (int i = 1; i <= map->models[0].nVisLeafs && i < map->leafCount; i++) {
+		if (map->leaves[i].nContents != CONTENTS_SOLID) {
+			cameraLeaves.push_back(i);
+		}
+	}
+	if (cameraLeaves.empty()) {
+		logf("ERROR: the map has no empty leaves to place cameras in\n");
+		return 1;
+	}
+
+	// same positions every run, so results can be compared between builds
+	srand(1);
+
+	VisCuller culler(map);
+	VisibleSet visible;
+	double totalTime = 0;
+	double maxTime = 0;
+	int64_t totalFaces = 0;
+	int64_t totalEnts = 0;
+	int64_t totalPvsLeaves = 0;
+	int64_t totalDrawnLeaves = 0;
+
+	for (int i = 0; i < samples; i++) {
+		BSPLEAF& leaf = map->leaves[cameraLeaves[rand() % cameraLeaves.size()]];
+		vec3 mins = vec3(leaf.nMins[0], leaf.nMins[1], leaf.nMins[2]);
+		vec3 maxs = vec3(leaf.nMaxs[0], leaf.nMaxs[1], leaf.nMaxs[2]);
+		vec3 origin = (mins + maxs) * 0.5f;
+		vec3 angles = vec3((rand() % 120) - 60.0f, 0, (float)(rand() % 360));
+
+		culler.cull(origin, angles, aspect, fov, zFar, visible);
+
+		totalTime += visible.cullTime;
+		maxTime = max(maxTime, visible.cullTime);
+		totalFaces += visible.faces.size();
+		totalEnts += visible.ents.size();
+		totalPvsLeaves += visible.pvsLeaves;
+		totalDrawnLeaves += visible.drawnLeaves;
+	}
+
+	int worldFaces = map->models[0].nFaces;
+	double avgFaces = totalFaces / (double)samples;
+
+	logf("Culled %d views of %s:\n", samples, map->name.c_str());
+	logf("    Visible world faces : %.1f of %d (%.1f%%)\n", avgFaces, worldFaces,
+		worldFaces ? avgFaces / worldFaces * 100.0 : 0.0);
+	logf("    Visible brush ents  : %.1f\n", totalEnts / (double)samples);
+	logf("    PVS leaves          : %.1f (%.1f in view)\n", totalPvsLeaves / (double)samples,
+		totalDrawnLeaves / (double)samples);
+	logf("    Cull time           : %.3f ms average, %.3f ms max\n", totalTime / samples * 1000.0, maxTime * 1000.0);
+
+	return 0;
+}
+
+static bool meshesEqual(const ClipnodeMesh& a, const ClipnodeMesh& b) {
+	return a.leafCount == b.leafCount &&
+		a.faceVerts.size() == b.faceVerts.size() &&
+		a.wireframeVerts.size() == b.wireframeVerts.size() &&
+		a.faceMaths.size() == b.faceMaths.size() &&
+		(a.faceVerts.empty() || !memcmp(&a.faceVerts[0], &b.faceVerts[0], a.faceVerts.size() * sizeof(cVert))) &&
+		(a.wireframeVerts.empty() || !memcmp(&a.wireframeVerts[0], &b.wireframeVerts[0], a.wireframeVerts.size() * sizeof(cVert)));
+}
+
+// returns the number of meshes that don't match a mesh generated without the cache
+static int countMeshMismatches(Bsp* map, const vector<int>& modelIdxs, const vector<shared_ptr<const ClipnodeMesh>>& meshes) {
+	int mismatches = 0;
+
+	for (int i = 0; i < meshes.size(); i++) {
+		int modelIdx = modelIdxs[i / MAX_MAP_HULLS];
+		int hull = i % MAX_MAP_HULLS;
+
+		ClipnodeMesh expected;
+		ClipnodeMeshBuilder::generate(map, modelIdx, hull, expected);
+
+		if (!meshes[i] || !meshesEqual(*meshes[i], expected)) {
+			logf("    Model %d hull %d doesn't match the uncached mesh\n", modelIdx, hull);
+			mismatches++;
+		}
+	}
+
+	return mismatches;
+}
+
+int BenchCommand::benchClipnodes(Bsp* map) {
+	vector<int> modelIdxs;
+	for (int i = 0; i < map->modelCount; i++) {
+		modelIdxs.push_back(i);
+	}
+
+	ClipnodeMeshBuilder builder;
+	const char* passNames[3] = { "Cold build", "Cached build", "Moved planes" };
+	int mismatches = 0;
+
+	logf("Built clipnode meshes for %d models of %s:\n", map->modelCount, map->name.c_str());
+
+	for (int pass = 0; pass < 3; pass++) {
+		if (pass == 2) {
+			// the map is thrown away after this, so it's ok to modify it. Every hull now has the
+			// same layout as before but different planes, so nothing should come from the cache.
+			for (int i = 0; i < map->planeCount; i++) {
+				map->planes[i].fDist += 16.0f;
+			}
+		}
+
+		ClipnodeMeshStats before = builder.getStats();
+		auto startTime = chrono::steady_clock::now();
+		vector<shared_ptr<const ClipnodeMesh>> meshes = builder.build(map, modelIdxs);
+		double seconds = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+		ClipnodeMeshStats after = builder.getStats();
+
+		logf("    %-13s: %8.2f ms, %d built, %d from the cache\n", passNames[pass], seconds * 1000.0,
+			after.built - before.built, after.cacheHits - before.cacheHits);
+
+		mismatches += countMeshMismatches(map, modelIdxs, meshes);
+	}
+
+	if (mismatches) {
+		logf("ERROR: %d meshes didn't match\n", mismatches);
+		return 1;
+	}
+
+	return 0;
+}
+
+struct PickTarget {
+	vector<FaceMath> faces;
+	Bvh bvh;
+};
+
+static float randomFloat(float min, float max) {
+	return min + (rand() / (float)RAND_MAX) * (max - min);
+}
+
+int BenchCommand::benchPicking(Bsp* map) {
+	// every model's faces, and every hull of every model. Brush entities are tested in model space.
+	vector<PickTarget> targets(map->modelCount * MAX_MAP_HULLS);
+
+	g_thread_pool->parallelFor(targets.size(), [&](int i) {
+		int modelIdx = i / MAX_MAP_HULLS;
+		int hull = i % MAX_MAP_HULLS;
+		PickTarget& target = targets[i];
+
+		if (hull == 0) {
+			BSPMODEL& model = map->models[modelIdx];
+			if (model.iFirstFace >= 0 && model.iFirstFace + model.nFaces <= map->faceCount) {
+				target.faces.resize(model.nFaces);
+				for (int k = 0; k < model.nFaces; k++) {
+					FaceMeshBuilder::calcFaceMath(map, model.iFirstFace + k, target.faces[k]);
+				}
+			}
+		}
+		else {
+			ClipnodeMesh mesh;
+			ClipnodeMeshBuilder::generate(map, modelIdx, hull, mesh);
+			target.faces = mesh.faceMaths;
+		}
+
+		if (!target.faces.empty()) {
+			FaceMeshBuilder::buildFaceMathBvh(target.bvh, &target.faces[0], target.faces.size(), false);
+		}
+	});
+
+	// rays are aimed at face centers, so most of them hit something
+	vector<vec3> aimPoints;
+	for (int i = 0; i < targets.size(); i++) {
+		for (int k = 0; k < targets[i].faces.size(); k++) {
+			aimPoints.push_back(getCenter(targets[i].faces[k].verts));
+		}
+	}
+	if (aimPoints.empty()) {
+		logf("ERROR: the map has no faces or clipnodes to pick\n");
+		return 1;
+	}
+
+	// same rays every run, so results can be compared between builds
+	srand(1);
+
+	double bvhTime = 0;
+	double linearTime = 0;
+	int64_t hits = 0;
+	int mismatches = 0;
+
+	for (int i = 0; i < samples; i++) {
+		vec3 aim = aimPoints[rand() % aimPoints.size()];
+		vec3 dir = vec3(randomFloat(-1, 1), randomFloat(-1, 1), randomFloat(-1, 1)).normalize();
+		vec3 start = aim - dir * randomFloat(64.0f, 4096.0f);
+
+		for (int t = 0; t < targets.size(); t++) {
+			PickTarget& target = targets[t];
+			if (target.faces.empty()) {
+				continue;
+			}
+
+			float bvhDist = FLT_MAX;
+			int bvhFace = -1;
+			auto bvhStart = chrono::steady_clock::now();
+			target.bvh.raycast(start, dir, bvhDist, [&](int k, float& dist) {
+				if (FaceMeshBuilder::pickFaceMath(start, dir, target.faces[k], dist)) {
+					bvhFace = k;
+				}
+			});
+			auto linearStart = chrono::steady_clock::now();
+
+			float linearDist = FLT_MAX;
+			int linearFace = -1;
+			for (int k = 0; k < target.faces.size(); k++) {
+				if (FaceMeshBuilder::pickFaceMath(start, dir, target.faces[k], linearDist)) {
+					linearFace = k;
+				}
+			}
+			auto linearEnd = chrono::steady_clock::now();
+
+			bvhTime += chrono::duration<double>(linearStart - bvhStart).count();
+			linearTime += chrono::duration<double>(linearEnd - linearStart).count();
+			hits += linearFace != -1;
+
+			// faces can tie, so only the distance has to match
+			if ((bvhFace == -1) != (linearFace == -1) || bvhDist != linearDist) {
+				if (mismatches < 10) {
+					logf("    Ray %d, model %d hull %d: tree hit face %d at %f, scan hit face %d at %f\n",
+						i, t / MAX_MAP_HULLS, t % MAX_MAP_HULLS, bvhFace, bvhDist, linearFace, linearDist);
+				}
+				mismatches++;
+			}
+		}
+	}
+
+	logf("Picked %d rays against %d models of %s:\n", samples, map->modelCount, map->name.c_str());
+	logf("    Hits         : %lld\n", (long long)hits);
+	logf("    Tree time    : %.3f ms average\n", bvhTime / samples * 1000.0);
+	logf("    Scan time    : %.3f ms average\n", linearTime / samples * 1000.0);
+
+	if (mismatches) {
+		logf("ERROR: %d picks didn't match testing every face\n", mismatches);
+		return 1;
+	}
+
+	return 0;
+}
+
+int BenchCommand::benchSolids(Bsp* map) {
+	int oldModelCount = map->modelCount;
+	int oldFaceCount = map->faceCount;
+	int oldClipnodeCount = map->clipnodeCount;
+
+	// same boxes every run, so results can be compared between builds
+	srand(1);
+
+	auto startTime = chrono::steady_clock::now();
+
+	for (int i = 0; i < samples; i++) {
+		vec3 origin = vec3(randomFloat(-4096, 4096), randomFloat(-4096, 4096), randomFloat(-4096, 4096));
+		vec3 size = vec3(randomFloat(8, 256), randomFloat(8, 256), randomFloat(8, 256));
+		map->create_solid(origin - size, origin + size, 0);
+	}
+
+	double totalTime = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+
+	logf("Created %d solids in %s:\n", samples, map->name.c_str());
+	logf("    Models       : %d -> %d\n", oldModelCount, map->modelCount);
+	logf("    Faces        : %d -> %d\n", oldFaceCount, map->faceCount);
+	logf("    Clipnodes    : %d -> %d\n", oldClipnodeCount, map->clipnodeCount);
+	logf("    Total time   : %.3f ms\n", totalTime * 1000.0);
+	logf("    Per solid    : %.3f ms average\n", totalTime / samples * 1000.0);
+
+	if (map->modelCount != oldModelCount + samples) {
+		logf("ERROR: expected %d new models\n", samples);
+		return 1;
+	}
+
+	return 0;
+}
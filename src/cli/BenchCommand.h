@@ -0,0 +1,38 @@
+#pragma once
+#include <string>
+
+class Bsp;
+
+// Runs the editor's CPU-side culling, picking, and mesh building code on a map without opening a
+// window, so it can be timed and checked on machines without a GPU. Results are printed as text.
+class BenchCommand {
+public:
+	// op is one of: cull, pick, clipnodes, solids
+	// samples is the number of camera positions, rays, or solids to test. Not used by clipnodes.
+	BenchCommand(std::string op, int samples);
+
+	// true if op is a known operation
+	static bool isValidOp(std::string op);
+
+	// returns 0 if the operation ran and its checks passed
+	int run(Bsp* map);
+
+private:
+	std::string op;
+	int samples;
+
+	// culls the world from cameras placed in random leaves, looking in random directions
+	int benchCulling(Bsp* map);
+
+	// picks faces and clipnodes with rays aimed at random faces, and checks that the picking trees
+	// find the same hits as testing every face
+	int benchPicking(Bsp* map);
+
+	// builds every clipnode mesh cold, then from the cache, then after moving all planes, and
+	// checks that each result matches a mesh generated without the cache
+	int benchClipnodes(Bsp* map);
+
+	// adds box models to the map one at a time, the way the editor creates them. The map is
+	// only changed in memory.
+	int benchSolids(Bsp* map);
+};
@@ -2,11 +2,53 @@
 #include "util.h"
 
 CommandLine::CommandLine(int argc, char* argv[]) {
+	parse(vector<string>(argv, argv + argc));
+}
+
+CommandLine::CommandLine(const string& line) {
+	vector<string> args = splitArgs(line);
+	args.insert(args.begin(), "bspguy");
+	parse(args);
+}
+
+CommandLine::CommandLine(const vector<string>& args) {
+	parse(args);
+}
+
+vector<string> CommandLine::splitArgs(const string& line) {
+	vector<string> args;
+	string arg;
+	bool quoted = false;
+	bool hasArg = false;
+
+	for (int i = 0; i <= line.size(); i++) {
+		char c = i < line.size() ? line[i] : ' ';
+
+		if (c == '"') {
+			quoted = !quoted;
+			hasArg = true;
+		}
+		else if (!quoted && isspace((unsigned char)c)) {
+			if (hasArg) {
+				args.push_back(arg);
+			}
+			arg.clear();
+			hasArg = false;
+		}
+		else {
+			arg += c;
+			hasArg = true;
+		}
+	}
+
+	return args;
+}
 
+void CommandLine::parse(const vector<string>& args) {
 	askingForHelp = false;
-	for (int i = 0; i < argc; i++)
+	for (int i = 0; i < args.size(); i++)
 	{
-		string arg = argv[i];
+		string arg = args[i];
 		string larg = toLowerCase(arg);
 
 		if (i == 1) {
@@ -1,8 +1,11 @@
+#pragma once
 #include "types.h"
 #include <string>
 #include <vector>
 #include <map>
 
+class Bsp;
+
 class CommandLine {
 public:
 	string command;
@@ -12,6 +15,15 @@ public:
 
 	CommandLine(int argc, char* argv[]);
 
+	// parses a line like "noclip map.bsp -hull 2". Quoted arguments may contain spaces.
+	CommandLine(const string& line);
+
+	// args[0] is the program name
+	CommandLine(const vector<string>& args);
+
+	// splits a line into arguments, like a shell would. Quoted arguments may contain spaces.
+	static vector<string> splitArgs(const string& line);
+
 	bool hasOption(string optionName);
 	bool hasOptionVector(string optionName);
 
@@ -22,4 +34,21 @@ public:
 
 private:
 	map<string,string> optionVals;
-};
\ No newline at end of file
+
+	// args[0] is the program name
+	void parse(const vector<string>& args);
+};
+
+// a command that works on a map that's already loaded, like noclip or transform
+struct MapCommand {
+	const char* name;
+	int (*func)(Bsp* map, CommandLine& cli); // returns 0 on success
+	int (*checkOptions)(CommandLine& cli); // validates options before unused data is deleted. Can be NULL.
+	bool edits; // the map needs to be written afterwards
+	bool cleanFirst; // delete unused data before running this, so the command reports accurate results
+	bool printInfo; // print the map summary after writing it
+};
+
+// deletes unused data and logs what was removed. Returns true if anything was deleted.
+// Defined in main.cpp.
+bool remove_unused_data(Bsp* map);
\ No newline at end of file
@@ -0,0 +1,297 @@
+#include "MapServer.h"
+#include "CommandLine.h"
+#include "Bsp.h"
+#include "util.h"
+#include <chrono>
+#include <sstream>
+#include <iostream>
+#include <stdio.h>
+
+#ifndef WIN32
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <signal.h>
+#endif
+
+static double secondsSince(chrono::steady_clock::time_point start) {
+	return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+static string mapKey(string path) {
+	if (path.size() < 4 || toLowerCase(path).rfind(".bsp") != path.size() - 4) {
+		path += ".bsp";
+	}
+	return path;
+}
+
+#ifndef WIN32
+// deletes a socket left over from a server that didn't shut down cleanly. Anything else at
+// the path is left alone. Returns false if the path is in use by something that isn't a socket.
+static bool removeOldSocket(const string& path) {
+	struct stat info;
+	if (lstat(path.c_str(), &info) != 0) {
+		return true; // nothing there
+	}
+	if (!S_ISSOCK(info.st_mode)) {
+		return false;
+	}
+	unlink(path.c_str());
+	return true;
+}
+#endif
+
+MapServer::MapServer(MapCommand* commands, int numCommands) {
+	this->commands = commands;
+	this->numCommands = numCommands;
+}
+
+MapServer::~MapServer() {
+	for (auto& item : maps) {
+		delete item.second.map;
+	}
+}
+
+int MapServer::run(string endpoint) {
+	if (endpoint == "stdio" || endpoint == "-") {
+		return serveStdio();
+	}
+	return serveSocket(endpoint);
+}
+
+int MapServer::serveStdio() {
+	string line;
+	bool quit = false;
+
+	while (!quit && getline(cin, line)) {
+		if (trimSpaces(line).empty()) {
+			continue;
+		}
+
+		string reply = handle(line, quit) + "\n";
+		fwrite(reply.c_str(), 1, reply.size(), stdout);
+		fflush(stdout);
+	}
+
+	return 0;
+}
+
+int MapServer::serveSocket(string path) {
+#ifdef WIN32
+	logf("ERROR: Unix sockets aren't supported on Windows. Use \"stdio\" instead.\n");
+	return 1;
+#else
+	sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+
+	if (path.size() >= sizeof(addr.sun_path)) {
+		logf("ERROR: socket path is too long: %s\n", path.c_str());
+		return 1;
+	}
+	strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+	if (!removeOldSocket(path)) {
+		logf("ERROR: %s already exists and isn't a socket\n", path.c_str());
+		return 1;
+	}
+
+	int server = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (server < 0) {
+		logf("ERROR: failed to create socket\n");
+		return 1;
+	}
+
+	// only the current user can connect. Commands can overwrite any file the server can write to.
+	mode_t oldMask = umask(0077);
+	bool bound = bind(server, (sockaddr*)&addr, sizeof(addr)) == 0;
+	umask(oldMask);
+
+	if (!bound || listen(server, 4) < 0) {
+		logf("ERROR: failed to listen on %s\n", path.c_str());
+		close(server);
+		return 1;
+	}
+
+	// a client disconnecting before reading its reply shouldn't kill the server
+	signal(SIGPIPE, SIG_IGN);
+
+	logf("Listening on %s\n", path.c_str());
+
+	bool quit = false;
+	while (!quit) {
+		int client = accept(server, NULL, NULL);
+		if (client < 0) {
+			continue;
+		}
+
+		string pending;
+		char buffer[4096];
+		ssize_t len;
+
+		// one client at a time. Commands edit shared maps, so they can't run in parallel anyway.
+		while (!quit && (len = read(client, buffer, sizeof(buffer))) > 0) {
+			pending.append(buffer, len);
+
+			size_t end;
+			while (!quit && (end = pending.find('\n')) != string::npos) {
+				string line = pending.substr(0, end);
+				pending.erase(0, end + 1);
+
+				if (trimSpaces(line).empty()) {
+					continue;
+				}
+
+				string reply = handle(line, quit) + "\n";
+				for (size_t sent = 0; sent < reply.size(); ) {
+					ssize_t n = write(client, reply.c_str() + sent, reply.size() - sent);
+					if (n <= 0) {
+						break;
+					}
+					sent += n;
+				}
+			}
+		}
+
+		close(client);
+	}
+
+	close(server);
+	removeOldSocket(path);
+
+	return 0;
+#endif
+}
+
+MapServer::ResidentMap* MapServer::getMap(string path, double& loadTime) {
+	string key = mapKey(path);
+	loadTime = 0;
+
+	auto loaded = maps.find(key);
+	if (loaded != maps.end()) {
+		return &loaded->second;
+	}
+
+	auto loadStart = chrono::steady_clock::now();
+	Bsp* map = new Bsp(key);
+	loadTime = secondsSince(loadStart);
+
+	if (!map->valid) {
+		delete map;
+		return NULL;
+	}
+
+	ResidentMap& resident = maps[key];
+	resident.map = map;
+	resident.cleaned = false;
+	resident.modified = false;
+
+	return &resident;
+}
+
+string MapServer::handle(const string& line, bool& quit) {
+	auto startTime = chrono::steady_clock::now();
+
+	string log;
+	ScopedLogCapture capture(log);
+
+	CommandLine cli(line);
+	bool ok = true;
+	double loadTime = 0;
+	double writeTime = 0;
+	bool wasResident = maps.count(mapKey(cli.bspfile)) != 0;
+
+	MapCommand* command = NULL;
+	for (int i = 0; i < numCommands && !command; i++) {
+		if (cli.command == commands[i].name) {
+			command = &commands[i];
+		}
+	}
+
+	if (cli.command == "quit") {
+		quit = true;
+	}
+	else if (cli.command == "list") {
+		for (auto& item : maps) {
+			logf("%s%s\n", item.first.c_str(), item.second.modified ? " (modified)" : "");
+		}
+	}
+	else if (cli.bspfile.empty()) {
+		logf("ERROR: no map specified\n");
+		ok = false;
+	}
+	else if (cli.command == "close") {
+		auto item = maps.find(mapKey(cli.bspfile));
+		if (item != maps.end()) {
+			delete item->second.map;
+			maps.erase(item);
+		}
+		else {
+			logf("ERROR: %s isn't loaded\n", cli.bspfile.c_str());
+			ok = false;
+		}
+	}
+	else if (command || cli.command == "save") {
+		ResidentMap* resident = getMap(cli.bspfile, loadTime);
+
+		if (!resident) {
+			ok = false;
+		}
+		else {
+			if (command) {
+				ok = !command->checkOptions || command->checkOptions(cli) == 0;
+
+				if (ok && command->cleanFirst && !resident->cleaned) {
+					resident->modified |= remove_unused_data(resident->map);
+					resident->cleaned = true;
+				}
+
+				if (ok) {
+					ok = command->func(resident->map, cli) == 0;
+
+					// even if it failed, the command may have edited the map before stopping
+					resident->modified |= command->edits;
+				}
+			}
+
+			if (ok && (cli.command == "save" || cli.hasOption("-o"))) {
+				auto writeStart = chrono::steady_clock::now();
+
+				if (resident->map->isValid()) {
+					string outPath = cli.hasOption("-o") ? cli.getOption("-o") : resident->map->path;
+					resident->map->write(outPath);
+
+					// writing a copy doesn't save the edits to the loaded map's file
+					if (outPath == resident->map->path) {
+						resident->modified = false;
+					}
+				}
+				else {
+					ok = false;
+				}
+
+				writeTime = secondsSince(writeStart);
+			}
+		}
+	}
+	else {
+		logf("ERROR: unrecognized command: %s\n", cli.command.c_str());
+		ok = false;
+	}
+
+	stringstream json;
+	json << "{\"command\":" << jsonString(cli.command);
+	if (!cli.bspfile.empty()) {
+		json << ",\"map\":" << jsonString(cli.bspfile);
+		json << ",\"resident\":" << (wasResident ? "true" : "false");
+	}
+	json << ",\"ok\":" << (ok ? "true" : "false");
+	json << ",\"load_seconds\":" << loadTime;
+	json << ",\"write_seconds\":" << writeTime;
+	json << ",\"seconds\":" << secondsSince(startTime);
+	json << ",\"output\":" << jsonStringList(getLogLines(log));
+	json << "}";
+
+	return json.str();
+}
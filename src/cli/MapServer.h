@@ -0,0 +1,48 @@
+#pragma once
+#include <string>
+#include <map>
+
+class Bsp;
+struct MapCommand;
+
+// Keeps maps loaded between commands, so a pipeline that makes many small edits to the
+// same map only pays for loading it once. Reads one command per line from stdin or a
+// Unix socket and replies with one JSON object per line. Maps are only written on request.
+//
+// Map commands use the normal command line syntax ("noclip c1a0.bsp -hull 2") and write
+// the map only if -o is given. Other commands:
+//   save <map> [-o <path>]  : write the map
+//   close <map>             : unload the map. Unsaved edits are lost.
+//   list                    : list the loaded maps
+//   quit                    : stop the server
+class MapServer {
+public:
+	MapServer(MapCommand* commands, int numCommands);
+
+	// unloads all maps
+	~MapServer();
+
+	// endpoint is the path to a Unix socket, or "stdio" to use stdin/stdout.
+	// Returns when a quit command is received, or stdin is closed.
+	int run(std::string endpoint);
+
+	// runs a single command line and returns the reply. Sets quit if the server should stop.
+	std::string handle(const std::string& line, bool& quit);
+
+private:
+	struct ResidentMap {
+		Bsp* map;
+		bool cleaned; // unused data was deleted
+		bool modified; // has edits that weren't saved
+	};
+
+	MapCommand* commands;
+	int numCommands;
+	std::map<std::string, ResidentMap> maps; // keyed by the path used to load the map
+
+	int serveStdio();
+	int serveSocket(std::string path);
+
+	// returns the loaded map, loading it first if needed. NULL if the map couldn't be loaded.
+	ResidentMap* getMap(std::string path, double& loadTime);
+};
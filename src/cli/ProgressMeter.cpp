@@ -9,6 +9,9 @@ ProgressMeter::ProgressMeter() {
 }
 
 void ProgressMeter::update(const char* newTitle, int totalProgressTicks) {
+	if (isLogCaptured()) {
+		return;
+	}
 	progress_title = newTitle;
 	progress = 0;
 	progress_total = totalProgressTicks;
@@ -18,7 +21,7 @@ void ProgressMeter::update(const char* newTitle, int totalProgressTicks) {
 }
 
 void ProgressMeter::tick() {
-	if (progress_title[0] == '\0' || simpleMode || hide) {
+	if (progress_title[0] == '\0' || simpleMode || hide || isLogCaptured()) {
 		return;
 	}
 	if (progress++ > 0) {
@@ -37,7 +40,7 @@ void ProgressMeter::tick() {
 }
 
 void ProgressMeter::clear() {
-	if (simpleMode || hide) {
+	if (simpleMode || hide || isLogCaptured()) {
 		return;
 	}
 	// 50 chars
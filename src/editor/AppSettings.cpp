@@ -40,7 +40,7 @@ void AppSettings::loadDefault()
 
 	render_flags = g_render_flags = RENDER_TEXTURES | RENDER_LIGHTMAPS | RENDER_SPECIAL
 		| RENDER_ENTS | RENDER_SPECIAL_ENTS | RENDER_POINT_ENTS | RENDER_WIREFRAME | RENDER_ENT_CONNECTIONS
-		| RENDER_ENT_CLIPNODES;
+		| RENDER_ENT_CLIPNODES | RENDER_VIS_CULLING;
 
 	vsync = true;
 
@@ -25,6 +25,9 @@ public:
 	BaseRenderer() { loadState = 0; valid = false; }
 	virtual ~BaseRenderer() {}
 
+	// parse the file. Called by a ModelLoader thread, so no OpenGL calls.
+	virtual void loadData() = 0;
+
 	virtual void upload() = 0;
 
 	// get intersection of pick ray and model polygon
@@ -5,6 +5,7 @@
 #include "lodepng.h"
 #include "Renderer.h"
 #include "Clipper.h"
+#include "ClipnodeMeshBuilder.h"
 #include "Polygon3D.h"
 #include "NavMeshGenerator.h"
 #include "LeafNavMeshGenerator.h"
@@ -15,9 +16,12 @@
 #include "NavMesh.h"
 #include "Entity.h"
 #include "Wad.h"
+#include "TextureDecoder.h"
 #include "util.h"
 #include "ShaderProgram.h"
 #include "globals.h"
+#include "Trace.h"
+#include "ThreadPool.h"
 #include <iomanip>
 #include <set>
 #include <fstream>
@@ -40,6 +44,7 @@ BspRenderer::BspRenderer(Bsp* map, ShaderProgram* bspShader, ShaderProgram* full
 	renderEnts = NULL;
 	renderModels = NULL;
 	faceMaths = NULL;
+	visCuller = new VisCuller(map, &entIndex);
 
 	whiteTex = new Texture(1, 1);
 	greyTex = new Texture(1, 1);
@@ -73,6 +78,7 @@ BspRenderer::BspRenderer(Bsp* map, ShaderProgram* bspShader, ShaderProgram* full
 	calcFaceMaths();
 	preRenderFaces();
 	preRenderEnts();
+	visGeometryHash = hashWorldGeometry();
 
 	bspShader->bind();
 
@@ -106,23 +112,16 @@ BspRenderer::BspRenderer(Bsp* map, ShaderProgram* bspShader, ShaderProgram* full
 }
 
 void BspRenderer::loadTextures() {
+	TRACE_SCOPE("BspRenderer::loadTextures");
 	for (int i = 0; i < wads.size(); i++) {
 		delete wads[i];
 	}
 	wads.clear();
 
 	vector<string> wadNames = map->get_wad_names();
-	vector<string> tryPaths = getAssetPaths();
 
 	for (int i = 0; i < wadNames.size(); i++) {
-		string path;
-		for (int k = 0; k < tryPaths.size(); k++) {
-			string tryPath = tryPaths[k] + wadNames[i];
-			if (fileExists(tryPath)) {
-				path = tryPath;
-				break;
-			}
-		}
+		string path = findAsset(wadNames[i]);
 
 		if (path.empty()) {
 			logf("Missing WAD: %s\n", wadNames[i].c_str());
@@ -136,77 +135,28 @@ void BspRenderer::loadTextures() {
 		wads.push_back(wad);
 	}
 
-	int wadTexCount = 0;
-	int missingCount = 0;
-	int embedCount = 0;
+	TextureDecoder decoder;
+	vector<DecodedTexture> decoded = decoder.decodeMapTextures(map, wads);
 
 	glTexturesSwap = new Texture * [map->textureCount];
 	for (int i = 0; i < map->textureCount; i++) {
-		int32_t texOffset = ((int32_t*)map->textures)[i + 1];
-		if (texOffset == -1) {
+		DecodedTexture& tex = decoded[i];
+
+		if (!tex.data) {
 			glTexturesSwap[i] = missingTex;
 			continue;
 		}
-		BSPMIPTEX& tex = *((BSPMIPTEX*)(map->textures + texOffset));
-
-		COLOR3* palette;
-		byte* src;
-		WADTEX* wadTex = NULL;
-
-		int lastMipSize = (tex.nWidth / 8) * (tex.nHeight / 8);
-
-		if (tex.nOffsets[0] <= 0) {
-
-			bool foundInWad = false;
-			for (int k = 0; k < wads.size(); k++) {
-				if (wads[k]->hasTexture(tex.szName)) {
-					foundInWad = true;
-
-					wadTex = wads[k]->readTexture(tex.szName);
-					palette = (COLOR3*)(wadTex->data + wadTex->nOffsets[3] + lastMipSize + 2 - 40);
-					src = wadTex->data;
-
-					wadTexCount++;
-					break;
-				}
-			}
-
-			if (!foundInWad) {
-				glTexturesSwap[i] = missingTex;
-				missingCount++;
-				continue;
-			}
-		}
-		else {
-			palette = (COLOR3*)(map->textures + texOffset + tex.nOffsets[3] + lastMipSize + 2);
-			src = map->textures + texOffset + tex.nOffsets[0];
-			embedCount++;
-		}
-
-		COLOR3* imageData = new COLOR3[tex.nWidth * tex.nHeight];
-
-		int sz = tex.nWidth * tex.nHeight;
-		
-		for (int k = 0; k < sz; k++) {
-			imageData[k] = palette[src[k]];
-		}
 
-		if (wadTex) {
-			delete[] wadTex->data;
-			delete wadTex;
+		Texture* glTex = new Texture(tex.width, tex.height, tex.data);
+		for (int m = 0; m < tex.numMips; m++) {
+			glTex->mips[m] = tex.mips[m];
 		}
-
-		// map->textures + texOffset + tex.nOffsets[0]
-
-		glTexturesSwap[i] = new Texture(tex.nWidth, tex.nHeight, imageData);
+		glTex->numMips = tex.numMips;
+		glTexturesSwap[i] = glTex;
 	}
 
-	if (wadTexCount)
-		debugf("Loaded %d wad textures\n", wadTexCount);
-	if (embedCount)
-		debugf("Loaded %d embedded textures\n", embedCount);
-	if (missingCount)
-		debugf("%d missing textures\n", missingCount);
+	textureStats = decoder.stats;
+	textureStats.print();
 }
 
 void BspRenderer::reload() {
@@ -217,6 +167,10 @@ void BspRenderer::reload() {
 	reloadTextures();
 	reloadLightmaps();
 	reloadClipnodes();
+
+	// commands that reload the whole map keep the leaves in sync with the faces, or restore both
+	visGeometryHash = hashWorldGeometry();
+	worldEdited = false;
 }
 
 void BspRenderer::reloadTextures() {
@@ -251,6 +205,7 @@ void BspRenderer::addClipnodeModel(int modelIdx) {
 	renderClipnodes = newRenderClipnodes;
 	
 	generateClipnodeBuffer(modelIdx);
+	invalidateModelPicking(modelIdx, true);
 }
 
 void BspRenderer::updateModelShaders() {
@@ -266,6 +221,7 @@ void BspRenderer::updateModelShaders() {
 }
 
 void BspRenderer::loadLightmaps() {
+	TRACE_SCOPE("BspRenderer::loadLightmaps");
 	vector<LightmapNode*> atlases;
 	vector<Texture*> atlasTextures;
 	atlases.push_back(new LightmapNode(0, 0, LIGHTMAP_ATLAS_SIZE, LIGHTMAP_ATLAS_SIZE));
@@ -381,6 +337,7 @@ void BspRenderer::updateLightmapInfos() {
 }
 
 void BspRenderer::preRenderFaces() {
+	TRACE_SCOPE("BspRenderer::preRenderFaces");
 	deleteRenderFaces();
 
 	genRenderFaces(numRenderModels);
@@ -405,8 +362,17 @@ void BspRenderer::genRenderFaces(int& renderModelCount) {
 	int worldRenderGroups = 0;
 	int modelRenderGroups = 0;
 
+	vector<int> modelIdxs(map->modelCount);
 	for (int m = 0; m < map->modelCount; m++) {
-		int groupCount = refreshModel(m, false);
+		modelIdxs[m] = m;
+	}
+	buildRenderModels(modelIdxs);
+
+	for (int m = 0; m < map->modelCount; m++) {
+		invalidateModelPicking(m, false);
+		staleIndexModels.push_back(m);
+
+		int groupCount = renderModels[m].groupCount;
 		if (m == 0)
 			worldRenderGroups += groupCount;
 		else
@@ -500,237 +466,376 @@ void BspRenderer::deleteFaceMaths() {
 	faceMaths = NULL;
 }
 
-int BspRenderer::refreshModel(int modelIdx, bool refreshClipnodes) {
-	BSPMODEL& model = map->models[modelIdx];
-	RenderModel* renderModel = &renderModels[modelIdx];
+// extra verts allocated in each render group, so that edits which grow a face or move it to
+// another group can be applied without rebuilding the whole model
+static int getRenderGroupCapacity(int vertCount) {
+	return vertCount + vertCount / 8 + 64;
+}
 
-	deleteRenderModel(renderModel);
-	
-	renderModel->renderFaces = new RenderFace[model.nFaces];
+// true if so many verts are dead that the group should be rebuilt to free the space
+static bool needsCompacting(int deadVerts, int vertCount) {
+	return deadVerts > 64 && deadVerts > vertCount / 4;
+}
 
-	vector<RenderGroup> renderGroups;
-	vector<vector<lightmapVert>> renderGroupVerts;
-	vector<vector<lightmapVert>> renderGroupWireframeVerts;
+#define RENDER_FACE_CHUNK_SIZE 256 // faces per thread pool task when building render models
 
-	ShaderProgram* activeShader = (g_render_flags & RENDER_LIGHTMAPS) ? bspShader : fullBrightBspShader;
+static void expandDirtyRange(int& start, int& end, int offset, int count) {
+	if (count <= 0) {
+		return;
+	}
+	if (end <= start) {
+		start = offset;
+		end = offset + count;
+	}
+	else {
+		start = min(start, offset);
+		end = max(end, offset + count);
+	}
+}
 
-	for (int i = 0; i < model.nFaces; i++) {
-		int faceIdx = model.iFirstFace + i;
-		BSPFACE& face = map->faces[faceIdx];
-		BSPTEXTUREINFO& texinfo = map->texinfos[face.iTextureInfo];
-		int32_t texOffset = ((int32_t*)map->textures)[texinfo.iMiptex + 1];
+int BspRenderer::refreshModel(int modelIdx, bool refreshClipnodes) {
+	RenderModel* renderModel = &renderModels[modelIdx];
 
-		int texWidth, texHeight;
-		if (texOffset != -1) {
-			BSPMIPTEX& tex = *((BSPMIPTEX*)(map->textures + texOffset));
-			texWidth = tex.nWidth;
-			texHeight = tex.nHeight;
+	vector<int> changedFaces;
+	if (updateModelFaces(modelIdx, changedFaces)) {
+		for (int i = 0; i < changedFaces.size(); i++) {
+			refreshFace(changedFaces[i]);
 		}
-		else {
-			// missing texture
-			texWidth = 16;
-			texHeight = 16;
+	}
+	else {
+		deleteRenderModel(renderModel);
+		buildRenderModels(vector<int>(1, modelIdx));
+
+		BSPMODEL& model = map->models[modelIdx];
+		for (int i = 0; i < model.nFaces; i++) {
+			refreshFace(model.iFirstFace + i);
 		}
-		
+	}
 
-		LightmapInfo* lmap = lightmapsGenerated ? &lightmaps[faceIdx] : NULL;
+	if (refreshClipnodes) {
+		generateClipnodeBuffer(modelIdx);
+	}
 
-		lightmapVert* verts = new lightmapVert[face.nEdges];
-		int vertCount = face.nEdges;
-		Texture* lightmapAtlas[MAXLIGHTMAPS];
+	invalidateModelPicking(modelIdx, refreshClipnodes);
+	staleIndexModels.push_back(modelIdx);
 
-		float lw = 0;
-		float lh = 0;
-		if (lightmapsGenerated) {
-			lw = (float)lmap->w / (float)LIGHTMAP_ATLAS_SIZE;
-			lh = (float)lmap->h / (float)LIGHTMAP_ATLAS_SIZE;
-		}
+	if (modelIdx == 0) {
+		// moved faces keep their old leaves and marksurfaces, so the PVS would hide them wrongly.
+		// Texture and other edits that don't move anything can still be culled.
+		worldEdited = hashWorldGeometry() != visGeometryHash;
+	}
 
-		bool isSpecial = texinfo.nFlags & TEX_SPECIAL;
-		bool hasLighting = face.nStyles[0] != 255 && face.nLightmapOffset >= 0 && !isSpecial;
-		for (int s = 0; s < MAXLIGHTMAPS; s++) {
-			lightmapAtlas[s] = lightmapsGenerated ? glLightmapTextures[lmap->atlasId[s]] : NULL;
-		}
+	return renderModel->groupCount;
+}
 
-		if (isSpecial) {
-			lightmapAtlas[0] = whiteTex;
-		}
+void BspRenderer::buildRenderModels(const vector<int>& modelIdxs) {
+	TRACE_SCOPE("BspRenderer::buildRenderModels");
 
-		float opacity = isSpecial ? 0.5f : 1.0f;
+	// lay out faces in their render groups. Cheap, and must be done in face order per model
+	// so that neighboring faces stay contiguous for culled draws.
+	g_thread_pool->parallelFor(modelIdxs.size(), [&](int i) {
+		layoutRenderModel(modelIdxs[i]);
+	});
 
-		for (int e = 0; e < face.nEdges; e++) {
-			int32_t edgeIdx = map->surfedges[face.iFirstEdge + e];
-			BSPEDGE& edge = map->edges[abs(edgeIdx)];
-			int vertIdx = edgeIdx < 0 ? edge.iVertex[1] : edge.iVertex[0];
+	// generate verts in chunks, so that the world model is split across threads too.
+	// Face maths only depend on the geometry, so they're left to calcFaceMaths and refreshModel.
+	struct FaceChunk {
+		int modelIdx;
+		int start; // relative to the model's first face
+		int count;
+	};
+	vector<FaceChunk> chunks;
+	for (int i = 0; i < modelIdxs.size(); i++) {
+		int nFaces = map->models[modelIdxs[i]].nFaces;
+		for (int start = 0; start < nFaces; start += RENDER_FACE_CHUNK_SIZE) {
+			FaceChunk chunk;
+			chunk.modelIdx = modelIdxs[i];
+			chunk.start = start;
+			chunk.count = min(RENDER_FACE_CHUNK_SIZE, nFaces - start);
+			chunks.push_back(chunk);
+		}
+	}
 
-			vec3& vert = map->verts[vertIdx];
-			verts[e].x = vert.x;
-			verts[e].y = vert.z;
-			verts[e].z = -vert.y;
+	g_thread_pool->parallelFor(chunks.size(), [&](int i) {
+		FaceChunk& chunk = chunks[i];
+		RenderModel& renderModel = renderModels[chunk.modelIdx];
+		int firstFace = map->models[chunk.modelIdx].iFirstFace;
 
-			verts[e].r = 1.0f;
-			verts[e].g = 1.0f;
-			verts[e].b = 1.0f;
-			verts[e].a = isSpecial ? 0.5f : 1.0f;
+		for (int k = chunk.start; k < chunk.start + chunk.count; k++) {
+			int faceIdx = firstFace + k;
+			RenderFace& rface = renderModel.renderFaces[k];
+			RenderGroup& group = renderModel.renderGroups[rface.group];
+			LightmapInfo* lmap = lightmapsGenerated ? &lightmaps[faceIdx] : NULL;
 
-			// texture coords
-			float tw = 1.0f / (float)texWidth;
-			float th = 1.0f / (float)texHeight;
-			float fU = dotProduct(texinfo.vS, vert) + texinfo.shiftS;
-			float fV = dotProduct(texinfo.vT, vert) + texinfo.shiftT;
-			verts[e].u = fU * tw;
-			verts[e].v = fV * th;
+			FaceMeshBuilder::generate(map, faceIdx, lmap, group.verts + rface.vertOffset, group.wireframeVerts + rface.wireframeVertOffset);
+		}
+	});
 
-			// lightmap texture coords
-			if (hasLighting && lightmapsGenerated) {
-				float fLightMapU = lmap->midTexU + (fU - lmap->midPolyU) / 16.0f;
-				float fLightMapV = lmap->midTexV + (fV - lmap->midPolyV) / 16.0f;
+	// buffers are created here, but uploaded by the caller
+	ShaderProgram* activeShader = (g_render_flags & RENDER_LIGHTMAPS) ? bspShader : fullBrightBspShader;
 
-				float uu = (fLightMapU / (float)lmap->w) * lw;
-				float vv = (fLightMapV / (float)lmap->h) * lh;
+	for (int i = 0; i < modelIdxs.size(); i++) {
+		RenderModel& renderModel = renderModels[modelIdxs[i]];
 
-				float pixelStep = 1.0f / (float)LIGHTMAP_ATLAS_SIZE;
+		for (int k = 0; k < renderModel.groupCount; k++) {
+			RenderGroup& group = renderModel.renderGroups[k];
 
-				for (int s = 0; s < MAXLIGHTMAPS; s++) {
-					verts[e].luv[s][0] = uu + lmap->x[s] * pixelStep;
-					verts[e].luv[s][1] = vv + lmap->y[s] * pixelStep;
-				}
-			}
-			// set lightmap scales
-			for (int s = 0; s < MAXLIGHTMAPS; s++) {
-				verts[e].luv[s][2] = (hasLighting && face.nStyles[s] != 255) ? 1.0f : 0.0f;
-				if (isSpecial && s == 0) {
-					verts[e].luv[s][2] = 1.0f;
-				}
-			}
-		}
+			group.buffer = new VertexBuffer(activeShader, 0);
+			group.buffer->addAttribute(TEX_2F, "vTex");
+			group.buffer->addAttribute(3, GL_FLOAT, 0, "vLightmapTex0");
+			group.buffer->addAttribute(3, GL_FLOAT, 0, "vLightmapTex1");
+			group.buffer->addAttribute(3, GL_FLOAT, 0, "vLightmapTex2");
+			group.buffer->addAttribute(3, GL_FLOAT, 0, "vLightmapTex3");
+			group.buffer->addAttribute(4, GL_FLOAT, 0, "vColor");
+			group.buffer->addAttribute(POS_3F, "vPosition");
+			group.buffer->setData(group.verts, group.vertCount, group.vertCapacity);
 
+			group.wireframeBuffer = new VertexBuffer(activeShader, 0);
+			group.wireframeBuffer->addAttribute(TEX_2F, "vTex");
+			group.wireframeBuffer->addAttribute(3, GL_FLOAT, 0, "vLightmapTex0");
+			group.wireframeBuffer->addAttribute(3, GL_FLOAT, 0, "vLightmapTex1");
+			group.wireframeBuffer->addAttribute(3, GL_FLOAT, 0, "vLightmapTex2");
+			group.wireframeBuffer->addAttribute(3, GL_FLOAT, 0, "vLightmapTex3");
+			group.wireframeBuffer->addAttribute(4, GL_FLOAT, 0, "vColor");
+			group.wireframeBuffer->addAttribute(POS_3F, "vPosition");
+			group.wireframeBuffer->setData(group.wireframeVerts, group.wireframeVertCount, group.wireframeVertCapacity);
+		}
+	}
+}
 
-		// convert TRIANGLE_FAN verts to TRIANGLES so multiple faces can be drawn in a single draw call
-		int newCount = face.nEdges + max(0, face.nEdges - 3) * 2;
-		int wireframeVertCount = face.nEdges * 2;
-		lightmapVert* newVerts = new lightmapVert[newCount];
-		lightmapVert* wireframeVerts = new lightmapVert[wireframeVertCount];
+void BspRenderer::layoutRenderModel(int modelIdx) {
+	BSPMODEL& model = map->models[modelIdx];
+	RenderModel& renderModel = renderModels[modelIdx];
 
-		int idx = 0;
-		for (int k = 2; k < face.nEdges; k++) {
-			// reverse order due to coordinate system swap
-			newVerts[idx++] = verts[k];
-			newVerts[idx++] = verts[k - 1];
-			newVerts[idx++] = verts[0];	
-		}
+	renderModel.renderFaces = new RenderFace[model.nFaces];
+	renderModel.renderFaceCount = model.nFaces;
 
-		idx = 0;
-		for (int k = 0; k < face.nEdges; k++) {
-			wireframeVerts[idx++] = verts[k];
-			wireframeVerts[idx++] = verts[(k + 1) % face.nEdges];
-		}
-		for (int k = 0; k < wireframeVertCount; k++) {
-			wireframeVerts[k].luv[0][2] = 1.0f;
-			wireframeVerts[k].luv[1][2] = 0.0f;
-			wireframeVerts[k].luv[2][2] = 0.0f;
-			wireframeVerts[k].luv[3][2] = 0.0f;
-			wireframeVerts[k].r = 1.0f;
-			wireframeVerts[k].g = 1.0f;
-			wireframeVerts[k].b = 1.0f;
-			wireframeVerts[k].a = 1.0f;
-		}
+	vector<RenderGroup> renderGroups;
 
-		delete[] verts;
-		verts = newVerts;
-		vertCount = newCount;
+	for (int i = 0; i < model.nFaces; i++) {
+		int faceIdx = model.iFirstFace + i;
+		int edgeCount = map->faces[faceIdx].nEdges;
 
 		// add face to a render group (faces that share that same textures and opacity flag)
-		bool isTransparent = opacity < 1.0f;
-		int groupIdx = -1;
-		for (int k = 0; k < renderGroups.size(); k++) {
-			bool textureMatch = !texturesLoaded || renderGroups[k].texture == glTextures[texinfo.iMiptex];
-			if (textureMatch && renderGroups[k].transparent == isTransparent) {
-				bool allMatch = true;
-				for (int s = 0; s < MAXLIGHTMAPS; s++) {
-					if (renderGroups[k].lightmapAtlas[s] != lightmapAtlas[s]) {
-						allMatch = false;
-						break;
-					}
-				}
-				if (allMatch) {
-					groupIdx = k;
-					break;
-				}
-			}
-		}
+		Texture* texture;
+		Texture* lightmapAtlas[MAXLIGHTMAPS];
+		bool isTransparent;
+		getFaceGroupKey(faceIdx, texture, lightmapAtlas, isTransparent);
+
+		int groupIdx = findRenderGroup(renderGroups.data(), renderGroups.size(), texture, lightmapAtlas, isTransparent);
 
 		// add the verts to a new group if no existing one share the same properties
 		if (groupIdx == -1) {
 			RenderGroup newGroup = RenderGroup();
-			newGroup.vertCount = 0;
-			newGroup.verts = NULL;
 			newGroup.transparent = isTransparent;
-			newGroup.texture = texturesLoaded ? glTextures[texinfo.iMiptex] : greyTex;
+			newGroup.texture = texture;
 			for (int s = 0; s < MAXLIGHTMAPS; s++) {
 				newGroup.lightmapAtlas[s] = lightmapAtlas[s];
 			}
 			renderGroups.push_back(newGroup);
-			renderGroupVerts.push_back(vector<lightmapVert>());
-			renderGroupWireframeVerts.push_back(vector<lightmapVert>());
 			groupIdx = renderGroups.size() - 1;
 		}
 
-		renderModel->renderFaces[i].group = groupIdx;
-		renderModel->renderFaces[i].vertOffset = renderGroupVerts[groupIdx].size();
-		renderModel->renderFaces[i].vertCount = vertCount;
-
-		renderGroupVerts[groupIdx].insert(renderGroupVerts[groupIdx].end(), verts, verts + vertCount);
-		renderGroupWireframeVerts[groupIdx].insert(renderGroupWireframeVerts[groupIdx].end(), wireframeVerts, wireframeVerts + wireframeVertCount);
+		RenderGroup& group = renderGroups[groupIdx];
+		RenderFace& rface = renderModel.renderFaces[i];
+		rface.group = groupIdx;
+		rface.vertOffset = group.vertCount;
+		rface.vertCount = FaceMeshBuilder::getVertCount(edgeCount);
+		rface.wireframeVertOffset = group.wireframeVertCount;
+		rface.wireframeVertCount = FaceMeshBuilder::getWireframeVertCount(edgeCount);
 
-		delete[] verts;
-		delete[] wireframeVerts;
+		group.vertCount += rface.vertCount;
+		group.wireframeVertCount += rface.wireframeVertCount;
 	}
 
-	renderModel->renderGroups = new RenderGroup[renderGroups.size()];
-	renderModel->groupCount = renderGroups.size();
+	renderModel.renderGroups = new RenderGroup[renderGroups.size()];
+	renderModel.groupCount = renderGroups.size();
 
 	for (int i = 0; i < renderGroups.size(); i++) {
-		renderGroups[i].verts = new lightmapVert[renderGroupVerts[i].size()];
-		renderGroups[i].vertCount = renderGroupVerts[i].size();
-		memcpy(renderGroups[i].verts, &renderGroupVerts[i][0], renderGroups[i].vertCount * sizeof(lightmapVert));
-
-		renderGroups[i].wireframeVerts = new lightmapVert[renderGroupWireframeVerts[i].size()];
-		renderGroups[i].wireframeVertCount = renderGroupWireframeVerts[i].size();
-		memcpy(renderGroups[i].wireframeVerts, &renderGroupWireframeVerts[i][0], renderGroups[i].wireframeVertCount * sizeof(lightmapVert));
-
-		renderGroups[i].buffer = new VertexBuffer(activeShader, 0);
-		renderGroups[i].buffer->addAttribute(TEX_2F, "vTex");
-		renderGroups[i].buffer->addAttribute(3, GL_FLOAT, 0, "vLightmapTex0");
-		renderGroups[i].buffer->addAttribute(3, GL_FLOAT, 0, "vLightmapTex1");
-		renderGroups[i].buffer->addAttribute(3, GL_FLOAT, 0, "vLightmapTex2");
-		renderGroups[i].buffer->addAttribute(3, GL_FLOAT, 0, "vLightmapTex3");
-		renderGroups[i].buffer->addAttribute(4, GL_FLOAT, 0, "vColor");
-		renderGroups[i].buffer->addAttribute(POS_3F, "vPosition");
-		renderGroups[i].buffer->setData(renderGroups[i].verts, renderGroups[i].vertCount);
-
-		renderGroups[i].wireframeBuffer = new VertexBuffer(activeShader, 0);
-		renderGroups[i].wireframeBuffer->addAttribute(TEX_2F, "vTex");
-		renderGroups[i].wireframeBuffer->addAttribute(3, GL_FLOAT, 0, "vLightmapTex0");
-		renderGroups[i].wireframeBuffer->addAttribute(3, GL_FLOAT, 0, "vLightmapTex1");
-		renderGroups[i].wireframeBuffer->addAttribute(3, GL_FLOAT, 0, "vLightmapTex2");
-		renderGroups[i].wireframeBuffer->addAttribute(3, GL_FLOAT, 0, "vLightmapTex3");
-		renderGroups[i].wireframeBuffer->addAttribute(4, GL_FLOAT, 0, "vColor");
-		renderGroups[i].wireframeBuffer->addAttribute(POS_3F, "vPosition");
-		renderGroups[i].wireframeBuffer->setData(renderGroups[i].wireframeVerts, renderGroups[i].wireframeVertCount);
-
-		renderModel->renderGroups[i] = renderGroups[i];
+		RenderGroup& group = renderGroups[i];
+		group.vertCapacity = getRenderGroupCapacity(group.vertCount);
+		group.verts = new lightmapVert[group.vertCapacity]();
+		group.wireframeVertCapacity = getRenderGroupCapacity(group.wireframeVertCount);
+		group.wireframeVerts = new lightmapVert[group.wireframeVertCapacity]();
+
+		renderModel.renderGroups[i] = group;
+	}
+}
+
+bool BspRenderer::updateModelFaces(int modelIdx, vector<int>& changedFaces) {
+	BSPMODEL& model = map->models[modelIdx];
+	RenderModel& renderModel = renderModels[modelIdx];
+
+	if (renderModel.renderGroups == NULL || renderModel.renderFaces == NULL || renderModel.renderFaceCount != model.nFaces) {
+		return false;
 	}
 
+	vector<lightmapVert> verts;
+	vector<lightmapVert> wireframeVerts;
+
 	for (int i = 0; i < model.nFaces; i++) {
-		refreshFace(model.iFirstFace + i);
+		int faceIdx = model.iFirstFace + i;
+		LightmapInfo* lmap = lightmapsGenerated ? &lightmaps[faceIdx] : NULL;
+
+		verts.clear();
+		wireframeVerts.clear();
+		FaceMeshBuilder::generate(map, faceIdx, lmap, verts, wireframeVerts);
+
+		Texture* texture;
+		Texture* lightmapAtlas[MAXLIGHTMAPS];
+		bool isTransparent;
+		getFaceGroupKey(faceIdx, texture, lightmapAtlas, isTransparent);
+
+		int groupIdx = findRenderGroup(renderModel.renderGroups, renderModel.groupCount, texture, lightmapAtlas, isTransparent);
+		if (groupIdx == -1) {
+			return false;
+		}
+
+		RenderFace& rface = renderModel.renderFaces[i];
+		RenderGroup& oldGroup = renderModel.renderGroups[rface.group];
+		int vertCount = verts.size();
+		int wireframeVertCount = wireframeVerts.size();
+		size_t vertBytes = vertCount * sizeof(lightmapVert);
+		size_t wireframeVertBytes = wireframeVertCount * sizeof(lightmapVert);
+
+		if (groupIdx == rface.group && vertCount == rface.vertCount && wireframeVertCount == rface.wireframeVertCount) {
+			lightmapVert* dst = oldGroup.verts + rface.vertOffset;
+			lightmapVert* wireframeDst = oldGroup.wireframeVerts + rface.wireframeVertOffset;
+
+			if ((!vertCount || !memcmp(dst, &verts[0], vertBytes)) &&
+				(!wireframeVertCount || !memcmp(wireframeDst, &wireframeVerts[0], wireframeVertBytes))) {
+				if (isFaceMathStale(faceIdx)) {
+					// flipped or moved plane with the same verts. Only picking needs an update.
+					changedFaces.push_back(faceIdx);
+				}
+				continue;
+			}
+
+			if (vertCount)
+				memcpy(dst, &verts[0], vertBytes);
+			if (wireframeVertCount)
+				memcpy(wireframeDst, &wireframeVerts[0], wireframeVertBytes);
+			markDirtyVerts(oldGroup, rface.vertOffset, vertCount, rface.wireframeVertOffset, wireframeVertCount);
+			changedFaces.push_back(faceIdx);
+			continue;
+		}
+
+		// the face changed size or group, so append it to its group's slack
+		RenderGroup& newGroup = renderModel.renderGroups[groupIdx];
+		if (newGroup.vertCount + vertCount > newGroup.vertCapacity ||
+			newGroup.wireframeVertCount + wireframeVertCount > newGroup.wireframeVertCapacity) {
+			return false;
+		}
+
+		// the old verts can't be removed without moving every face after them,
+		// so they're collapsed into a single point which draws nothing
+		for (int k = 1; k < rface.vertCount; k++) {
+			oldGroup.verts[rface.vertOffset + k] = oldGroup.verts[rface.vertOffset];
+		}
+		for (int k = 1; k < rface.wireframeVertCount; k++) {
+			oldGroup.wireframeVerts[rface.wireframeVertOffset + k] = oldGroup.wireframeVerts[rface.wireframeVertOffset];
+		}
+		markDirtyVerts(oldGroup, rface.vertOffset, rface.vertCount, rface.wireframeVertOffset, rface.wireframeVertCount);
+		oldGroup.deadVerts += rface.vertCount;
+		oldGroup.deadWireframeVerts += rface.wireframeVertCount;
+
+		rface.group = groupIdx;
+		rface.vertOffset = newGroup.vertCount;
+		rface.vertCount = vertCount;
+		rface.wireframeVertOffset = newGroup.wireframeVertCount;
+		rface.wireframeVertCount = wireframeVertCount;
+
+		if (vertCount)
+			memcpy(newGroup.verts + rface.vertOffset, &verts[0], vertBytes);
+		if (wireframeVertCount)
+			memcpy(newGroup.wireframeVerts + rface.wireframeVertOffset, &wireframeVerts[0], wireframeVertBytes);
+		newGroup.vertCount += vertCount;
+		newGroup.wireframeVertCount += wireframeVertCount;
+		newGroup.buffer->numVerts = newGroup.vertCount;
+		newGroup.wireframeBuffer->numVerts = newGroup.wireframeVertCount;
+		markDirtyVerts(newGroup, rface.vertOffset, vertCount, rface.wireframeVertOffset, wireframeVertCount);
+
+		changedFaces.push_back(faceIdx);
 	}
 
-	if (refreshClipnodes) {
-		generateClipnodeBuffer(modelIdx);
+	for (int i = 0; i < renderModel.groupCount; i++) {
+		RenderGroup& group = renderModel.renderGroups[i];
+		if (needsCompacting(group.deadVerts, group.vertCount) ||
+			needsCompacting(group.deadWireframeVerts, group.wireframeVertCount)) {
+			return false;
+		}
 	}
 
-	return renderModel->groupCount;
+	return true;
+}
+
+bool BspRenderer::isFaceMathStale(int faceIdx) {
+	if (faceIdx >= numFaceMaths) {
+		return true;
+	}
+
+	FaceMath& faceMath = faceMaths[faceIdx];
+	BSPFACE& face = map->faces[faceIdx];
+	BSPPLANE& plane = map->planes[face.iPlane];
+	vec3 planeNormal = face.nPlaneSide ? plane.vNormal * -1 : plane.vNormal;
+	float fDist = face.nPlaneSide ? -plane.fDist : plane.fDist;
+
+	return faceMath.plane_z != planeNormal || faceMath.fdist != fDist || faceMath.verts.size() != face.nEdges;
+}
+
+void BspRenderer::getFaceGroupKey(int faceIdx, Texture*& texture, Texture** lightmapAtlas, bool& transparent) {
+	BSPFACE& face = map->faces[faceIdx];
+	BSPTEXTUREINFO& texinfo = map->texinfos[face.iTextureInfo];
+	bool isSpecial = texinfo.nFlags & TEX_SPECIAL;
+
+	texture = texturesLoaded ? glTextures[texinfo.iMiptex] : greyTex;
+	transparent = isSpecial;
+
+	for (int s = 0; s < MAXLIGHTMAPS; s++) {
+		lightmapAtlas[s] = lightmapsGenerated ? glLightmapTextures[lightmaps[faceIdx].atlasId[s]] : NULL;
+	}
+
+	if (isSpecial) {
+		lightmapAtlas[0] = whiteTex;
+	}
+}
+
+int BspRenderer::findRenderGroup(RenderGroup* groups, int groupCount, Texture* texture, Texture** lightmapAtlas, bool transparent) {
+	for (int k = 0; k < groupCount; k++) {
+		if (groups[k].texture != texture || groups[k].transparent != transparent) {
+			continue;
+		}
+
+		bool allMatch = true;
+		for (int s = 0; s < MAXLIGHTMAPS; s++) {
+			if (groups[k].lightmapAtlas[s] != lightmapAtlas[s]) {
+				allMatch = false;
+				break;
+			}
+		}
+		if (allMatch) {
+			return k;
+		}
+	}
+
+	return -1;
+}
+
+void BspRenderer::markDirtyVerts(RenderGroup& group, int offset, int count, int wireframeOffset, int wireframeCount) {
+	expandDirtyRange(group.dirtyStart, group.dirtyEnd, offset, count);
+	expandDirtyRange(group.wireframeDirtyStart, group.wireframeDirtyEnd, wireframeOffset, wireframeCount);
+}
+
+void BspRenderer::uploadDirtyVerts(RenderGroup& group) {
+	if (group.dirtyEnd > group.dirtyStart) {
+		group.buffer->uploadRange(group.dirtyStart, group.dirtyEnd - group.dirtyStart);
+	}
+	if (group.wireframeDirtyEnd > group.wireframeDirtyStart) {
+		group.wireframeBuffer->uploadRange(group.wireframeDirtyStart, group.wireframeDirtyEnd - group.wireframeDirtyStart);
+	}
+
+	group.dirtyStart = group.dirtyEnd = 0;
+	group.wireframeDirtyStart = group.wireframeDirtyEnd = 0;
 }
 
 void BspRenderer::write_obj_file() {
@@ -793,17 +898,29 @@ bool BspRenderer::refreshModelClipnodes(int modelIdx) {
 
 	deleteRenderModelClipnodes(&renderClipnodes[modelIdx]);
 	generateClipnodeBuffer(modelIdx);
+	invalidateModelPicking(modelIdx, true);
 	return true;
 }
 
 void BspRenderer::loadClipnodes() {
+	TRACE_SCOPE("BspRenderer::loadClipnodes");
 	numRenderClipnodes = map->modelCount;
 	renderClipnodes = new RenderClipnodes[numRenderClipnodes];
 	memset(renderClipnodes, 0, numRenderClipnodes * sizeof(RenderClipnodes));
 
+	vector<int> modelIdxs;
 	for (int i = 0; i < numRenderClipnodes; i++) {
-		generateClipnodeBuffer(i);
+		modelIdxs.push_back(i);
 	}
+
+	vector<shared_ptr<const ClipnodeMesh>> meshes = clipnodeMeshBuilder.build(map, modelIdxs);
+
+	for (int i = 0; i < numRenderClipnodes; i++) {
+		setClipnodeBuffers(i, &meshes[i * MAX_MAP_HULLS]);
+	}
+
+	ClipnodeMeshStats stats = clipnodeMeshBuilder.getStats();
+	debugf("Clipnode meshes: %d built, %d reused, %d evicted (all maps)\n", stats.built, stats.cacheHits, stats.evicted);
 }
 
 void BspRenderer::generateNavMeshBuffer() {
@@ -1025,171 +1142,43 @@ void BspRenderer::generateSingleLeafNavMeshBuffer(LeafNode* node) {
 }
 
 void BspRenderer::generateClipnodeBuffer(int modelIdx) {
-	BSPMODEL& model = map->models[modelIdx];
-	RenderClipnodes* renderClip = &renderClipnodes[modelIdx];
-
-	vec3 min = vec3(model.nMins.x, model.nMins.y, model.nMins.z);
-	vec3 max = vec3(model.nMaxs.x, model.nMaxs.y, model.nMaxs.z);
+	vector<int> modelIdxs(1, modelIdx);
+	vector<shared_ptr<const ClipnodeMesh>> meshes = clipnodeMeshBuilder.build(map, modelIdxs);
+	setClipnodeBuffers(modelIdx, &meshes[0]);
 
-	for (int i = 0; i < MAX_MAP_HULLS; i++) {
-		renderClip->clipnodeBuffer[i] = NULL;
-		renderClip->wireframeClipnodeBuffer[i] = NULL;
+	if (modelIdx == 0) {
+		//generateNavMeshBuffer();
 	}
+}
 
-	Clipper clipper;
-	
-	for (int i = 0; i < MAX_MAP_HULLS; i++) {
-		vector<NodeVolumeCuts> solidNodes = map->get_model_leaf_volume_cuts(modelIdx, i, CONTENTS_SOLID);
-
-		vector<CMesh> solidMeshes;
-		for (int k = 0; k < solidNodes.size(); k++) {
-			solidMeshes.push_back(clipper.clip(solidNodes[k].cuts));
-		}
-		
-		static COLOR4 hullColors[] = {
-			COLOR4(255, 255, 255, 128),
-			COLOR4(96, 255, 255, 128),
-			COLOR4(255, 96, 255, 128),
-			COLOR4(255, 255, 96, 128),
-		};
-		COLOR4 color = hullColors[i];
-
-		vector<cVert> allVerts;
-		vector<cVert> wireframeVerts;
-		vector<FaceMath> faceMaths;
-
-		for (int m = 0; m < solidMeshes.size(); m++) {
-			CMesh& mesh = solidMeshes[m];
-			clipnodeLeafCount++;
-
-			for (int i = 0; i < mesh.faces.size(); i++) {
-
-				if (!mesh.faces[i].visible) {
-					continue;
-				}
-
-				set<int> uniqueFaceVerts;
-
-				for (int k = 0; k < mesh.faces[i].edges.size(); k++) {
-					for (int v = 0; v < 2; v++) {
-						int vertIdx = mesh.edges[mesh.faces[i].edges[k]].verts[v];
-						if (!mesh.verts[vertIdx].visible) {
-							continue;
-						}
-						uniqueFaceVerts.insert(vertIdx);
-					}
-				}
-
-				vector<vec3> faceVerts;
-				for (auto vertIdx : uniqueFaceVerts) {
-					faceVerts.push_back(mesh.verts[vertIdx].pos);
-				}
-
-				sortPlanarVerts(faceVerts);
-
-				if (faceVerts.size() < 3) {
-					//logf("Degenerate clipnode face discarded\n");
-					continue;
-				}
-
-				vec3 normal = getNormalFromVerts(faceVerts);
-
-				if (dotProduct(mesh.faces[i].normal, normal) < 0) {
-					reverse(faceVerts.begin(), faceVerts.end());
-					normal = normal.invert();
-				}
-
-				// calculations for face picking
-				{
-					FaceMath faceMath;
-					faceMath.plane_z = mesh.faces[i].normal;
-					faceMath.fdist = getDistAlongAxis(mesh.faces[i].normal, faceVerts[0]);
-
-					vec3 v0 = faceVerts[0];
-					vec3 v1;
-					bool found = false;
-					for (int z = 1; z < faceVerts.size(); z++) {
-						if (faceVerts[z] != v0) {
-							v1 = faceVerts[z];
-							found = true;
-							break;
-						}
-					}
-					if (!found) {
-						logf("Failed to find non-duplicate vert for clipnode face\n");
-					}
-
-					vec3 plane_z = mesh.faces[i].normal;
-					vec3 plane_x = faceMath.plane_x = (v1 - v0).normalize();
-					vec3 plane_y = faceMath.plane_y = crossProduct(plane_z, plane_x).normalize();
-					faceMath.worldToLocal = worldToLocalTransform(plane_x, plane_y, plane_z);
-
-					faceMath.verts = vector<vec3>(faceVerts.size());
-					faceMath.localVerts = vector<vec2>(faceVerts.size());
-					for (int k = 0; k < faceVerts.size(); k++) {
-						faceMath.verts[k] = faceVerts[k];
-						faceMath.localVerts[k] = (faceMath.worldToLocal * vec4(faceVerts[k], 1)).xy();
-					}
-
-					faceMaths.push_back(faceMath);
-				}
-
-				// create the verts for rendering
-				{
-					for (int i = 0; i < faceVerts.size(); i++) {
-						faceVerts[i] = faceVerts[i].flip();
-					}
-
-					COLOR4 wireframeColor = { 0, 0, 0, 255 };
-					for (int k = 0; k < faceVerts.size(); k++) {
-						wireframeVerts.push_back(cVert(faceVerts[k], wireframeColor));
-						wireframeVerts.push_back(cVert(faceVerts[(k + 1) % faceVerts.size()], wireframeColor));
-					}
-
-					vec3 lightDir = vec3(1, 1, -1).normalize();
-					float dot = (dotProduct(normal*-1, lightDir) + 1) / 2.0f;
-					if (dot > 0.5f) {
-						dot = dot * dot;
-					}
-					COLOR4 faceColor = color * (dot);
-
-					// convert from TRIANGLE_FAN style verts to TRIANGLES
-					for (int k = 2; k < faceVerts.size(); k++) {
-						allVerts.push_back(cVert(faceVerts[0], faceColor));
-						allVerts.push_back(cVert(faceVerts[k - 1], faceColor));
-						allVerts.push_back(cVert(faceVerts[k], faceColor));
-					}
-				}
-			}
-		}
-
-		cVert* output = new cVert[allVerts.size()];
-		for (int i = 0; i < allVerts.size(); i++) {
-			output[i] = allVerts[i];
-		}
+void BspRenderer::setClipnodeBuffers(int modelIdx, const shared_ptr<const ClipnodeMesh>* hullMeshes) {
+	RenderClipnodes* renderClip = &renderClipnodes[modelIdx];
 
-		cVert* wireOutput = new cVert[wireframeVerts.size()];
-		for (int i = 0; i < wireframeVerts.size(); i++) {
-			wireOutput[i] = wireframeVerts[i];
-		}
+	for (int i = 0; i < MAX_MAP_HULLS; i++) {
+		const ClipnodeMesh& mesh = *hullMeshes[i];
+		clipnodeLeafCount += mesh.leafCount;
 
-		if (allVerts.size() == 0 || wireframeVerts.size() == 0) {
+		if (mesh.faceVerts.empty() || mesh.wireframeVerts.empty()) {
 			renderClip->clipnodeBuffer[i] = NULL;
 			renderClip->wireframeClipnodeBuffer[i] = NULL;
 			continue;
 		}
 
-		renderClip->clipnodeBuffer[i] = new VertexBuffer(colorShader, COLOR_4B | POS_3F, output, allVerts.size());
+		// the buffers get their own copy because the mesh may be shared with other maps and
+		// the vertex colors are changed when the clipnode opacity is adjusted
+		cVert* output = new cVert[mesh.faceVerts.size()];
+		memcpy(output, &mesh.faceVerts[0], mesh.faceVerts.size() * sizeof(cVert));
+
+		cVert* wireOutput = new cVert[mesh.wireframeVerts.size()];
+		memcpy(wireOutput, &mesh.wireframeVerts[0], mesh.wireframeVerts.size() * sizeof(cVert));
+
+		renderClip->clipnodeBuffer[i] = new VertexBuffer(colorShader, COLOR_4B | POS_3F, output, mesh.faceVerts.size());
 		renderClip->clipnodeBuffer[i]->ownData = true;
 
-		renderClip->wireframeClipnodeBuffer[i] = new VertexBuffer(colorShader, COLOR_4B | POS_3F, wireOutput, wireframeVerts.size());
+		renderClip->wireframeClipnodeBuffer[i] = new VertexBuffer(colorShader, COLOR_4B | POS_3F, wireOutput, mesh.wireframeVerts.size());
 		renderClip->wireframeClipnodeBuffer[i]->ownData = true;
 
-		renderClip->faceMaths[i] = faceMaths;
-	}
-
-	if (modelIdx == 0) {
-		//generateNavMeshBuffer();
+		renderClip->faceMaths[i] = mesh.faceMaths;
 	}
 }
 
@@ -1209,12 +1198,20 @@ void BspRenderer::updateClipnodeOpacity(byte newValue) {
 }
 
 void BspRenderer::preRenderEnts() {
+	TRACE_SCOPE("BspRenderer::preRenderEnts");
 	if (renderEnts != NULL) {
 		delete[] renderEnts;
 		delete pointEnts;
 	}
 	renderEnts = new RenderEnt[map->ents.size()];
 
+	// entity bounds only depend on the current models, so nothing is stale after this
+	entIndex.clear(g_limits.max_mapboundary);
+	staleIndexModels.clear();
+	staleModelEnts.clear();
+	allModelEntsStale = true;
+	modelEnts.clear();
+
 	numPointEnts = 0;
 	for (int i = 1; i < map->ents.size(); i++) {
 		Entity* ent = map->ents[i];
@@ -1226,9 +1223,12 @@ void BspRenderer::preRenderEnts() {
 
 	for (int i = 0; i < map->ents.size(); i++) {
 		Entity* ent = map->ents[i];
+		renderEnts[i].modelIdx = -1;
 		refreshEnt(i);
+		renderEnts[i].pointEntIdx = -1;
 
 		if (i != 0 && !ent->isBspModel() && !ent->hidden) {
+			renderEnts[i].pointEntIdx = pointEntIdx;
 			memcpy(entCubes + pointEntIdx, renderEnts[i].pointEntCube->buffer->data, sizeof(cCube));
 			cVert* verts = (cVert*)(entCubes + pointEntIdx);
 			vec3 offset = renderEnts[i].offset.flip();
@@ -1244,6 +1244,8 @@ void BspRenderer::preRenderEnts() {
 	pointEnts = new VertexBuffer(colorShader, COLOR_4B | POS_3F, entCubes, numPointEnts * 6 * 6);
 	pointEnts->ownData = true;
 	pointEnts->upload();
+
+	entPickBvhDirty = true;
 }
 
 void BspRenderer::refreshPointEnt(int entIdx) {
@@ -1290,7 +1292,7 @@ void BspRenderer::refreshPointEnt(int entIdx) {
 
 void BspRenderer::refreshEnt(int entIdx) {
 	Entity* ent = map->ents[entIdx];
-	renderEnts[entIdx].modelIdx = ent->getBspModelIdx();
+	setEntModel(entIdx, ent->getBspModelIdx());
 	renderEnts[entIdx].modelMat.loadIdentity();
 	renderEnts[entIdx].offset = vec3(0, 0, 0);
 	renderEnts[entIdx].angles = vec3(0, 0, 0);
@@ -1305,63 +1307,143 @@ void BspRenderer::refreshEnt(int entIdx) {
 	}
 	
 	renderEnts[entIdx].angles = ent->getAngles().flip() * (PI / 180.0f);
+
+	if (movedPickEnts.size() < map->ents.size()) {
+		movedPickEnts.push_back(entIdx);
+	}
+	else {
+		entPickBvhDirty = true; // cheaper to rebuild than to update this many
+	}
+
+	if (!allModelEntsStale) {
+		if (staleModelEnts.size() < map->ents.size()) {
+			staleModelEnts.push_back(entIdx);
+		}
+		else {
+			allModelEntsStale = true;
+			staleModelEnts.clear();
+		}
+	}
+
+	updateEntIndex(entIdx);
 }
 
-void BspRenderer::calcFaceMaths() {
-	deleteFaceMaths();
+void BspRenderer::setEntModel(int entIdx, int modelIdx) {
+	int oldModelIdx = renderEnts[entIdx].modelIdx;
+	renderEnts[entIdx].modelIdx = modelIdx;
 
-	numFaceMaths = map->faceCount;
-	faceMaths = new FaceMath[map->faceCount];
+	if (oldModelIdx == modelIdx) {
+		return;
+	}
 
-	vec3 world_x = vec3(1, 0, 0);
-	vec3 world_y = vec3(0, 1, 0);
-	vec3 world_z = vec3(0, 0, 1);
+	if (oldModelIdx >= 0 && oldModelIdx < modelEnts.size()) {
+		vector<int>& ents = modelEnts[oldModelIdx];
+		ents.erase(std::remove(ents.begin(), ents.end(), entIdx), ents.end());
+	}
 
-	for (int i = 0; i < map->faceCount; i++) {
-		refreshFace(i);
+	// invalid model keys are ignored like everywhere else, but still limited to sane values
+	if (modelIdx >= 0 && modelIdx < g_limits.max_models) {
+		if (modelIdx >= modelEnts.size()) {
+			modelEnts.resize(modelIdx + 1);
+		}
+		modelEnts[modelIdx].push_back(entIdx);
 	}
 }
 
-void BspRenderer::refreshFace(int faceIdx) {
-	const vec3 world_x = vec3(1, 0, 0);
-	const vec3 world_y = vec3(0, 1, 0);
-	const vec3 world_z = vec3(0, 0, 1);
+void BspRenderer::updateEntIndex(int entIdx) {
+	if (entIdx < 0 || entIdx >= map->ents.size()) {
+		return;
+	}
 
-	FaceMath& faceMath = faceMaths[faceIdx];
-	BSPFACE& face = map->faces[faceIdx];
-	BSPPLANE& plane = map->planes[face.iPlane];
-	vec3 planeNormal = face.nPlaneSide ? plane.vNormal * -1 : plane.vNormal;
-	float fDist = face.nPlaneSide ? -plane.fDist : plane.fDist;
+	Entity* ent = map->ents[entIdx];
+	RenderEnt& renderEnt = renderEnts[entIdx];
+	vec3 mins, maxs;
 
-	faceMath.plane_z = planeNormal;
-	faceMath.fdist = fDist;
-	
-	vector<vec3> allVerts(face.nEdges);
-	vec3 v1;
-	for (int e = 0; e < face.nEdges; e++) {
-		int32_t edgeIdx = map->surfedges[face.iFirstEdge + e];
-		BSPEDGE& edge = map->edges[abs(edgeIdx)];
-		int vertIdx = edgeIdx < 0 ? edge.iVertex[1] : edge.iVertex[0];
-		allVerts[e] = map->verts[vertIdx];
+	if (renderEnt.modelIdx >= 0 && renderEnt.modelIdx < map->modelCount) {
+		BSPMODEL& model = map->models[renderEnt.modelIdx];
+		mins = model.nMins;
+		maxs = model.nMaxs;
 
-		// 2 verts can share the same position on a face, so need to find one that isn't shared (aomdc_1intro)
-		if (e > 0 && allVerts[e] != allVerts[0]) {
-			v1 = allVerts[e];
+		if (renderEnt.angles != vec3()) {
+			// any rotation fits in a cube around the model origin
+			float radius = max(mins.length(), maxs.length());
+			mins = vec3(-radius, -radius, -radius);
+			maxs = vec3(radius, radius, radius);
 		}
 	}
+	else if (renderEnt.pointEntCube) {
+		mins = renderEnt.pointEntCube->mins;
+		maxs = renderEnt.pointEntCube->maxs;
+	}
+	mins += renderEnt.offset;
+	maxs += renderEnt.offset;
 
-	vec3 plane_x = faceMath.plane_x = (v1 - allVerts[0]).normalize(1.0f);
-	vec3 plane_y = faceMath.plane_y = crossProduct(planeNormal, plane_x).normalize(1.0f);
-	vec3 plane_z = planeNormal;
+	if (ent->drawCached && ent->hasCachedMdl && ent->cachedMdl) {
+		expandBoundingBox(ent->drawMin, mins, maxs);
+		expandBoundingBox(ent->drawMax, mins, maxs);
+	}
 
-	faceMath.worldToLocal = worldToLocalTransform(plane_x, plane_y, plane_z);
+	entIndex.update(entIdx, mins, maxs);
+}
 
-	faceMath.verts = vector<vec3>(allVerts.size());
-	faceMath.localVerts = vector<vec2>(allVerts.size());
-	for (int i = 0; i < allVerts.size(); i++) {
-		faceMath.verts[i] = allVerts[i];
-		faceMath.localVerts[i] = (faceMath.worldToLocal * vec4(allVerts[i], 1)).xy();
+uint64_t BspRenderer::hashWorldGeometry() {
+	if (map->modelCount <= 0) {
+		return 0;
+	}
+
+	BSPMODEL& world = map->models[0];
+	vector<vec3> verts;
+	verts.push_back(vec3((float)world.iFirstFace, (float)world.nFaces, 0));
+
+	for (int i = world.iFirstFace; i < world.iFirstFace + world.nFaces && i < map->faceCount; i++) {
+		BSPFACE& face = map->faces[i];
+		for (int e = 0; e < face.nEdges; e++) {
+			int32_t edgeIdx = map->surfedges[face.iFirstEdge + e];
+			BSPEDGE& edge = map->edges[abs(edgeIdx)];
+			verts.push_back(map->verts[edgeIdx < 0 ? edge.iVertex[1] : edge.iVertex[0]]);
+		}
+	}
+
+	return hashData(&verts[0], verts.size() * sizeof(vec3));
+}
+
+void BspRenderer::updateStaleIndexModels() {
+	if (staleIndexModels.empty() || !renderEnts) {
+		return;
+	}
+
+	sort(staleIndexModels.begin(), staleIndexModels.end());
+	staleIndexModels.erase(unique(staleIndexModels.begin(), staleIndexModels.end()), staleIndexModels.end());
+	for (int modelIdx : staleIndexModels) {
+		if (modelIdx < 0 || modelIdx >= modelEnts.size()) {
+			continue;
+		}
+		for (int entIdx : modelEnts[modelIdx]) {
+			updateEntIndex(entIdx);
+		}
 	}
+	staleIndexModels.clear();
+}
+
+void BspRenderer::calcFaceMaths() {
+	deleteFaceMaths();
+
+	numFaceMaths = map->faceCount;
+	faceMaths = new FaceMath[map->faceCount];
+
+	int chunkCount = (map->faceCount + RENDER_FACE_CHUNK_SIZE - 1) / RENDER_FACE_CHUNK_SIZE;
+	g_thread_pool->parallelFor(chunkCount, [&](int chunk) {
+		int end = min(map->faceCount, (chunk + 1) * RENDER_FACE_CHUNK_SIZE);
+		for (int i = chunk * RENDER_FACE_CHUNK_SIZE; i < end; i++) {
+			refreshFace(i);
+		}
+	});
+
+	invalidateAllPicking();
+}
+
+void BspRenderer::refreshFace(int faceIdx) {
+	FaceMeshBuilder::calcFaceMath(map, faceIdx, faceMaths[faceIdx]);
 }
 
 BspRenderer::~BspRenderer() {
@@ -1396,6 +1478,7 @@ BspRenderer::~BspRenderer() {
 	delete blueTex;
 	delete missingTex;
 
+	delete visCuller;
 	delete map;
 }
 
@@ -1442,6 +1525,10 @@ void BspRenderer::delayLoadData() {
 		}
 
 		clipnodesLoaded = true;
+		for (int i = 0; i < modelPickBvhs.size(); i++) {
+			modelPickBvhs[i].clipnodesDirty = true;
+		}
+		entPickBvhDirty = true;
 		debugf("Loaded %d clipnode leaves\n", clipnodeLeafCount);
 	}
 }
@@ -1474,8 +1561,7 @@ void BspRenderer::highlightFace(int faceIdx, bool highlight) {
 		rgroup->verts[rface->vertOffset + i].b = b;
 	}
 
-	rgroup->buffer->deleteBuffer();
-	rgroup->buffer->upload();
+	markDirtyVerts(*rgroup, rface->vertOffset, rface->vertCount, 0, 0);
 }
 
 void BspRenderer::updateFaceUVs(int faceIdx) {
@@ -1503,8 +1589,7 @@ void BspRenderer::updateFaceUVs(int faceIdx) {
 		vert.v = fV * th;
 	}
 
-	rgroup->buffer->deleteBuffer();
-	rgroup->buffer->upload();
+	markDirtyVerts(*rgroup, rface->vertOffset, rface->vertCount, 0, 0);
 }
 
 bool BspRenderer::getRenderPointers(int faceIdx, RenderFace** renderFace, RenderGroup** renderGroup) {
@@ -1536,13 +1621,9 @@ Texture* BspRenderer::uploadTexture(WADTEX* tex) {
 	COLOR3* palette = (COLOR3*)(tex->data + tex->nOffsets[3] + lastMipSize + 2 - 40);
 	byte* src = tex->data;
 
-	COLOR3* imageData = new COLOR3[tex->nWidth * tex->nHeight];
-
 	int sz = tex->nWidth * tex->nHeight;
-
-	for (int k = 0; k < sz; k++) {
-		imageData[k] = palette[src[k]];
-	}
+	COLOR3* imageData = new COLOR3[sz];
+	decodePalettedTexels(src, palette, imageData, sz);
 
 	Texture* newTex = new Texture(tex->nWidth, tex->nHeight, imageData);
 	newTex->upload(GL_RGB);
@@ -1560,6 +1641,82 @@ void BspRenderer::loadTexture(WADTEX* tex) {
 	glTextures = newTextures;
 }
 
+static void addDrawRange(vector<int>& starts, vector<int>& counts, int start, int count) {
+	if (starts.size() && starts.back() + counts.back() == start) {
+		counts.back() += count;
+	}
+	else {
+		starts.push_back(start);
+		counts.push_back(count);
+	}
+}
+
+void BspRenderer::updateVisibility(vec3 cameraOrigin, vec3 cameraAngles, float aspect, float fov, float zFar) {
+	TRACE_SCOPE("BspRenderer::updateVisibility");
+	visibilityCulled = false;
+	entsCulled = false;
+
+	if (!renderModels || numRenderModels <= 0 || !renderEnts || map->ents.empty()) {
+		return;
+	}
+
+	updateStaleIndexModels();
+
+	vec3 offset = map->ents[0]->getOrigin();
+
+	if (!(g_render_flags & RENDER_VIS_CULLING) || worldEdited) {
+		// brush entities outside the view are still skipped. That's invisible to the user.
+		Frustum frustum = getViewFrustum(cameraOrigin - offset, cameraAngles, aspect, 1.0f, zFar, fov);
+		visibleSet.faces.clear();
+		visibleSet.ents.clear();
+		entIndex.queryFrustum(frustum, zFar, visibleSet.ents);
+		visibleSet.ents.erase(remove_if(visibleSet.ents.begin(), visibleSet.ents.end(), [&](int i) {
+			return i == 0 || i >= map->ents.size() || renderEnts[i].modelIdx < 0;
+		}), visibleSet.ents.end());
+		sort(visibleSet.ents.begin(), visibleSet.ents.end());
+		entsCulled = true;
+		return;
+	}
+
+	visCuller->cull(cameraOrigin - offset, cameraAngles, aspect, fov, zFar, visibleSet);
+
+	// merge the visible faces into as few draw ranges as possible. Faces were added to their
+	// render groups in order, so neighboring faces with the same texture are usually contiguous.
+	RenderModel& world = renderModels[0];
+	BSPMODEL& worldModel = map->models[0];
+
+	visibleRangeStarts.resize(world.groupCount);
+	visibleRangeCounts.resize(world.groupCount);
+	visibleWireframeStarts.resize(world.groupCount);
+	visibleWireframeCounts.resize(world.groupCount);
+	for (int i = 0; i < world.groupCount; i++) {
+		visibleRangeStarts[i].clear();
+		visibleRangeCounts[i].clear();
+		visibleWireframeStarts[i].clear();
+		visibleWireframeCounts[i].clear();
+	}
+
+	for (int i = 0; i < visibleSet.faces.size(); i++) {
+		int relativeFaceIdx = visibleSet.faces[i] - worldModel.iFirstFace;
+		if (relativeFaceIdx < 0 || relativeFaceIdx >= worldModel.nFaces) {
+			continue;
+		}
+
+		RenderFace& face = world.renderFaces[relativeFaceIdx];
+		if (face.group < 0 || face.group >= world.groupCount || face.vertCount <= 0) {
+			continue;
+		}
+
+		addDrawRange(visibleRangeStarts[face.group], visibleRangeCounts[face.group],
+			face.vertOffset, face.vertCount);
+		addDrawRange(visibleWireframeStarts[face.group], visibleWireframeCounts[face.group],
+			face.wireframeVertOffset, face.wireframeVertCount);
+	}
+
+	visibilityCulled = true;
+	entsCulled = true;
+}
+
 void BspRenderer::render(const vector<int>& highlightedEnts, bool highlightAlwaysOnTop, int clipnodeHull, bool transparencyPass) {
 	if (map->ents.empty())
 		return;
@@ -1615,8 +1772,10 @@ void BspRenderer::render(const vector<int>& highlightedEnts, bool highlightAlway
 
 		drawModel(0, drawTransparentFaces, false, false);
 
-		for (int i = 0, sz = map->ents.size(); i < sz; i++) {
-			if (renderEnts[i].modelIdx >= 0 && renderEnts[i].modelIdx < map->modelCount) {
+		int drawCount = entsCulled ? visibleSet.ents.size() : map->ents.size();
+		for (int k = 0; k < drawCount; k++) {
+			int i = entsCulled ? visibleSet.ents[k] : k;
+			if (i < map->ents.size() && renderEnts[i].modelIdx >= 0 && renderEnts[i].modelIdx < map->modelCount) {
 				Entity* ent = map->ents[i];
 				if (ent->hidden)
 					continue;
@@ -1715,6 +1874,7 @@ void BspRenderer::drawModel(int modelIdx, bool transparent, bool highlight, bool
 	if (edgesOnly) {
 		for (int i = 0; i < renderModels[modelIdx].groupCount; i++) {
 			RenderGroup& rgroup = renderModels[modelIdx].renderGroups[i];
+			uploadDirtyVerts(rgroup);
 
 			glActiveTexture(GL_TEXTURE0);
 			if (highlight)
@@ -1729,12 +1889,18 @@ void BspRenderer::drawModel(int modelIdx, bool transparent, bool highlight, bool
 		return;
 	}
 
+	bool culled = modelIdx == 0 && visibilityCulled && visibleRangeStarts.size() == renderModels[0].groupCount;
+
 	for (int i = 0; i < renderModels[modelIdx].groupCount; i++) {
 		RenderGroup& rgroup = renderModels[modelIdx].renderGroups[i];
+		uploadDirtyVerts(rgroup);
 
 		if (rgroup.transparent != transparent)
 			continue;
 
+		if (culled && visibleRangeStarts[i].empty())
+			continue;
+
 		if (rgroup.transparent) {
 			if (modelIdx == 0 && !(g_render_flags & RENDER_SPECIAL)) {
 				continue;
@@ -1760,7 +1926,12 @@ void BspRenderer::drawModel(int modelIdx, bool transparent, bool highlight, bool
 			glActiveTexture(GL_TEXTURE1);
 			whiteTex->bind();
 
-			rgroup.wireframeBuffer->draw(GL_LINES);
+			if (culled) {
+				rgroup.wireframeBuffer->drawRanges(GL_LINES, visibleWireframeStarts[i], visibleWireframeCounts[i]);
+			}
+			else {
+				rgroup.wireframeBuffer->draw(GL_LINES);
+			}
 		}
 
 
@@ -1802,7 +1973,12 @@ void BspRenderer::drawModel(int modelIdx, bool transparent, bool highlight, bool
 			}
 		}
 
-		rgroup.buffer->draw(GL_TRIANGLES);
+		if (culled) {
+			rgroup.buffer->drawRanges(GL_TRIANGLES, visibleRangeStarts[i], visibleRangeCounts[i]);
+		}
+		else {
+			rgroup.buffer->draw(GL_TRIANGLES);
+		}
 	}
 }
 
@@ -1833,47 +2009,49 @@ void BspRenderer::drawPointEntities(const vector<int>& highlightedEnts) {
 		return;
 	}
 
-	int pointEntIdx = 0;
 	int nextRangeDrawIdx = 0; // starting index for the next range draw
 
-	std::unordered_set<int> highlighted;
-	for (int highlightEnt : highlightedEnts) {
-		highlighted.insert(highlightEnt);
+	// only highlighted entities and drawn models are drawn differently, so only those are visited
+	vector<int> skipEnts;
+	for (int i : highlightedEnts) {
+		skipEnts.push_back(i);
 	}
+	for (int i : studioDrawnEnts) {
+		if (i < map->ents.size() && map->ents[i]->didStudioDraw)
+			skipEnts.push_back(i);
+	}
+	sort(skipEnts.begin(), skipEnts.end());
+	skipEnts.erase(unique(skipEnts.begin(), skipEnts.end()), skipEnts.end());
 
 	const int cubeVerts = 6 * 6;
 
-	// skip worldspawn
-	for (int i = 1, sz = map->ents.size(); i < sz; i++) {
-		Entity* ent = map->ents[i];
-		if (renderEnts[i].modelIdx >= 0 || ent->hidden)
+	// cubes are in entity order, so the skipped cubes are sorted too
+	for (int i : skipEnts) {
+		if (i <= 0 || i >= map->ents.size() || renderEnts[i].pointEntIdx < 0 || map->ents[i]->hidden)
 			continue;
 
-		if (highlighted.count(i) || map->ents[i]->didStudioDraw) {
-			if (pointEntIdx - nextRangeDrawIdx > 0) {
-				pointEnts->drawRange(GL_TRIANGLES, cubeVerts * nextRangeDrawIdx, cubeVerts * pointEntIdx);
-			}
-			nextRangeDrawIdx = pointEntIdx+1;
+		int pointEntIdx = renderEnts[i].pointEntIdx;
+		if (pointEntIdx - nextRangeDrawIdx > 0) {
+			pointEnts->drawRange(GL_TRIANGLES, cubeVerts * nextRangeDrawIdx, cubeVerts * pointEntIdx);
+		}
+		nextRangeDrawIdx = pointEntIdx+1;
 
-			if (!map->ents[i]->didStudioDraw) {
-				colorShader->pushMatrix(MAT_MODEL);
-				*colorShader->modelMat = renderEnts[i].modelMat;
-				colorShader->modelMat->translate(renderOffset.x, renderOffset.y, renderOffset.z);
-				colorShader->updateMatrixes();
+		if (!map->ents[i]->didStudioDraw) {
+			colorShader->pushMatrix(MAT_MODEL);
+			*colorShader->modelMat = renderEnts[i].modelMat;
+			colorShader->modelMat->translate(renderOffset.x, renderOffset.y, renderOffset.z);
+			colorShader->updateMatrixes();
 
-				renderEnts[i].pointEntCube->selectBuffer->draw(GL_TRIANGLES);
-				renderEnts[i].pointEntCube->buffer->draw(GL_TRIANGLES);
-				renderEnts[i].pointEntCube->wireframeBuffer->draw(GL_LINES);
+			renderEnts[i].pointEntCube->selectBuffer->draw(GL_TRIANGLES);
+			renderEnts[i].pointEntCube->buffer->draw(GL_TRIANGLES);
+			renderEnts[i].pointEntCube->wireframeBuffer->draw(GL_LINES);
 
-				colorShader->popMatrix(MAT_MODEL);
-			}
+			colorShader->popMatrix(MAT_MODEL);
 		}
-
-		pointEntIdx++;
 	}
 
-	if (pointEntIdx - nextRangeDrawIdx > 0) {
-		pointEnts->drawRange(GL_TRIANGLES, cubeVerts * nextRangeDrawIdx, cubeVerts * pointEntIdx);
+	if (numPointEnts - nextRangeDrawIdx > 0) {
+		pointEnts->drawRange(GL_TRIANGLES, cubeVerts * nextRangeDrawIdx, cubeVerts * numPointEnts);
 	}
 }
 
@@ -1895,10 +2073,13 @@ bool BspRenderer::pickPoly(vec3 start, vec3 dir, int hullIdx, int& entIdx, int&
 		foundBetterPick = true;
 	}
 
-	for (int i = 0, sz = map->ents.size(); i < sz; i++) {
+	updateEntPickBvh();
+
+	entPickBvh.raycast(start, dir, bestDist, [&](int prim, float& dist) {
+		int i = prim + 1;
 		Entity* ent = map->ents[i];
 		if (ent->hidden)
-			continue;
+			return;
 
 		if (renderEnts[i].modelIdx >= 0 && renderEnts[i].modelIdx < map->modelCount) {
 
@@ -1911,27 +2092,40 @@ bool BspRenderer::pickPoly(vec3 start, vec3 dir, int hullIdx, int& entIdx, int&
 			}
 
 			if (isSpecial && !(g_render_flags & RENDER_SPECIAL_ENTS)) {
-				continue;
+				return;
 			} else if (!isSpecial && !(g_render_flags & RENDER_ENTS)) {
-				continue;
+				return;
 			}
 
 			vec3 angles = map->ents[i]->canRotate() ? renderEnts[i].angles : vec3();
 			if (pickModelPoly(start, dir, renderEnts[i].offset, angles,
-				renderEnts[i].modelIdx, hullIdx, i, faceIdx, bestDist)) {
+				renderEnts[i].modelIdx, hullIdx, i, faceIdx, dist)) {
 				entIdx = i;
 				foundBetterPick = true;
 			}
 		}
-		else if (i > 0 && g_render_flags & RENDER_POINT_ENTS) {
+		else if (g_render_flags & RENDER_POINT_ENTS) {
 			vec3 mins = renderEnts[i].offset + renderEnts[i].pointEntCube->mins;
 			vec3 maxs = renderEnts[i].offset + renderEnts[i].pointEntCube->maxs;
 
-			if (pickAABB(start, dir, mins, maxs, bestDist)) {
+			if (pickAABB(start, dir, mins, maxs, dist)) {
 				entIdx = i;
 				foundBetterPick = true;
 			}
-			else if (ent->cachedMdl && ent->cachedMdl->pick(start, dir, ent, bestDist)) {
+		}
+	});
+
+	// models and sprites are posed while drawing, so their bounds can change every frame.
+	// Only the ones drawn last frame can be picked.
+	if (g_render_flags & RENDER_POINT_ENTS) {
+		for (int i : studioDrawnEnts) {
+			if (i <= 0 || i >= map->ents.size())
+				continue;
+			Entity* ent = map->ents[i];
+			if (!ent->cachedMdl || ent->hidden || (renderEnts[i].modelIdx >= 0 && renderEnts[i].modelIdx < map->modelCount))
+				continue;
+
+			if (ent->cachedMdl->pick(start, dir, ent, bestDist)) {
 				entIdx = i;
 				foundBetterPick = true;
 			}
@@ -1941,22 +2135,6 @@ bool BspRenderer::pickPoly(vec3 start, vec3 dir, int hullIdx, int& entIdx, int&
 	return foundBetterPick;
 }
 
-void rotateFaceMath(FaceMath& faceMath, mat4x4& rotation) {
-	vec3 pointOnPlane = (faceMath.plane_z * faceMath.fdist);
-	pointOnPlane = (rotation * vec4(pointOnPlane, 1)).xyz();
-	faceMath.plane_x = (rotation * vec4(faceMath.plane_x, 1)).xyz();
-	faceMath.plane_y = (rotation * vec4(faceMath.plane_y, 1)).xyz();
-	faceMath.plane_z = (rotation * vec4(faceMath.plane_z, 1)).xyz();
-	faceMath.fdist = dotProduct(faceMath.plane_z, pointOnPlane);
-	faceMath.worldToLocal = worldToLocalTransform(faceMath.plane_x, faceMath.plane_y, faceMath.plane_z);
-
-	faceMath.localVerts = vector<vec2>(faceMath.verts.size());
-	for (int k = 0; k < faceMath.verts.size(); k++) {
-		vec3 rotVert = (rotation * vec4(faceMath.verts[k], 1)).xyz();
-		faceMath.localVerts[k] = (faceMath.worldToLocal * vec4(rotVert, 1)).xy();
-	}
-}
-
 bool BspRenderer::pickModelPoly(vec3 start, vec3 dir, vec3 offset, vec3 rot, int modelIdx, int hullIdx,
 	int testEntidx, int& faceIdx, float& bestDist) {
 	BSPMODEL& model = map->models[modelIdx];
@@ -1966,32 +2144,28 @@ bool BspRenderer::pickModelPoly(vec3 start, vec3 dir, vec3 offset, vec3 rot, int
 	bool foundBetterPick = false;
 	bool skipSpecial = !(g_render_flags & RENDER_SPECIAL);
 
-	bool hasAngles = rot != vec3();
-	mat4x4 angleTransform = map->ents[testEntidx]->getRotationMatrix(true);
-
-	for (int k = 0; k < model.nFaces; k++) {
-		FaceMath faceMath = faceMaths[model.iFirstFace + k];
-
-		if (hasAngles) {
-			rotateFaceMath(faceMath, angleTransform);
-		}
+	if (rot != vec3()) {
+		// rotate the ray into model space instead of rotating every face into world space
+		mat4x4 worldToModel = map->ents[testEntidx]->getRotationMatrix(true).invert();
+		start = (worldToModel * vec4(start, 1)).xyz();
+		dir = (worldToModel * vec4(dir, 0)).xyz();
+	}
 
+	getFacePickBvh(modelIdx).raycast(start, dir, bestDist, [&](int k, float& dist) {
 		BSPFACE& face = map->faces[model.iFirstFace + k];
 		
 		if (skipSpecial && modelIdx == 0) {
 			BSPTEXTUREINFO& info = map->texinfos[face.iTextureInfo];
 			if (info.nFlags & TEX_SPECIAL) {
-				continue;
+				return;
 			}
 		}
 
-		float t = bestDist;
-		if (pickFaceMath(start, dir, faceMath, t)) {
+		if (pickFaceMath(start, dir, faceMaths[model.iFirstFace + k], dist)) {
 			foundBetterPick = true;
-			bestDist = t;
 			faceIdx = model.iFirstFace + k;
 		}
-	}
+	});
 
 	bool selectWorldClips = modelIdx == 0 && (g_render_flags & RENDER_WORLD_CLIPNODES) && hullIdx != -1;
 	bool selectEntClips = modelIdx > 0 && (g_render_flags & RENDER_ENT_CLIPNODES);
@@ -2002,17 +2176,9 @@ bool BspRenderer::pickModelPoly(vec3 start, vec3 dir, vec3 offset, vec3 rot, int
 	}
 
 	if (clipnodesLoaded && (selectWorldClips || selectEntClips) && hullIdx != -1) {
-		for (int i = 0; i < renderClipnodes[modelIdx].faceMaths[hullIdx].size(); i++) {
-			FaceMath faceMath = renderClipnodes[modelIdx].faceMaths[hullIdx][i];
-
-			if (hasAngles) {
-				rotateFaceMath(faceMath, angleTransform);
-			}
-
-			float t = bestDist;
-			if (pickFaceMath(start, dir, faceMath, t)) {
+		getClipnodePickBvh(modelIdx, hullIdx).raycast(start, dir, bestDist, [&](int i, float& dist) {
+			if (pickFaceMath(start, dir, renderClipnodes[modelIdx].faceMaths[hullIdx][i], dist)) {
 				foundBetterPick = true;
-				bestDist = t;
 
 				// Nav mesh WIP code
 				if (g_app->debugNavMesh && modelIdx == 0 && hullIdx == 3) {
@@ -2031,36 +2197,190 @@ bool BspRenderer::pickModelPoly(vec3 start, vec3 dir, vec3 offset, vec3 rot, int
 					logf("Picked hull %d, face %d, verts %d, area %.1f\nNav links %d\n", hullIdx, i, debugFaces[i].verts.size(), debugFaces[i].area, node.numLinks());
 				}
 			}
-		}
+		});
 	}
 
 	return foundBetterPick;
 }
 
 bool BspRenderer::pickFaceMath(vec3 start, vec3 dir, FaceMath& faceMath, float& bestDist) {
-	float dot = dotProduct(dir, faceMath.plane_z);
-	if (dot >= 0) {
-		return false; // don't select backfaces or parallel faces
+	if (!FaceMeshBuilder::pickFaceMath(start, dir, faceMath, bestDist)) {
+		return false;
 	}
 
-	float t = dotProduct((faceMath.plane_z * faceMath.fdist) - start, faceMath.plane_z) / dot;
-	if (t < 0 || t >= bestDist) {
-		return false; // intersection behind camera, or not a better pick
+	g_app->debugVec0 = start + dir * bestDist;
+	return true;
+}
+
+Bvh& BspRenderer::getFacePickBvh(int modelIdx) {
+	if (modelPickBvhs.size() < map->modelCount) {
+		modelPickBvhs.resize(map->modelCount);
 	}
 
-	// transform intersection point to the plane's coordinate system
-	vec3 intersection = start + dir * t;
-	vec2 localRayPoint = (faceMath.worldToLocal * vec4(intersection, 1)).xy();
+	ModelPickBvhs& pick = modelPickBvhs[modelIdx];
 
-	// check if point is inside the polygon using the plane's 2D coordinate system
-	if (!pointInsidePolygon(faceMath.localVerts, localRayPoint)) {
-		return false;
+	if (pick.facesDirty) {
+		BSPMODEL& model = map->models[modelIdx];
+
+		if (model.iFirstFace < 0 || model.iFirstFace + model.nFaces > numFaceMaths) {
+			pick.faces.clear();
+		}
+		else {
+			// vertex edits keep the face count, and moving a few verts doesn't need a new tree
+			bool refit = !pick.faces.empty() && pick.faces.primCount() == model.nFaces;
+			FaceMeshBuilder::buildFaceMathBvh(pick.faces, faceMaths + model.iFirstFace, model.nFaces, refit);
+		}
+		pick.facesDirty = false;
 	}
 
-	bestDist = t;
-	g_app->debugVec0 = intersection;
+	return pick.faces;
+}
 
-	return true;
+Bvh& BspRenderer::getClipnodePickBvh(int modelIdx, int hullIdx) {
+	if (modelPickBvhs.size() < map->modelCount) {
+		modelPickBvhs.resize(map->modelCount);
+	}
+
+	ModelPickBvhs& pick = modelPickBvhs[modelIdx];
+
+	if (pick.clipnodesDirty) {
+		for (int i = 0; i < MAX_MAP_HULLS; i++) {
+			if (clipnodesLoaded && modelIdx < numRenderClipnodes) {
+				vector<FaceMath>& clipFaces = renderClipnodes[modelIdx].faceMaths[i];
+				FaceMeshBuilder::buildFaceMathBvh(pick.clipnodes[i], clipFaces.empty() ? NULL : &clipFaces[0], clipFaces.size(), false);
+			}
+			else {
+				pick.clipnodes[i].clear();
+			}
+		}
+		pick.clipnodesDirty = false;
+	}
+
+	return pick.clipnodes[hullIdx];
+}
+
+void BspRenderer::getEntPickBounds(int entIdx, vec3& mins, vec3& maxs) {
+	RenderEnt& renderEnt = renderEnts[entIdx];
+	int modelIdx = renderEnt.modelIdx;
+
+	if (modelIdx < 0 || modelIdx >= map->modelCount) {
+		const vec3 padding = vec3(0.1f, 0.1f, 0.1f);
+		mins = maxs = renderEnt.offset;
+		if (renderEnt.pointEntCube) {
+			mins += renderEnt.pointEntCube->mins - padding;
+			maxs += renderEnt.pointEntCube->maxs + padding;
+		}
+		return;
+	}
+
+	// the face and clipnode boxes are already padded
+	bool hasBounds = false;
+	Bvh* bvhs[1 + MAX_MAP_HULLS];
+	bvhs[0] = &getFacePickBvh(modelIdx);
+	for (int i = 0; i < MAX_MAP_HULLS; i++) {
+		bvhs[1 + i] = &getClipnodePickBvh(modelIdx, i);
+	}
+
+	for (int i = 0; i < 1 + MAX_MAP_HULLS; i++) {
+		if (bvhs[i]->empty()) {
+			continue;
+		}
+		if (!hasBounds) {
+			mins = bvhs[i]->getMins();
+			maxs = bvhs[i]->getMaxs();
+			hasBounds = true;
+		}
+		else {
+			expandBoundingBox(bvhs[i]->getMins(), mins, maxs);
+			expandBoundingBox(bvhs[i]->getMaxs(), mins, maxs);
+		}
+	}
+
+	if (!hasBounds) {
+		mins = maxs = vec3();
+	}
+
+	Entity* ent = map->ents[entIdx];
+	if (ent->canRotate() && renderEnt.angles != vec3()) {
+		mat4x4 rotation = ent->getRotationMatrix(true);
+		vec3 modelMins = mins;
+		vec3 modelMaxs = maxs;
+
+		for (int i = 0; i < 8; i++) {
+			vec3 corner = vec3(i & 1 ? modelMaxs.x : modelMins.x,
+				i & 2 ? modelMaxs.y : modelMins.y,
+				i & 4 ? modelMaxs.z : modelMins.z);
+			corner = (rotation * vec4(corner, 1)).xyz();
+
+			if (i == 0) {
+				mins = maxs = corner;
+			}
+			else {
+				expandBoundingBox(corner, mins, maxs);
+			}
+		}
+	}
+
+	mins += renderEnt.offset;
+	maxs += renderEnt.offset;
+}
+
+void BspRenderer::updateEntPickBvh() {
+	int entCount = map->ents.size() - 1;
+
+	if (entPickBvhDirty || entPickBvh.primCount() != entCount) {
+		TRACE_SCOPE("BspRenderer::updateEntPickBvh");
+		vector<vec3> mins(entCount);
+		vector<vec3> maxs(entCount);
+
+		for (int i = 0; i < entCount; i++) {
+			getEntPickBounds(i + 1, mins[i], maxs[i]);
+		}
+
+		entPickBvh.build(mins, maxs);
+		entPickBvhDirty = false;
+		movedPickEnts.clear();
+		return;
+	}
+
+	for (int i = 0; i < movedPickEnts.size(); i++) {
+		int entIdx = movedPickEnts[i];
+		if (entIdx < 1 || entIdx > entCount) {
+			continue;
+		}
+
+		vec3 mins, maxs;
+		getEntPickBounds(entIdx, mins, maxs);
+		entPickBvh.update(entIdx - 1, mins, maxs);
+	}
+	movedPickEnts.clear();
+}
+
+void BspRenderer::invalidateModelPicking(int modelIdx, bool clipnodes) {
+	if (modelIdx >= 0 && modelIdx < modelPickBvhs.size()) {
+		modelPickBvhs[modelIdx].facesDirty = true;
+		modelPickBvhs[modelIdx].clipnodesDirty |= clipnodes;
+	}
+
+	if (entPickBvhDirty) {
+		return; // all bounds are recalculated on the next pick anyway
+	}
+
+	// entities using the model need new bounds
+	if (modelIdx < 0 || modelIdx >= modelEnts.size()) {
+		return;
+	}
+	for (int entIdx : modelEnts[modelIdx]) {
+		if (entIdx >= 1 && entIdx <= entPickBvh.primCount()) {
+			movedPickEnts.push_back(entIdx);
+		}
+	}
+}
+
+void BspRenderer::invalidateAllPicking() {
+	modelPickBvhs.clear();
+	entPickBvhDirty = true;
+	movedPickEnts.clear();
 }
 
 int BspRenderer::getBestClipnodeHull(int modelIdx) {
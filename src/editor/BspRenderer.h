@@ -4,6 +4,12 @@
 #include <vector>
 #include "Polygon3D.h"
 #include <future>
+#include "TextureDecoder.h"
+#include "ClipnodeMeshBuilder.h"
+#include "FaceMeshBuilder.h"
+#include "Bvh.h"
+#include "VisCuller.h"
+#include "LooseOctree.h"
 
 class NavMesh;
 class PointEntRenderer;
@@ -18,8 +24,6 @@ class Entity;
 struct LeafNode;
 struct WADTEX;
 
-#define LIGHTMAP_ATLAS_SIZE 512
-
 enum RenderFlags {
 	RENDER_TEXTURES = 1,
 	RENDER_LIGHTMAPS = 2,
@@ -36,28 +40,7 @@ enum RenderFlags {
 	RENDER_STUDIO_MDL = 4096,
 	RENDER_SPRITES = 8192,
 	RENDER_ENT_DIRECTIONS = 16384,
-};
-
-struct LightmapInfo {
-	// each face can have 4 lightmaps, and those may be split across multiple atlases
-	int atlasId[MAXLIGHTMAPS];
-	int x[MAXLIGHTMAPS];
-	int y[MAXLIGHTMAPS];
-
-	int w, h;
-
-	float midTexU, midTexV;
-	float midPolyU, midPolyV;
-};
-
-struct FaceMath {
-	mat4x4 worldToLocal; // transforms world coordiantes to this face's plane's coordinate system
-	vec3 plane_x;
-	vec3 plane_y;
-	vec3 plane_z;
-	float fdist;
-	vector<vec3> verts;
-	vector<vec2> localVerts;
+	RENDER_VIS_CULLING = 32768,
 };
 
 struct RenderEnt {
@@ -65,6 +48,7 @@ struct RenderEnt {
 	vec3 offset; // vertex transformations for picking
 	vec3 angles; // vertex transformations for picking
 	int modelIdx; // -1 = point entity
+	int pointEntIdx; // cube index in the point entity buffer, -1 if not in it
 	EntCube* pointEntCube;
 };
 
@@ -73,6 +57,12 @@ struct RenderGroup {
 	lightmapVert* verts;
 	int vertCount;
 	int wireframeVertCount;
+	int vertCapacity; // allocated verts, with room for faces that grow or move into this group
+	int wireframeVertCapacity;
+	int deadVerts; // verts of faces that moved out of their old range. They draw nothing but take up space.
+	int deadWireframeVerts;
+	int dirtyStart, dirtyEnd; // verts changed since the last upload (empty if end <= start)
+	int wireframeDirtyStart, wireframeDirtyEnd;
 	Texture* texture;
 	Texture* lightmapAtlas[MAXLIGHTMAPS];
 	VertexBuffer* buffer;
@@ -84,6 +74,8 @@ struct RenderFace {
 	int group;
 	int vertOffset;
 	int vertCount;
+	int wireframeVertOffset;
+	int wireframeVertCount;
 };
 
 struct RenderModel {
@@ -99,6 +91,14 @@ struct RenderClipnodes {
 	vector<FaceMath> faceMaths[MAX_MAP_HULLS];
 };
 
+// acceleration structures for picking faces in a model. Built on the first pick after a change.
+struct ModelPickBvhs {
+	Bvh faces; // primitives are offsets from the model's first face
+	Bvh clipnodes[MAX_MAP_HULLS]; // primitives are indexes into RenderClipnodes::faceMaths
+	bool facesDirty = true;
+	bool clipnodesDirty = true;
+};
+
 struct BSPMODEL;
 struct BSPFACE;
 
@@ -144,12 +144,26 @@ public:
 	vec3 mapOffset;
 	int showLightFlag = -1;
 	vector<Wad*> wads;
+	TextureDecodeStats textureStats; // from the last texture (re)load
+	VisibleSet visibleSet; // from the last visibility update
+	bool worldEdited = false; // world faces may no longer match their leaves, so only the frustum culls
+	uint64_t visGeometryHash = 0; // world face verts when the leaves were last known to match them
+
+	// world-space bounds of all entities, for finding the ones in view without checking every entity.
+	// Point entities include their model/sprite bounds once those are known.
+	LooseOctree entIndex;
+	vector<int> staleModelEnts; // entities whose model or sprite needs to be reloaded or repositioned
+	bool allModelEntsStale = true; // too many entities changed to list them
+	vector<int> studioDrawnEnts; // entities with models or sprites drawn in the last frame
 
 	BspRenderer(Bsp* map, ShaderProgram* bspShader, ShaderProgram* fullBrightBspShader, ShaderProgram* colorShader, PointEntRenderer* fgd);
 	~BspRenderer();
 
 	void render(const vector<int>& highlightedEnts, bool highlightAlwaysOnTop, int clipnodeHull, bool transparencyPass);
 
+	// culls the world and brush entities for the next render. Camera position is in world space.
+	void updateVisibility(vec3 cameraOrigin, vec3 cameraAngles, float aspect, float fov, float zFar);
+
 	void drawModel(int modelIdx, bool transparent, bool highlight, bool edgesOnly);
 	void drawModelClipnodes(int modelIdx, bool highlight, int hullIdx);
 	void drawPointEntities(const vector<int>& highlightedEnts);
@@ -159,6 +173,7 @@ public:
 	bool pickFaceMath(vec3 start, vec3 dir, FaceMath& faceMath, float& bestDist);
 
 	void refreshEnt(int entIdx);
+	void updateEntIndex(int entIdx); // call when an entity's model or sprite bounds change
 	int refreshModel(int modelIdx, bool refreshClipnodes=true);
 	bool refreshModelClipnodes(int modelIdx);
 	void refreshFace(int faceIdx);
@@ -219,6 +234,21 @@ private:
 	vector<Polygon3D> debugFaces;
 	NavMesh* debugNavMesh;
 
+	VisCuller* visCuller = NULL;
+	bool visibilityCulled = false; // visibleSet and the visible ranges apply to the next render
+	bool entsCulled = false; // visibleSet.ents applies to the next render
+	vector<int> staleIndexModels; // models whose entities need new bounds in entIndex
+	vector<vector<int>> modelEnts; // indexes of the entities using each model, kept by refreshEnt
+	vector<vector<int>> visibleRangeStarts; // vertex ranges of visible faces in each world render group
+	vector<vector<int>> visibleRangeCounts;
+	vector<vector<int>> visibleWireframeStarts;
+	vector<vector<int>> visibleWireframeCounts;
+
+	vector<ModelPickBvhs> modelPickBvhs; // indexed by model
+	Bvh entPickBvh; // world-space bounds of entities. Primitive i is entity i+1 (worldspawn is tested separately).
+	bool entPickBvhDirty = true; // entities were added or removed, or all models changed
+	vector<int> movedPickEnts; // entities to update in entPickBvh before the next pick
+
 
 	Texture** glTextures = NULL;
 	Texture** glLightmapTextures = NULL;
@@ -241,13 +271,24 @@ private:
 	bool clipnodesLoaded = false;
 	int clipnodeLeafCount = 0;
 	future<void> clipnodesFuture;
+	ClipnodeMeshBuilder clipnodeMeshBuilder; // cached meshes are freed with the map's renderer
 
 	void loadLightmaps();
 	void genRenderFaces(int& renderModelCount);
 	void loadClipnodes();
 	void generateClipnodeBuffer(int modelIdx);
+	void setClipnodeBuffers(int modelIdx, const shared_ptr<const ClipnodeMesh>* hullMeshes);
 	void generateNavMeshBuffer();
 	void deleteRenderModel(RenderModel* renderModel);
+	Bvh& getFacePickBvh(int modelIdx);
+	Bvh& getClipnodePickBvh(int modelIdx, int hullIdx);
+	void getEntPickBounds(int entIdx, vec3& mins, vec3& maxs);
+	void updateEntPickBvh();
+	void invalidateModelPicking(int modelIdx, bool clipnodes);
+	void invalidateAllPicking();
+	void updateStaleIndexModels();
+	uint64_t hashWorldGeometry(); // world face membership and vertex positions
+	void setEntModel(int entIdx, int modelIdx);
 	void deleteRenderModelClipnodes(RenderClipnodes* renderModel);
 	void deleteRenderClipnodes();
 	void deleteRenderFaces();
@@ -256,5 +297,20 @@ private:
 	void deleteFaceMaths();
 	void delayLoadData();
 	bool getRenderPointers(int faceIdx, RenderFace** renderFace, RenderGroup** renderGroup);
+
+	// rewrites only the faces whose verts changed, in place or in group slack. changedFaces also
+	// gets faces whose plane changed without moving their verts. Returns false if the model needs a
+	// full rebuild (faces added/removed, a new render group, out of slack, or too much dead slack).
+	bool updateModelFaces(int modelIdx, vector<int>& changedFaces);
+	bool isFaceMathStale(int faceIdx); // the face's plane or vert count differs from its FaceMath
+
+	// generates render groups for the models on the thread pool. The models must be deleted first.
+	// Buffers are created but not uploaded, so they're drawn from client memory until they are.
+	void buildRenderModels(const vector<int>& modelIdxs);
+	void layoutRenderModel(int modelIdx); // allocates faces and groups, without generating verts
+	void getFaceGroupKey(int faceIdx, Texture*& texture, Texture** lightmapAtlas, bool& transparent);
+	int findRenderGroup(RenderGroup* groups, int groupCount, Texture* texture, Texture** lightmapAtlas, bool transparent);
+	void markDirtyVerts(RenderGroup& group, int offset, int count, int wireframeOffset, int wireframeCount);
+	void uploadDirtyVerts(RenderGroup& group); // sends changed verts to the GPU
 	int getBestClipnodeHull(int modelIdx);
 };
\ No newline at end of file
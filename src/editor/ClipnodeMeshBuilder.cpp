@@ -0,0 +1,285 @@
+#include "ClipnodeMeshBuilder.h"
+#include "Clipper.h"
+#include "Bsp.h"
+#include "util.h"
+#include "globals.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+#include <algorithm>
+
+size_t ClipnodeMesh::sizeBytes() const {
+	size_t sz = sizeof(ClipnodeMesh);
+	sz += (faceVerts.size() + wireframeVerts.size()) * sizeof(cVert);
+	for (int i = 0; i < faceMaths.size(); i++) {
+		sz += sizeof(FaceMath) + faceMaths[i].verts.size() * sizeof(vec3) + faceMaths[i].localVerts.size() * sizeof(vec2);
+	}
+	return sz;
+}
+
+vector<shared_ptr<const ClipnodeMesh>> ClipnodeMeshBuilder::build(Bsp* map, const vector<int>& modelIdxs) {
+	TRACE_SCOPE("ClipnodeMeshBuilder::build");
+	vector<shared_ptr<const ClipnodeMesh>> meshes(modelIdxs.size() * MAX_MAP_HULLS);
+
+	// one task per hull. The world hulls take much longer than everything else, so splitting
+	// by model alone would leave most of the pool idle.
+	g_thread_pool->parallelFor(meshes.size(), [&](int i) {
+		meshes[i] = build(map, modelIdxs[i / MAX_MAP_HULLS], i % MAX_MAP_HULLS);
+	});
+
+	return meshes;
+}
+
+shared_ptr<const ClipnodeMesh> ClipnodeMeshBuilder::build(Bsp* map, int modelIdx, int hull) {
+	vector<uint8_t> key;
+	getHullKey(map, modelIdx, hull, key);
+	uint64_t hash = hashData(key.data(), key.size());
+
+	shared_ptr<const ClipnodeMesh> cached = getCached(hash, key);
+	if (cached) {
+		return cached;
+	}
+
+	shared_ptr<ClipnodeMesh> mesh(new ClipnodeMesh());
+	generate(map, modelIdx, hull, *mesh);
+	addCached(hash, key, mesh);
+
+	return mesh;
+}
+
+void ClipnodeMeshBuilder::generate(Bsp* map, int modelIdx, int hull, ClipnodeMesh& output) {
+	TRACE_SCOPE("ClipnodeMeshBuilder::generate");
+	static COLOR4 hullColors[] = {
+		COLOR4(255, 255, 255, 128),
+		COLOR4(96, 255, 255, 128),
+		COLOR4(255, 96, 255, 128),
+		COLOR4(255, 255, 96, 128),
+	};
+	COLOR4 color = hullColors[hull];
+
+	vector<CMesh> solidMeshes;
+	map->get_model_leaf_volumes(modelIdx, hull, CONTENTS_SOLID, solidMeshes);
+
+	output.faceVerts.clear();
+	output.wireframeVerts.clear();
+	output.faceMaths.clear();
+	output.leafCount = solidMeshes.size();
+
+	vector<int> uniqueFaceVerts;
+	vector<vec3> faceVerts;
+
+	for (int m = 0; m < solidMeshes.size(); m++) {
+		CMesh& mesh = solidMeshes[m];
+
+		for (int i = 0; i < mesh.faces.size(); i++) {
+
+			if (!mesh.faces[i].visible) {
+				continue;
+			}
+
+			uniqueFaceVerts.clear();
+
+			for (int k = 0; k < mesh.faces[i].edges.size(); k++) {
+				for (int v = 0; v < 2; v++) {
+					int vertIdx = mesh.edges[mesh.faces[i].edges[k]].verts[v];
+					if (!mesh.verts[vertIdx].visible) {
+						continue;
+					}
+					uniqueFaceVerts.push_back(vertIdx);
+				}
+			}
+
+			sort(uniqueFaceVerts.begin(), uniqueFaceVerts.end());
+			uniqueFaceVerts.erase(unique(uniqueFaceVerts.begin(), uniqueFaceVerts.end()), uniqueFaceVerts.end());
+
+			faceVerts.clear();
+			for (int k = 0; k < uniqueFaceVerts.size(); k++) {
+				faceVerts.push_back(mesh.verts[uniqueFaceVerts[k]].pos);
+			}
+
+			sortPlanarVerts(faceVerts);
+
+			if (faceVerts.size() < 3) {
+				//logf("Degenerate clipnode face discarded\n");
+				continue;
+			}
+
+			vec3 normal = getNormalFromVerts(faceVerts);
+
+			if (dotProduct(mesh.faces[i].normal, normal) < 0) {
+				reverse(faceVerts.begin(), faceVerts.end());
+				normal = normal.invert();
+			}
+
+			// calculations for face picking
+			{
+				FaceMath faceMath;
+				faceMath.plane_z = mesh.faces[i].normal;
+				faceMath.fdist = getDistAlongAxis(mesh.faces[i].normal, faceVerts[0]);
+
+				vec3 v0 = faceVerts[0];
+				vec3 v1;
+				bool found = false;
+				for (int z = 1; z < faceVerts.size(); z++) {
+					if (faceVerts[z] != v0) {
+						v1 = faceVerts[z];
+						found = true;
+						break;
+					}
+				}
+				if (!found) {
+					logf("Failed to find non-duplicate vert for clipnode face\n");
+				}
+
+				vec3 plane_z = mesh.faces[i].normal;
+				vec3 plane_x = faceMath.plane_x = (v1 - v0).normalize();
+				vec3 plane_y = faceMath.plane_y = crossProduct(plane_z, plane_x).normalize();
+				faceMath.worldToLocal = worldToLocalTransform(plane_x, plane_y, plane_z);
+
+				faceMath.verts = vector<vec3>(faceVerts.size());
+				faceMath.localVerts = vector<vec2>(faceVerts.size());
+				for (int k = 0; k < faceVerts.size(); k++) {
+					faceMath.verts[k] = faceVerts[k];
+					faceMath.localVerts[k] = (faceMath.worldToLocal * vec4(faceVerts[k], 1)).xy();
+				}
+
+				output.faceMaths.push_back(faceMath);
+			}
+
+			// create the verts for rendering
+			{
+				for (int k = 0; k < faceVerts.size(); k++) {
+					faceVerts[k] = faceVerts[k].flip();
+				}
+
+				COLOR4 wireframeColor = { 0, 0, 0, 255 };
+				for (int k = 0; k < faceVerts.size(); k++) {
+					output.wireframeVerts.push_back(cVert(faceVerts[k], wireframeColor));
+					output.wireframeVerts.push_back(cVert(faceVerts[(k + 1) % faceVerts.size()], wireframeColor));
+				}
+
+				vec3 lightDir = vec3(1, 1, -1).normalize();
+				float dot = (dotProduct(normal*-1, lightDir) + 1) / 2.0f;
+				if (dot > 0.5f) {
+					dot = dot * dot;
+				}
+				COLOR4 faceColor = color * (dot);
+
+				// convert from TRIANGLE_FAN style verts to TRIANGLES
+				for (int k = 2; k < faceVerts.size(); k++) {
+					output.faceVerts.push_back(cVert(faceVerts[0], faceColor));
+					output.faceVerts.push_back(cVert(faceVerts[k - 1], faceColor));
+					output.faceVerts.push_back(cVert(faceVerts[k], faceColor));
+				}
+			}
+		}
+	}
+}
+
+static inline void appendBytes(vector<uint8_t>& key, const void* data, int len) {
+	const uint8_t* bytes = (const uint8_t*)data;
+	key.insert(key.end(), bytes, bytes + len);
+}
+
+// pre-order walk. Node and plane indexes aren't stored, only what they point to, so a model that
+// was only moved around in the lumps (e.g. after deleting another model) still matches.
+static void appendNode(vector<uint8_t>& key, Bsp* map, int iNode, bool isClipnode) {
+	int iPlane = isClipnode ? map->clipnodes[iNode].iPlane : map->nodes[iNode].iPlane;
+	int maxNodes = isClipnode ? map->clipnodeCount : map->nodeCount;
+
+	if (iPlane < 0 || iPlane >= map->planeCount) {
+		int32_t badPlane = -1;
+		appendBytes(key, &badPlane, sizeof(int32_t));
+		return;
+	}
+	BSPPLANE& plane = map->planes[iPlane];
+	appendBytes(key, &plane.vNormal, sizeof(vec3));
+	appendBytes(key, &plane.fDist, sizeof(float));
+
+	for (int i = 0; i < 2; i++) {
+		int child = isClipnode ? map->clipnodes[iNode].iChildren[i] : map->nodes[iNode].iChildren[i];
+		uint8_t isNode = child >= 0 && child < maxNodes;
+		appendBytes(key, &isNode, 1);
+
+		if (isNode) {
+			appendNode(key, map, child, isClipnode);
+			continue;
+		}
+
+		int32_t contents = child;
+		if (!isClipnode && child < 0 && ~child < map->leafCount) {
+			contents = map->leaves[~child].nContents;
+		}
+		appendBytes(key, &contents, sizeof(int32_t));
+	}
+}
+
+void ClipnodeMeshBuilder::getHullKey(Bsp* map, int modelIdx, int hull, vector<uint8_t>& key) {
+	key.clear();
+	appendBytes(key, &hull, sizeof(int));
+
+	if (modelIdx < 0 || modelIdx >= map->modelCount || hull < 0 || hull >= MAX_MAP_HULLS) {
+		return;
+	}
+
+	int headNode = map->models[modelIdx].iHeadnodes[hull];
+	int maxNodes = hull == 0 ? map->nodeCount : map->clipnodeCount;
+	if (headNode >= 0 && headNode < maxNodes) {
+		appendNode(key, map, headNode, hull != 0);
+	}
+}
+
+ClipnodeMeshStats ClipnodeMeshBuilder::getStats() {
+	lock_guard<mutex> lock(cacheMutex);
+	return stats;
+}
+
+void ClipnodeMeshBuilder::clearCache() {
+	lock_guard<mutex> lock(cacheMutex);
+	cache.clear();
+	lru.clear();
+	cacheBytes = 0;
+}
+
+shared_ptr<const ClipnodeMesh> ClipnodeMeshBuilder::getCached(uint64_t hash, const vector<uint8_t>& key) {
+	lock_guard<mutex> lock(cacheMutex);
+
+	auto entry = cache.find(hash);
+	if (entry == cache.end() || entry->second.key != key) {
+		return NULL;
+	}
+
+	lru.splice(lru.begin(), lru, entry->second.lruPos);
+	stats.cacheHits++;
+	return entry->second.mesh;
+}
+
+void ClipnodeMeshBuilder::addCached(uint64_t hash, const vector<uint8_t>& key, shared_ptr<const ClipnodeMesh> mesh) {
+	lock_guard<mutex> lock(cacheMutex);
+	stats.built++;
+
+	auto existing = cache.find(hash);
+	if (existing != cache.end()) {
+		if (existing->second.key == key) {
+			return; // another thread built the same hull (e.g. identical func_wall copies)
+		}
+		removeCached(existing); // hash collision. Keep the newest hull.
+	}
+
+	lru.push_front(hash);
+	CacheEntry& entry = cache[hash];
+	entry.mesh = mesh;
+	entry.key = key;
+	entry.lruPos = lru.begin();
+	cacheBytes += mesh->sizeBytes() + key.size();
+
+	while (cacheBytes > MAX_CACHE_BYTES && lru.size() > 1) {
+		removeCached(cache.find(lru.back()));
+		stats.evicted++;
+	}
+}
+
+void ClipnodeMeshBuilder::removeCached(unordered_map<uint64_t, CacheEntry>::iterator entry) {
+	cacheBytes -= entry->second.mesh->sizeBytes() + entry->second.key.size();
+	lru.erase(entry->second.lruPos);
+	cache.erase(entry);
+}
@@ -0,0 +1,71 @@
+#pragma once
+#include "bsplimits.h"
+#include "primitives.h"
+#include "FaceMeshBuilder.h"
+#include <vector>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+class Bsp;
+
+// CPU-side geometry for one hull of a model's clipnode visualization
+struct ClipnodeMesh {
+	vector<cVert> faceVerts; // triangles
+	vector<cVert> wireframeVerts; // lines
+	vector<FaceMath> faceMaths; // for picking
+	int leafCount = 0; // number of solid leaf volumes in the mesh
+
+	size_t sizeBytes() const;
+};
+
+struct ClipnodeMeshStats {
+	int built; // meshes generated from the BSP tree
+	int cacheHits; // meshes reused because the hull hadn't changed
+	int evicted;
+};
+
+// Builds clipnode meshes on the shared thread pool. Does not touch OpenGL, so it can be used
+// without a window. Meshes are cached by the hull's node tree and planes, so models that didn't
+// change are reused after edits instead of being clipped again.
+class ClipnodeMeshBuilder {
+public:
+	// cache size limit, in bytes of mesh data
+	static const size_t MAX_CACHE_BYTES = 256 * 1024 * 1024;
+
+	// builds all hulls of the given models. Output is indexed by [model*MAX_MAP_HULLS + hull].
+	// Hulls with no solid volume get an empty mesh.
+	vector<shared_ptr<const ClipnodeMesh>> build(Bsp* map, const vector<int>& modelIdxs);
+
+	// builds or gets a cached mesh for a single hull
+	shared_ptr<const ClipnodeMesh> build(Bsp* map, int modelIdx, int hull);
+
+	// generates the mesh from scratch, without the cache
+	static void generate(Bsp* map, int modelIdx, int hull, ClipnodeMesh& mesh);
+
+	// serializes everything that affects the mesh for this hull (node layout, planes, leaf contents).
+	// Hulls with equal keys have equal meshes.
+	static void getHullKey(Bsp* map, int modelIdx, int hull, vector<uint8_t>& key);
+
+	ClipnodeMeshStats getStats();
+
+	void clearCache();
+
+private:
+	struct CacheEntry {
+		shared_ptr<const ClipnodeMesh> mesh;
+		vector<uint8_t> key; // compared on lookup, in case two hulls have the same hash
+		list<uint64_t>::iterator lruPos;
+	};
+
+	mutex cacheMutex;
+	unordered_map<uint64_t, CacheEntry> cache;
+	list<uint64_t> lru; // most recently used first
+	size_t cacheBytes = 0;
+	ClipnodeMeshStats stats = ClipnodeMeshStats();
+
+	shared_ptr<const ClipnodeMesh> getCached(uint64_t hash, const vector<uint8_t>& key);
+	void addCached(uint64_t hash, const vector<uint8_t>& key, shared_ptr<const ClipnodeMesh> mesh);
+	void removeCached(unordered_map<uint64_t, CacheEntry>::iterator entry);
+};
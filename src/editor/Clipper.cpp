@@ -10,24 +10,28 @@ CMesh Clipper::clip(vector<BSPPLANE>& clips) {
 	CMesh mesh = createMaxSizeVolume();
 
 	for (int i = 0; i < clips.size(); i++) {
-		BSPPLANE clip = clips[i];
-
-		int result = clipVertices(mesh, clip);
-
-		if (result == -1) {
-			// everything clipped
+		if (!clip(mesh, clips[i])) {
 			return CMesh();
 		}
-		if (result == 1) {
-			// nothing clipped
-			continue;
-		}
+	}
+
+	return mesh;
+}
 
+bool Clipper::clip(CMesh& mesh, BSPPLANE& clip) {
+	int result = clipVertices(mesh, clip);
+
+	if (result == -1) {
+		// everything clipped
+		mesh.clear();
+		return false;
+	}
+	if (result == 0) {
 		clipEdges(mesh, clip);
 		clipFaces(mesh, clip);
 	}
 
-	return mesh;
+	return !mesh.empty();
 }
 
 CMesh Clipper::clip(vector<Polygon3D>& clips) {
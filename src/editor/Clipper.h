@@ -71,6 +71,13 @@ public:
 	// clips a box against the list of clipping planes, in order, to create a convex volume
 	CMesh clip(vector<Polygon3D>& clips);
 
+	// clips the mesh in place, keeping the part in front of the plane.
+	// Returns false and clears the mesh if everything was clipped away.
+	bool clip(CMesh& mesh, BSPPLANE& clip);
+
+	// a box the size of the whole map, to be cut down with clip()
+	CMesh createMaxSizeVolume();
+
 	// load mesh from a set of polygons and split it by another poly
 	// 0 = no splitting done
 	// 1 = successful split
@@ -87,6 +94,4 @@ private:
 	void clipEdges(CMesh& mesh, BSPPLANE& clip);
 	void clipFaces(CMesh& mesh, BSPPLANE& clip);
 	bool getOpenPolyline(CMesh& mesh, CFace& face, int& start, int& final);
-
-	CMesh createMaxSizeVolume();
 };
\ No newline at end of file
@@ -664,6 +664,7 @@ void CleanMapCommand::execute() {
 
 	logf("Cleaning %s\n", map->name.c_str());
 	map->remove_unused_model_structures().print_delete_stats(1);
+	map->merge_duplicate_planes().print_delete_stats(1);
 
 	refresh();
 }
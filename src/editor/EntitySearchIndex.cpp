@@ -0,0 +1,317 @@
+#include "EntitySearchIndex.h"
+#include "Entity.h"
+#include <algorithm>
+
+// reindexing this fraction of the entities or more rebuilds the whole index instead,
+// which is faster than inserting into the middle of every posting list
+#define ENT_INDEX_REBUILD_FRACTION 8
+
+static uint32_t getTrigram(const string& s, int offset) {
+	return ((uint8_t)s[offset] << 16) | ((uint8_t)s[offset + 1] << 8) | (uint8_t)s[offset + 2];
+}
+
+static void addPosting(vector<int>& list, int entIdx, bool append) {
+	if (append) {
+		if (list.empty() || list.back() != entIdx) {
+			list.push_back(entIdx);
+		}
+		return;
+	}
+
+	auto it = lower_bound(list.begin(), list.end(), entIdx);
+	if (it == list.end() || *it != entIdx) {
+		list.insert(it, entIdx);
+	}
+}
+
+static void removePosting(vector<int>& list, int entIdx) {
+	auto it = lower_bound(list.begin(), list.end(), entIdx);
+	if (it != list.end() && *it == entIdx) {
+		list.erase(it);
+	}
+}
+
+int EntitySearchIndex::sync(const vector<Entity*>& ents) {
+	int changed = abs((int)ents.size() - (int)entries.size());
+	int common = min(ents.size(), entries.size());
+	for (int i = 0; i < common; i++) {
+		if (entries[i].ent != ents[i] || entries[i].revision != ents[i]->revision) {
+			changed++;
+		}
+	}
+
+	if (changed == 0) {
+		return 0;
+	}
+
+	if (changed * ENT_INDEX_REBUILD_FRACTION >= (int)ents.size()) {
+		// interned strings are kept, so only new keyvalues need lowercasing
+		for (int i = 0; i < keyEnts.size(); i++) {
+			keyEnts[i].clear();
+			valueEnts[i].clear();
+			classEnts[i].clear();
+		}
+		entries.clear();
+		entries.resize(ents.size());
+		for (int i = 0; i < ents.size(); i++) {
+			addEnt(i, ents[i], true);
+		}
+		return ents.size();
+	}
+
+	for (int i = ents.size(); i < entries.size(); i++) {
+		removeEnt(i);
+	}
+	entries.resize(ents.size());
+
+	for (int i = 0; i < ents.size(); i++) {
+		if (entries[i].ent != ents[i] || entries[i].revision != ents[i]->revision) {
+			removeEnt(i);
+			addEnt(i, ents[i], false);
+		}
+	}
+
+	return changed;
+}
+
+void EntitySearchIndex::clear() {
+	entries.clear();
+	strings.clear();
+	stringIds.clear();
+	keyEnts.clear();
+	valueEnts.clear();
+	classEnts.clear();
+	keyIds.clear();
+	trigrams.clear();
+}
+
+int EntitySearchIndex::intern(const string& s) {
+	auto existing = stringIds.find(s);
+	if (existing != stringIds.end()) {
+		return existing->second;
+	}
+
+	int id = strings.size();
+	strings.push_back(s);
+	stringIds[s] = id;
+	keyEnts.push_back(vector<int>());
+	valueEnts.push_back(vector<int>());
+	classEnts.push_back(vector<int>());
+
+	// ids only increase, so the trigram lists stay sorted
+	for (int i = 0; i + 3 <= (int)s.size(); i++) {
+		vector<int>& list = trigrams[getTrigram(s, i)];
+		if (list.empty() || list.back() != id) {
+			list.push_back(id);
+		}
+	}
+
+	return id;
+}
+
+int EntitySearchIndex::findString(const string& s) const {
+	auto existing = stringIds.find(s);
+	return existing != stringIds.end() ? existing->second : -1;
+}
+
+void EntitySearchIndex::addEnt(int entIdx, Entity* ent, bool append) {
+	Entry& entry = entries[entIdx];
+	entry.ent = ent;
+	entry.revision = ent->revision;
+	entry.keyvalues.clear();
+
+	for (int i = 0; i < ent->keyOrder.size(); i++) {
+		const string& key = ent->keyOrder[i];
+		int keyId = intern(toLowerCase(key));
+		int valueId = intern(toLowerCase(ent->getKeyvalue(key)));
+
+		if (keyEnts[keyId].empty() && find(keyIds.begin(), keyIds.end(), keyId) == keyIds.end()) {
+			keyIds.push_back(keyId);
+		}
+
+		entry.keyvalues.push_back(make_pair(keyId, valueId));
+		addPosting(keyEnts[keyId], entIdx, append);
+		addPosting(valueEnts[valueId], entIdx, append);
+	}
+
+	entry.classname = ent->getClassname();
+	entry.classId = intern(toLowerCase(entry.classname));
+	addPosting(classEnts[entry.classId], entIdx, append);
+}
+
+void EntitySearchIndex::removeEnt(int entIdx) {
+	if (entIdx >= entries.size() || entries[entIdx].ent == NULL) {
+		return;
+	}
+
+	Entry& entry = entries[entIdx];
+	for (int i = 0; i < entry.keyvalues.size(); i++) {
+		removePosting(keyEnts[entry.keyvalues[i].first], entIdx);
+		removePosting(valueEnts[entry.keyvalues[i].second], entIdx);
+	}
+	removePosting(classEnts[entry.classId], entIdx);
+
+	entry = Entry();
+}
+
+void EntitySearchIndex::findStrings(const string& search, bool partial, const vector<int>* candidates, vector<char>& matches) const {
+	if (!partial) {
+		int exact = findString(search);
+		if (exact != -1) {
+			matches[exact] = 1;
+		}
+		return;
+	}
+
+	if (search.size() >= 3) {
+		// every match contains all of the search's trigrams, so only test strings with the rarest one
+		const vector<int>* rarest = NULL;
+		for (int i = 0; i + 3 <= (int)search.size(); i++) {
+			auto list = trigrams.find(getTrigram(search, i));
+			if (list == trigrams.end()) {
+				return;
+			}
+			if (!rarest || list->second.size() < rarest->size()) {
+				rarest = &list->second;
+			}
+		}
+		if (!candidates || rarest->size() < candidates->size()) {
+			candidates = rarest;
+		}
+	}
+
+	if (candidates) {
+		for (int i = 0; i < candidates->size(); i++) {
+			int id = (*candidates)[i];
+			if (strings[id].find(search) != string::npos) {
+				matches[id] = 1;
+			}
+		}
+	}
+	else {
+		for (int id = 0; id < strings.size(); id++) {
+			if (!valueEnts[id].empty() && strings[id].find(search) != string::npos) {
+				matches[id] = 1;
+			}
+		}
+	}
+}
+
+void EntitySearchIndex::query(const EntityFilter& filter, vector<int>& output) const {
+	const vector<int>* classList = NULL;
+	int classId = -1;
+	string classname = toLowerCase(filter.classname);
+	if (!classname.empty()) {
+		classId = findString(classname);
+		if (classId == -1) {
+			return;
+		}
+		classList = &classEnts[classId];
+	}
+
+	struct Search {
+		bool hasKey;
+		bool hasValue;
+		vector<char> keyMatches;
+		vector<char> valueMatches;
+	};
+	vector<Search> searches;
+
+	for (int i = 0; i < filter.keyvalues.size(); i++) {
+		string key = trimSpaces(toLowerCase(filter.keyvalues[i].first));
+		string value = trimSpaces(toLowerCase(filter.keyvalues[i].second));
+		if (key.empty() && value.empty()) {
+			continue;
+		}
+
+		Search search;
+		search.hasKey = !key.empty();
+		search.hasValue = !value.empty();
+		if (search.hasKey) {
+			search.keyMatches.resize(strings.size());
+			findStrings(key, filter.partialMatches, &keyIds, search.keyMatches);
+		}
+		if (search.hasValue) {
+			search.valueMatches.resize(strings.size());
+			findStrings(value, filter.partialMatches, NULL, search.valueMatches);
+		}
+		searches.push_back(search);
+	}
+
+	// gather candidates from the posting lists of the first search, then check everything else
+	vector<int> candidates;
+	if (searches.size()) {
+		const Search& first = searches[0];
+		const vector<vector<int>>& postings = first.hasKey ? keyEnts : valueEnts;
+		const vector<char>& matches = first.hasKey ? first.keyMatches : first.valueMatches;
+
+		vector<char> seen(entries.size());
+		for (int id = 0; id < matches.size(); id++) {
+			if (!matches[id]) {
+				continue;
+			}
+			const vector<int>& list = postings[id];
+			for (int k = 0; k < list.size(); k++) {
+				if (!seen[list[k]]) {
+					seen[list[k]] = 1;
+					candidates.push_back(list[k]);
+				}
+			}
+		}
+		sort(candidates.begin(), candidates.end());
+	}
+	else if (classList) {
+		candidates = *classList;
+	}
+	else {
+		for (int i = 0; i < entries.size(); i++) {
+			if (entries[i].ent) {
+				candidates.push_back(i);
+			}
+		}
+	}
+
+	for (int i = 0; i < candidates.size(); i++) {
+		const Entry& entry = entries[candidates[i]];
+
+		if (classList && entry.classId != classId) {
+			continue;
+		}
+
+		bool visible = true;
+		for (int s = 0; s < searches.size() && visible; s++) {
+			const Search& search = searches[s];
+
+			if (search.hasKey) {
+				// only the first matching key is checked for the value
+				int matchIdx = -1;
+				for (int k = 0; k < entry.keyvalues.size(); k++) {
+					if (search.keyMatches[entry.keyvalues[k].first]) {
+						matchIdx = k;
+						break;
+					}
+				}
+				if (matchIdx == -1) {
+					visible = false;
+				}
+				else if (search.hasValue && !search.valueMatches[entry.keyvalues[matchIdx].second]) {
+					visible = false;
+				}
+			}
+			else {
+				bool foundMatch = false;
+				for (int k = 0; k < entry.keyvalues.size(); k++) {
+					if (search.valueMatches[entry.keyvalues[k].second]) {
+						foundMatch = true;
+						break;
+					}
+				}
+				visible = foundMatch;
+			}
+		}
+
+		if (visible) {
+			output.push_back(candidates[i]);
+		}
+	}
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include "util.h"
+#include <vector>
+#include <unordered_map>
+
+class Entity;
+
+struct EntityFilter {
+	string classname; // empty to match any class
+	vector<pair<string, string>> keyvalues; // key and value searches. Either can be empty.
+	bool partialMatches = true;
+};
+
+// Search index over entity keys and values, so that filtering large entity lists doesn't need to
+// lowercase and scan every keyvalue on each keystroke. Keys and values are lowercased once and
+// interned, with a sorted list of the entities using each one. Substring searches look up
+// candidate strings in a trigram index instead of testing all of them.
+class EntitySearchIndex {
+public:
+	// reindexes entities that were added, removed, or edited since the last sync, by comparing
+	// entity pointers and revisions. Returns the number of entities that were reindexed.
+	int sync(const vector<Entity*>& ents);
+
+	void clear();
+
+	// adds the sorted indexes of entities that match the filter. Read-only, so this can run on
+	// another thread as long as sync() isn't called until it finishes.
+	void query(const EntityFilter& filter, vector<int>& output) const;
+
+	// classname of an indexed entity, as it was when last synced
+	const string& getClassname(int entIdx) const { return entries[entIdx].classname; }
+
+	int size() const { return entries.size(); }
+
+private:
+	struct Entry {
+		Entity* ent = NULL;
+		uint64_t revision = 0;
+		string classname;
+		int classId = -1; // lowercase classname
+		vector<pair<int, int>> keyvalues; // lowercase key and value ids, in key order
+	};
+
+	vector<Entry> entries; // indexed by entity index
+
+	vector<string> strings; // lowercase, indexed by id
+	unordered_map<string, int> stringIds;
+	vector<vector<int>> keyEnts; // entities with each key, indexed by string id
+	vector<vector<int>> valueEnts; // entities with each value
+	vector<vector<int>> classEnts; // entities with each classname
+	vector<int> keyIds; // strings that have been used as a key
+	unordered_map<uint32_t, vector<int>> trigrams; // ids of strings containing each trigram
+
+	int intern(const string& s);
+	int findString(const string& s) const;
+
+	void addEnt(int entIdx, Entity* ent, bool append);
+	void removeEnt(int entIdx);
+
+	// marks ids of strings that equal or contain the search string. Partial searches only test the
+	// candidates, or the strings that share a trigram with the search if there are fewer of those.
+	void findStrings(const string& search, bool partial, const vector<int>* candidates, vector<char>& matches) const;
+};
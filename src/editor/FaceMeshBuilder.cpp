@@ -0,0 +1,223 @@
+#include "FaceMeshBuilder.h"
+#include "Bsp.h"
+#include "util.h"
+#include "Bvh.h"
+
+void FaceMeshBuilder::generate(Bsp* map, int faceIdx, const LightmapInfo* lmap, vector<lightmapVert>& verts, vector<lightmapVert>& wireframeVerts) {
+	int edgeCount = map->faces[faceIdx].nEdges;
+	int vertOffset = verts.size();
+	int wireframeVertOffset = wireframeVerts.size();
+
+	verts.resize(vertOffset + getVertCount(edgeCount));
+	wireframeVerts.resize(wireframeVertOffset + getWireframeVertCount(edgeCount));
+
+	generate(map, faceIdx, lmap, verts.data() + vertOffset, wireframeVerts.data() + wireframeVertOffset);
+}
+
+static lightmapVert getWireframeVert(lightmapVert v) {
+	v.luv[0][2] = 1.0f;
+	v.luv[1][2] = 0.0f;
+	v.luv[2][2] = 0.0f;
+	v.luv[3][2] = 0.0f;
+	v.r = 1.0f;
+	v.g = 1.0f;
+	v.b = 1.0f;
+	v.a = 1.0f;
+	return v;
+}
+
+void FaceMeshBuilder::generate(Bsp* map, int faceIdx, const LightmapInfo* lmap, lightmapVert* verts, lightmapVert* wireframeVerts) {
+	BSPFACE& face = map->faces[faceIdx];
+	BSPTEXTUREINFO& texinfo = map->texinfos[face.iTextureInfo];
+	int32_t texOffset = ((int32_t*)map->textures)[texinfo.iMiptex + 1];
+
+	int texWidth, texHeight;
+	if (texOffset != -1) {
+		BSPMIPTEX& tex = *((BSPMIPTEX*)(map->textures + texOffset));
+		texWidth = tex.nWidth;
+		texHeight = tex.nHeight;
+	}
+	else {
+		// missing texture
+		texWidth = 16;
+		texHeight = 16;
+	}
+
+	if (face.nEdges < 3) {
+		return;
+	}
+
+	float lw = 0;
+	float lh = 0;
+	if (lmap) {
+		lw = (float)lmap->w / (float)LIGHTMAP_ATLAS_SIZE;
+		lh = (float)lmap->h / (float)LIGHTMAP_ATLAS_SIZE;
+	}
+
+	bool isSpecial = texinfo.nFlags & TEX_SPECIAL;
+	bool hasLighting = face.nStyles[0] != 255 && face.nLightmapOffset >= 0 && !isSpecial;
+
+	lightmapVert first;
+	lightmapVert prev;
+
+	for (int e = 0; e < face.nEdges; e++) {
+		int32_t edgeIdx = map->surfedges[face.iFirstEdge + e];
+		BSPEDGE& edge = map->edges[abs(edgeIdx)];
+		int vertIdx = edgeIdx < 0 ? edge.iVertex[1] : edge.iVertex[0];
+
+		vec3& vert = map->verts[vertIdx];
+
+		// zeroed so that unused lightmap coordinates compare equal between rebuilds
+		lightmapVert v = lightmapVert();
+		v.x = vert.x;
+		v.y = vert.z;
+		v.z = -vert.y;
+
+		v.r = 1.0f;
+		v.g = 1.0f;
+		v.b = 1.0f;
+		v.a = isSpecial ? 0.5f : 1.0f;
+
+		// texture coords
+		float tw = 1.0f / (float)texWidth;
+		float th = 1.0f / (float)texHeight;
+		float fU = dotProduct(texinfo.vS, vert) + texinfo.shiftS;
+		float fV = dotProduct(texinfo.vT, vert) + texinfo.shiftT;
+		v.u = fU * tw;
+		v.v = fV * th;
+
+		// lightmap texture coords
+		if (hasLighting && lmap) {
+			float fLightMapU = lmap->midTexU + (fU - lmap->midPolyU) / 16.0f;
+			float fLightMapV = lmap->midTexV + (fV - lmap->midPolyV) / 16.0f;
+
+			float uu = (fLightMapU / (float)lmap->w) * lw;
+			float vv = (fLightMapV / (float)lmap->h) * lh;
+
+			float pixelStep = 1.0f / (float)LIGHTMAP_ATLAS_SIZE;
+
+			for (int s = 0; s < MAXLIGHTMAPS; s++) {
+				v.luv[s][0] = uu + lmap->x[s] * pixelStep;
+				v.luv[s][1] = vv + lmap->y[s] * pixelStep;
+			}
+		}
+		// set lightmap scales
+		for (int s = 0; s < MAXLIGHTMAPS; s++) {
+			v.luv[s][2] = (hasLighting && face.nStyles[s] != 255) ? 1.0f : 0.0f;
+			if (isSpecial && s == 0) {
+				v.luv[s][2] = 1.0f;
+			}
+		}
+
+		// convert TRIANGLE_FAN verts to TRIANGLES so multiple faces can be drawn in a single draw call
+		if (e >= 2) {
+			// reverse order due to coordinate system swap
+			lightmapVert* tri = verts + (e - 2) * 3;
+			tri[0] = v;
+			tri[1] = prev;
+			tri[2] = first;
+		}
+
+		// edge lines, each starting where the last one ended
+		lightmapVert wireVert = getWireframeVert(v);
+		wireframeVerts[e * 2] = wireVert;
+		if (e > 0) {
+			wireframeVerts[e * 2 - 1] = wireVert;
+		}
+		else {
+			first = v;
+		}
+		prev = v;
+	}
+	wireframeVerts[face.nEdges * 2 - 1] = getWireframeVert(first);
+}
+
+void FaceMeshBuilder::calcFaceMath(Bsp* map, int faceIdx, FaceMath& faceMath) {
+	BSPFACE& face = map->faces[faceIdx];
+	BSPPLANE& plane = map->planes[face.iPlane];
+	vec3 planeNormal = face.nPlaneSide ? plane.vNormal * -1 : plane.vNormal;
+	float fDist = face.nPlaneSide ? -plane.fDist : plane.fDist;
+
+	faceMath.plane_z = planeNormal;
+	faceMath.fdist = fDist;
+	
+	vector<vec3> allVerts(face.nEdges);
+	vec3 v1;
+	for (int e = 0; e < face.nEdges; e++) {
+		int32_t edgeIdx = map->surfedges[face.iFirstEdge + e];
+		BSPEDGE& edge = map->edges[abs(edgeIdx)];
+		int vertIdx = edgeIdx < 0 ? edge.iVertex[1] : edge.iVertex[0];
+		allVerts[e] = map->verts[vertIdx];
+
+		// 2 verts can share the same position on a face, so need to find one that isn't shared (aomdc_1intro)
+		if (e > 0 && allVerts[e] != allVerts[0]) {
+			v1 = allVerts[e];
+		}
+	}
+
+	vec3 plane_x = faceMath.plane_x = (v1 - allVerts[0]).normalize(1.0f);
+	vec3 plane_y = faceMath.plane_y = crossProduct(planeNormal, plane_x).normalize(1.0f);
+	vec3 plane_z = planeNormal;
+
+	faceMath.worldToLocal = worldToLocalTransform(plane_x, plane_y, plane_z);
+
+	faceMath.verts = vector<vec3>(allVerts.size());
+	faceMath.localVerts = vector<vec2>(allVerts.size());
+	for (int i = 0; i < allVerts.size(); i++) {
+		faceMath.verts[i] = allVerts[i];
+		faceMath.localVerts[i] = (faceMath.worldToLocal * vec4(allVerts[i], 1)).xy();
+	}
+}
+
+bool FaceMeshBuilder::pickFaceMath(vec3 start, vec3 dir, FaceMath& faceMath, float& bestDist) {
+	float dot = dotProduct(dir, faceMath.plane_z);
+	if (dot >= 0) {
+		return false; // don't select backfaces or parallel faces
+	}
+
+	float t = dotProduct((faceMath.plane_z * faceMath.fdist) - start, faceMath.plane_z) / dot;
+	if (t < 0 || t >= bestDist) {
+		return false; // intersection behind camera, or not a better pick
+	}
+
+	// transform intersection point to the plane's coordinate system
+	vec3 intersection = start + dir * t;
+	vec2 localRayPoint = (faceMath.worldToLocal * vec4(intersection, 1)).xy();
+
+	// check if point is inside the polygon using the plane's 2D coordinate system
+	if (!pointInsidePolygon(faceMath.localVerts, localRayPoint)) {
+		return false;
+	}
+
+	bestDist = t;
+	return true;
+}
+
+void FaceMeshBuilder::buildFaceMathBvh(Bvh& bvh, const FaceMath* faces, int count, bool refit) {
+	// padded so that float rounding in the box test can't miss hits on the edge of a face
+	const vec3 padding = vec3(0.1f, 0.1f, 0.1f);
+
+	vector<vec3> mins(count);
+	vector<vec3> maxs(count);
+
+	for (int i = 0; i < count; i++) {
+		const vector<vec3>& verts = faces[i].verts;
+		if (verts.empty()) {
+			continue;
+		}
+
+		mins[i] = maxs[i] = verts[0];
+		for (int k = 1; k < verts.size(); k++) {
+			expandBoundingBox(verts[k], mins[i], maxs[i]);
+		}
+		mins[i] -= padding;
+		maxs[i] += padding;
+	}
+
+	if (refit) {
+		bvh.refit(mins, maxs);
+	}
+	else {
+		bvh.build(mins, maxs);
+	}
+}
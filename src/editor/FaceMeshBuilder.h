@@ -0,0 +1,57 @@
+#pragma once
+#include "bsplimits.h"
+#include "primitives.h"
+#include "mat4x4.h"
+#include <vector>
+
+class Bsp;
+class Bvh;
+
+#define LIGHTMAP_ATLAS_SIZE 512
+
+struct LightmapInfo {
+	// each face can have 4 lightmaps, and those may be split across multiple atlases
+	int atlasId[MAXLIGHTMAPS];
+	int x[MAXLIGHTMAPS];
+	int y[MAXLIGHTMAPS];
+
+	int w, h;
+
+	float midTexU, midTexV;
+	float midPolyU, midPolyV;
+};
+
+struct FaceMath {
+	mat4x4 worldToLocal; // transforms world coordiantes to this face's plane's coordinate system
+	vec3 plane_x;
+	vec3 plane_y;
+	vec3 plane_z;
+	float fdist;
+	vector<vec3> verts;
+	vector<vec2> localVerts;
+};
+
+// Generates the vertex data used to draw faces. Does not touch OpenGL, so it can be used
+// without a window and from any thread.
+class FaceMeshBuilder {
+public:
+	// appends the face's triangles to verts and its edges (as line pairs) to wireframeVerts.
+	// lmap is NULL if lightmaps haven't been generated yet.
+	static void generate(Bsp* map, int faceIdx, const LightmapInfo* lmap, vector<lightmapVert>& verts, vector<lightmapVert>& wireframeVerts);
+
+	// same as above, but writes to preallocated arrays sized with the count functions below
+	static void generate(Bsp* map, int faceIdx, const LightmapInfo* lmap, lightmapVert* verts, lightmapVert* wireframeVerts);
+
+	// number of verts generated for a face with the given number of edges
+	static int getVertCount(int edgeCount) { return edgeCount >= 3 ? (edgeCount - 2) * 3 : 0; }
+	static int getWireframeVertCount(int edgeCount) { return edgeCount >= 3 ? edgeCount * 2 : 0; }
+
+	// calculates the plane and 2D polygon used to pick the face
+	static void calcFaceMath(Bsp* map, int faceIdx, FaceMath& faceMath);
+
+	// true if the ray hits the front of the face closer than bestDist, which is then set to the hit distance
+	static bool pickFaceMath(vec3 start, vec3 dir, FaceMath& faceMath, float& bestDist);
+
+	// builds a tree over the bounds of the faces, or refits it if the face count didn't change
+	static void buildFaceMathBvh(Bvh& bvh, const FaceMath* faces, int count, bool refit);
+};
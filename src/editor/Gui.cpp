@@ -16,6 +16,11 @@
 #include <algorithm>
 #include "BspMerger.h"
 #include "LeafNavMesh.h"
+#include "ModelLoader.h"
+#include "AssetResolver.h"
+#include "LogRingBuffer.h"
+#include "EntitySearchIndex.h"
+#include "ThreadPool.h"
 #include <unordered_map>
 #include <lzma_util.h>
 
@@ -37,6 +42,8 @@ string iniPath = getConfigDir() + "imgui.ini";
 
 char const* bspFilterPatterns[1] = { "*.bsp" };
 
+#define ENT_REPORT_ASYNC_MIN_ENTS 8192 // entity report filters run on the thread pool for maps with this many entities
+
 void tooltip(ImGuiContext& g, const char* text) {
 	if (ImGui::IsItemHovered() && g.HoveredIdTimer > g_tooltip_delay) {
 		ImGui::BeginTooltip();
@@ -106,6 +113,10 @@ void Gui::draw() {
 	drawToolbar();
 	drawStatusMessage();
 
+	// drain every frame so the log queue doesn't fill up while the log window is closed
+	flushLogRepeats();
+	g_log_buffer->drain([this](const char* msg) { addLog(msg); });
+
 	if (showDebugWidget) {
 		drawDebugWidget();
 	}
@@ -1022,6 +1033,12 @@ void Gui::drawMenuBar() {
 		}
 		tooltip(g, "Displays a colored cross at the world origin (0,0,0)");
 
+		if (ImGui::MenuItem("Visibility Culling", 0, g_render_flags & RENDER_VIS_CULLING)) {
+			g_render_flags ^= RENDER_VIS_CULLING;
+		}
+		tooltip(g, "Only draw world faces and brush entities that are in the view and in the PVS of the camera leaf. "
+			"Turn this off if faces disappear after editing a map without recompiling VIS.");
+
 		ImGui::PopItemFlag();
 		ImGui::EndMenu();
 	}
@@ -2127,6 +2144,33 @@ void Gui::drawDebugWidget() {
 
 			float mb = app->undoMemoryUsage / (1024.0f * 1024.0f);
 			ImGui::Text("Undo Memory Usage: %.2f MB\n", mb);
+
+			ModelLoadStats loadStats = app->modelLoader->getStats();
+			ImGui::Text("Model loads: %d queued, %d loading, %d done, %d cancelled",
+				loadStats.queued, loadStats.loading, loadStats.loaded, loadStats.cancelled);
+			ImGui::Text("Model load latency: %.2fs avg, %.2fs max (%.1f ms parsing)",
+				loadStats.avgLatency, loadStats.maxLatency, loadStats.avgLoadTime * 1000.0f);
+
+			ImGui::Text("Log: %d lines, %d dropped, %d truncated", LineOffsets.Size - 1,
+				g_log_buffer->getDroppedCount(), g_log_buffer->getTruncatedCount());
+
+			AssetResolverStats assetStats = g_asset_resolver->getStats();
+			ImGui::Text("Asset lookups: %d (%d cached), %d dirs indexed, %d file checks saved",
+				assetStats.lookups, assetStats.cacheHits, assetStats.dirsIndexed, assetStats.probesSaved);
+
+			if (app->transformTarget == TRANSFORM_VERTEX && app->vertHandleGrid.size()) {
+				ImGui::Text("Vertex hover: %d/%d handles tested (%.3f ms)",
+					app->hoverHandleTests, app->vertHandleGrid.size(), app->hoverTime * 1000.0f);
+			}
+
+			if (app->mapRenderer && (g_render_flags & RENDER_VIS_CULLING) && app->mapRenderer->worldEdited) {
+				ImGui::Text("Visible: world faces aren't culled after world edits");
+			}
+			else if (app->mapRenderer && (g_render_flags & RENDER_VIS_CULLING)) {
+				VisibleSet& vis = app->mapRenderer->visibleSet;
+				ImGui::Text("Visible: %d world faces, %d brush ents, %d/%d leaves (%.2f ms)",
+					(int)vis.faces.size(), (int)vis.ents.size(), vis.drawnLeaves, vis.pvsLeaves, vis.cullTime * 1000.0f);
+			}
 		}
 	}
 	ImGui::End();
@@ -3649,6 +3693,14 @@ void Gui::addLog(const char* s)
 	for (int new_size = Buf.size(); old_size < new_size; old_size++)
 		if (Buf[old_size] == '\n')
 			LineOffsets.push_back(old_size + 1);
+
+	if (LineOffsets.Size > LOG_MAX_LINES) {
+		// drop the oldest half so trimming doesn't happen on every new line
+		int cut = LineOffsets[LineOffsets.Size - LOG_MAX_LINES / 2];
+		string keep(Buf.begin() + cut, Buf.end());
+		clearLog();
+		addLog(keep.c_str());
+	}
 }
 
 void Gui::loadFonts() {
@@ -3762,13 +3814,6 @@ void Gui::drawLog() {
 		return;
 	}
 
-	g_log_mutex.lock();
-	for (int i = 0; i < g_log_buffer.size(); i++) {
-		addLog(g_log_buffer[i].c_str());
-	}
-	g_log_buffer.clear();
-	g_log_mutex.unlock();
-
 	static int i = 0;
 
 	ImGui::BeginChild("scrolling", ImVec2(0, 0), false, ImGuiWindowFlags_HorizontalScrollbar);
@@ -4043,6 +4088,8 @@ void Gui::drawSettings() {
 				g_settings.gamedir = string(gamedir);
 				g_settings.fgdPaths = tmpFgdPaths;
 				g_settings.resPaths = tmpResPaths;
+				g_asset_resolver->invalidate();
+				g_asset_resolver->prefetch();
 
 				app->loadFgds();
 				app->postLoadFgds();
@@ -4537,11 +4584,14 @@ void Gui::drawEntityReport() {
 	struct ReportEnt {
 		int idx;
 		bool selected;
-		bool hasFgd;
+		int hasFgd; // -1 = not checked yet
 		string cname;
 	};
 
 	static vector<ReportEnt> filteredEnts;
+	static EntitySearchIndex searchIndex;
+	static future<vector<ReportEnt>> filterFuture;
+	static bool filterPending = false;
 
 	Bsp* map = app->mapRenderer->map;
 	string title = "Entity Report  (" + to_string(filteredEnts.size()) + " results)";
@@ -4566,75 +4616,60 @@ void Gui::drawEntityReport() {
 			int footerHeight = ImGui::GetFrameHeightWithSpacing() * 5 + 16;
 			ImGui::BeginChild("entlist", ImVec2(0, -footerHeight));
 
-			if (entityReportFilterNeeded) {
-				filteredEnts.clear();
-				for (int i = 1; i < map->ents.size(); i++) {
-					Entity* ent = map->ents[i];
-					string cname = ent->getClassname();
+			// results of a filter that ran on the thread pool
+			if (filterPending && filterFuture.wait_for(chrono::milliseconds(0)) == future_status::ready) {
+				filteredEnts = filterFuture.get();
+				filterPending = false;
+			}
 
-					bool visible = true;
+			// the index can't be synced while a filter is reading it, so wait for that to finish first
+			if (entityReportFilterNeeded && !filterPending) {
+				if (entityReportMapChanged) {
+					// don't keep the old map's strings, or match new entities at reused addresses
+					searchIndex.clear();
+					entityReportMapChanged = false;
+				}
+				searchIndex.sync(map->ents);
 
-					if (!classFilter.empty() && classFilter != "(none)") {
-						if (toLowerCase(cname) != toLowerCase(classFilter)) {
-							visible = false;
-						}
-					}
+				EntityFilter filter;
+				if (classFilter != "(none)") {
+					filter.classname = classFilter;
+				}
+				for (int k = 0; k < MAX_FILTERS; k++) {
+					filter.keyvalues.push_back(make_pair(string(keyFilter[k]), string(valueFilter[k])));
+				}
+				filter.partialMatches = partialMatches;
 
-					for (int k = 0; k < MAX_FILTERS; k++) {
-						if (strlen(keyFilter[k]) > 0) {
-							string searchKey = trimSpaces(toLowerCase(keyFilter[k]));
-
-							bool foundKey = false;
-							string actualKey;
-							for (int c = 0; c < ent->keyOrder.size(); c++) {
-								string key = toLowerCase(ent->keyOrder[c]);
-								if (key == searchKey || (partialMatches && key.find(searchKey) != string::npos)) {
-									foundKey = true;
-									actualKey = key;
-									break;
-								}
-							}
-							if (!foundKey) {
-								visible = false;
-								break;
-							}
+				auto filterEnts = [filter]() {
+					vector<int> matches;
+					searchIndex.query(filter, matches);
 
-							string searchValue = trimSpaces(toLowerCase(valueFilter[k]));
-							if (!searchValue.empty()) {
-								if ((partialMatches && ent->getKeyvalue(actualKey).find(searchValue) == string::npos) ||
-									(!partialMatches && ent->getKeyvalue(actualKey) != searchValue)) {
-									visible = false;
-									break;
-								}
-							}
+					vector<ReportEnt> results;
+					results.reserve(matches.size());
+					for (int i = 0; i < matches.size(); i++) {
+						if (matches[i] == 0) {
+							continue; // worldspawn
 						}
-						else if (strlen(valueFilter[k]) > 0) {
-							string searchValue = trimSpaces(toLowerCase(valueFilter[k]));
-							bool foundMatch = false;
-							for (int c = 0; c < ent->keyOrder.size(); c++) {
-								string val = toLowerCase(ent->getKeyvalue(ent->keyOrder[c]));
-								if (val == searchValue || (partialMatches && val.find(searchValue) != string::npos)) {
-									foundMatch = true;
-									break;
-								}
-							}
-							if (!foundMatch) {
-								visible = false;
-								break;
-							}
-						}
-					}
-					if (visible) {
 						ReportEnt rpent;
-						rpent.idx = i;
+						rpent.idx = matches[i];
 						rpent.selected = false;
-						rpent.hasFgd = app->entityHasFgd(cname);
-						rpent.cname = cname;
-						filteredEnts.push_back(rpent);
+						rpent.hasFgd = -1;
+						rpent.cname = searchIndex.getClassname(matches[i]);
+						results.push_back(rpent);
 					}
+					return results;
+				};
+
+				if (map->ents.size() >= ENT_REPORT_ASYNC_MIN_ENTS) {
+					filterFuture = g_thread_pool->submit(filterEnts);
+					filterPending = true;
 				}
+				else {
+					filteredEnts = filterEnts();
+				}
+
+				entityReportFilterNeeded = false;
 			}
-			entityReportFilterNeeded = false;
 
 			if (entityReportReselectNeeded) {
 				unordered_set<int> selection;
@@ -4660,6 +4695,10 @@ void Gui::drawEntityReport() {
 					Entity* ent = map->ents[entIdx];
 					string cname = filteredEnts[i].cname;
 
+					if (filteredEnts[i].hasFgd == -1) {
+						filteredEnts[i].hasFgd = app->entityHasFgd(cname);
+					}
+
 					bool pushedColor = true;
 					if (!filteredEnts[i].hasFgd) {
 						ImGui::PushStyleColor(ImGuiCol_Text, ImVec4(1.0f, 0.5f, 0.0f, 1.0f));
@@ -5751,6 +5790,7 @@ void Gui::refresh() {
 	reloadLimits();
 	checkValidHulls();
 	entityReportFilterNeeded = true;
+	entityReportMapChanged = true;
 }
 
 void Gui::saveAs() {
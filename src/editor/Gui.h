@@ -9,6 +9,8 @@
 #include "qtools/rad.h"
 #include "Fgd.h"
 
+#define LOG_MAX_LINES 20000 // older lines are discarded from the message window
+
 class Entity;
 class Texture;
 
@@ -119,6 +121,7 @@ private:
 	bool AutoScroll = true;  // Keep scrolling if already at the bottom
 
 	bool entityReportFilterNeeded = true;
+	bool entityReportMapChanged = false; // the search index belongs to the previous map
 	bool entityReportReselectNeeded = false;
 
 	float mainMenuBarHeight;
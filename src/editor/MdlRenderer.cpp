@@ -11,6 +11,11 @@
 #include "globals.h"
 #include "Renderer.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MDL_SSE
+#endif
+
 MdlRenderer::MdlRenderer(ShaderProgram* shaderProgram, string modelPath) {
 	this->fpath = modelPath;
 	this->shaderProgram = shaderProgram;
@@ -29,8 +34,6 @@ MdlRenderer::MdlRenderer(ShaderProgram* shaderProgram, string modelPath) {
 	u_viewerRightId = glGetUniformLocation(shaderProgram->ID, "viewerRight");
 	u_textureST = glGetUniformLocation(shaderProgram->ID, "textureST");
 
-	loadFuture = async(launch::async, &MdlRenderer::loadData, this);
-	//loadData();
 	//upload();
 }
 
@@ -54,7 +57,6 @@ MdlRenderer::~MdlRenderer() {
 
 					delete[] render.origVerts;
 					delete[] render.origNorms;
-					delete[] render.transformVerts;
 					delete[] render.verts;
 					delete render.buffer;
 				}
@@ -356,13 +358,7 @@ void MdlRenderer::loadData() {
 	vec3 angles;
 	SetUpBones(angles, 0, 0);
 	loadMeshes();
-	//transformVerts();
-
-	// precalculate anim bounds
-	for (int i = 0; i < header->numseq; i++) {
-		vec3 mins, maxs;
-		getModelBoundingBox(vec3(), i, mins, maxs);
-	}
+	calcAnimBounds();
 
 	valid = true;
 	loadState = MDL_LOAD_UPLOAD;
@@ -673,7 +669,6 @@ bool MdlRenderer::loadMeshes() {
 
 				render.origVerts = new short[totalElements];
 				render.origNorms = new short[totalElements];
-				render.transformVerts = new vec3[totalElements];
 
 				vector<boneVert> allVerts;
 				allVerts.reserve(totalElements);
@@ -681,7 +676,6 @@ bool MdlRenderer::loadMeshes() {
 				for (int i = 0; i < totalElements; i++) {
 					MdlVert& v = mdlVerts[i];
 					render.origVerts[i] = v.origVert;
-					render.transformVerts[i] = v.pos;
 					render.origNorms[i] = v.origNorm;
 
 					boneVert bvert;
@@ -1120,7 +1114,7 @@ void R_ConcatTransforms(float in1[3][4], float in2[3][4], float out[3][4])
 
 void MdlRenderer::SetUpBones(vec3 angles, int sequence, float frame, int gaitsequence, float gaitframe)
 {
-	if (loadState != MDL_LOAD_DONE && g_main_thread_id != this_thread::get_id()) {
+	if (loadState != MDL_LOAD_DONE && g_main_thread_id == this_thread::get_id()) {
 		return; // don't let multiple threads access the same buffers
 	}
 	angles = angles.flipToStudioMdl();
@@ -1216,67 +1210,177 @@ void MdlRenderer::SetUpBones(vec3 angles, int sequence, float frame, int gaitseq
 	}
 }
 
-void MdlRenderer::transformVerts() {
-	int modelIdx = 0;
-	int vertCount = 0;
+// transforms studio verts by their bone matrices. Each output component is one row of
+// the bone matrix dotted with (x, y, z, 1).
+static void transformVertsByBones(const vec3* verts, const uint8_t* vertBones, int count, float bones[][4][4], vec3* out) {
+#ifdef MDL_SSE
+	__m128 one = _mm_set_ps(1.0f, 0, 0, 0);
+	__m128 xyzMask = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+	__m128 zero = _mm_setzero_ps();
+
+	for (int k = 0; k < count; k++) {
+		float (*bone)[4] = bones[vertBones[k]];
+
+		// (x, y, z, 1). Reading 4 floats from the last vert would go out of bounds.
+		__m128 v;
+		if (k < count - 1) {
+			v = _mm_loadu_ps(&verts[k].x);
+		}
+		else {
+			v = _mm_set_ps(0, verts[k].z, verts[k].y, verts[k].x);
+		}
+		v = _mm_or_ps(_mm_and_ps(v, xyzMask), one);
+
+		__m128 r0 = _mm_mul_ps(_mm_loadu_ps(bone[0]), v);
+		__m128 r1 = _mm_mul_ps(_mm_loadu_ps(bone[1]), v);
+		__m128 r2 = _mm_mul_ps(_mm_loadu_ps(bone[2]), v);
+		__m128 r3 = zero;
+
+		// sum each row horizontally
+		_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+		__m128 result = _mm_add_ps(_mm_add_ps(r0, r1), _mm_add_ps(r2, r3));
+
+		if (k < count - 1) {
+			_mm_storeu_ps(&out[k].x, result); // 4th float is overwritten by the next vert
+		}
+		else {
+			float last[4];
+			_mm_storeu_ps(last, result);
+			out[k] = vec3(last[0], last[1], last[2]);
+		}
+	}
+#else
+	for (int k = 0; k < count; k++) {
+		float (*bone)[4] = bones[vertBones[k]];
+		const vec3& v = verts[k];
+		out[k].x = v.x * bone[0][0] + v.y * bone[0][1] + v.z * bone[0][2] + bone[0][3];
+		out[k].y = v.x * bone[1][0] + v.y * bone[1][1] + v.z * bone[1][2] + bone[1][3];
+		out[k].z = v.x * bone[2][0] + v.y * bone[2][1] + v.z * bone[2][2] + bone[2][3];
+	}
+#endif
+}
 
+void MdlRenderer::transformVerts(vec3* out) {
 	for (int b = 0; b < header->numbodyparts; b++) {
 		data.seek(header->bodypartindex + b * sizeof(mstudiobodyparts_t));
 		mstudiobodyparts_t* bod = (mstudiobodyparts_t*)data.getOffsetBuffer();
 
-		for (int i = 0; i < bod->nummodels; i++) {
-			data.seek(bod->modelindex + i * sizeof(mstudiomodel_t));
-			mstudiomodel_t* mod = (mstudiomodel_t*)data.getOffsetBuffer();
+		if (bod->nummodels < 1) {
+			continue;
+		}
 
-			data.seek(mod->vertindex);
-			vec3* pstudioverts = (vec3*)data.getOffsetBuffer();
+		data.seek(bod->modelindex);
+		mstudiomodel_t* mod = (mstudiomodel_t*)data.getOffsetBuffer();
 
-			//data.seek(mod->normindex);
-			//vec3* pstudionorms = (vec3*)data.getOffsetBuffer();
+		data.seek(mod->vertindex);
+		vec3* pstudioverts = (vec3*)data.getOffsetBuffer();
 
-			data.seek(mod->vertinfoindex);
-			uint8_t* pvertbone = (uint8_t*)data.getOffsetBuffer();
+		data.seek(mod->vertinfoindex);
+		uint8_t* pvertbone = (uint8_t*)data.getOffsetBuffer();
 
-			//data.seek(mod->norminfoindex);
-			//uint8_t* pnormbone = (uint8_t*)data.getOffsetBuffer();
+		transformVertsByBones(pstudioverts, pvertbone, mod->numverts, m_bonetransform, out + bodyVertOffset[b]);
+	}
+}
 
-			//static vec3 transformedNormals[MAXSTUDIOVERTS];
+void MdlRenderer::calcAnimBounds() {
+	memset(bodyVertOffset, 0, sizeof(bodyVertOffset));
+	frameVertCount = 0;
 
-			for (int k = 0; k < mod->numverts; k++) {
-				VectorTransform(pstudioverts[k], m_bonetransform[pvertbone[k]], transformedVerts[k]);
-			}
+	// verts that are part of a mesh. Unused verts shouldn't affect the bounds.
+	vector<bool> usedVerts;
+
+	for (int b = 0; b < header->numbodyparts; b++) {
+		data.seek(header->bodypartindex + b * sizeof(mstudiobodyparts_t));
+		mstudiobodyparts_t* bod = (mstudiobodyparts_t*)data.getOffsetBuffer();
 
-			/*
-			for (int k = 0; k < mod->numnorms; k++) {
-				VectorRotate(pstudionorms[k], m_bonetransform[pnormbone[k]], transformedNormals[k]);
+		bodyVertOffset[b] = frameVertCount;
+		if (bod->nummodels < 1) {
+			continue;
+		}
+
+		data.seek(bod->modelindex);
+		mstudiomodel_t* mod = (mstudiomodel_t*)data.getOffsetBuffer();
+		frameVertCount += mod->numverts;
+		usedVerts.resize(frameVertCount, false);
+
+		for (int k = 0; k < mod->nummesh; k++) {
+			MdlMeshRender& render = meshBuffers[b][0][k];
+			for (int v = 0; v < render.numVerts; v++) {
+				usedVerts[bodyVertOffset[b] + render.origVerts[v]] = true;
 			}
-			*/
+		}
+	}
 
-			for (int k = 0; k < mod->nummesh; k++) {
-				MdlMeshRender& buffer = meshBuffers[b][i][k];
+	int totalFrames = 0;
+	for (int i = 0; i < header->numseq; i++) {
+		totalFrames += max(1, getSequence(i)->numframes);
+	}
+
+	int64 cacheBytes = (int64)totalFrames * frameVertCount * sizeof(vec3);
+	frameCacheStride = max(1, (int)((cacheBytes + MDL_FRAME_CACHE_MAX_BYTES - 1) / MDL_FRAME_CACHE_MAX_BYTES));
 
-				// TODO: this does more transformations than necessary.
-				// Only transform the original verts then update the GL_TRIANGLES verts by copying data,
-				// or maybe that's not much faster?
-				for (int v = 0; v < buffer.numVerts; v++) {
-					short oldVertIdx = buffer.origVerts[v];
-					short oldNormIdx = buffer.origNorms[v];
+	int cachedFrames = 0;
+	seqFrameStart.resize(header->numseq);
+	for (int i = 0; i < header->numseq; i++) {
+		int numFrames = max(1, getSequence(i)->numframes);
+		seqFrameStart[i] = cachedFrames;
+		cachedFrames += (numFrames + frameCacheStride - 1) / frameCacheStride;
+	}
+	frameVerts.resize(cachedFrames * frameVertCount);
 
-					buffer.transformVerts[v] = transformedVerts[oldVertIdx].flipFromStudioMdl();
-					//buffer.transformVerts[v].normal = transformedNormals[oldNormIdx].flipFromStudioMdl();
+	vector<vec3> verts(frameVertCount);
 
-					//VectorTransform(pstudioverts[oldVertIdx], m_bonetransform[bone], *pos);
-					//VectorRotate(pstudionorms[oldNormIdx], m_bonetransform[bone], *norm);
+	for (int i = 0; i < header->numseq; i++) {
+		int numFrames = max(1, getSequence(i)->numframes);
+		vec3 mins = vec3(FLT_MAX, FLT_MAX, FLT_MAX);
+		vec3 maxs = vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+
+		for (int f = 0; f < numFrames && frameVertCount; f++) {
+			SetUpBones(vec3(), i, f);
+			transformVerts(&verts[0]);
+
+			// stored in the same coordinates the drawn mesh and the old per-pick transform used, so
+			// that the bounds line up with drawOrigin and the angles in getModelBoundingBox
+			for (int v = 0; v < frameVertCount; v++) {
+				verts[v] = verts[v].flipFromStudioMdl();
+			}
 
-					//*norm = norm->normalize();
-					//printf("NORM: %.1f %.1f %.1f\n", norm->x, norm->y, norm->z);
-					vertCount++;
+			for (int v = 0; v < frameVertCount; v++) {
+				if (usedVerts[v]) {
+					expandBoundingBox(verts[v], mins, maxs);
 				}
 			}
+
+			if (f % frameCacheStride == 0) {
+				int cacheIdx = seqFrameStart[i] + f / frameCacheStride;
+				memcpy(&frameVerts[cacheIdx * frameVertCount], &verts[0], frameVertCount * sizeof(vec3));
+			}
 		}
+
+		if (mins.x > maxs.x) {
+			mins = maxs = vec3();
+		}
+
+		cachedBounds[i].mins = mins;
+		cachedBounds[i].maxs = maxs;
+		cachedBounds[i].isCached = true;
+	}
+
+	debugf("Cached %d of %d frames (%.1f MB) for %s\n", cachedFrames, totalFrames,
+		(frameVerts.size() * sizeof(vec3)) / (1024.0f * 1024.0f), fpath.c_str());
+}
+
+const vec3* MdlRenderer::getFrameVerts(int sequence, float frame) {
+	if (sequence < 0 || sequence >= seqFrameStart.size() || !frameVertCount) {
+		return NULL;
 	}
 
-	//logf("Transformed %d verts\n", vertCount);
+	int numFrames = max(1, getSequence(sequence)->numframes);
+	int f = clamp((int)(frame + 0.5f), 0, numFrames - 1);
+	int cacheIdx = seqFrameStart[sequence] + (f + frameCacheStride / 2) / frameCacheStride;
+	int lastIdx = seqFrameStart[sequence] + (numFrames - 1) / frameCacheStride;
+
+	return &frameVerts[min(cacheIdx, lastIdx) * frameVertCount];
 }
 
 void MdlRenderer::draw(vec3 origin, vec3 angles, int sequence, vec3 viewerOrigin, vec3 viewerRight, vec3 color) {
@@ -1421,66 +1525,16 @@ void MdlRenderer::draw(vec3 origin, vec3 angles, int sequence, vec3 viewerOrigin
 
 // get a AABB containing all model vertices at the given angles and animation frame
 void MdlRenderer::getModelBoundingBox(vec3 angles, int sequence, vec3& mins, vec3& maxs) {
-	if (loadState != MDL_LOAD_DONE && g_main_thread_id != this_thread::get_id()) {
-		// don't let main thread transform verts before they're loaded
-		mins = vec3();
-		maxs = vec3();
-		return;
-	}
-
 	sequence = clamp(sequence, 0, header->numseq - 1);
-	mstudioseqdesc_t* seq = getSequence(sequence);
-	if (!seq) {
+
+	if (loadState != MDL_LOAD_DONE || sequence < 0 || !cachedBounds[sequence].isCached) {
 		mins = vec3();
 		maxs = vec3();
 		return;
 	}
 
-	mins = vec3(FLT_MAX, FLT_MAX, FLT_MAX);
-	maxs = vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
-
-	if (cachedBounds[sequence].isCached) {
-		mins = cachedBounds[sequence].mins;
-		maxs = cachedBounds[sequence].maxs;
-	}
-	else {
-		if (isEmpty()) {
-			cachedBounds[sequence].mins = vec3();
-			cachedBounds[sequence].maxs = vec3();
-			cachedBounds[sequence].isCached = true;
-			return;
-		}
-
-		for (int f = 0; f < seq->numframes; f++) {
-			SetUpBones(vec3(), sequence, f);
-			transformVerts();
-
-			int meshCount = 0;
-			for (int b = 0; b < header->numbodyparts; b++) {
-				// Try loading required model info
-				data.seek(header->bodypartindex + b * sizeof(mstudiobodyparts_t));
-				mstudiobodyparts_t* bod = (mstudiobodyparts_t*)data.getOffsetBuffer();
-
-				for (int i = 0; i < bod->nummodels && i < 1; i++) {
-					data.seek(bod->modelindex + i * sizeof(mstudiomodel_t));
-					mstudiomodel_t* mod = (mstudiomodel_t*)data.getOffsetBuffer();
-
-					for (int k = 0; k < mod->nummesh; k++) {
-						meshCount++;
-						MdlMeshRender& render = meshBuffers[b][i][k];
-
-						for (int v = 0; v < render.numVerts; v++) {
-							expandBoundingBox(render.transformVerts[v], mins, maxs);
-						}
-					}
-				}
-			}
-		}
-
-		cachedBounds[sequence].mins = mins;
-		cachedBounds[sequence].maxs = maxs;
-		cachedBounds[sequence].isCached = true;
-	}
+	mins = cachedBounds[sequence].mins;
+	maxs = cachedBounds[sequence].maxs;
 
 	angles = angles.flip();
 
@@ -1531,10 +1585,25 @@ bool MdlRenderer::pick(vec3 start, vec3 rayDir, Entity* ent, float& bestDist) {
 	}
 	bestDist = oldBestDist;	
 
-	SetUpBones(ent->drawAngles, ent->drawSequence, ent->drawFrame);
-	transformVerts();
+	const vec3* verts = getFrameVerts(clamp(ent->drawSequence, 0, header->numseq - 1), ent->drawFrame);
+	if (!verts) {
+		return false;
+	}
+
+	// cached verts have no model rotation, so rotate the ray into model space instead. SetUpBones
+	// rotates in studio coordinates, before the verts are flipped out of them, so the ray is
+	// flipped into studio coordinates for the rotation and back out to match the cached verts.
+	float angleMatrix[3][4];
+	vec4 angleQuat;
+	AngleQuaternion(ent->drawAngles.flipToStudioMdl() * (PI / 180.0f), angleQuat);
+	QuaternionMatrix((float*)&angleQuat, angleMatrix);
 
-	start -= ent->drawOrigin;
+	vec3 worldStart = (start - ent->drawOrigin).flip();
+	vec3 worldDir = rayDir.flip();
+	VectorIRotate(worldStart, angleMatrix, start);
+	VectorIRotate(worldDir, angleMatrix, rayDir);
+	start = start.flipFromStudioMdl();
+	rayDir = rayDir.flipFromStudioMdl();
 
 	for (int b = 0; b < header->numbodyparts; b++) {
 		// Try loading required model info
@@ -1544,14 +1613,15 @@ bool MdlRenderer::pick(vec3 start, vec3 rayDir, Entity* ent, float& bestDist) {
 		for (int i = 0; i < bod->nummodels && i < 1; i++) {
 			data.seek(bod->modelindex + i * sizeof(mstudiomodel_t));
 			mstudiomodel_t* mod = (mstudiomodel_t*)data.getOffsetBuffer();
+			const vec3* bodyVerts = verts + bodyVertOffset[b];
 
 			for (int k = 0; k < mod->nummesh; k++) {
 				MdlMeshRender& render = meshBuffers[b][i][k];
 
 				for (int v = 0; v < render.numVerts; v += 3) {
-					const vec3& v0 = render.transformVerts[v];
-					const vec3& v1 = render.transformVerts[v+1];
-					const vec3& v2 = render.transformVerts[v+2];
+					const vec3& v0 = bodyVerts[render.origVerts[v]];
+					const vec3& v1 = bodyVerts[render.origVerts[v+1]];
+					const vec3& v2 = bodyVerts[render.origVerts[v+2]];
 					
 					float t = rayTriangleIntersect(start, rayDir, v0, v1, v2);
 					//g_app->drawPolygon3D(Polygon3D({ v0, v1, v2 }), COLOR4(0, 255, 0, 255));
@@ -8,6 +8,9 @@
 
 #define	EQUAL_EPSILON	0.001f
 
+// max memory used to cache transformed vertices per model. Frames are skipped if all don't fit.
+#define MDL_FRAME_CACHE_MAX_BYTES (8 * 1024 * 1024)
+
 struct MdlVert {
 	vec3 pos;
 	vec2 uv;
@@ -26,7 +29,6 @@ struct boneVert {
 struct MdlMeshRender {
 	boneVert* verts;
 	short* origVerts; // original mdl vertex used to create the rendered vertex
-	vec3* transformVerts; // duplicate of verts positions that can be edited before buffers upload
 	short* origNorms; // original mdl normals used to create the rendered normal
 	int numVerts;
 	int flags;
@@ -59,6 +61,7 @@ public:
 
 	void draw(vec3 origin, vec3 angles, int sequence, vec3 viewerOrigin, vec3 viewerRight, vec3 color);
 
+	void loadData() override;
 	void upload() override; // called by main thread to upload data to gpu
 
 	// get intersection of pick ray and model polygon
@@ -79,7 +82,6 @@ private:
 	studiohdr_t* texheader = NULL; // external texture data
 	mstream data; // TODO: parse structures into class members instead of seeking through the original data
 	mstream texdata;
-	std::future<void> loadFuture;
 
 	// opengl uniforms
 	uint u_sTexId;
@@ -98,7 +100,17 @@ private:
 		vec3 mins, maxs;
 		bool isCached;
 	};
-	AABB cachedBounds[MAXSTUDIOANIMATIONS]; // cached results for getModelBoundingBox
+	AABB cachedBounds[MAXSTUDIOANIMATIONS]; // per-sequence bounds, calculated while loading
+
+	// Vertex positions for the first model of each body part at every (sequence, frame), with no
+	// model rotation applied. Flipped out of studio coordinates, like the verts picking used to
+	// transform, so cachedBounds are in the same space. Filled while loading so picking doesn't
+	// need to transform verts.
+	vector<vec3> frameVerts;
+	vector<int> seqFrameStart; // index of the first cached frame for each sequence
+	int bodyVertOffset[MAXSTUDIOBODYPARTS]; // offset of each body part's verts within a frame
+	int frameVertCount = 0; // verts per cached frame
+	int frameCacheStride = 1; // 1 = every frame cached, 2 = every other frame, etc.
 
 	mstream seqheaders[MAXSTUDIOSEQUENCES]; // external sequence model data
 
@@ -112,19 +124,19 @@ private:
 	vec3 pos4[MAXSTUDIOBONES];
 	vec4 q4[MAXSTUDIOBONES];
 
-	// for transformverts
-	vec3 transformedVerts[MAXSTUDIOVERTS];
 
-	void loadData();
 	bool loadTextureData();
 	bool loadSequenceData();
 	bool loadMeshes();
-	void calcAnimBounds(); // calculate bounding boxes for anll animations
+	void calcAnimBounds(); // calculate bounding boxes and cache vertices for all animations
 	bool isEmpty();
 	bool validate();
 	bool hasExternalTextures();
 	bool hasExternalSequences();
-	void transformVerts();
+	void transformVerts(vec3* out); // transform the first model of each body part by the current bones
+
+	// cached vertices for the frame closest to the given one, or NULL if there are none
+	const vec3* getFrameVerts(int sequence, float frame);
 
 	// frame values = 0 - 1.0 (0-100%)
 	// angles = rotation for the entire model (y = pitch, z = yaw)
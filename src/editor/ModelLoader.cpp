@@ -0,0 +1,125 @@
+#include "ModelLoader.h"
+#include "BaseRenderer.h"
+#include "Trace.h"
+#include <algorithm>
+
+ModelLoader::ModelLoader(int numThreads) {
+	if (numThreads <= 0) {
+		numThreads = std::min(4, std::max(1, (int)thread::hardware_concurrency() / 2));
+	}
+
+	for (int i = 0; i < numThreads; i++) {
+		workers.push_back(thread(&ModelLoader::workerLoop, this));
+	}
+}
+
+ModelLoader::~ModelLoader() {
+	{
+		lock_guard<mutex> lock(jobMutex);
+		stopping = true;
+		jobs.clear();
+	}
+	jobAdded.notify_all();
+
+	for (int i = 0; i < workers.size(); i++) {
+		workers[i].join();
+	}
+}
+
+void ModelLoader::queue(BaseRenderer* mdl, float priority) {
+	LoadJob job;
+	job.mdl = mdl;
+	job.priority = priority;
+	job.queueTime = chrono::steady_clock::now();
+
+	{
+		lock_guard<mutex> lock(jobMutex);
+		jobs.push_back(job);
+	}
+	jobAdded.notify_one();
+}
+
+void ModelLoader::setPriorities(const unordered_map<BaseRenderer*, float>& priorities) {
+	lock_guard<mutex> lock(jobMutex);
+
+	for (int i = 0; i < jobs.size(); i++) {
+		auto prio = priorities.find(jobs[i].mdl);
+		if (prio != priorities.end()) {
+			jobs[i].priority = prio->second;
+		}
+	}
+}
+
+vector<BaseRenderer*> ModelLoader::cancelAll() {
+	vector<BaseRenderer*> cancelled;
+
+	lock_guard<mutex> lock(jobMutex);
+	for (int i = 0; i < jobs.size(); i++) {
+		cancelled.push_back(jobs[i].mdl);
+	}
+	numCancelled += jobs.size();
+	jobs.clear();
+
+	return cancelled;
+}
+
+ModelLoadStats ModelLoader::getStats() {
+	lock_guard<mutex> lock(jobMutex);
+
+	ModelLoadStats stats;
+	stats.queued = jobs.size();
+	stats.loading = numLoading;
+	stats.loaded = numLoaded;
+	stats.cancelled = numCancelled;
+	stats.avgLatency = numLoaded ? totalLatency / numLoaded : 0;
+	stats.maxLatency = maxLatency;
+	stats.avgLoadTime = numLoaded ? totalLoadTime / numLoaded : 0;
+
+	return stats;
+}
+
+void ModelLoader::workerLoop() {
+	while (true) {
+		LoadJob job;
+
+		{
+			unique_lock<mutex> lock(jobMutex);
+			jobAdded.wait(lock, [this] { return stopping || !jobs.empty(); });
+
+			if (stopping) {
+				return;
+			}
+
+			// priorities change every frame as the camera moves, so a heap would need
+			// rebuilding anyway. The queue is at most a few hundred models.
+			int best = 0;
+			for (int i = 1; i < jobs.size(); i++) {
+				if (jobs[i].priority < jobs[best].priority) {
+					best = i;
+				}
+			}
+
+			job = jobs[best];
+			jobs[best] = jobs.back();
+			jobs.pop_back();
+			numLoading++;
+		}
+
+		auto loadStart = chrono::steady_clock::now();
+		{
+			TRACE_SCOPE("ModelLoader::loadData");
+			job.mdl->loadData();
+		}
+		auto loadEnd = chrono::steady_clock::now();
+
+		{
+			lock_guard<mutex> lock(jobMutex);
+			double latency = chrono::duration<double>(loadEnd - job.queueTime).count();
+			numLoading--;
+			numLoaded++;
+			totalLatency += latency;
+			totalLoadTime += chrono::duration<double>(loadEnd - loadStart).count();
+			maxLatency = max(maxLatency, latency);
+		}
+	}
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <unordered_map>
+
+class BaseRenderer;
+
+struct ModelLoadStats {
+	int queued; // waiting for a worker
+	int loading; // being parsed right now
+	int loaded; // finished since startup
+	int cancelled; // dropped before loading started
+	float avgLatency; // seconds from being queued to finishing
+	float maxLatency;
+	float avgLoadTime; // seconds spent parsing
+};
+
+// Loads MDL/SPR data on a small fixed set of threads, closest models first.
+// Only parsing happens here. GPU uploads are still done on the main thread.
+class ModelLoader {
+public:
+	// numThreads <= 0 picks a small number based on the CPU count.
+	// Loading is mostly disk-bound so more threads don't help much.
+	ModelLoader(int numThreads=0);
+
+	// drops queued loads and waits for the ones in progress
+	~ModelLoader();
+
+	// lower priority values load first (e.g. distance from the camera,
+	// or a negative entity count when there is no camera)
+	void queue(BaseRenderer* mdl, float priority);
+
+	// update priorities for models that are still waiting. Models not in the map keep their old priority.
+	void setPriorities(const std::unordered_map<BaseRenderer*, float>& priorities);
+
+	// remove every load that hasn't started yet. The models are returned so the caller can delete them.
+	// Loads already in progress are left to finish.
+	std::vector<BaseRenderer*> cancelAll();
+
+	ModelLoadStats getStats();
+
+private:
+	struct LoadJob {
+		BaseRenderer* mdl;
+		float priority;
+		std::chrono::steady_clock::time_point queueTime;
+	};
+
+	std::vector<std::thread> workers;
+	std::vector<LoadJob> jobs;
+	std::mutex jobMutex;
+	std::condition_variable jobAdded;
+	bool stopping = false;
+
+	int numLoading = 0;
+	int numLoaded = 0;
+	int numCancelled = 0;
+	double totalLatency = 0;
+	double maxLatency = 0;
+	double totalLoadTime = 0;
+
+	void workerLoop();
+};
@@ -20,6 +20,8 @@
 #include "BspMerger.h"
 #include "MdlRenderer.h"
 #include "SprRenderer.h"
+#include "ModelLoader.h"
+#include "AssetResolver.h"
 #include <unordered_set>
 #include "tinyfiledialogs.h"
 
@@ -132,8 +134,10 @@ GLFWmonitor* GetMonitorForWindow(GLFWwindow* window) {
 
 Renderer::Renderer() {
 	programStartTime = glfwGetTime();
+	modelLoader = new ModelLoader();
 	g_settings.loadDefault();
 	g_settings.load();
+	g_asset_resolver->prefetch();
 
 	if (!glfwInit())
 	{
@@ -263,6 +267,7 @@ Renderer::Renderer() {
 }
 
 Renderer::~Renderer() {
+	delete modelLoader;
 	glfwTerminate();
 }
 
@@ -343,6 +348,8 @@ void Renderer::renderLoop() {
 		glEnable(GL_DEPTH_TEST);
 
 		isLoading = reloading;
+
+		mapRenderer->updateVisibility(cameraOrigin, cameraAngles, (float)windowWidth / (float)windowHeight, fov, zFar);
 		
 		// draw opaque world/entity faces
 		mapRenderer->render(pickInfo.ents, transformTarget == TRANSFORM_VERTEX, clipnodeRenderHull, false);
@@ -904,6 +911,13 @@ void Renderer::clearMapData() {
 		mapRenderer = NULL;
 	}
 
+	// models that haven't started loading were only wanted by the closed map
+	vector<BaseRenderer*> cancelledModels = modelLoader->cancelAll();
+	for (BaseRenderer* mdl : cancelledModels) {
+		studioModels.erase(mdl->fpath);
+		delete mdl;
+	}
+
 	pickInfo = PickInfo();
 
 	if (entConnections) {
@@ -1554,6 +1568,7 @@ void Renderer::cameraPickingControls() {
 				for (int i = 0; i < modelVerts.size(); i++) {
 					modelVerts[i].pos = modelVerts[i].startPos = modelVerts[i].undoPos;
 				}
+				vertHandlesMoved = true;
 				for (int i = 0; i < modelFaceVerts.size(); i++) {
 					modelFaceVerts[i].pos = modelFaceVerts[i].startPos = modelFaceVerts[i].undoPos;
 					if (modelFaceVerts[i].ptr) {
@@ -1733,10 +1748,33 @@ void Renderer::cameraObjectHovering() {
 		float bestDist = FLT_MAX;
 
 		vec3 entOrigin = pickInfo.getOrigin();
+		auto hoverStart = chrono::steady_clock::now();
+
+		if (vertHandlesMoved || vertHandleGrid.size() != modelVerts.size() + modelEdges.size()) {
+			vector<vec3> handles;
+			handles.reserve(modelVerts.size() + modelEdges.size());
+			for (int i = 0; i < modelVerts.size(); i++) {
+				handles.push_back(modelVerts[i].pos);
+			}
+			for (int i = 0; i < modelEdges.size(); i++) {
+				handles.push_back(getEdgeControlPoint(modelVerts, modelEdges[i]));
+			}
+			vertHandleGrid.build(handles);
+			vertHandlesMoved = false;
+		}
+
+		// only handles near the mouse ray can be hovered
+		vector<int> nearHandles;
+		vec3 gridOffset = entOrigin + mapOffset;
+		vertHandleGrid.query(pickStart - gridOffset, pickDir, cameraOrigin - gridOffset, vertExtentFactor * 2.0f, nearHandles);
+		int firstNearEdge = lower_bound(nearHandles.begin(), nearHandles.end(), (int)modelVerts.size()) - nearHandles.begin();
+		hoverHandleTests = 0;
 		
 		hoverEdge = -1;
 		if (!(anyVertSelected && !anyEdgeSelected)) {
-			for (int i = 0; i < modelEdges.size(); i++) {
+			for (int k = firstNearEdge; k < nearHandles.size(); k++) {
+				int i = nearHandles[k] - modelVerts.size();
+				hoverHandleTests++;
 				vec3 ori = getEdgeControlPoint(modelVerts, modelEdges[i]) + entOrigin + mapOffset;
 				float s = (ori - cameraOrigin).length() * vertExtentFactor * 2.0f;
 				vec3 min = vec3(-s, -s, -s) + ori;
@@ -1749,7 +1787,9 @@ void Renderer::cameraObjectHovering() {
 
 		hoverVert = -1;
 		if (!anyEdgeSelected) {
-			for (int i = 0; i < modelVerts.size(); i++) {
+			for (int k = 0; k < firstNearEdge; k++) {
+				int i = nearHandles[k];
+				hoverHandleTests++;
 				vec3 ori = entOrigin + modelVerts[i].pos + mapOffset;
 				float s = (ori - cameraOrigin).length() * vertExtentFactor * 2.0f;
 				vec3 min = vec3(-s, -s, -s) + ori;
@@ -1759,6 +1799,8 @@ void Renderer::cameraObjectHovering() {
 				}
 			}
 		}
+
+		hoverTime = chrono::duration<double>(chrono::steady_clock::now() - hoverStart).count();
 	}
 
 	if (transformTarget == TRANSFORM_ORIGIN && pickInfo.getModelIndex() > 0) {
@@ -2520,6 +2562,8 @@ BaseRenderer* Renderer::loadModel(Entity* ent) {
 			newModel = new SprRenderer(g_app->sprShader, g_app->vec3Shader, modelPath);
 		}
 		
+		modelLoader->queue(newModel, (ent->getOrigin() - cameraOrigin).length());
+
 		studioModels[modelPath] = newModel;
 		ent->cachedMdl = newModel;
 		ent->hasCachedMdl = true;
@@ -2573,18 +2617,52 @@ void Renderer::drawModelsAndSprites() {
 	float aspect = (float)windowWidth / (float)windowHeight;
 	Frustum frustum = getViewFrustum(cameraOrigin, cameraAngles, aspect, zNear, zFar, fov);
 
+	unordered_map<BaseRenderer*, float> loadPriorities; // closest entity distance for models still loading
+
+	Bsp* map = mapRenderer->map;
+
+	// anything not drawn this frame can't be picked
+	for (int idx : mapRenderer->studioDrawnEnts) {
+		if (idx < map->ents.size())
+			map->ents[idx]->didStudioDraw = false;
+	}
+	mapRenderer->studioDrawnEnts.clear();
+
 	vector<DepthSortedEnt> depthSortedMdlEnts;
-	for (int i = 0; i < mapRenderer->map->ents.size(); i++) {
-		Entity* ent = mapRenderer->map->ents[i];
+
+	// Load models and update draw bounds only for entities that changed or are still loading.
+	// Everything else already has its bounds in the entity index.
+	vector<int>& staleEnts = mapRenderer->staleModelEnts;
+	if (mapRenderer->allModelEntsStale) {
+		staleEnts.clear();
+		for (int i = 0; i < map->ents.size(); i++) {
+			staleEnts.push_back(i);
+		}
+		mapRenderer->allModelEntsStale = false;
+	}
+	sort(staleEnts.begin(), staleEnts.end());
+	staleEnts.erase(unique(staleEnts.begin(), staleEnts.end()), staleEnts.end());
+
+	vector<int> stillStale;
+	for (int i : staleEnts) {
+		if (i >= map->ents.size())
+			continue;
+		Entity* ent = map->ents[i];
 		DepthSortedEnt sent;
 		sent.ent = ent;
 		sent.mdl = loadModel(sent.ent);
-		sent.ent->didStudioDraw = false;
 
 		if (ent->hidden)
-			continue;
+			continue; // hiding or unhiding entities marks everything stale again
 
-		if (sent.mdl && sent.mdl->loadState != MDL_LOAD_INITIAL) {
+		if (sent.mdl && sent.mdl->loadState == MDL_LOAD_INITIAL) {
+			float dist = (ent->getOrigin() - cameraOrigin).length();
+			auto prio = loadPriorities.find(sent.mdl);
+			if (prio == loadPriorities.end() || dist < prio->second) {
+				loadPriorities[sent.mdl] = dist;
+			}
+		}
+		else if (sent.mdl) {
 			if (!sent.mdl->valid) {
 				logf("Failed to load model: %s\n", sent.mdl->fpath.c_str());
 				studioModels[ent->cachedMdl->fpath] = NULL;
@@ -2598,58 +2676,75 @@ void Renderer::drawModelsAndSprites() {
 			}
 		}
 
-		if (sent.mdl && sent.mdl->loadState == MDL_LOAD_DONE && sent.mdl->valid) {
-			if (!ent->drawCached) {
-				ent->drawOrigin = ent->getOrigin();
-				ent->drawAngles = ent->getAngles();
-				ent->drawSequence = atoi(ent->getKeyvalue("sequence").c_str());
-				EntRenderOpts opts = ent->getRenderOpts();
+		if (!sent.mdl) {
+			continue; // nothing to draw
+		}
 
-				if (sent.mdl->isStudioModel()) {
-					vec3 mins, maxs;
-					((MdlRenderer*)sent.mdl)->getModelBoundingBox(ent->drawAngles, ent->drawSequence, mins, maxs);
-					ent->drawMin = mins + sent.origin;
-					ent->drawMax = maxs + sent.origin;
-				}
-				else {
-					vec3 mins, maxs;
-					((SprRenderer*)sent.mdl)->getBoundingBox(mins, maxs, opts.scale);
-					ent->drawMin = mins + sent.origin;
-					ent->drawMax = maxs + sent.origin;
-				}
-			}
+		if (sent.mdl->loadState != MDL_LOAD_DONE || !sent.mdl->valid) {
+			stillStale.push_back(i);
+			continue;
+		}
+
+		ent->drawOrigin = ent->getOrigin();
+		ent->drawAngles = ent->getAngles();
+		ent->drawSequence = atoi(ent->getKeyvalue("sequence").c_str());
 
+		if (sent.mdl->lastDrawCall == 0) {
+			// need to draw at least once to know mins/maxs
 			sent.idx = i;
 			sent.origin = ent->drawOrigin;
 			sent.dist = dotProduct(sent.origin - cameraOrigin, camForward);
+			depthSortedMdlEnts.push_back(sent);
+			stillStale.push_back(i);
+			continue;
+		}
 
-			if (sent.mdl->lastDrawCall == 0) {
-				// need to draw at least once to know mins/maxs
-				depthSortedMdlEnts.push_back(sent);
-				continue;
-			}
+		vec3 mins, maxs;
+		if (sent.mdl->isStudioModel()) {
+			((MdlRenderer*)sent.mdl)->getModelBoundingBox(ent->drawAngles, ent->drawSequence, mins, maxs);
+		}
+		else {
+			EntRenderOpts opts = ent->getRenderOpts();
+			((SprRenderer*)sent.mdl)->getBoundingBox(mins, maxs, opts.scale);
+		}
+		ent->drawMin = mins + ent->drawOrigin;
+		ent->drawMax = maxs + ent->drawOrigin;
+		ent->drawCached = true;
 
-			if (!sent.ent->drawCached) {
-				if (sent.mdl->isStudioModel()) {
-					vec3 mins, maxs;
-					((MdlRenderer*)sent.mdl)->getModelBoundingBox(ent->drawAngles, ent->drawSequence, mins, maxs);
-					ent->drawMin = mins + sent.origin;
-					ent->drawMax = maxs + sent.origin;
-				}
-				else {
-					EntRenderOpts opts = ent->getRenderOpts();
-					vec3 mins, maxs;
-					((SprRenderer*)sent.mdl)->getBoundingBox(mins, maxs, opts.scale);
-					ent->drawMin = mins + sent.origin;
-					ent->drawMax = maxs + sent.origin;
-				}
-				ent->drawCached = true;
-			}
+		mapRenderer->updateEntIndex(i);
+	}
+	staleEnts.swap(stillStale);
+
+	vector<int> entsInView;
+	mapRenderer->entIndex.queryFrustum(frustum, zFarMdl, entsInView);
 
-			if (isBoxInView(ent->drawMin, ent->drawMax, frustum, zFarMdl))
-				depthSortedMdlEnts.push_back(sent);
+	for (int i : entsInView) {
+		if (i >= map->ents.size())
+			continue;
+		Entity* ent = map->ents[i];
+		BaseRenderer* mdl = ent->cachedMdl;
+
+		// stale entities were handled above
+		if (ent->hidden || !ent->drawCached || !ent->hasCachedMdl || !mdl)
+			continue;
+		if (mdl->loadState != MDL_LOAD_DONE || !mdl->valid || mdl->lastDrawCall == 0)
+			continue;
+
+		if (isBoxInView(ent->drawMin, ent->drawMax, frustum, zFarMdl)) {
+			DepthSortedEnt sent;
+			sent.ent = ent;
+			sent.mdl = mdl;
+			sent.idx = i;
+			sent.origin = ent->drawOrigin;
+			sent.dist = dotProduct(sent.origin - cameraOrigin, camForward);
+			depthSortedMdlEnts.push_back(sent);
 		}
 	}
+
+	if (loadPriorities.size()) {
+		modelLoader->setPriorities(loadPriorities);
+	}
+
 	sort(depthSortedMdlEnts.begin(), depthSortedMdlEnts.end(), [](const DepthSortedEnt& a, const DepthSortedEnt& b) {
 		return a.dist > b.dist;
 	});
@@ -2707,6 +2802,7 @@ void Renderer::drawModelsAndSprites() {
 
 		// draw the model
 		ent->didStudioDraw = true;
+		mapRenderer->studioDrawnEnts.push_back(entidx);
 		if (mdl->isStudioModel()) {
 			((MdlRenderer*)mdl)->draw(ent->drawOrigin + worldOffset, ent->drawAngles, ent->drawSequence,
 				g_app->cameraOrigin, g_app->cameraRight, isSelected ? vec3(1, 0, 0) : vec3(1, 1, 1));
@@ -2973,6 +3069,7 @@ vec3 Renderer::getAxisDragPoint(vec3 origin) {
 }
 
 void Renderer::updateModelVerts() {
+	vertHandlesMoved = true;
 
 	if (modelVertBuff) {
 		delete modelVertBuff;
@@ -3394,6 +3491,7 @@ void Renderer::scaleSelectedObject(vec3 dir, vec3 fromDir) {
 			modelVerts[i].pos = snapToGrid(modelVerts[i].pos);
 		}
 	}
+	vertHandlesMoved = true;
 
 	// scale visible faces
 	for (int i = 0; i < modelFaceVerts.size(); i++) {
@@ -3504,6 +3602,7 @@ void Renderer::moveSelectedVerts(vec3 delta) {
 				*modelVerts[i].ptr = modelVerts[i].pos;
 		}
 	}
+	vertHandlesMoved = true;
 
 	invalidSolid = !pickInfo.getMap()->vertex_manipulation_sync(pickInfo.getModelIndex(), modelVerts, true, false);
 	mapRenderer->refreshModel(pickInfo.getModelIndex());
@@ -3732,6 +3831,7 @@ void Renderer::scaleSelectedVerts(float x, float y, float z) {
 				*modelVerts[i].ptr = modelVerts[i].pos;
 		}
 	}
+	vertHandlesMoved = true;
 
 	invalidSolid = !pickInfo.getMap()->vertex_manipulation_sync(pickInfo.getModelIndex(), modelVerts, true, false);
 	mapRenderer->refreshModel(pickInfo.getModelIndex());
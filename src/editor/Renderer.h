@@ -4,6 +4,7 @@
 #include "BspRenderer.h"
 #include "bsptypes.h"
 #include "BspMerger.h"
+#include "VertexHandleGrid.h"
 #include <unordered_map>
 
 class Gui;
@@ -17,6 +18,7 @@ class Entity;
 class Bsp;
 class LeafNavMesh;
 class BaseRenderer;
+class ModelLoader;
 
 enum transform_modes {
 	TRANSFORM_NONE = -1,
@@ -160,6 +162,7 @@ private:
 
 	unordered_map<string, BaseRenderer*> studioModels; // maps a path to a model/sprite renderer
 	unordered_map<string, string> studioModelPaths; // maps a entity path to an existing path, or blank if not found
+	ModelLoader* modelLoader; // parses models/sprites in the background, closest to the camera first
 
 	vec3 cameraOrigin;
 	vec3 cameraAngles;
@@ -221,6 +224,10 @@ private:
 	int hoverVert = -1;
 	int hoverEdge = -1;
 	float vertExtentFactor = 0.01f;
+	VertexHandleGrid vertHandleGrid; // model verts followed by edge control points, relative to the entity origin
+	bool vertHandlesMoved = true; // vertHandleGrid needs to be rebuilt
+	int hoverHandleTests = 0; // handles ray tested by the last hover check
+	double hoverTime = 0; // seconds spent in the last hover check
 	bool modelUsesSharedStructures = false;
 	vec3 selectionSize;
 
@@ -20,7 +20,6 @@ SprRenderer::SprRenderer(ShaderProgram* frameShader, ShaderProgram* outlineShade
 	u_color_outline = glGetUniformLocation(outlineShader->ID, "color");
 
 	loadState = SPR_LOAD_INITIAL;
-	loadData();
 }
 
 SprRenderer::~SprRenderer() {
@@ -127,6 +126,7 @@ void SprRenderer::loadData() {
 
 	if (!validate()) {
 		delete[] buffer;
+		loadState = SPR_LOAD_DONE;
 		return;
 	}
 
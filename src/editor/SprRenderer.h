@@ -66,6 +66,7 @@ public:
 	SprRenderer(ShaderProgram* frameShader, ShaderProgram* outlineShader, string sprPath);
 	~SprRenderer();
 
+	void loadData() override;
 	void upload() override;
 	void draw(vec3 ori, vec3 angles, EntRenderOpts opts, bool selected);
 	void getBoundingBox(vec3& mins, vec3& maxs, float scale);
@@ -77,7 +78,6 @@ private:
 	SpriteHeader* header;
 
 	bool validate();
-	void loadData();
 
 	ShaderProgram* frameShader;
 	ShaderProgram* outlineShader;
@@ -0,0 +1,139 @@
+#include "VertexHandleGrid.h"
+#include <algorithm>
+#include <float.h>
+
+#define HANDLE_GRID_MAX_DIM 128 // cells per axis
+
+void VertexHandleGrid::build(const vector<vec3>& points) {
+	clear();
+	this->points = points;
+
+	if (points.empty()) {
+		return;
+	}
+
+	mins = maxs = points[0];
+	for (int i = 1; i < points.size(); i++) {
+		expandBoundingBox(points[i], mins, maxs);
+	}
+
+	// about one point per cell, with flat models treated as at least 1 unit thick
+	vec3 size = maxs - mins;
+	float volume = max(size.x, 1.0f) * max(size.y, 1.0f) * max(size.z, 1.0f);
+	float maxSize = max(size.x, max(size.y, size.z));
+	cellSize = max(1.0f, max(cbrtf(volume / points.size()), maxSize / HANDLE_GRID_MAX_DIM));
+
+	for (int i = 0; i < 3; i++) {
+		dims[i] = min(HANDLE_GRID_MAX_DIM, (int)((&size.x)[i] / cellSize) + 1);
+	}
+
+	// counting sort into cells
+	int cellCount = dims[0] * dims[1] * dims[2];
+	cellStarts.resize(cellCount + 1, 0);
+	cellStamps.resize(cellCount, 0);
+	vector<int> pointCells(points.size());
+
+	for (int i = 0; i < points.size(); i++) {
+		int cell = (cellCoord(points[i].z, 2) * dims[1] + cellCoord(points[i].y, 1)) * dims[0] + cellCoord(points[i].x, 0);
+		pointCells[i] = cell;
+		cellStarts[cell + 1]++;
+	}
+	for (int i = 0; i < cellCount; i++) {
+		cellStarts[i + 1] += cellStarts[i];
+	}
+
+	cellPoints.resize(points.size());
+	vector<int> cellFill(cellStarts.begin(), cellStarts.end() - 1);
+	for (int i = 0; i < points.size(); i++) {
+		cellPoints[cellFill[pointCells[i]]++] = i;
+	}
+}
+
+void VertexHandleGrid::clear() {
+	points.clear();
+	cellStarts.clear();
+	cellPoints.clear();
+	cellStamps.clear();
+	queryCount = 0;
+}
+
+int VertexHandleGrid::cellCoord(float v, int axis) const {
+	float c = clamp((v - (&mins.x)[axis]) / cellSize, 0, dims[axis] - 1);
+	return (int)c;
+}
+
+void VertexHandleGrid::query(vec3 start, vec3 dir, vec3 eye, float sizeFactor, vector<int>& output) {
+	if (points.empty()) {
+		return;
+	}
+
+	int outputStart = output.size();
+
+	// A box with half-width s is only hit if its center is within s*sqrt(3) of the ray, and s grows
+	// with the distance from the eye, which is at most |t| + d + e for a point at distance d from
+	// the ray, t along it. Solving for d gives a cone: d <= coneSlope * (|t| + e).
+	float reach = sqrtf(3.0f) * sizeFactor;
+	if (reach >= 1.0f) {
+		// boxes are so big that anything could be hit
+		for (int i = 0; i < points.size(); i++) {
+			output.push_back(i);
+		}
+		return;
+	}
+	float coneSlope = reach / (1.0f - reach);
+	float e = (start - eye).length();
+
+	// range of t covered by the grid
+	float tMin = FLT_MAX;
+	float tMax = -FLT_MAX;
+	for (int i = 0; i < 8; i++) {
+		vec3 corner = vec3(i & 1 ? maxs.x : mins.x, i & 2 ? maxs.y : mins.y, i & 4 ? maxs.z : mins.z);
+		float t = dotProduct(corner - start, dir);
+		tMin = min(tMin, t);
+		tMax = max(tMax, t);
+	}
+
+	queryCount++;
+
+	// march along the ray, visiting every cell within the cone around each step
+	float step = cellSize;
+	for (float t = tMin; t < tMax + step; t += step) {
+		vec3 center = start + dir * t;
+		float radius = coneSlope * (fabs(t) + step * 0.5f + e) + step * 0.5f;
+
+		vec3 lo = center - vec3(radius, radius, radius);
+		vec3 hi = center + vec3(radius, radius, radius);
+		if (lo.x > maxs.x || lo.y > maxs.y || lo.z > maxs.z || hi.x < mins.x || hi.y < mins.y || hi.z < mins.z) {
+			continue;
+		}
+
+		int x0 = cellCoord(lo.x, 0), x1 = cellCoord(hi.x, 0);
+		int y0 = cellCoord(lo.y, 1), y1 = cellCoord(hi.y, 1);
+		int z0 = cellCoord(lo.z, 2), z1 = cellCoord(hi.z, 2);
+
+		for (int z = z0; z <= z1; z++) {
+			for (int y = y0; y <= y1; y++) {
+				for (int x = x0; x <= x1; x++) {
+					int cell = (z * dims[1] + y) * dims[0] + x;
+					if (cellStamps[cell] == queryCount) {
+						continue;
+					}
+					cellStamps[cell] = queryCount;
+
+					for (int k = cellStarts[cell]; k < cellStarts[cell + 1]; k++) {
+						int idx = cellPoints[k];
+						vec3 delta = points[idx] - start;
+						float pt = dotProduct(delta, dir);
+						float dist = (delta - dir * pt).length();
+						if (dist <= coneSlope * (fabs(pt) + e) + 0.01f) {
+							output.push_back(idx);
+						}
+					}
+				}
+			}
+		}
+	}
+
+	// callers test in index order so ties are broken the same way as testing everything
+	sort(output.begin() + outputStart, output.end());
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include "util.h"
+#include <vector>
+
+// Uniform grid of vertex edit handles, so hovering only ray tests the handles near the mouse ray.
+// Handles are drawn as cubes that grow with their distance from the camera, so a ray can only hit
+// handles within a cone around it. Positions are only read on build, so rebuild after moving them.
+class VertexHandleGrid {
+public:
+	void build(const vector<vec3>& points);
+
+	void clear();
+
+	int size() const { return points.size(); }
+
+	// adds the sorted indexes of points whose box could be hit by the ray, where a box's half-width
+	// is (distance from the eye) * sizeFactor. dir must be normalized.
+	void query(vec3 start, vec3 dir, vec3 eye, float sizeFactor, vector<int>& output);
+
+private:
+	vector<vec3> points;
+	vec3 mins;
+	vec3 maxs;
+	float cellSize;
+	int dims[3];
+	vector<int> cellStarts; // first index into cellPoints for each cell, plus one past the end
+	vector<int> cellPoints; // point indexes grouped by cell
+	vector<int> cellStamps; // last query that visited each cell
+	int queryCount = 0;
+
+	int cellCoord(float v, int axis) const;
+};
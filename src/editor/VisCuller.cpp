@@ -0,0 +1,269 @@
+#include "VisCuller.h"
+#include "Bsp.h"
+#include "Entity.h"
+#include "vis.h"
+#include "LooseOctree.h"
+#include <algorithm>
+#include <chrono>
+#include <string.h>
+
+VisCuller::VisCuller(Bsp* map, const LooseOctree* entIndex) {
+	this->map = map;
+	this->entIndex = entIndex;
+}
+
+void VisCuller::cull(vec3 cameraOrigin, vec3 cameraAngles, float aspect, float fov, float zFar, VisibleSet& output) {
+	cull(getViewFrustum(cameraOrigin, cameraAngles, aspect, 1.0f, zFar, fov), zFar, output);
+}
+
+void VisCuller::cull(const Frustum& frustum, float zFar, VisibleSet& output) {
+	auto cullStart = chrono::steady_clock::now();
+
+	output.faces.clear();
+	output.ents.clear();
+	output.pvsLeaves = 0;
+	output.drawnLeaves = 0;
+	output.cameraLeaf = 0;
+
+	if (map->modelCount <= 0 || map->leafCount <= 0) {
+		output.cullTime = 0;
+		return;
+	}
+
+	output.cameraLeaf = map->get_leaf(frustum.origin, 0);
+	loadPvs(output.cameraLeaf);
+
+	if (faceStamps.size() != map->faceCount) {
+		faceStamps.clear();
+		faceStamps.resize(map->faceCount, 0);
+	}
+	cullCount++;
+
+	output.pvsLeaves = pvsLeafTotal;
+
+	markVisibleFaces(map->models[0].iHeadnodes[0], frustum, zFar, output);
+
+	updateUnmarkedFaces();
+	output.faces.insert(output.faces.end(), unmarkedFaces.begin(), unmarkedFaces.end());
+	sort(output.faces.begin(), output.faces.end());
+
+	entCandidates.clear();
+	if (entIndex) {
+		entIndex->queryFrustum(frustum, zFar, entCandidates);
+		sort(entCandidates.begin(), entCandidates.end());
+	}
+	else {
+		for (int i = 1; i < map->ents.size(); i++) {
+			entCandidates.push_back(i);
+		}
+	}
+
+	for (int k = 0; k < entCandidates.size(); k++) {
+		int i = entCandidates[k];
+		if (i <= 0 || i >= map->ents.size()) {
+			continue;
+		}
+
+		Entity* ent = map->ents[i];
+		int modelIdx = ent->getBspModelIdx();
+		if (modelIdx <= 0 || modelIdx >= map->modelCount) {
+			continue;
+		}
+
+		BSPMODEL& model = map->models[modelIdx];
+		vec3 origin = ent->getOrigin();
+		vec3 mins = model.nMins;
+		vec3 maxs = model.nMaxs;
+
+		if (ent->getAngles() != vec3()) {
+			// any rotation fits in a cube around the model origin
+			float radius = max(mins.length(), maxs.length());
+			mins = vec3(-radius, -radius, -radius);
+			maxs = vec3(radius, radius, radius);
+		}
+		mins += origin;
+		maxs += origin;
+
+		if (!isBoxInView(mins, maxs, frustum, zFar)) {
+			continue;
+		}
+		if (hasPvs && !isBoxInPvs(map->models[0].iHeadnodes[0], mins, maxs)) {
+			continue;
+		}
+
+		output.ents.push_back(i);
+	}
+
+	output.cullTime = chrono::duration<double>(chrono::steady_clock::now() - cullStart).count();
+}
+
+void VisCuller::loadPvs(int leafIdx) {
+	byte* visLump = map->lumps[LUMP_VISIBILITY];
+	int visLength = map->visDataLength;
+
+	if (leafIdx == pvsLeaf && visLump == pvsVisLump && visLength == pvsVisLength && map->leafCount == pvsLeafCount) {
+		return;
+	}
+	pvsLeaf = leafIdx;
+	pvsVisLump = visLump;
+	pvsVisLength = visLength;
+	pvsLeafCount = map->leafCount;
+	pvsLeafTotal = map->models[0].nVisLeafs;
+	hasPvs = false;
+
+	if (leafIdx <= 0 || leafIdx >= map->leafCount || !visLump || visLength <= 0) {
+		return; // outside the map or no vis data. Everything could be visible.
+	}
+
+	int visOffset = map->leaves[leafIdx].nVisOffset;
+	if (visOffset < 0 || visOffset >= visLength) {
+		return; // the compiler marks leaves that see everything this way
+	}
+
+	// exclude the solid leaf
+	int visLeafCount = map->leafCount - 1;
+	uint visRowSize = ((visLeafCount + 63) & ~63) >> 3;
+	pvs.resize(visRowSize);
+	memset(&pvs[0], 0, visRowSize);
+
+	if (!DecompressVis(visLump + visOffset, &pvs[0], visRowSize, visLeafCount, visLump, visLength)) {
+		debugf("Failed to decompress VIS for leaf %d. Not culling.\n", leafIdx);
+		return;
+	}
+
+	hasPvs = true;
+	pvsLeafTotal = 1; // the camera leaf
+	for (int i = 1; i < map->leafCount; i++) {
+		if (i != leafIdx && isLeafInPvs(i)) {
+			pvsLeafTotal++;
+		}
+	}
+}
+
+void VisCuller::updateUnmarkedFaces() {
+	if (map->faceCount == unmarkedFaceCount && map->marksurfCount == unmarkedMarksurfCount) {
+		return;
+	}
+	unmarkedFaceCount = map->faceCount;
+	unmarkedMarksurfCount = map->marksurfCount;
+	unmarkedFaces.clear();
+
+	vector<bool> marked(map->faceCount);
+	for (int i = 0; i < map->marksurfCount; i++) {
+		if (map->marksurfs[i] < map->faceCount) {
+			marked[map->marksurfs[i]] = true;
+		}
+	}
+
+	BSPMODEL& world = map->models[0];
+	for (int i = world.iFirstFace; i < world.iFirstFace + world.nFaces && i < map->faceCount; i++) {
+		if (!marked[i]) {
+			unmarkedFaces.push_back(i);
+		}
+	}
+}
+
+bool VisCuller::isLeafInPvs(int leafIdx) {
+	if (!hasPvs || leafIdx == pvsLeaf) {
+		return true;
+	}
+
+	int bit = leafIdx - 1;
+	if (bit < 0 || (bit >> 3) >= pvs.size()) {
+		return false;
+	}
+
+	return (pvs[bit >> 3] & (1 << (bit & 7))) != 0;
+}
+
+bool VisCuller::isBoxInPvs(int iNode, const vec3& mins, const vec3& maxs) {
+	while (iNode >= 0) {
+		if (iNode >= map->nodeCount) {
+			return true;
+		}
+
+		BSPNODE& node = map->nodes[iNode];
+		if (node.iPlane >= map->planeCount) {
+			return true;
+		}
+		BSPPLANE& plane = map->planes[node.iPlane];
+
+		// distance range of the box from the plane
+		vec3 n = plane.vNormal;
+		float center = dotProduct(n, (mins + maxs) * 0.5f) - plane.fDist;
+		vec3 extents = (maxs - mins) * 0.5f;
+		float radius = fabs(n.x) * extents.x + fabs(n.y) * extents.y + fabs(n.z) * extents.z;
+
+		if (center - radius >= 0) {
+			iNode = node.iChildren[0];
+		}
+		else if (center + radius < 0) {
+			iNode = node.iChildren[1];
+		}
+		else {
+			// straddles the plane
+			if (isBoxInPvs(node.iChildren[0], mins, maxs)) {
+				return true;
+			}
+			iNode = node.iChildren[1];
+		}
+	}
+
+	int leafIdx = ~iNode;
+	if (leafIdx <= 0 || leafIdx >= map->leafCount) {
+		return false; // solid leaf
+	}
+
+	return isLeafInPvs(leafIdx);
+}
+
+void VisCuller::markVisibleFaces(int iNode, const Frustum& frustum, float zFar, VisibleSet& output) {
+	if (iNode >= 0) {
+		if (iNode >= map->nodeCount) {
+			return;
+		}
+
+		BSPNODE& node = map->nodes[iNode];
+		vec3 mins = vec3(node.nMins[0], node.nMins[1], node.nMins[2]);
+		vec3 maxs = vec3(node.nMaxs[0], node.nMaxs[1], node.nMaxs[2]);
+		if (!isBoxInView(mins, maxs, frustum, zFar)) {
+			return;
+		}
+
+		markVisibleFaces(node.iChildren[0], frustum, zFar, output);
+		markVisibleFaces(node.iChildren[1], frustum, zFar, output);
+		return;
+	}
+
+	int leafIdx = ~iNode;
+	if (leafIdx <= 0 || leafIdx >= map->leafCount) {
+		return;
+	}
+
+	if (!isLeafInPvs(leafIdx)) {
+		return;
+	}
+
+	BSPLEAF& leaf = map->leaves[leafIdx];
+	vec3 mins = vec3(leaf.nMins[0], leaf.nMins[1], leaf.nMins[2]);
+	vec3 maxs = vec3(leaf.nMaxs[0], leaf.nMaxs[1], leaf.nMaxs[2]);
+	if (!isBoxInView(mins, maxs, frustum, zFar)) {
+		return;
+	}
+	output.drawnLeaves++;
+
+	for (int i = 0; i < leaf.nMarkSurfaces; i++) {
+		int markIdx = leaf.iFirstMarkSurface + i;
+		if (markIdx >= map->marksurfCount) {
+			break;
+		}
+
+		int faceIdx = map->marksurfs[markIdx];
+		if (faceIdx < 0 || faceIdx >= map->faceCount || faceStamps[faceIdx] == cullCount) {
+			continue;
+		}
+
+		faceStamps[faceIdx] = cullCount;
+		output.faces.push_back(faceIdx);
+	}
+}
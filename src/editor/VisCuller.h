@@ -0,0 +1,63 @@
+#pragma once
+#include "util.h"
+#include <vector>
+
+class Bsp;
+class LooseOctree;
+
+// what the camera can see, for one frame
+struct VisibleSet {
+	vector<int> faces; // world faces, sorted
+	vector<int> ents; // entities with brush models, sorted. Hidden entities are included.
+	int cameraLeaf; // 0 if the camera is outside the map, in which case nothing is culled by the PVS
+	int pvsLeaves; // leaves in the camera leaf's PVS
+	int drawnLeaves; // PVS leaves that are also in the view frustum
+	double cullTime; // seconds
+};
+
+// Culls the world with the potentially visible set of the camera leaf and the view frustum, the same
+// way the engine does. Doesn't touch OpenGL, so it can be benchmarked without a window.
+class VisCuller {
+public:
+	// entIndex narrows down which entities to test. Every entity is tested without it.
+	VisCuller(Bsp* map, const LooseOctree* entIndex=NULL);
+
+	// camera position is in map space (ignores the worldspawn origin).
+	// aspect = width / height, fov = vertical field of view in degrees
+	void cull(vec3 cameraOrigin, vec3 cameraAngles, float aspect, float fov, float zFar, VisibleSet& output);
+
+	void cull(const Frustum& frustum, float zFar, VisibleSet& output);
+
+private:
+	Bsp* map;
+	const LooseOctree* entIndex;
+	vector<int> entCandidates;
+
+	// decompressed vis row of the last camera leaf. Reloaded when the leaf or vis lump changes.
+	int pvsLeaf = -1;
+	byte* pvsVisLump = NULL;
+	int pvsVisLength = 0;
+	int pvsLeafCount = 0;
+	vector<byte> pvs;
+	int pvsLeafTotal = 0; // leaves set in the pvs row
+	bool hasPvs = false; // false if every leaf should be considered visible
+
+	vector<int> faceStamps; // last cull that added each face, to skip faces shared between leaves
+	int cullCount = 0;
+
+	// world faces that no leaf references (e.g. after some edits). These are always drawn.
+	vector<int> unmarkedFaces;
+	int unmarkedFaceCount = -1;
+	int unmarkedMarksurfCount = -1;
+
+	void loadPvs(int leafIdx);
+
+	void updateUnmarkedFaces();
+
+	bool isLeafInPvs(int leafIdx);
+
+	// true if the box touches a leaf in the PVS
+	bool isBoxInPvs(int iNode, const vec3& mins, const vec3& maxs);
+
+	void markVisibleFaces(int iNode, const Frustum& frustum, float zFar, VisibleSet& output);
+};
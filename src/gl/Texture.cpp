@@ -25,6 +25,8 @@ Texture::~Texture()
 	if (uploaded)
 		glDeleteTextures(1, &id);
 	delete[] data;
+	for (int i = 0; i < numMips; i++)
+		delete[] mips[i];
 }
 
 void Texture::upload(int format, bool lightmap)
@@ -51,7 +53,13 @@ void Texture::upload(int format, bool lightmap)
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_GENERATE_MIPMAP, GL_TRUE);
+
+		if (numMips) {
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, numMips);
+		}
+		else {
+			glTexParameteri(GL_TEXTURE_2D, GL_GENERATE_MIPMAP, GL_TRUE);
+		}
 	}
 
 	if (format == GL_RGB)
@@ -59,10 +67,17 @@ void Texture::upload(int format, bool lightmap)
 		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 	}
 
-	// TODO: load mipmaps from BSP/WAD
-
 	glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
 
+	// mip levels decoded from the BSP/WAD
+	if (!lightmap) {
+		for (int i = 0; i < numMips; i++) {
+			int mipWidth = width >> (i + 1);
+			int mipHeight = height >> (i + 1);
+			glTexImage2D(GL_TEXTURE_2D, i + 1, format, mipWidth, mipHeight, 0, format, GL_UNSIGNED_BYTE, mips[i]);
+		}
+	}
+
 	uploaded = true;
 }
 
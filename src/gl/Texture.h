@@ -13,6 +13,10 @@ public:
 	bool uploaded = false;
 	bool isLightmap; // always filtered
 
+	// optional smaller mip levels (same format as data). GL generates them if none are set.
+	uint8_t* mips[3] = {};
+	int numMips = 0;
+
 	Texture(int width, int height);
 	Texture(int width, int height, void * data);
 	~Texture();
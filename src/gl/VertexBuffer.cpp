@@ -161,10 +161,11 @@ void VertexBuffer::bindAttributes(bool hideErrors) {
 	attributesBound = true;
 }
 
-void VertexBuffer::setData(const void* data, int numVerts)
+void VertexBuffer::setData(const void* data, int numVerts, int capacity)
 {
 	this->data = (byte*)data;
 	this->numVerts = numVerts;
+	this->capacity = capacity;
 }
 
 void VertexBuffer::upload() {
@@ -173,7 +174,8 @@ void VertexBuffer::upload() {
 
 	glGenBuffers(1, &vboId);
 	glBindBuffer(GL_ARRAY_BUFFER, vboId);
-	glBufferData(GL_ARRAY_BUFFER, elementSize * numVerts, data, GL_STATIC_DRAW);
+	uploadedVerts = capacity > numVerts ? capacity : numVerts;
+	glBufferData(GL_ARRAY_BUFFER, elementSize * uploadedVerts, data, GL_STATIC_DRAW);
 
 	int offset = 0;
 	for (int i = 0; i < attribs.size(); i++)
@@ -192,6 +194,25 @@ void VertexBuffer::upload() {
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
+void VertexBuffer::uploadRange(int start, int count) {
+	if (vboId == -1) {
+		return; // drawn straight from data
+	}
+	if (start < 0 || count <= 0) {
+		return;
+	}
+	if (start + count > uploadedVerts) {
+		// grew past the GPU buffer
+		deleteBuffer();
+		upload();
+		return;
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, vboId);
+	glBufferSubData(GL_ARRAY_BUFFER, elementSize * start, elementSize * count, data + elementSize * start);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
 void VertexBuffer::deleteBuffer() {
 	if (vboId != -1)
 		glDeleteBuffers(1, &vboId);
@@ -199,6 +220,33 @@ void VertexBuffer::deleteBuffer() {
 }
 
 void VertexBuffer::drawRange(int primitive, int start, int end)
+{
+	enableAttributes();
+
+	if (start < 0 || start > numVerts)
+		logf("Invalid start index: %d\n", start);
+	else if (end > numVerts || end < 0)
+		logf("Invalid end index: %d\n", end);
+	else if (end - start <= 0)
+		logf("Invalid draw range: %d -> %d\n", start, end);
+	else
+		glDrawArrays(primitive, start, end - start);
+
+	disableAttributes();
+}
+
+void VertexBuffer::drawRanges(int primitive, const vector<int>& starts, const vector<int>& counts)
+{
+	if (starts.empty()) {
+		return;
+	}
+
+	enableAttributes();
+	glMultiDrawArrays(primitive, &starts[0], &counts[0], starts.size());
+	disableAttributes();
+}
+
+void VertexBuffer::enableAttributes()
 {
 	shaderProgram->bind();
 	bindAttributes();
@@ -221,16 +269,10 @@ void VertexBuffer::drawRange(int primitive, int start, int end)
 			glVertexAttribPointer(a.handle, a.numValues, a.valueType, a.normalized != 0, elementSize, ptr);
 		}
 	}
+}
 
-	if (start < 0 || start > numVerts)
-		logf("Invalid start index: %d\n", start);
-	else if (end > numVerts || end < 0)
-		logf("Invalid end index: %d\n", end);
-	else if (end - start <= 0)
-		logf("Invalid draw range: %d -> %d\n", start, end);
-	else
-		glDrawArrays(primitive, start, end - start);
-
+void VertexBuffer::disableAttributes()
+{
 	if (vboId != -1) {
 		glBindBuffer(GL_ARRAY_BUFFER, 0);
 	}
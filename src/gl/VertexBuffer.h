@@ -61,15 +61,21 @@ public:
 
 	// Note: Data is not copied into the class - don't delete your data.
 	//       Data will be deleted when the buffer is destroyed.
-	void setData(const void * data, int numVerts);
+	// capacity is the number of verts data has room for, if more than numVerts. The GPU buffer
+	// is sized to match, so verts added later can be sent with uploadRange.
+	void setData(const void * data, int numVerts, int capacity=0);
 
 	void upload();
+	void uploadRange(int start, int count); // updates part of an uploaded buffer after editing data
 	void deleteBuffer();
 	void setShader(ShaderProgram* program, bool hideErrors=false);
 
 	void drawRange(int primitive, int start, int end);
 	void draw(int primitive);
 
+	// draws several ranges of verts with one call. Ranges are not validated.
+	void drawRanges(int primitive, const std::vector<int>& starts, const std::vector<int>& counts);
+
 	void addAttribute(int numValues, int valueType, int normalized, const char* varName);
 	void addAttribute(int type, const char* varName);
 	void bindAttributes(bool hideErrors = false); // find handles for all vertex attributes (call from main thread only)
@@ -77,8 +83,13 @@ public:
 private:
 	ShaderProgram * shaderProgram = NULL; // for getting handles to vertex attributes
 	uint32_t vboId = -1;
+	int capacity = 0;
+	int uploadedVerts = 0; // size of the GPU buffer
 	bool attributesBound = false;
 
+	void enableAttributes(); // binds the shader, buffer, and vertex attribute pointers
+	void disableAttributes();
+
 	// add attributes according to the attribute flags
 	void addAttributes(int attFlags);
 };
@@ -1,14 +1,18 @@
 #include "globals.h"
 #include "util.h"
+#include "ThreadPool.h"
+#include "AssetResolver.h"
+#include "LogRingBuffer.h"
 #include <thread>
 
 using namespace std;
 
+LogRingBuffer* g_log_buffer = new LogRingBuffer();
 ProgressMeter g_progress;
 int g_render_flags;
-vector<string> g_log_buffer;
-mutex g_log_mutex;
 std::thread::id g_main_thread_id = std::this_thread::get_id();
+ThreadPool* g_thread_pool = new ThreadPool();
+AssetResolver* g_asset_resolver = new AssetResolver();
 
 AppSettings g_settings;
 string g_config_dir = getConfigDir();
@@ -39,12 +39,14 @@ struct MapLimits {
 };
 
 class Renderer;
+class ThreadPool;
+class AssetResolver;
+class LogRingBuffer;
 
 extern bool g_verbose;
 extern ProgressMeter g_progress;
-extern std::vector<std::string> g_log_buffer;
+extern LogRingBuffer* g_log_buffer; // messages waiting to be shown in the GUI
 extern const char* g_version_string;
-extern std::mutex g_log_mutex;
 
 extern AppSettings g_settings;
 extern Renderer* g_app;
@@ -59,4 +61,10 @@ extern std::set<std::string> g_parsed_fgds;
 
 extern std::thread::id g_main_thread_id;
 
+// shared workers for CPU-bound background jobs
+extern ThreadPool* g_thread_pool;
+
+// indexed lookups for findAsset()
+extern AssetResolver* g_asset_resolver;
+
 extern int g_render_flags;
\ No newline at end of file
@@ -4,6 +4,13 @@
 #include "CommandLine.h"
 #include "Renderer.h"
 #include "globals.h"
+#include "ThreadPool.h"
+#include "AssetResolver.h"
+#include "BatchCommand.h"
+#include "BenchCommand.h"
+#include "MapServer.h"
+#include "Trace.h"
+#include <fstream>
 
 // super todo:
 // gui scale not accurate and mostly broken
@@ -35,7 +42,6 @@
 // reference aaatrigger from wad instead of embedding it if it doesnt exist
 // red highlight not working with lightmaps disabled
 // undo history
-// invalid solid log spam
 // scaling allowing concave solids (merge0.bsp angled wedge)
 // can't select faces sometimes
 // make all commands available in the 3d editor
@@ -97,7 +103,7 @@ const char* g_version_string = "bspguy v5 WIP (March 2025)";
 bool g_verbose = false;
 
 // remove unused data before modifying anything to avoid misleading results
-void remove_unused_data(Bsp* map) {
+bool remove_unused_data(Bsp* map) {
 	STRUCTCOUNT removed = map->remove_unused_model_structures();
 
 	if (!removed.allZero()) {
@@ -105,7 +111,10 @@ void remove_unused_data(Bsp* map) {
 		removed.print_delete_stats(1);
 		g_progress.clear();
 		logf("\n");
+		return true;
 	}
+
+	return false;
 }
 
 #ifdef WIN32
@@ -198,6 +207,10 @@ int test() {
 	return 0;
 }
 
+float get_weld_epsilon(CommandLine& cli) {
+	return cli.hasOption("-epsilon") ? atof(cli.getOption("-epsilon").c_str()) : 0;
+}
+
 int merge_maps(CommandLine& cli) {
 	vector<string> input_maps = cli.getOptionList("-maps");
 
@@ -206,35 +219,56 @@ int merge_maps(CommandLine& cli) {
 		return 1;
 	}
 
-	vector<Bsp*> maps;
+	bool nohull2 = cli.hasOption("-nohull2");
+	bool optimize = cli.hasOption("-optimize");
 
-	for (int i = 0; i < input_maps.size(); i++) {
-		Bsp* map = new Bsp(input_maps[i]);
+	// Each map is loaded and preprocessed on its own, so do them all at once.
+	// Logs are held until everything finishes so they don't interleave.
+	vector<Bsp*> maps(input_maps.size());
+	vector<string> mapLogs(input_maps.size());
+
+	g_thread_pool->parallelFor(input_maps.size(), [&](int i) {
+		ScopedLogCapture capture(mapLogs[i]);
+
+		Bsp* map = maps[i] = new Bsp(input_maps[i]);
 		if (!map->valid)
-			return 1;
-		maps.push_back(map);
-	}
+			return;
 
-	for (int i = 0; i < maps.size(); i++) {
-		logf("Preprocessing %s:\n", maps[i]->name.c_str());
+		logf("Preprocessing %s:\n", map->name.c_str());
 
 		logf("    Deleting unused data...\n");
-		STRUCTCOUNT removed = maps[i]->remove_unused_model_structures();
-		g_progress.clear();
+		STRUCTCOUNT removed = map->remove_unused_model_structures();
 		removed.print_delete_stats(2);
 
-		if (cli.hasOption("-nohull2") || (cli.hasOption("-optimize") && !maps[i]->has_hull2_ents())) {
+		if (nohull2 || (optimize && !map->has_hull2_ents())) {
 			logf("    Deleting hull 2...\n");
-			maps[i]->delete_hull(2, 1);
-			maps[i]->remove_unused_model_structures().print_delete_stats(2);
+			map->delete_hull(2, 1);
+			map->remove_unused_model_structures().print_delete_stats(2);
 		}
 
-		if (cli.hasOption("-optimize")) {
+		if (optimize) {
 			logf("    Optmizing...\n");
-			maps[i]->delete_unused_hulls().print_delete_stats(2);
+			map->delete_unused_hulls().print_delete_stats(2);
+
+			STRUCTCOUNT shared = map->share_clipnodes();
+			shared.add(map->remove_unused_model_structures());
+			shared.print_delete_stats(2);
 		}
 
 		logf("\n");
+	});
+
+	bool allValid = true;
+	for (int i = 0; i < maps.size(); i++) {
+		printCapturedLog(mapLogs[i]);
+		allValid = allValid && maps[i]->valid;
+	}
+
+	if (!allValid) {
+		for (int i = 0; i < maps.size(); i++) {
+			delete maps[i];
+		}
+		return 1;
 	}
 	
 	vec3 gap = cli.hasOption("-gap") ? cli.getOptionVector("-gap") : vec3(0,0,0);
@@ -247,6 +281,11 @@ int merge_maps(CommandLine& cli) {
 	Bsp* result = merger.merge(maps, gap, output_name,
 		cli.hasOption("-noripent"), cli.hasOption("-noscript"), false, max_dim).map;
 
+	if (cli.hasOption("-weld")) {
+		logf("\nWelding vertexes...\n");
+		result->weld_vertices(get_weld_epsilon(cli)).print_delete_stats(1);
+	}
+
 	logf("\n");
 	if (result->isValid()) result->write(output_name);
 	logf("\n");
@@ -259,11 +298,7 @@ int merge_maps(CommandLine& cli) {
 	return 0;
 }
 
-int print_info(CommandLine& cli) {
-	Bsp* map = new Bsp(cli.bspfile);
-	if (!map->valid)
-		return 1;
-
+int apply_info(Bsp* map, CommandLine& cli) {
 	bool limitMode = false;
 	int listLength = 10;
 	int sortMode = SORT_CLIPNODES;
@@ -286,7 +321,7 @@ int print_info(CommandLine& cli) {
 		}
 		else {
 			logf("ERROR: invalid limit name: %s\n", limitName.c_str());
-			return 0;
+			return 1;
 		}
 	}
 	if (cli.hasOption("-all")) {
@@ -295,19 +330,11 @@ int print_info(CommandLine& cli) {
 
 	map->print_info(limitMode, listLength, sortMode);
 
-	delete map;
-
 	return 0;
 }
 
-int noclip(CommandLine& cli) {
-	Bsp* map = new Bsp(cli.bspfile);
-	if (!map->valid)
-		return 1;
-
-	int model = -1;
+int check_noclip(CommandLine& cli) {
 	int hull = -1;
-	int redirect = 0;
 
 	if (cli.hasOption("-hull")) {
 		hull = cli.getOptionInt("-hull");
@@ -323,7 +350,7 @@ int noclip(CommandLine& cli) {
 			logf("ERROR: -redirect must be used with -hull\n");
 			return 1;
 		}
-		redirect = cli.getOptionInt("-redirect");
+		int redirect = cli.getOptionInt("-redirect");
 
 		if (redirect < 1 || redirect >= MAX_MAP_HULLS) {
 			logf("ERROR: redirect hull number must be 1-3\n");
@@ -335,7 +362,13 @@ int noclip(CommandLine& cli) {
 		}
 	}
 
-	remove_unused_data(map);
+	return 0;
+}
+
+int apply_noclip(Bsp* map, CommandLine& cli) {
+	int model = -1;
+	int hull = cli.hasOption("-hull") ? cli.getOptionInt("-hull") : -1;
+	int redirect = cli.hasOption("-redirect") ? cli.getOptionInt("-redirect") : 0;
 
 	if (cli.hasOption("-model")) {
 		model = cli.getOptionInt("-model");
@@ -363,7 +396,7 @@ int noclip(CommandLine& cli) {
 	else {
 		if (hull == 0) {
 			logf("HULL 0 can't be stripped globally. The entire map would be invisible!\n");
-			return 0;
+			return 1;
 		}
 
 		if (hull != -1) {
@@ -389,30 +422,17 @@ int noclip(CommandLine& cli) {
 		logf("    Model hull(s) was previously deleted or redirected.");
 	logf("\n");
 
-	if (map->isValid()) map->write(cli.hasOption("-o") ? cli.getOption("-o") : map->path);
-	logf("\n");
-
-	map->print_info(false, 0, 0);
-
-	delete map;
-
 	return 0;
 }
 
-int simplify(CommandLine& cli) {
-	Bsp* map = new Bsp(cli.bspfile);
-	if (!map->valid)
-		return 1;
-
-	int hull = 0;
-
+int check_simplify(CommandLine& cli) {
 	if (!cli.hasOption("-model")) {
 		logf("ERROR: -model is required\n");
 		return 1;
 	}
 
 	if (cli.hasOption("-hull")) {
-		hull = cli.getOptionInt("-hull");
+		int hull = cli.getOptionInt("-hull");
 
 		if (hull < 1 || hull >= MAX_MAP_HULLS) {
 			logf("ERROR: hull number must be 1-3\n");
@@ -420,9 +440,12 @@ int simplify(CommandLine& cli) {
 		}
 	}
 
-	int modelIdx = cli.getOptionInt("-model");
+	return 0;
+}
 
-	remove_unused_data(map);
+int apply_simplify(Bsp* map, CommandLine& cli) {
+	int hull = cli.hasOption("-hull") ? cli.getOptionInt("-hull") : 0;
+	int modelIdx = cli.getOptionInt("-model");
 
 	STRUCTCOUNT oldCounts(map);
 
@@ -452,23 +475,10 @@ int simplify(CommandLine& cli) {
 
 	logf("\n");
 
-	if (map->isValid()) map->write(cli.hasOption("-o") ? cli.getOption("-o") : map->path);
-	logf("\n");
-
-	map->print_info(false, 0, 0);
-
-	delete map;
-
 	return 0;
 }
 
-int deleteCmd(CommandLine& cli) {
-	Bsp* map = new Bsp(cli.bspfile);
-	if (!map->valid)
-		return 1;
-
-	remove_unused_data(map);
-
+int apply_delete(Bsp* map, CommandLine& cli) {
 	if (cli.hasOption("-model")) {
 		int modelIdx = cli.getOptionInt("-model");
 
@@ -482,21 +492,10 @@ int deleteCmd(CommandLine& cli) {
 		logf("\n");
 	}
 
-	if (map->isValid()) map->write(cli.hasOption("-o") ? cli.getOption("-o") : map->path);
-	logf("\n");
-
-	map->print_info(false, 0, 0);
-
-	delete map;
-
 	return 0;
 }
 
-int transform(CommandLine& cli) {
-	Bsp* map = new Bsp(cli.bspfile);
-	if (!map->valid)
-		return 1;
-
+int apply_transform(Bsp* map, CommandLine& cli) {
 	vec3 move;
 
 	if (cli.hasOptionVector("-move")) {
@@ -511,49 +510,299 @@ int transform(CommandLine& cli) {
 		logf("ERROR: at least one transformation option is required\n");
 		return 1;
 	}
-	
-	if (map->isValid()) map->write(cli.hasOption("-o") ? cli.getOption("-o") : map->path);
-	logf("\n");
 
-	map->print_info(false, 0, 0);
+	return 0;
+}
+
+int apply_optimize(Bsp* map, CommandLine& cli) {
+	STRUCTCOUNT oldCounts(map);
 
-	delete map;
+	logf("Merging duplicate planes and clipnodes:\n");
+	map->share_clipnodes();
+	map->remove_unused_model_structures();
+
+	STRUCTCOUNT change = oldCounts;
+	change.sub(STRUCTCOUNT(map));
+
+	if (!change.allZero())
+		change.print_delete_stats(1);
+	logf("\n");
 
 	return 0;
 }
 
-int unembed(CommandLine& cli) {
-	Bsp* map = new Bsp(cli.bspfile);
-	if (!map->valid)
-		return 1;
+int apply_weld(Bsp* map, CommandLine& cli) {
+	float epsilon = get_weld_epsilon(cli);
+	logf("Welding vertexes within %g units:\n", epsilon);
+
+	STRUCTCOUNT removed = map->weld_vertices(epsilon);
+	if (!removed.allZero())
+		removed.print_delete_stats(1);
+	logf("\n");
 
+	return 0;
+}
+
+int apply_unembed(Bsp* map, CommandLine& cli) {
 	int deleted = map->delete_embedded_textures();
 	logf("Deleted %d embedded textures\n", deleted);
 
-	if (map->isValid()) map->write(cli.hasOption("-o") ? cli.getOption("-o") : map->path);
-	logf("\n");
+	return 0;
+}
+
+int apply_renametex(Bsp* map, CommandLine& cli) {
+	string oldName = cli.getOption("-old");
+	string newName = cli.getOption("-new");
+
+	map->rename_texture(oldName.c_str(), newName.c_str());
 
 	return 0;
 }
 
-int rename_texture(CommandLine& cli) {
+// commands that work on a single map. Used by the command line, scripts, and the map server.
+MapCommand g_map_commands[] = {
+	// name        function          options         edits  cleanFirst  printInfo
+	{"info",       apply_info,       NULL,           false, false,      false},
+	{"noclip",     apply_noclip,     check_noclip,   true,  true,       true},
+	{"simplify",   apply_simplify,   check_simplify, true,  true,       true},
+	{"delete",     apply_delete,     NULL,           true,  true,       true},
+	{"transform",  apply_transform,  NULL,           true,  false,      true},
+	{"optimize",   apply_optimize,   NULL,           true,  true,       true},
+	{"weld",       apply_weld,       NULL,           true,  true,       true},
+	{"unembed",    apply_unembed,    NULL,           true,  false,      false},
+	{"renametex",  apply_renametex,  NULL,           true,  false,      false},
+};
+
+MapCommand* find_map_command(string name) {
+	for (int i = 0; i < sizeof(g_map_commands) / sizeof(MapCommand); i++) {
+		if (name == g_map_commands[i].name) {
+			return &g_map_commands[i];
+		}
+	}
+	return NULL;
+}
+
+// loads the map, runs the command, and writes the map if the command edited it
+int run_map_command(CommandLine& cli, MapCommand* command) {
 	Bsp* map = new Bsp(cli.bspfile);
-	if (!map->valid)
+	if (!map->valid) {
+		delete map;
 		return 1;
+	}
 
-	string oldName = cli.getOption("-old");
-	string newName = cli.getOption("-new");
+	int ret = command->checkOptions ? command->checkOptions(cli) : 0;
 
-	map->rename_texture(oldName.c_str(), newName.c_str());
+	if (ret == 0) {
+		if (command->cleanFirst) {
+			remove_unused_data(map);
+		}
 
-	if (map->isValid()) map->write(cli.hasOption("-o") ? cli.getOption("-o") : map->path);
-	logf("\n");
+		ret = command->func(map, cli);
+	}
+
+	if (ret == 0 && command->edits) {
+		if (map->isValid()) map->write(cli.hasOption("-o") ? cli.getOption("-o") : map->path);
+		logf("\n");
+
+		if (command->printInfo) {
+			map->print_info(false, 0, 0);
+		}
+	}
+
+	delete map;
+
+	return ret;
+}
+
+// loads the map once, applies each command to it in order, and writes it once at the end.
+// If any command needs unused data deleted, that's done once after the last command, instead of
+// before every command. If outPath is empty, the last -o given to a step is used, or else the map
+// is overwritten.
+int run_map_chain(string mapPath, vector<CommandLine>& steps, string outPath) {
+	vector<MapCommand*> commands;
+	bool outPathGiven = !outPath.empty();
+
+	for (int i = 0; i < steps.size(); i++) {
+		MapCommand* command = find_map_command(steps[i].command);
+		if (!command) {
+			logf("ERROR: step %d: unrecognized command: %s\n", i + 1, steps[i].command.c_str());
+			return 1;
+		}
+		if (command->checkOptions && command->checkOptions(steps[i])) {
+			logf("ERROR: step %d: invalid options for %s\n", i + 1, command->name);
+			return 1;
+		}
+		commands.push_back(command);
+
+		if (steps[i].hasOption("-o") && !outPathGiven) {
+			outPath = steps[i].getOption("-o");
+		}
+	}
+
+	Bsp* map = new Bsp(mapPath);
+	if (!map->valid) {
+		delete map;
+		return 1;
+	}
+
+	bool needsClean = false;
+	bool edited = false;
+
+	for (int i = 0; i < steps.size(); i++) {
+		logf("[%d/%d] %s\n", i + 1, (int)steps.size(), commands[i]->name);
+
+		if (commands[i]->func(map, steps[i])) {
+			logf("ERROR: step %d failed. The map was not written.\n", i + 1);
+			delete map;
+			return 1;
+		}
+
+		needsClean |= commands[i]->cleanFirst;
+		edited |= commands[i]->edits;
+	}
+
+	if (needsClean) {
+		remove_unused_data(map);
+	}
+
+	if (edited) {
+		if (map->isValid()) map->write(outPath.size() ? outPath : map->path);
+		logf("\n");
+
+		map->print_info(false, 0, 0);
+	}
 
 	delete map;
 
 	return 0;
 }
 
+// splits "bspguy noclip c1a0 -hull 2 --then transform -move 0,0,64" into one command line per step.
+// Following steps get the map of the first step. Returns false if a step has no command or there's
+// no map to work on.
+bool split_command_chain(int argc, char* argv[], vector<CommandLine>& steps) {
+	vector<vector<string>> stepArgs(1);
+
+	for (int i = 1; i < argc; i++) {
+		if (string(argv[i]) == "--then") {
+			stepArgs.push_back(vector<string>());
+		}
+		else {
+			stepArgs.back().push_back(argv[i]);
+		}
+	}
+
+	steps.clear();
+	if (stepArgs.size() == 1) {
+		steps.push_back(CommandLine(argc, argv));
+		return true;
+	}
+
+	for (int i = 0; i < stepArgs.size(); i++) {
+		if (stepArgs[i].empty()) {
+			logf("ERROR: step %d is empty. Each --then must be between two commands.\n", i + 1);
+			return false;
+		}
+	}
+
+	if (stepArgs[0].size() < 2) {
+		logf("ERROR: no map specified\n");
+		return false;
+	}
+	string mapPath = stepArgs[0][1];
+
+	for (int i = 0; i < stepArgs.size(); i++) {
+		vector<string>& args = stepArgs[i];
+		if (i > 0) {
+			args.insert(args.begin() + 1, mapPath);
+		}
+		args.insert(args.begin(), argv[0]);
+		steps.push_back(CommandLine(args));
+	}
+
+	return true;
+}
+
+int run_script(CommandLine& cli) {
+	if (!cli.hasOption("-script")) {
+		logf("ERROR: -script is required\n");
+		return 1;
+	}
+
+	string scriptPath = cli.getOption("-script");
+	ifstream file(scriptPath);
+	if (!file.is_open()) {
+		logf("ERROR: failed to open %s\n", scriptPath.c_str());
+		return 1;
+	}
+
+	vector<CommandLine> steps;
+	string line;
+	while (getline(file, line)) {
+		vector<string> args = CommandLine::splitArgs(line);
+
+		if (args.empty() || args[0][0] == '#') {
+			continue;
+		}
+
+		args.insert(args.begin() + 1, cli.bspfile);
+		args.insert(args.begin(), "bspguy");
+		steps.push_back(CommandLine(args));
+	}
+
+	if (steps.empty()) {
+		logf("ERROR: %s has no commands\n", scriptPath.c_str());
+		return 1;
+	}
+
+	return run_map_chain(cli.bspfile, steps, cli.hasOption("-o") ? cli.getOption("-o") : "");
+}
+
+int batch(CommandLine& cli) {
+	string op = cli.hasOption("-op") ? cli.getOption("-op") : "info";
+
+	if (!BatchCommand::isValidOp(op)) {
+		logf("ERROR: unknown operation '%s'\n", op.c_str());
+		return 1;
+	}
+
+	if (cli.hasOption("-res")) {
+		vector<string> resPaths = cli.getOptionList("-res");
+		g_settings.resPaths.insert(g_settings.resPaths.end(), resPaths.begin(), resPaths.end());
+		g_asset_resolver->invalidate();
+	}
+
+	vector<string> maps = BatchCommand::findMaps(cli.bspfile);
+	if (maps.empty()) {
+		logf("ERROR: no maps found in %s\n", cli.bspfile.c_str());
+		return 1;
+	}
+
+	BatchCommand command(op);
+	return command.run(maps) ? 1 : 0;
+}
+
+int bench(CommandLine& cli) {
+	string op = cli.hasOption("-op") ? cli.getOption("-op") : "cull";
+
+	if (!BenchCommand::isValidOp(op)) {
+		logf("ERROR: unknown operation '%s'\n", op.c_str());
+		return 1;
+	}
+
+	Bsp* map = new Bsp(cli.bspfile);
+	if (!map->valid) {
+		delete map;
+		return 1;
+	}
+
+	BenchCommand command(op, cli.hasOption("-n") ? cli.getOptionInt("-n") : 1000);
+	int ret = command.run(map);
+
+	delete map;
+
+	return ret;
+}
 
 void print_help(string command) {
 	if (command == "merge") {
@@ -567,6 +816,7 @@ void print_help(string command) {
 			"  -optimize    : Deletes unused model hulls before merging.\n"
 			"                 This can be risky and crash the game if assumptions about\n"
 			"                 entity visibility/solidity are wrong.\n"
+			"                 Identical clipnode subtrees are also shared.\n"
 			"  -nohull2     : Forces redirection of hull 2 to hull 1 in each map before merging.\n"
 			"                 This reduces clipnodes at the expense of less accurate collision\n"
 			"                 for large monsters and pushables.\n"
@@ -583,6 +833,8 @@ void print_help(string command) {
 			"  -hl          : Arranges maps to fit inside the vanilla Half-Life engine (+/-4096).\n"
 			"                 Otherwise uses the Sven Co-op limit of +/-32768.\n"
 			"  -gap \"X,Y,Z\" : Amount of extra space to add between each map\n"
+			"  -weld        : Welds duplicate vertexes and shares edges in the merged map.\n"
+			"  -epsilon #   : Max distance between vertexes welded by -weld. Default is 0.\n"
 			"  -v           : Verbose console output.\n"
 			);
 	}
@@ -661,6 +913,122 @@ void print_help(string command) {
 			"  -o <file>     : Output file. By default, <mapname> is overwritten.\n"
 			);
 	}
+	else if (command == "batch") {
+		logf(
+			"batch - Runs an operation on every map in a folder, in parallel\n\n"
+
+			"Usage:   bspguy batch <folder or pattern> [options]\n"
+			"Example: bspguy batch \"svencoop/maps/*.bsp\" -op limits\n"
+
+			"\nPrints one JSON object per map, in the order the maps finish.\n"
+			"WADs are read once and shared between maps.\n"
+
+			"\n[Options]\n"
+			"  -op <name>    : Operation to run on each map. Default is info.\n"
+			"                  info     = Data counts\n"
+			"                  validate = Check for bad indexes and missing textures/WADs\n"
+			"                  limits   = Usage of each engine limit\n"
+			"                  hulls    = Data that deleting unused hulls would remove\n"
+			"  -res \"a, b\"   : Extra folders to search for WADs.\n"
+			"  -hl           : Check against the vanilla Half-Life limits.\n"
+			);
+	}
+	else if (command == "bench") {
+		logf(
+			"bench - Times the editor's culling, picking, and mesh building code without opening a window\n\n"
+
+			"Usage:   bspguy bench <mapname> [options]\n"
+			"Example: bspguy bench c1a0.bsp -op cull -n 5000\n"
+
+			"\n[Options]\n"
+			"  -op <name> : Operation to run. Default is cull.\n"
+			"               cull = Cull the world with the PVS and view frustum from cameras\n"
+			"                      in random leaves. Prints visible counts and timings.\n"
+			"               pick = Pick faces and clipnodes of every model with rays aimed at\n"
+			"                      random faces. Fails if the picking trees miss a hit that\n"
+			"                      testing every face finds.\n"
+			"               clipnodes = Build all clipnode meshes, then rebuild them from the\n"
+			"                      cache and after moving every plane. Fails if any mesh\n"
+			"                      differs from one built without the cache.\n"
+			"               solids = Add boxes to the map one at a time, like the editor's\n"
+			"                      \"Create BSP model\" does. Prints the time taken.\n"
+			"  -n #       : Number of samples or solids to test. Default is 1000.\n"
+			"               Not used by clipnodes.\n"
+			);
+	}
+	else if (command == "run") {
+		logf(
+			"run - Applies a list of commands to a map, loading and writing it only once\n\n"
+
+			"Usage:   bspguy run <mapname> -script <file> [options]\n"
+			"Example: bspguy run c1a0.bsp -script edits.txt -o c1a0_edit.bsp\n"
+
+			"\nEach line of the script is a command without the map name, for example:\n"
+			"  noclip -hull 2\n"
+			"  transform -move \"0,0,64\"\n"
+			"Blank lines and lines starting with # are skipped. The map is only written\n"
+			"if every command succeeds.\n"
+
+			"\nCommands can also be chained on the command line with --then:\n"
+			"  bspguy noclip c1a0.bsp -hull 2 --then transform -move \"0,0,64\"\n"
+
+			"\n[Options]\n"
+			"  -o <file>  : Output file. By default, <mapname> is overwritten.\n"
+			);
+	}
+	else if (command == "serve") {
+		logf(
+			"serve - Keeps maps loaded and runs commands sent to a socket or stdin\n\n"
+
+			"Usage:   bspguy serve <socket path | stdio>\n"
+			"Example: bspguy serve /tmp/bspguy.sock\n"
+
+			"\nEach line sent to the server is a command, using the same syntax as the\n"
+			"command line. A map is loaded the first time it's used, and stays loaded\n"
+			"for later commands. Edits are only written if -o is given, or by 'save'.\n"
+			"Each command gets a one line JSON reply with its output and timings.\n"
+
+			"\n[Commands]\n"
+			"  info, noclip, simplify, delete, transform, optimize, weld, unembed, renametex\n"
+			"  save <mapname> [-o <path>] : Write the map\n"
+			"  close <mapname>            : Unload the map. Unsaved edits are lost.\n"
+			"  list                       : List the loaded maps\n"
+			"  quit                       : Stop the server\n"
+
+			"\nExample session:\n"
+			"  noclip c1a0.bsp -hull 2\n"
+			"  transform c1a0.bsp -move \"0,0,64\"\n"
+			"  save c1a0.bsp -o c1a0_edit.bsp\n"
+			);
+	}
+	else if (command == "optimize") {
+		logf(
+			"optimize - Merges duplicate data without changing how the map plays\n\n"
+
+			"Usage:   bspguy optimize <mapname> [options]\n"
+			"Example: bspguy optimize svencoop1.bsp\n"
+
+			"\nDuplicate planes are merged, including planes facing the opposite direction.\n"
+			"Identical clipnode subtrees are stored once and shared between hulls and models.\n"
+
+			"\n[Options]\n"
+			"  -o <file>  : Output file. By default, <mapname> is overwritten.\n"
+			);
+	}
+	else if (command == "weld") {
+		logf(
+			"weld - Merges duplicate vertexes and edges\n\n"
+
+			"Usage:   bspguy weld <mapname> [options]\n"
+			"Example: bspguy weld svencoop1.bsp -epsilon 0.01\n"
+
+			"\n[Options]\n"
+			"  -epsilon # : Max distance between welded vertexes. By default, only vertexes\n"
+			"               in the exact same position are welded. Vertexes are not moved if\n"
+			"               that would change a face's lightmap size.\n"
+			"  -o <file>  : Output file. By default, <mapname> is overwritten.\n"
+			);
+	}
 	else if (command == "unembed") {
 	logf(
 		"unembed - Deletes embedded texture data, so that they reference WADs instead.\n\n"
@@ -685,6 +1053,10 @@ void print_help(string command) {
 
 			"\n<Commands>\n"
 			"  info      : Show BSP data summary\n"
+			"  batch     : Run info/validate/limit checks on many maps at once\n"
+			"  bench     : Time the editor's culling, picking, and mesh code without a window\n"
+			"  serve     : Keep maps loaded and run commands sent to a socket or stdin\n"
+			"  run       : Apply a script of commands to a map, writing it only once\n"
 			"  merge     : Merges two or more maps together\n"
 			"  noclip    : Delete some clipnodes/nodes from the BSP\n"
 			"  delete    : Delete BSP models\n"
@@ -692,6 +1064,12 @@ void print_help(string command) {
 			"  transform : Apply 3D transformations to the BSP\n"
 			"  unembed   : Deletes embedded texture data\n"
 			"  renametex : Renames/replaces a texture in the BSP\n"
+			"  optimize  : Merges duplicate data in the BSP\n"
+			"  weld      : Merges duplicate vertexes and edges\n"
+
+			"\n[Global options]\n"
+			"  -trace <file> : Save a profile of the command (or editor session) as a\n"
+			"                  Chrome trace. Open it in chrome://tracing or ui.perfetto.dev\n"
 
 			"\nRun 'bspguy <command> help' to read about a specific command.\n"
 			"\nTo launch the 3D editor. Drag and drop a .bsp file onto the executable,\n"
@@ -748,6 +1126,11 @@ void init_limits() {
 	g_limits = g_engine_limits[ENGINE_SVEN_COOP];
 }
 
+int serve(CommandLine& cli) {
+	MapServer server(g_map_commands, sizeof(g_map_commands) / sizeof(MapCommand));
+	return server.run(cli.bspfile);
+}
+
 int main(int argc, char* argv[])
 {
 	#ifdef WIN32
@@ -758,7 +1141,33 @@ int main(int argc, char* argv[])
 
 	init_limits();
 
+	// -trace works with every command and the editor, so it's removed before anything else sees it
+	string tracePath;
+	vector<char*> args;
+	for (int i = 0; i < argc; i++) {
+		if (toLowerCase(argv[i]) == "-trace" && i + 1 < argc) {
+			tracePath = argv[++i];
+		}
+		else {
+			args.push_back(argv[i]);
+		}
+	}
+	argc = args.size();
+	argv = &args[0];
+
+#ifdef BSPGUY_TRACE
+	unique_ptr<TraceSession> trace(tracePath.size() ? new TraceSession(tracePath) : NULL);
+#else
+	if (tracePath.size()) {
+		logf("WARNING: -trace is ignored. This build was compiled without BSPGUY_TRACE.\n");
+	}
+#endif
+
 	CommandLine cli(argc, argv);
+	vector<CommandLine> chain;
+	if (!split_command_chain(argc, argv, chain)) {
+		return 1;
+	}
 
 	if (cli.hasOption("-hl")) {
 		g_limits = g_engine_limits[ENGINE_HALF_LIFE];
@@ -791,29 +1200,28 @@ int main(int argc, char* argv[])
 			g_verbose = true;
 		}
 
-		if (cli.command == "info") {
-			return print_info(cli);
-		}
-		else if (cli.command == "noclip") {
-			return noclip(cli);
-		}
-		else if (cli.command == "simplify") {
-			return simplify(cli);
-		}
-		else if (cli.command == "delete") {
-			return deleteCmd(cli);
+		MapCommand* mapCommand = find_map_command(cli.command);
+
+		if (chain.size() > 1) {
+			return run_map_chain(chain[0].bspfile, chain, "");
 		}
-		else if (cli.command == "transform") {
-			return transform(cli);
+		else if (mapCommand) {
+			return run_map_command(cli, mapCommand);
 		}
 		else if (cli.command == "merge") {
 			return merge_maps(cli);
 		}
-		else if (cli.command == "unembed") {
-			return unembed(cli);
+		else if (cli.command == "batch") {
+			return batch(cli);
+		}
+		else if (cli.command == "bench") {
+			return bench(cli);
+		}
+		else if (cli.command == "serve") {
+			return serve(cli);
 		}
-		else if (cli.command == "renametex") {
-			return rename_texture(cli);
+		else if (cli.command == "run") {
+			return run_script(cli);
 		}
 		else {
 			logf("unrecognized command: %d\n", cli.command.c_str());
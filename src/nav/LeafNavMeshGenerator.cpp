@@ -12,8 +12,10 @@
 #include <algorithm>
 #include <float.h>
 #include "Entity.h"
+#include "Trace.h"
 
 LeafNavMesh* LeafNavMeshGenerator::generate(Bsp* map) {
+	TRACE_SCOPE("LeafNavMeshGenerator::generate");
 	float NavMeshGeneratorGenStart = glfwGetTime();
 	BSPMODEL& model = map->models[0];
 
@@ -68,20 +70,19 @@ LeafNavMesh* LeafNavMeshGenerator::generate(Bsp* map) {
 }
 
 vector<LeafNode> LeafNavMeshGenerator::getHullLeaves(Bsp* map, int modelIdx, int contents) {
+	TRACE_SCOPE("getHullLeaves");
 	vector<LeafNode> leaves;
 
 	if (modelIdx < 0 || modelIdx >= map->modelCount) {
 		return leaves;
 	}
 
-	Clipper clipper;
+	vector<CMesh> meshes;
+	map->get_model_leaf_volumes(modelIdx, NAV_HULL, contents, meshes);
 
-	vector<NodeVolumeCuts> nodes = map->get_model_leaf_volume_cuts(modelIdx, NAV_HULL, contents);
-
-	for (int m = 0; m < nodes.size(); m++) {
-		CMesh mesh = clipper.clip(nodes[m].cuts);
+	for (int m = 0; m < meshes.size(); m++) {
 		LeafNode hull;
-		getHullForClipperMesh(mesh, hull);
+		getHullForClipperMesh(meshes[m], hull);
 
 		if (hull.leafFaces.size()) {
 			hull.id = leaves.size();
@@ -181,6 +182,7 @@ void LeafNavMeshGenerator::getOctreeBox(Bsp* map, vec3& min, vec3& max) {
 }
 
 LeafOctree* LeafNavMeshGenerator::createLeafOctree(Bsp* map, vector<LeafNode>& nodes, int treeDepth) {
+	TRACE_SCOPE("createLeafOctree");
 	float treeStart = glfwGetTime();
 
 	vec3 treeMin, treeMax;
@@ -192,15 +194,15 @@ LeafOctree* LeafNavMeshGenerator::createLeafOctree(Bsp* map, vector<LeafNode>& n
 		octree->insertLeaf(&nodes[i]);
 	}
 
-	logf("Create octree depth %d, size %f -> %f in %.2fs\n", treeDepth,
-		treeMax.x, treeMax.x / pow(2, treeDepth), (float)glfwGetTime() - treeStart);
+	logf("Create octree depth %d, size %f -> %f, %d octants in %.2fs\n", treeDepth,
+		treeMax.x, treeMax.x / pow(2, treeDepth), octree->octantCount(), (float)glfwGetTime() - treeStart);
 
 	return octree;
 }
 
 void LeafNavMeshGenerator::splitEntityLeaves(Bsp* map, LeafNavMesh* mesh) {
-	vector<bool> regionLeaves;
-	regionLeaves.resize(mesh->nodes.size());
+	TRACE_SCOPE("splitEntityLeaves");
+	vector<int> regionLeaves;
 
 	int oldNodeCount = mesh->nodes.size();
 
@@ -238,8 +240,9 @@ void LeafNavMeshGenerator::splitEntityLeaves(Bsp* map, LeafNavMesh* mesh) {
 			
 			mesh->octree->getLeavesInRegion(entNode, regionLeaves);
 
-			for (int k = 0; k < regionLeaves.size(); k++) {
-				if (regionLeaves[k] && boxesIntersect(entNode->mins, entNode->maxs, mesh->nodes[k].mins, mesh->nodes[k].maxs)) {
+			for (int r = 0; r < regionLeaves.size(); r++) {
+				int k = regionLeaves[r];
+				if (boxesIntersect(entNode->mins, entNode->maxs, mesh->nodes[k].mins, mesh->nodes[k].maxs)) {
 					nodeSplits[k].push_back({ state, entNode });
 				}
 			}
@@ -484,11 +487,11 @@ vec3 LeafNavMeshGenerator::getBestPolyOrigin(Bsp* map, Polygon3D& poly, vec3 bia
 }
 
 void LeafNavMeshGenerator::linkNavLeaves(Bsp* map, LeafNavMesh* mesh, int offset) {
+	TRACE_SCOPE("linkNavLeaves");
 	int numLinks = 0;
 	float linkStart = glfwGetTime();
 
-	vector<bool> regionLeaves;
-	regionLeaves.resize(mesh->nodes.size());
+	vector<int> regionLeaves;
 
 	for (int i = offset; i < mesh->nodes.size(); i++) {
 		LeafNode& leaf = mesh->nodes[i];
@@ -504,8 +507,9 @@ void LeafNavMeshGenerator::linkNavLeaves(Bsp* map, LeafNavMesh* mesh, int offset
 
 		mesh->octree->getLeavesInRegion(&leaf, regionLeaves);
 
-		for (int k = i + 1; k < mesh->nodes.size(); k++) {
-			if (!regionLeaves[k]) {
+		for (int r = 0; r < regionLeaves.size(); r++) {
+			int k = regionLeaves[r];
+			if (k <= i) {
 				continue;
 			}
 
@@ -581,8 +585,8 @@ void LeafNavMeshGenerator::linkNavChildLeaves(Bsp* map, LeafNavMesh* mesh, int n
 }
 
 void LeafNavMeshGenerator::linkEntityLeaves(Bsp* map, LeafNavMesh* mesh, int offset) {
-	vector<bool> regionLeaves;
-	regionLeaves.resize(mesh->nodes.size());
+	TRACE_SCOPE("linkEntityLeaves");
+	vector<int> regionLeaves;
 
 	const vec3 pointMins = vec3(-16, -16, -36);
 	const vec3 pointMaxs = vec3(16, 16, 36);
@@ -677,14 +681,12 @@ void LeafNavMeshGenerator::linkEntityLeaves(Bsp* map, LeafNavMesh* mesh, int off
 	}
 }
 
-void LeafNavMeshGenerator::linkEntityLeaves(Bsp* map, LeafNavMesh* mesh, LeafNode& entNode, vector<bool>& regionLeaves) {
+void LeafNavMeshGenerator::linkEntityLeaves(Bsp* map, LeafNavMesh* mesh, LeafNode& entNode, vector<int>& regionLeaves) {
 	mesh->octree->getLeavesInRegion(&entNode, regionLeaves);
 
 	// link teleport destinations to touched nodes
-	for (int i = 0; i < regionLeaves.size(); i++) {
-		if (!regionLeaves[i]) {
-			continue;
-		}
+	for (int r = 0; r < regionLeaves.size(); r++) {
+		int i = regionLeaves[r];
 
 		LeafNode& node = mesh->nodes[i];
 		if (boxesIntersect(node.mins, node.maxs, entNode.mins, entNode.maxs)) {
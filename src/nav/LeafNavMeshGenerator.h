@@ -57,7 +57,7 @@ private:
 	// find point on poly which is closest to a floor, using distance to the bias point as a tie breaker
 	vec3 getBestPolyOrigin(Bsp* map, Polygon3D& poly, vec3 bias);
 
-	void linkEntityLeaves(Bsp* map, LeafNavMesh* mesh, LeafNode& entNode, vector<bool>& regionLeaves);
+	void linkEntityLeaves(Bsp* map, LeafNavMesh* mesh, LeafNode& entNode, vector<int>& regionLeaves);
 
 	// returns a combined node for an entity, which is the bounding box of all its model leaves
 	void getSolidEntityNode(Bsp* map, LeafNavMesh* mesh, int bspModelIdx, vec3 origin, LeafNode& node);
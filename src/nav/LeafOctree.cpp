@@ -22,30 +22,17 @@ LeafOctree::~LeafOctree() {
 LeafOctree::LeafOctree(const vec3& min, const vec3& max, int depth) {
     root = new LeafOctant(min, max);
     maxDepth = depth;
-    buildOctree(root, 0);
 }
 
-void LeafOctree::buildOctree(LeafOctant* node, int currentDepth) {
-    if (currentDepth >= maxDepth) {
-        return;
-    }
-    const vec3& min = node->min;
-    const vec3& max = node->max;
-    vec3 mid((min.x + max.x) / 2, (min.y + max.y) / 2, (min.z + max.z) / 2);
-
-    // Define eight child octants using the min and max values
-    node->children[0] = new LeafOctant(min, mid);
-    node->children[1] = new LeafOctant(vec3(mid.x, min.y, min.z), vec3(max.x, mid.y, mid.z));
-    node->children[2] = new LeafOctant(vec3(min.x, mid.y, min.z), vec3(mid.x, max.y, mid.z));
-    node->children[3] = new LeafOctant(vec3(mid.x, mid.y, min.z), vec3(max.x, max.y, mid.z));
-    node->children[4] = new LeafOctant(vec3(min.x, min.y, mid.z), vec3(mid.x, mid.y, max.z));
-    node->children[5] = new LeafOctant(vec3(mid.x, min.y, mid.z), vec3(max.x, mid.y, max.z));
-    node->children[6] = new LeafOctant(vec3(min.x, mid.y, mid.z), vec3(mid.x, max.y, max.z));
-    node->children[7] = new LeafOctant(mid, max);
-
-    for (LeafOctant* child : node->children) {
-        buildOctree(child, currentDepth + 1);
-    }
+void LeafOctree::getChildBounds(LeafOctant* node, int i, vec3& min, vec3& max) {
+    vec3 mid = (node->min + node->max) * 0.5f;
+
+    min.x = (i & 1) ? mid.x : node->min.x;
+    min.y = (i & 2) ? mid.y : node->min.y;
+    min.z = (i & 4) ? mid.z : node->min.z;
+    max.x = (i & 1) ? node->max.x : mid.x;
+    max.y = (i & 2) ? node->max.y : mid.y;
+    max.z = (i & 4) ? node->max.z : mid.z;
 }
 
 void LeafOctree::insertLeaf(LeafNode* leaf) {
@@ -57,10 +44,18 @@ void LeafOctree::insertLeaf(LeafOctant* node, LeafNode* leaf, int currentDepth)
         node->leaves.push_back(leaf->id);
         return;
     }
+    int touched = getTouchedOctants(node->min, node->max, leaf->mins - vec3(1, 1, 1), leaf->maxs + vec3(1, 1, 1));
+
     for (int i = 0; i < 8; ++i) {
-        if (isLeafInOctant(leaf, node->children[i])) {
-            insertLeaf(node->children[i], leaf, currentDepth + 1);
+        if (!(touched & (1 << i))) {
+            continue;
+        }
+        if (!node->children[i]) {
+            vec3 min, max;
+            getChildBounds(node, i, min, max);
+            node->children[i] = new LeafOctant(min, max);
         }
+        insertLeaf(node->children[i], leaf, currentDepth + 1);
     }
 }
 
@@ -73,21 +68,20 @@ void LeafOctree::removeLeaf(LeafOctant* node, LeafNode* leaf, int currentDepth)
         node->leaves.erase(std::remove(node->leaves.begin(), node->leaves.end(), leaf->id), node->leaves.end());
         return;
     }
+    int touched = getTouchedOctants(node->min, node->max, leaf->mins - vec3(1, 1, 1), leaf->maxs + vec3(1, 1, 1));
+
     for (int i = 0; i < 8; ++i) {
-        if (isLeafInOctant(leaf, node->children[i])) {
+        if (node->children[i] && (touched & (1 << i))) {
             removeLeaf(node->children[i], leaf, currentDepth + 1);
         }
     }
 }
 
-bool LeafOctree::isLeafInOctant(LeafNode* leaf, LeafOctant* node) {
-    vec3 epsilon = vec3(1, 1, 1); // in case leaves are touching right on the border of an octree leaf
-    return boxesIntersect(leaf->mins - epsilon, leaf->maxs + epsilon, node->min, node->max);
-}
-
-void LeafOctree::getLeavesInRegion(LeafNode* leaf, vector<bool>& regionLeaves) {
-    fill(regionLeaves.begin(), regionLeaves.end(), false);
+void LeafOctree::getLeavesInRegion(LeafNode* leaf, vector<int>& regionLeaves) {
+    regionLeaves.clear();
+    queryCount++;
     getLeavesInRegion(root, leaf, 0, regionLeaves);
+    sort(regionLeaves.begin(), regionLeaves.end());
 }
 
 bool LeafOctree::validate(LeafOctant* node, int currentDepth, int maxNodes) {
@@ -104,7 +98,7 @@ bool LeafOctree::validate(LeafOctant* node, int currentDepth, int maxNodes) {
     }
 
     for (int i = 0; i < 8; ++i) {
-        if (!validate(node->children[i], currentDepth + 1, maxNodes)) {
+        if (node->children[i] && !validate(node->children[i], currentDepth + 1, maxNodes)) {
             valid = false;
         }
     }
@@ -126,7 +120,9 @@ void LeafOctree::shiftLeafIds(LeafOctant* node, int currentDepth, int shiftStart
         return;
     }
     for (int i = 0; i < 8; ++i) {
-        shiftLeafIds(node->children[i], currentDepth + 1, shiftStart, shiftAmount);
+        if (node->children[i]) {
+            shiftLeafIds(node->children[i], currentDepth + 1, shiftStart, shiftAmount);
+        }
     }
 }
 
@@ -134,15 +130,36 @@ void LeafOctree::shiftLeafIds(int shiftStart, int shiftAmount) {
     shiftLeafIds(root, 0, shiftStart, shiftAmount);
 }
 
-void LeafOctree::getLeavesInRegion(LeafOctant* node, LeafNode* leaf, int currentDepth, vector<bool>& regionLeaves) {
+int LeafOctree::octantCount() {
+    return octantCount(root);
+}
+
+int LeafOctree::octantCount(LeafOctant* node) {
+    int count = 1;
+    for (int i = 0; i < 8; ++i) {
+        if (node->children[i]) {
+            count += octantCount(node->children[i]);
+        }
+    }
+    return count;
+}
+
+void LeafOctree::getLeavesInRegion(LeafOctant* node, LeafNode* leaf, int currentDepth, vector<int>& regionLeaves) {
     if (currentDepth >= maxDepth) {
         for (uint16_t p : node->leaves) {
-            regionLeaves[p] = true;
+            if (p >= queryStamps.size())
+                queryStamps.resize(p + 1, 0);
+            if (queryStamps[p] != queryCount) {
+                queryStamps[p] = queryCount;
+                regionLeaves.push_back(p);
+            }
         }
         return;
     }
+    int touched = getTouchedOctants(node->min, node->max, leaf->mins - vec3(1, 1, 1), leaf->maxs + vec3(1, 1, 1));
+
     for (int i = 0; i < 8; ++i) {
-        if (isLeafInOctant(leaf, node->children[i])) {
+        if (node->children[i] && (touched & (1 << i))) {
             getLeavesInRegion(node->children[i], leaf, currentDepth + 1, regionLeaves);
         }
     }
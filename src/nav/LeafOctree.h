@@ -2,13 +2,13 @@
 #include "Polygon3D.h"
 #include <vector>
 #include "LeafNavMesh.h"
-#include <list>
 
+// octants are only created once a leaf is inserted into them, so empty space costs nothing
 struct LeafOctant {
     vec3 min;
     vec3 max;
-    list<uint16_t> leaves;
-    LeafOctant* children[8]; // Eight children octants
+    vector<uint16_t> leaves;
+    LeafOctant* children[8]; // Eight children octants. NULL if nothing was inserted there.
 
     LeafOctant(vec3 min, vec3 max);
 
@@ -28,18 +28,25 @@ public:
 
     void removeLeaf(LeafNode* leaf);
 
-    bool isLeafInOctant(LeafNode* leaf, LeafOctant* node);
-
-    void getLeavesInRegion(LeafNode* leaf, vector<bool>& regionLeaves);
+    // returns the ids of leaves that share an octant with the given leaf, sorted and without duplicates
+    void getLeavesInRegion(LeafNode* leaf, vector<int>& regionLeaves);
 
     bool validate(int maxNodes);
 
     void shiftLeafIds(int shiftStart, int shiftAmount);
 
+    // number of octants allocated
+    int octantCount();
+
 private:
-    void buildOctree(LeafOctant* node, int currentDepth);
+    // the last query that returned each leaf id. Large leaves are in many octants.
+    vector<int> queryStamps;
+    int queryCount = 0;
+
+    // bounds of child octant i. Bits 0, 1, and 2 select the upper half of the X, Y, and Z axes.
+    void getChildBounds(LeafOctant* node, int i, vec3& min, vec3& max);
 
-    void getLeavesInRegion(LeafOctant* node, LeafNode* leaf, int currentDepth, vector<bool>& regionLeaves);
+    void getLeavesInRegion(LeafOctant* node, LeafNode* leaf, int currentDepth, vector<int>& regionLeaves);
 
     void insertLeaf(LeafOctant* node, LeafNode* leaf, int currentDepth);
 
@@ -48,4 +55,6 @@ private:
     void shiftLeafIds(LeafOctant* node, int currentDepth, int shiftStart, int shiftAmount);
 
     bool validate(LeafOctant* node, int currentDepth, int maxNodes);
-};
\ No newline at end of file
+
+    int octantCount(LeafOctant* node);
+};
@@ -7,9 +7,11 @@
 #include <set>
 #include "util.h"
 #include "PolyOctree.h"
+#include "Trace.h"
 #include <algorithm>
 
 NavMesh* NavMeshGenerator::generate(Bsp* map, int hull) {
+	TRACE_SCOPE("NavMeshGenerator::generate");
 	float NavMeshGeneratorGenStart = glfwGetTime();
 	BSPMODEL& model = map->models[0];
 
@@ -32,17 +34,12 @@ NavMesh* NavMeshGenerator::generate(Bsp* map, int hull) {
 }
 
 vector<Polygon3D*> NavMeshGenerator::getHullFaces(Bsp* map, int hull) {
+	TRACE_SCOPE("getHullFaces");
 	float hullShrink = 0;
 	vector<Polygon3D*> solidFaces;
 
-	Clipper clipper;
-
-	vector<NodeVolumeCuts> solidNodes = map->get_model_leaf_volume_cuts(0, hull, CONTENTS_SOLID);
-
 	vector<CMesh> solidMeshes;
-	for (int k = 0; k < solidNodes.size(); k++) {
-		solidMeshes.push_back(clipper.clip(solidNodes[k].cuts));
-	}
+	map->get_model_leaf_volumes(0, hull, CONTENTS_SOLID, solidMeshes);
 
 	// GET FACES FROM MESHES
 	for (int m = 0; m < solidMeshes.size(); m++) {
@@ -113,6 +110,7 @@ void NavMeshGenerator::getOctreeBox(Bsp* map, vec3& min, vec3& max) {
 }
 
 PolygonOctree* NavMeshGenerator::createPolyOctree(Bsp* map, const vector<Polygon3D*>& faces, int treeDepth) {
+	TRACE_SCOPE("createPolyOctree");
 	vec3 treeMin, treeMax;
 	getOctreeBox(map, treeMin, treeMax);
 
@@ -127,6 +125,7 @@ PolygonOctree* NavMeshGenerator::createPolyOctree(Bsp* map, const vector<Polygon
 }
 
 vector<Polygon3D> NavMeshGenerator::getInteriorFaces(Bsp* map, int hull, vector<Polygon3D*>& faces) {
+	TRACE_SCOPE("getInteriorFaces");
 	PolygonOctree* octree = createPolyOctree(map, faces, octreeDepth);
 
 	int debugPoly = 0;
@@ -147,8 +146,7 @@ vector<Polygon3D> NavMeshGenerator::getInteriorFaces(Bsp* map, int hull, vector<
 	bool doTinyCull = true;
 	bool walkableSurfacesOnly = true;
 
-	vector<bool> regionPolys;
-	regionPolys.resize(cuttingPolyCount);
+	vector<int> regionPolys;
 
 	for (int i = 0; i < faces.size(); i++) {
 		Polygon3D* poly = faces[i];
@@ -168,8 +166,6 @@ vector<Polygon3D> NavMeshGenerator::getInteriorFaces(Bsp* map, int hull, vector<
 		//logf("Splitting %d\n", i);
 
 		octree->getPolysInRegion(poly, regionPolys);
-		if (poly->idx < cuttingPolyCount)
-			regionPolys[poly->idx] = false;
 		regionChecks++;
 
 		bool anySplits = false;
@@ -178,8 +174,12 @@ vector<Polygon3D> NavMeshGenerator::getInteriorFaces(Bsp* map, int hull, vector<
 		if (!doSplit || (debugPoly && i != debugPoly && i < cuttingPolyCount))
 			sz = 0;
 
-		for (int k = 0; k < sz; k++) {
-			if (!regionPolys[k]) {
+		for (int r = 0; r < regionPolys.size(); r++) {
+			int k = regionPolys[r];
+			if (k >= sz) {
+				break;
+			}
+			if (k == poly->idx) {
 				continue;
 			}
 			Polygon3D* cutPoly = faces[k];
@@ -235,6 +235,7 @@ vector<Polygon3D> NavMeshGenerator::getInteriorFaces(Bsp* map, int hull, vector<
 }
 
 void NavMeshGenerator::mergeFaces(Bsp* map, vector<Polygon3D>& faces) {
+	TRACE_SCOPE("mergeFaces");
 	float mergeStart = glfwGetTime();
 
 	vec3 treeMin, treeMax;
@@ -253,8 +254,7 @@ void NavMeshGenerator::mergeFaces(Bsp* map, vector<Polygon3D>& faces) {
 			mergeOctree.insertPolygon(&mergedFaces[i]);
 		}
 
-		vector<bool> regionPolys;
-		regionPolys.resize(mergedFaces.size());
+		vector<int> regionPolys;
 
 		vector<Polygon3D> newMergedFaces;
 
@@ -266,13 +266,12 @@ void NavMeshGenerator::mergeFaces(Bsp* map, vector<Polygon3D>& faces) {
 			//	continue;
 
 			mergeOctree.getPolysInRegion(&poly, regionPolys);
-			regionPolys[poly.idx] = false;
 
-			int sz = regionPolys.size();
 			bool anyMerges = false;
 
-			for (int k = i + 1; k < sz; k++) {
-				if (!regionPolys[k]) {
+			for (int r = 0; r < regionPolys.size(); r++) {
+				int k = regionPolys[r];
+				if (k <= i) {
 					continue;
 				}
 				Polygon3D& mergePoly = mergedFaces[k];
@@ -339,6 +338,7 @@ void NavMeshGenerator::cullTinyFaces(vector<Polygon3D>& faces) {
 }
 
 void NavMeshGenerator::linkNavPolys(Bsp* map, NavMesh* mesh) {
+	TRACE_SCOPE("linkNavPolys");
 	int numLinks = 0;
 
 	float linkStart = glfwGetTime();
@@ -30,30 +30,17 @@ PolygonOctree::~PolygonOctree() {
 PolygonOctree::PolygonOctree(const vec3& min, const vec3& max, int depth) {
     root = new PolyOctant(min, max);
     maxDepth = depth;
-    buildOctree(root, 0);
 }
 
-void PolygonOctree::buildOctree(PolyOctant* node, int currentDepth) {
-    if (currentDepth >= maxDepth) {
-        return;
-    }
-    const vec3& min = node->min;
-    const vec3& max = node->max;
-    vec3 mid((min.x + max.x) / 2, (min.y + max.y) / 2, (min.z + max.z) / 2);
+void PolygonOctree::getChildBounds(PolyOctant* node, int i, vec3& min, vec3& max) {
+    vec3 mid = (node->min + node->max) * 0.5f;
 
-    // Define eight child octants using the min and max values
-    node->children[0] = new PolyOctant(min, mid);
-    node->children[1] = new PolyOctant(vec3(mid.x, min.y, min.z), vec3(max.x, mid.y, mid.z));
-    node->children[2] = new PolyOctant(vec3(min.x, mid.y, min.z), vec3(mid.x, max.y, mid.z));
-    node->children[3] = new PolyOctant(vec3(mid.x, mid.y, min.z), vec3(max.x, max.y, mid.z));
-    node->children[4] = new PolyOctant(vec3(min.x, min.y, mid.z), vec3(mid.x, mid.y, max.z));
-    node->children[5] = new PolyOctant(vec3(mid.x, min.y, mid.z), vec3(max.x, mid.y, max.z));
-    node->children[6] = new PolyOctant(vec3(min.x, mid.y, mid.z), vec3(mid.x, max.y, max.z));
-    node->children[7] = new PolyOctant(mid, max);
-
-    for (PolyOctant* child : node->children) {
-        buildOctree(child, currentDepth + 1);
-    }
+    min.x = (i & 1) ? mid.x : node->min.x;
+    min.y = (i & 2) ? mid.y : node->min.y;
+    min.z = (i & 4) ? mid.z : node->min.z;
+    max.x = (i & 1) ? node->max.x : mid.x;
+    max.y = (i & 2) ? node->max.y : mid.y;
+    max.z = (i & 4) ? node->max.z : mid.z;
 }
 
 void PolygonOctree::insertPolygon(Polygon3D* polygon) {
@@ -65,10 +52,18 @@ void PolygonOctree::insertPolygon(PolyOctant* node, Polygon3D* polygon, int curr
         node->polygons.push_back(polygon);
         return;
     }
+    int touched = getTouchedOctants(node->min, node->max, polygon->worldMins, polygon->worldMaxs);
+
     for (int i = 0; i < 8; ++i) {
-        if (isPolygonInOctant(polygon, node->children[i])) {
-            insertPolygon(node->children[i], polygon, currentDepth + 1);
+        if (!(touched & (1 << i))) {
+            continue;
+        }
+        if (!node->children[i]) {
+            vec3 min, max;
+            getChildBounds(node, i, min, max);
+            node->children[i] = new PolyOctant(min, max);
         }
+        insertPolygon(node->children[i], polygon, currentDepth + 1);
     }
 }
 
@@ -76,25 +71,31 @@ void PolygonOctree::removePolygon(Polygon3D* polygon) {
     root->removePolygon(polygon);
 }
 
-bool PolygonOctree::isPolygonInOctant(Polygon3D* polygon, PolyOctant* node) {
-    return boxesIntersect(polygon->worldMins, polygon->worldMaxs, node->min, node->max);
-}
-
-void PolygonOctree::getPolysInRegion(Polygon3D* poly, vector<bool>& regionPolys) {
-    fill(regionPolys.begin(), regionPolys.end(), false);
+void PolygonOctree::getPolysInRegion(Polygon3D* poly, vector<int>& regionPolys) {
+    regionPolys.clear();
+    queryCount++;
     getPolysInRegion(root, poly, 0, regionPolys);
+    sort(regionPolys.begin(), regionPolys.end());
 }
 
-void PolygonOctree::getPolysInRegion(PolyOctant* node, Polygon3D* poly, int currentDepth, vector<bool>& regionPolys) {
+void PolygonOctree::getPolysInRegion(PolyOctant* node, Polygon3D* poly, int currentDepth, vector<int>& regionPolys) {
     if (currentDepth >= maxDepth) {
         for (auto p : node->polygons) {
-            if (p->idx != -1)
-                regionPolys[p->idx] = true;
+            if (p->idx == -1)
+                continue;
+            if (p->idx >= queryStamps.size())
+                queryStamps.resize(p->idx + 1, 0);
+            if (queryStamps[p->idx] != queryCount) {
+                queryStamps[p->idx] = queryCount;
+                regionPolys.push_back(p->idx);
+            }
         }
         return;
     }
+    int touched = getTouchedOctants(node->min, node->max, poly->worldMins, poly->worldMaxs);
+
     for (int i = 0; i < 8; ++i) {
-        if (isPolygonInOctant(poly, node->children[i])) {
+        if (node->children[i] && (touched & (1 << i))) {
             getPolysInRegion(node->children[i], poly, currentDepth + 1, regionPolys);
         }
     }
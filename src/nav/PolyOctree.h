@@ -2,11 +2,12 @@
 #include "Polygon3D.h"
 #include <vector>
 
+// octants are only created once a polygon is inserted into them, so empty space costs nothing
 struct PolyOctant {
     vec3 min;
     vec3 max;
     vector<Polygon3D*> polygons;
-    PolyOctant* children[8]; // Eight children octants
+    PolyOctant* children[8]; // Eight children octants. NULL if nothing was inserted there.
 
     PolyOctant(vec3 min, vec3 max);
 
@@ -28,14 +29,19 @@ public:
 
     void removePolygon(Polygon3D* polygon);
 
-    bool isPolygonInOctant(Polygon3D* polygon, PolyOctant* node);
-
-    void getPolysInRegion(Polygon3D* poly, vector<bool>& regionPolys);
+    // returns the idx of polygons that share an octant with the given polygon, sorted and without
+    // duplicates. Polygons with an idx of -1 are skipped.
+    void getPolysInRegion(Polygon3D* poly, vector<int>& regionPolys);
 
 private:
-    void buildOctree(PolyOctant* node, int currentDepth);
+    // the last query that returned each polygon idx. Large polygons are in many octants.
+    vector<int> queryStamps;
+    int queryCount = 0;
+
+    // bounds of child octant i. Bits 0, 1, and 2 select the upper half of the X, Y, and Z axes.
+    void getChildBounds(PolyOctant* node, int i, vec3& min, vec3& max);
 
-    void getPolysInRegion(PolyOctant* node, Polygon3D* poly, int currentDepth, vector<bool>& regionPolys);
+    void getPolysInRegion(PolyOctant* node, Polygon3D* poly, int currentDepth, vector<int>& regionPolys);
 
     void insertPolygon(PolyOctant* node, Polygon3D* polygon, int currentDepth);
-};
\ No newline at end of file
+};
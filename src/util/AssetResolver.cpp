@@ -0,0 +1,272 @@
+#include "AssetResolver.h"
+#include "util.h"
+#include "globals.h"
+#include <string.h>
+
+#ifdef WIN32
+#define _SILENCE_EXPERIMENTAL_FILESYSTEM_DEPRECATION_WARNING
+#endif
+
+#ifdef __cpp_lib_filesystem
+#include <filesystem>
+namespace fs = std::filesystem;
+#else 
+#include <experimental/filesystem>
+namespace fs = std::experimental::filesystem;
+#endif
+
+AssetResolver::AssetResolver() {
+	memset(&stats, 0, sizeof(AssetResolverStats));
+}
+
+void AssetResolver::loadSearchPaths() {
+	if (searchPaths.empty()) {
+		searchPaths = getAssetPaths();
+	}
+}
+
+AssetResolver::DirListing* AssetResolver::getListing(const string& dir) {
+	auto cached = dirs.find(dir);
+	if (cached != dirs.end()) {
+		return &cached->second;
+	}
+
+	// missing/unreadable directories get an empty listing so they aren't retried
+	DirListing& listing = dirs[dir];
+	fsOps++;
+	stats.dirsIndexed++;
+
+	readListing(dir, listing);
+	stats.filesIndexed += listing.entries.size();
+
+	return &listing;
+}
+
+void AssetResolver::readListing(const string& dir, DirListing& listing) {
+	// read the time first, so that files added while listing count as a change
+	listing.modified = getModifiedTime(dir);
+	listing.entries.clear();
+
+	std::error_code err;
+	for (fs::directory_iterator it(dir, err), end; !err && it != end; it.increment(err)) {
+		DirEntry entry;
+		entry.name = it->path().filename().string();
+		entry.type = -1;
+
+		// prefer an exact match if two names differ only by case
+		string key = toLowerCase(entry.name);
+		if (!listing.entries.count(key) || key == entry.name) {
+			listing.entries[key] = entry;
+		}
+	}
+}
+
+int64_t AssetResolver::getModifiedTime(const string& dir) {
+	std::error_code err;
+	auto time = fs::last_write_time(dir, err);
+	return err ? -1 : (int64_t)time.time_since_epoch().count();
+}
+
+bool AssetResolver::isDir(const string& dir, DirEntry& entry) {
+	if (entry.type == -1) {
+		fsOps++;
+		std::error_code err;
+		entry.type = fs::is_directory(dir + entry.name, err) ? 1 : 0;
+	}
+
+	return entry.type == 1;
+}
+
+bool AssetResolver::missingDirsChanged(CachedResult& result) {
+	auto now = chrono::steady_clock::now();
+	if (now - result.checked < chrono::seconds(MISSING_RECHECK_SECONDS)) {
+		return false;
+	}
+	result.checked = now;
+
+	if (result.missDirs.empty()) {
+		return true; // absolute path, which is cheaper to check again than to track
+	}
+
+	bool changed = false;
+	for (int i = 0; i < result.missDirs.size(); i++) {
+		const string& dir = result.missDirs[i].first;
+		fsOps++;
+		int64_t modified = getModifiedTime(dir);
+		if (modified == result.missDirs[i].second) {
+			continue;
+		}
+		changed = true;
+
+		// the listing may have been refreshed already by another lookup
+		auto listing = dirs.find(dir);
+		if (listing != dirs.end() && listing->second.modified != modified) {
+			dirs.erase(listing);
+		}
+	}
+
+	return changed;
+}
+
+string AssetResolver::findInDir(string dir, const vector<string>& parts, vector<pair<string, int64_t>>& missDirs) {
+	for (int i = 0; i < parts.size(); i++) {
+		const string& part = parts[i];
+		bool isLast = i == parts.size() - 1;
+
+		if (part == ".." && !isLast) {
+			dir += "../";
+			continue;
+		}
+
+		DirListing* listing = getListing(dir);
+		auto match = listing->entries.find(part);
+		if (match == listing->entries.end()) {
+			missDirs.push_back(make_pair(dir, listing->modified));
+			return "";
+		}
+
+		bool matchIsDir = isDir(dir, match->second);
+		if (isLast && !matchIsDir) {
+			return dir + match->second.name;
+		}
+		if (isLast || !matchIsDir) {
+			missDirs.push_back(make_pair(dir, listing->modified)); // replacing the entry changes the directory
+			return "";
+		}
+
+		dir += match->second.name + "/";
+	}
+
+	return "";
+}
+
+string AssetResolver::find(string asset) {
+	if (asset.empty()) {
+		return "";
+	}
+
+	lock_guard<mutex> lock(indexMutex);
+	loadSearchPaths();
+	stats.lookups++;
+
+	string key = toLowerCase(asset);
+	for (int i = 0; i < key.size(); i++) {
+		if (key[i] == '\\') {
+			key[i] = '/';
+		}
+	}
+
+	auto cached = results.find(key);
+	if (cached != results.end() && !(cached->second.path.empty() && missingDirsChanged(cached->second))) {
+		stats.cacheHits++;
+		stats.probesSaved += cached->second.oldProbes;
+		return cached->second.path;
+	}
+
+	int startOps = fsOps;
+	int oldProbes = 1; // the old search checked the file as-is, then once per search path until a match
+	string found;
+	vector<pair<string, int64_t>> missDirs;
+
+	if (isAbsolutePath(asset)) {
+		fsOps++;
+		if (fileExists(asset)) {
+			found = asset;
+		}
+	}
+	else {
+		vector<string> parts;
+		for (const string& part : splitString(key, "/")) {
+			if (!part.empty() && part != ".") {
+				parts.push_back(part);
+			}
+		}
+
+		for (int i = 0; i < searchPaths.size() && !parts.empty(); i++) {
+			oldProbes++;
+			found = findInDir(searchPaths[i], parts, missDirs);
+			if (!found.empty()) {
+				break;
+			}
+		}
+	}
+
+	stats.probesSaved += oldProbes - (fsOps - startOps);
+
+	CachedResult& result = results[key];
+	result.path = found;
+	result.oldProbes = oldProbes;
+	result.missDirs = found.empty() ? missDirs : vector<pair<string, int64_t>>();
+	result.checked = chrono::steady_clock::now();
+
+	return found;
+}
+
+void AssetResolver::invalidate() {
+	if (prefetchFuture.valid()) {
+		prefetchFuture.wait();
+	}
+
+	lock_guard<mutex> lock(indexMutex);
+	searchPaths.clear();
+	dirs.clear();
+	results.clear();
+}
+
+void AssetResolver::prefetch() {
+	if (prefetchFuture.valid()) {
+		prefetchFuture.wait();
+	}
+
+	prefetchFuture = async(launch::async, [this]() {
+		static const char* assetDirs[] = { "models", "sprites", "gfx" };
+
+		vector<string> paths;
+		{
+			lock_guard<mutex> lock(indexMutex);
+			loadSearchPaths();
+			paths = searchPaths;
+		}
+
+		// the disk is read without the lock, so lookups aren't blocked until every folder is listed
+		vector<pair<string, DirListing>> listings;
+		for (int i = 0; i < paths.size(); i++) {
+			DirListing root;
+			readListing(paths[i], root);
+
+			for (int k = 0; k < 3; k++) {
+				auto sub = root.entries.find(assetDirs[k]);
+				if (sub == root.entries.end()) {
+					continue;
+				}
+
+				std::error_code err;
+				sub->second.type = fs::is_directory(paths[i] + sub->second.name, err) ? 1 : 0;
+				if (sub->second.type == 1) {
+					DirListing subListing;
+					readListing(paths[i] + sub->second.name + "/", subListing);
+					listings.push_back(make_pair(paths[i] + sub->second.name + "/", std::move(subListing)));
+				}
+			}
+
+			listings.push_back(make_pair(paths[i], std::move(root)));
+		}
+
+		lock_guard<mutex> lock(indexMutex);
+		for (int i = 0; i < listings.size(); i++) {
+			if (dirs.count(listings[i].first)) {
+				continue; // a lookup listed it first
+			}
+
+			fsOps++;
+			stats.dirsIndexed++;
+			stats.filesIndexed += listings[i].second.entries.size();
+			dirs[listings[i].first] = std::move(listings[i].second);
+		}
+	});
+}
+
+AssetResolverStats AssetResolver::getStats() {
+	lock_guard<mutex> lock(indexMutex);
+	return stats;
+}
@@ -0,0 +1,87 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <future>
+#include <chrono>
+#include <stdint.h>
+
+struct AssetResolverStats {
+	int lookups; // calls to find()
+	int cacheHits; // lookups answered without touching the filesystem
+	int dirsIndexed; // directory listings read
+	int filesIndexed; // entries across all listings
+	int probesSaved; // file existence checks the old search order would have made, minus listings read
+};
+
+// Finds assets (models, sprites, wads, fgds) in the game dir and resource paths.
+// Each directory is listed once and kept in a case-insensitive index, so repeated
+// and missing lookups don't cost a stat() per search path. Missing assets are looked
+// up again if a directory they were missing from has changed since it was listed.
+class AssetResolver {
+public:
+	AssetResolver();
+
+	// returns the path to the asset, or an empty string if it doesn't exist in any search path.
+	// Matching is case-insensitive, like the game on Windows.
+	std::string find(std::string asset);
+
+	// forget everything. Call this after the game dir or resource paths change.
+	void invalidate();
+
+	// list the root of every search path and the common asset folders in a background thread
+	void prefetch();
+
+	AssetResolverStats getStats();
+
+private:
+	// seconds before a missing asset checks if its directories changed
+	static const int MISSING_RECHECK_SECONDS = 2;
+
+	struct DirEntry {
+		std::string name; // name with original capitalization
+		int type; // -1 = not checked yet, 0 = file, 1 = directory
+	};
+
+	struct DirListing {
+		std::unordered_map<std::string, DirEntry> entries; // keyed by lowercase name
+		int64_t modified = -1; // directory's last write time when listed, -1 if it couldn't be read
+	};
+
+	struct CachedResult {
+		std::string path; // empty if not found
+		int oldProbes; // file checks the old linear search would make for this asset
+		// for missing assets, directories without the next part of the path, and their listed write times
+		std::vector<std::pair<std::string, int64_t>> missDirs;
+		std::chrono::steady_clock::time_point checked; // when the directories were last checked
+	};
+
+	std::mutex indexMutex;
+	std::vector<std::string> searchPaths; // from getAssetPaths(). Empty until first use.
+	std::unordered_map<std::string, DirListing> dirs; // directory path -> contents
+	std::unordered_map<std::string, CachedResult> results; // keyed by lowercase asset path
+	std::future<void> prefetchFuture;
+	AssetResolverStats stats;
+	int fsOps = 0; // directory listings + stat calls made so far
+
+	// lists a directory, if not already indexed. Unreadable directories are empty.
+	DirListing* getListing(const std::string& dir);
+
+	// reads a directory without touching the index, so it can be done without holding the lock
+	static void readListing(const std::string& dir, DirListing& listing);
+
+	static int64_t getModifiedTime(const std::string& dir);
+
+	bool isDir(const std::string& dir, DirEntry& entry);
+
+	// true if a missing asset may exist now, because a directory it was missing from changed.
+	// Changed directories are dropped from the index so they're listed again.
+	bool missingDirsChanged(CachedResult& result);
+
+	// find an asset relative to a single search path. Returns an empty string if not found.
+	// Directories that didn't have the next part of the path are added to missDirs.
+	std::string findInDir(std::string dir, const std::vector<std::string>& parts, std::vector<std::pair<std::string, int64_t>>& missDirs);
+
+	void loadSearchPaths();
+};
@@ -0,0 +1,231 @@
+#include "Bvh.h"
+#include <algorithm>
+#include <float.h>
+
+#define BVH_BINS 12
+#define BVH_LEAF_PRIMS 4 // always split nodes with more primitives than this...
+#define BVH_MAX_LEAF_PRIMS 16 // ...unless the SAH says not to. Never more than this.
+#define BVH_MAX_DEPTH 60 // keeps the raycast stack bounded
+#define BVH_TRAVERSAL_COST 1.0f // relative to the cost of testing a primitive
+
+static float halfArea(const vec3& mins, const vec3& maxs) {
+	vec3 d = maxs - mins;
+	return d.x * d.y + d.y * d.z + d.z * d.x;
+}
+
+static void expandBox(vec3& mins, vec3& maxs, const vec3& addMins, const vec3& addMaxs) {
+	mins.x = min(mins.x, addMins.x);
+	mins.y = min(mins.y, addMins.y);
+	mins.z = min(mins.z, addMins.z);
+	maxs.x = max(maxs.x, addMaxs.x);
+	maxs.y = max(maxs.y, addMaxs.y);
+	maxs.z = max(maxs.z, addMaxs.z);
+}
+
+void Bvh::build(const vector<vec3>& mins, const vector<vec3>& maxs) {
+	clear();
+
+	int count = mins.size();
+	if (count == 0) {
+		return;
+	}
+
+	primMins = mins;
+	primMaxs = maxs;
+
+	vector<vec3> centers(count);
+	prims.resize(count);
+	for (int i = 0; i < count; i++) {
+		prims[i] = i;
+		centers[i] = (mins[i] + maxs[i]) * 0.5f;
+	}
+
+	// a binary tree never has more than this many nodes, so nothing moves while building
+	nodes.reserve(count * 2);
+	parents.reserve(count * 2);
+
+	nodes.push_back(BvhNode());
+	parents.push_back(-1);
+	buildNode(0, 0, count, centers, 0);
+
+	primLeaf.resize(count);
+	for (int i = 0; i < nodes.size(); i++) {
+		for (int k = nodes[i].start; k < nodes[i].start + nodes[i].count; k++) {
+			primLeaf[prims[k]] = i;
+		}
+	}
+}
+
+void Bvh::buildNode(int nodeIdx, int first, int count, const vector<vec3>& centers, int depth) {
+	// children are added right after their parent is built, so the first child is always nodeIdx+1
+	nodes[nodeIdx].start = first;
+	nodes[nodeIdx].count = count;
+	calcLeafBounds(nodes[nodeIdx]);
+
+	if (count <= BVH_LEAF_PRIMS || depth >= BVH_MAX_DEPTH) {
+		return;
+	}
+
+	vec3 centerMins = centers[prims[first]];
+	vec3 centerMaxs = centerMins;
+	for (int i = first + 1; i < first + count; i++) {
+		expandBox(centerMins, centerMaxs, centers[prims[i]], centers[prims[i]]);
+	}
+
+	// find the cheapest split between bins on any axis
+	float bestCost = FLT_MAX;
+	int bestAxis = -1;
+	int bestSplit = -1;
+
+	for (int axis = 0; axis < 3; axis++) {
+		float lo = (&centerMins.x)[axis];
+		float hi = (&centerMaxs.x)[axis];
+		if (hi <= lo) {
+			continue;
+		}
+		float scale = BVH_BINS / (hi - lo);
+
+		int binCounts[BVH_BINS] = { 0 };
+		vec3 binMins[BVH_BINS];
+		vec3 binMaxs[BVH_BINS];
+		for (int b = 0; b < BVH_BINS; b++) {
+			binMins[b] = vec3(FLT_MAX, FLT_MAX, FLT_MAX);
+			binMaxs[b] = vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+		}
+
+		for (int i = first; i < first + count; i++) {
+			int prim = prims[i];
+			int b = min(BVH_BINS - 1, (int)(((&centers[prim].x)[axis] - lo) * scale));
+			binCounts[b]++;
+			expandBox(binMins[b], binMaxs[b], primMins[prim], primMaxs[prim]);
+		}
+
+		// sweep from the left, then from the right, to get the cost of splitting after each bin
+		float leftArea[BVH_BINS - 1];
+		int leftCount[BVH_BINS - 1];
+		vec3 boxMins = vec3(FLT_MAX, FLT_MAX, FLT_MAX);
+		vec3 boxMaxs = vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+		int sum = 0;
+		for (int b = 0; b < BVH_BINS - 1; b++) {
+			sum += binCounts[b];
+			expandBox(boxMins, boxMaxs, binMins[b], binMaxs[b]);
+			leftCount[b] = sum;
+			leftArea[b] = sum ? halfArea(boxMins, boxMaxs) : 0;
+		}
+
+		boxMins = vec3(FLT_MAX, FLT_MAX, FLT_MAX);
+		boxMaxs = vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+		sum = 0;
+		for (int b = BVH_BINS - 1; b > 0; b--) {
+			sum += binCounts[b];
+			expandBox(boxMins, boxMaxs, binMins[b], binMaxs[b]);
+			if (sum == 0 || leftCount[b - 1] == 0) {
+				continue;
+			}
+
+			float cost = leftCount[b - 1] * leftArea[b - 1] + sum * halfArea(boxMins, boxMaxs);
+			if (cost < bestCost) {
+				bestCost = cost;
+				bestAxis = axis;
+				bestSplit = b - 1;
+			}
+		}
+	}
+
+	if (bestAxis == -1) {
+		return; // every primitive has the same center, so there's nothing to split
+	}
+
+	float nodeArea = halfArea(nodes[nodeIdx].mins, nodes[nodeIdx].maxs);
+	if (count <= BVH_MAX_LEAF_PRIMS && nodeArea * BVH_TRAVERSAL_COST + bestCost >= count * nodeArea) {
+		return; // testing everything is cheaper than splitting
+	}
+
+	float lo = (&centerMins.x)[bestAxis];
+	float scale = BVH_BINS / ((&centerMaxs.x)[bestAxis] - lo);
+	int* mid = partition(&prims[first], &prims[first] + count, [&](int prim) {
+		return min(BVH_BINS - 1, (int)(((&centers[prim].x)[bestAxis] - lo) * scale)) <= bestSplit;
+	});
+	int leftCount = mid - &prims[first];
+
+	if (leftCount == 0 || leftCount == count) {
+		// float rounding put everything on one side
+		leftCount = count / 2;
+		nth_element(&prims[first], &prims[first] + leftCount, &prims[first] + count, [&](int a, int b) {
+			return (&centers[a].x)[bestAxis] < (&centers[b].x)[bestAxis];
+		});
+	}
+
+	nodes[nodeIdx].count = 0;
+
+	int left = nodes.size();
+	nodes.push_back(BvhNode());
+	parents.push_back(nodeIdx);
+	buildNode(left, first, leftCount, centers, depth + 1);
+
+	int right = nodes.size();
+	nodes.push_back(BvhNode());
+	parents.push_back(nodeIdx);
+	nodes[nodeIdx].start = right;
+	buildNode(right, first + leftCount, count - leftCount, centers, depth + 1);
+}
+
+void Bvh::calcLeafBounds(BvhNode& node) {
+	node.mins = vec3(FLT_MAX, FLT_MAX, FLT_MAX);
+	node.maxs = vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+
+	for (int i = node.start; i < node.start + node.count; i++) {
+		expandBox(node.mins, node.maxs, primMins[prims[i]], primMaxs[prims[i]]);
+	}
+}
+
+void Bvh::refit(const vector<vec3>& mins, const vector<vec3>& maxs) {
+	if (mins.size() != primLeaf.size()) {
+		build(mins, maxs);
+		return;
+	}
+
+	primMins = mins;
+	primMaxs = maxs;
+
+	// children always come after their parent
+	for (int i = nodes.size() - 1; i >= 0; i--) {
+		BvhNode& node = nodes[i];
+		if (node.count) {
+			calcLeafBounds(node);
+		}
+		else {
+			node.mins = nodes[i + 1].mins;
+			node.maxs = nodes[i + 1].maxs;
+			expandBox(node.mins, node.maxs, nodes[node.start].mins, nodes[node.start].maxs);
+		}
+	}
+}
+
+void Bvh::update(int prim, vec3 mins, vec3 maxs) {
+	if (prim < 0 || prim >= primLeaf.size()) {
+		return;
+	}
+
+	primMins[prim] = mins;
+	primMaxs[prim] = maxs;
+
+	int nodeIdx = primLeaf[prim];
+	calcLeafBounds(nodes[nodeIdx]);
+
+	for (nodeIdx = parents[nodeIdx]; nodeIdx != -1; nodeIdx = parents[nodeIdx]) {
+		BvhNode& node = nodes[nodeIdx];
+		node.mins = nodes[nodeIdx + 1].mins;
+		node.maxs = nodes[nodeIdx + 1].maxs;
+		expandBox(node.mins, node.maxs, nodes[node.start].mins, nodes[node.start].maxs);
+	}
+}
+
+void Bvh::clear() {
+	nodes.clear();
+	prims.clear();
+	parents.clear();
+	primLeaf.clear();
+	primMins.clear();
+	primMaxs.clear();
+}
@@ -0,0 +1,159 @@
+#pragma once
+#include "vectors.h"
+#include <vector>
+
+struct BvhNode {
+	vec3 mins;
+	vec3 maxs;
+	int start; // leaf: first index into Bvh::prims. Interior: index of the second child (the first child is the next node)
+	int count; // number of primitives in a leaf, 0 for interior nodes
+};
+
+// Bounding volume hierarchy over axis-aligned boxes, built with the binned surface area heuristic.
+// Primitives are only known by index, so this can be used for faces, entities, or anything else
+// with a bounding box. Nodes are stored depth-first in a flat array.
+class Bvh {
+public:
+	vector<BvhNode> nodes;
+	vector<int> prims; // primitive indexes, grouped by leaf
+
+	// builds the tree from scratch. The arrays are indexed by primitive.
+	void build(const vector<vec3>& mins, const vector<vec3>& maxs);
+
+	// recomputes every node's bounds for primitives that moved, without changing the tree layout.
+	// Faster than a rebuild, but the tree gets worse the further things move from where they were.
+	void refit(const vector<vec3>& mins, const vector<vec3>& maxs);
+
+	// updates the bounds of a single primitive and the nodes above it
+	void update(int prim, vec3 mins, vec3 maxs);
+
+	void clear();
+
+	bool empty() const { return nodes.empty(); }
+
+	int primCount() const { return primLeaf.size(); }
+
+	// bounds of everything in the tree
+	vec3 getMins() const { return nodes.empty() ? vec3() : nodes[0].mins; }
+	vec3 getMaxs() const { return nodes.empty() ? vec3() : nodes[0].maxs; }
+
+	// calls testPrim(primIdx, bestDist) for every primitive whose box the ray hits closer than bestDist.
+	// Boxes are visited front to back, so testPrim should lower bestDist when it finds a hit,
+	// which lets the rest of the tree be skipped.
+	template<class F>
+	void raycast(vec3 start, vec3 dir, float& bestDist, F testPrim) const;
+
+private:
+	vector<int> parents; // parent node index for each node, -1 for the root
+	vector<int> primLeaf; // leaf node index for each primitive
+	vector<vec3> primMins;
+	vector<vec3> primMaxs;
+
+	void buildNode(int nodeIdx, int first, int count, const vector<vec3>& centers, int depth);
+
+	void calcLeafBounds(BvhNode& node);
+
+	// start, dir and invDir are xyz arrays
+	static bool rayBox(const float* start, const float* dir, const float* invDir,
+		const BvhNode& node, float bestDist, float& tEntry);
+};
+
+inline bool Bvh::rayBox(const float* start, const float* dir, const float* invDir,
+	const BvhNode& node, float bestDist, float& tEntry) {
+	const float* mins = &node.mins.x;
+	const float* maxs = &node.maxs.x;
+	float tmin = 0;
+	float tmax = bestDist;
+
+	for (int i = 0; i < 3; i++) {
+		if (dir[i] == 0) {
+			// parallel to the slab. 0 * inf would give NaN below.
+			if (start[i] < mins[i] || start[i] > maxs[i]) {
+				return false;
+			}
+			continue;
+		}
+
+		float t1 = (mins[i] - start[i]) * invDir[i];
+		float t2 = (maxs[i] - start[i]) * invDir[i];
+		if (t1 > t2) {
+			float temp = t1;
+			t1 = t2;
+			t2 = temp;
+		}
+		if (t1 > tmin) tmin = t1;
+		if (t2 < tmax) tmax = t2;
+		if (tmin > tmax) {
+			return false;
+		}
+	}
+
+	tEntry = tmin;
+	return true;
+}
+
+template<class F>
+void Bvh::raycast(vec3 start, vec3 dir, float& bestDist, F testPrim) const {
+	if (nodes.empty()) {
+		return;
+	}
+
+	float rayStart[3] = { start.x, start.y, start.z };
+	float rayDir[3] = { dir.x, dir.y, dir.z };
+	float invDir[3];
+	for (int i = 0; i < 3; i++) {
+		invDir[i] = rayDir[i] != 0 ? 1.0f / rayDir[i] : 0;
+	}
+
+	float tEntry;
+	if (!rayBox(rayStart, rayDir, invDir, nodes[0], bestDist, tEntry)) {
+		return;
+	}
+
+	// the build limits the depth, so the stack can't overflow
+	int stack[128];
+	float stackDist[128];
+	int stackSize = 0;
+	stack[stackSize] = 0;
+	stackDist[stackSize++] = tEntry;
+
+	while (stackSize) {
+		stackSize--;
+		if (stackDist[stackSize] > bestDist) {
+			continue; // a closer hit was found after this node was pushed
+		}
+
+		const BvhNode& node = nodes[stack[stackSize]];
+
+		if (node.count) {
+			for (int i = node.start; i < node.start + node.count; i++) {
+				testPrim(prims[i], bestDist);
+			}
+			continue;
+		}
+
+		int left = stack[stackSize] + 1;
+		int right = node.start;
+		float tLeft, tRight;
+		bool hitLeft = rayBox(rayStart, rayDir, invDir, nodes[left], bestDist, tLeft);
+		bool hitRight = rayBox(rayStart, rayDir, invDir, nodes[right], bestDist, tRight);
+
+		// push the farther child first so the nearer one is tested first
+		if (hitLeft && hitRight && tLeft < tRight) {
+			stack[stackSize] = right;
+			stackDist[stackSize++] = tRight;
+			stack[stackSize] = left;
+			stackDist[stackSize++] = tLeft;
+		}
+		else {
+			if (hitLeft) {
+				stack[stackSize] = left;
+				stackDist[stackSize++] = tLeft;
+			}
+			if (hitRight) {
+				stack[stackSize] = right;
+				stackDist[stackSize++] = tRight;
+			}
+		}
+	}
+}
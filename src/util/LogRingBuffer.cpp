@@ -0,0 +1,89 @@
+#include "LogRingBuffer.h"
+#include <string.h>
+#include <stdio.h>
+
+// Bounded MPMC queue design from Dmitry Vyukov, with a single consumer.
+// Each slot's sequence number says whether it's free for the writer at that position
+// (seq == pos) or holds a message for the reader at that position (seq == pos + 1).
+
+LogRingBuffer::LogRingBuffer() {
+	for (int i = 0; i < LOG_SLOT_COUNT; i++) {
+		slots[i].seq.store(i, std::memory_order_relaxed);
+	}
+	writePos = 0;
+	readPos = 0;
+	dropped = 0;
+	truncated = 0;
+	reportedDrops = 0;
+}
+
+bool LogRingBuffer::push(const char* msg) {
+	uint32_t pos = writePos.load(std::memory_order_relaxed);
+	Slot* slot;
+
+	while (true) {
+		slot = &slots[pos & (LOG_SLOT_COUNT - 1)];
+		uint32_t seq = slot->seq.load(std::memory_order_acquire);
+		int32_t diff = (int32_t)(seq - pos);
+
+		if (diff == 0) {
+			if (writePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+				break;
+			}
+		}
+		else if (diff < 0) {
+			dropped++; // reader hasn't freed this slot yet
+			return false;
+		}
+		else {
+			pos = writePos.load(std::memory_order_relaxed); // another writer claimed it
+		}
+	}
+
+	size_t len = strlen(msg);
+	if (len >= LOG_SLOT_SIZE) {
+		len = LOG_SLOT_SIZE - 1;
+		truncated++;
+	}
+	memcpy(slot->text, msg, len);
+	slot->text[len] = 0;
+
+	// keep the line break so the next message doesn't end up on the same line
+	if (len == LOG_SLOT_SIZE - 1 && msg[strlen(msg) - 1] == '\n') {
+		slot->text[len - 1] = '\n';
+	}
+
+	slot->seq.store(pos + 1, std::memory_order_release);
+	return true;
+}
+
+void LogRingBuffer::drain(const std::function<void(const char*)>& func) {
+	while (true) {
+		Slot* slot = &slots[readPos & (LOG_SLOT_COUNT - 1)];
+		uint32_t seq = slot->seq.load(std::memory_order_acquire);
+
+		if ((int32_t)(seq - (readPos + 1)) < 0) {
+			break; // nothing written here yet
+		}
+
+		func(slot->text);
+		slot->seq.store(readPos + LOG_SLOT_COUNT, std::memory_order_release);
+		readPos++;
+	}
+
+	int totalDrops = dropped;
+	if (totalDrops != reportedDrops) {
+		char note[128];
+		snprintf(note, sizeof(note), "(%d log messages were dropped)\n", totalDrops - reportedDrops);
+		func(note);
+		reportedDrops = totalDrops;
+	}
+}
+
+int LogRingBuffer::getDroppedCount() {
+	return dropped;
+}
+
+int LogRingBuffer::getTruncatedCount() {
+	return truncated;
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include <atomic>
+#include <stdint.h>
+#include <functional>
+
+#define LOG_SLOT_COUNT 1024 // must be a power of 2
+#define LOG_SLOT_SIZE 512 // longer messages are truncated
+
+// Fixed-size queue of log messages. Any thread can push without locking, but only one
+// thread (the GUI) may drain it. Messages pushed while the queue is full are dropped and counted.
+class LogRingBuffer {
+public:
+	LogRingBuffer();
+
+	// copies the message into the queue. Returns false if there was no room for it.
+	bool push(const char* msg);
+
+	// calls func for each queued message, oldest first, then frees them.
+	// A note is added if any messages were dropped since the last drain.
+	void drain(const std::function<void(const char*)>& func);
+
+	int getDroppedCount();
+	int getTruncatedCount();
+
+private:
+	struct Slot {
+		std::atomic<uint32_t> seq; // which write/read position this slot is ready for
+		char text[LOG_SLOT_SIZE];
+	};
+
+	Slot slots[LOG_SLOT_COUNT];
+	std::atomic<uint32_t> writePos;
+	uint32_t readPos; // only touched by the draining thread
+	std::atomic<int> dropped;
+	std::atomic<int> truncated;
+	int reportedDrops; // drops already announced by drain()
+};
@@ -0,0 +1,220 @@
+#include "LooseOctree.h"
+#include <float.h>
+
+#define OCTREE_MIN_NODE_SIZE 32.0f // smaller items share nodes instead of getting deeper ones
+#define OCTREE_MAX_DEPTH 20 // keeps the query stack bounded for very large worlds
+
+LooseOctree::LooseOctree(float worldSize) {
+	clear(worldSize);
+}
+
+void LooseOctree::clear(float worldSize) {
+	this->worldSize = worldSize;
+	nodes.clear();
+	freeNodes.clear();
+	slots.clear();
+	itemCount = 0;
+
+	addNode(-1, 0);
+}
+
+int LooseOctree::addNode(int parent, int octant) {
+	int idx;
+	if (freeNodes.size()) {
+		idx = freeNodes.back();
+		freeNodes.pop_back();
+	}
+	else {
+		idx = nodes.size();
+		nodes.push_back(Node());
+	}
+
+	Node& node = nodes[idx];
+	node.parent = parent;
+	node.octant = octant;
+	node.count = 0;
+	node.items.clear();
+	for (int i = 0; i < 8; i++) {
+		node.children[i] = -1;
+	}
+
+	if (parent == -1) {
+		node.center = vec3();
+		node.size = worldSize;
+	}
+	else {
+		Node& parentNode = nodes[parent];
+		float size = parentNode.size * 0.5f;
+		node.size = size;
+		node.center = parentNode.center + vec3(octant & 1 ? size : -size, octant & 2 ? size : -size, octant & 4 ? size : -size);
+		parentNode.children[octant] = idx;
+	}
+
+	return idx;
+}
+
+int LooseOctree::findNode(vec3 mins, vec3 maxs, bool create) {
+	vec3 center = (mins + maxs) * 0.5f;
+	vec3 extent = (maxs - mins) * 0.5f;
+	float radius = max(extent.x, max(extent.y, extent.z));
+
+	if (fabs(center.x) > worldSize || fabs(center.y) > worldSize || fabs(center.z) > worldSize) {
+		return 0; // doesn't fit anywhere, so it's always tested
+	}
+
+	int nodeIdx = 0;
+	for (int depth = 0; depth < OCTREE_MAX_DEPTH; depth++) {
+		const Node& node = nodes[nodeIdx];
+		float childSize = node.size * 0.5f;
+		if (childSize < radius || childSize < OCTREE_MIN_NODE_SIZE) {
+			break;
+		}
+
+		int octant = (center.x >= node.center.x ? 1 : 0) | (center.y >= node.center.y ? 2 : 0) | (center.z >= node.center.z ? 4 : 0);
+		int child = node.children[octant];
+		if (child == -1) {
+			if (!create) {
+				return -1;
+			}
+			child = addNode(nodeIdx, octant);
+		}
+		nodeIdx = child;
+	}
+
+	return nodeIdx;
+}
+
+void LooseOctree::update(int item, vec3 mins, vec3 maxs) {
+	if (item < 0) {
+		return;
+	}
+	if (item >= slots.size()) {
+		Slot empty;
+		empty.node = -1;
+		empty.pos = -1;
+		slots.resize(item + 1, empty);
+	}
+
+	Slot& slot = slots[item];
+	if (slot.node != -1 && findNode(mins, maxs, false) == slot.node) {
+		// still fits in the same node. Common for small moves.
+		slot.mins = mins;
+		slot.maxs = maxs;
+		return;
+	}
+
+	remove(item);
+
+	int nodeIdx = findNode(mins, maxs, true);
+	Node& node = nodes[nodeIdx];
+	slot.node = nodeIdx;
+	slot.pos = node.items.size();
+	slot.mins = mins;
+	slot.maxs = maxs;
+	node.items.push_back(item);
+
+	for (int i = nodeIdx; i != -1; i = nodes[i].parent) {
+		nodes[i].count++;
+	}
+	itemCount++;
+}
+
+void LooseOctree::remove(int item) {
+	if (!contains(item)) {
+		return;
+	}
+
+	Slot& slot = slots[item];
+	Node& node = nodes[slot.node];
+
+	int last = node.items.back();
+	node.items[slot.pos] = last;
+	slots[last].pos = slot.pos;
+	node.items.pop_back();
+
+	for (int i = slot.node; i != -1; i = nodes[i].parent) {
+		nodes[i].count--;
+	}
+	itemCount--;
+
+	// prune branches that are now empty. Their children were already pruned when they emptied.
+	int nodeIdx = slot.node;
+	while (nodeIdx != 0 && nodes[nodeIdx].count == 0) {
+		Node& emptyNode = nodes[nodeIdx];
+		nodes[emptyNode.parent].children[emptyNode.octant] = -1;
+		freeNodes.push_back(nodeIdx);
+		nodeIdx = emptyNode.parent;
+	}
+
+	slot.node = -1;
+	slot.pos = -1;
+}
+
+bool LooseOctree::contains(int item) const {
+	return item >= 0 && item < slots.size() && slots[item].node != -1;
+}
+
+void LooseOctree::queryBox(vec3 mins, vec3 maxs, vector<int>& output) const {
+	query([&](const vec3& boxMins, const vec3& boxMaxs) {
+		return boxMins.x <= maxs.x && boxMaxs.x >= mins.x
+			&& boxMins.y <= maxs.y && boxMaxs.y >= mins.y
+			&& boxMins.z <= maxs.z && boxMaxs.z >= mins.z;
+	}, output);
+}
+
+void LooseOctree::queryFrustum(const Frustum& frustum, float zFar, vector<int>& output) const {
+	// same result as isBoxInView, but only tests the corner nearest to the inside of each plane
+	query([&](const vec3& boxMins, const vec3& boxMaxs) {
+		const vec3& o = frustum.origin;
+		vec3 closest = vec3(clamp(o.x, boxMins.x, boxMaxs.x), clamp(o.y, boxMins.y, boxMaxs.y), clamp(o.z, boxMins.z, boxMaxs.z));
+		if ((closest - o).length() >= zFar) {
+			return false;
+		}
+
+		for (int i = 0; i < 4; i++) {
+			const vec3& n = frustum.planes[i];
+			vec3 corner = vec3(n.x > 0 ? boxMaxs.x : boxMins.x, n.y > 0 ? boxMaxs.y : boxMins.y, n.z > 0 ? boxMaxs.z : boxMins.z);
+			if (dotProduct(corner - o, n) <= 0) {
+				return false;
+			}
+		}
+
+		return true;
+	}, output);
+}
+
+void LooseOctree::queryRay(vec3 start, vec3 dir, vector<int>& output) const {
+	query([&](const vec3& boxMins, const vec3& boxMaxs) {
+		float tmin = 0;
+		float tmax = FLT_MAX;
+
+		for (int i = 0; i < 3; i++) {
+			float s = (&start.x)[i];
+			float d = (&dir.x)[i];
+			float lo = (&boxMins.x)[i];
+			float hi = (&boxMaxs.x)[i];
+
+			if (d == 0) {
+				if (s < lo || s > hi) {
+					return false;
+				}
+				continue;
+			}
+
+			float t1 = (lo - s) / d;
+			float t2 = (hi - s) / d;
+			if (t1 > t2) {
+				float temp = t1;
+				t1 = t2;
+				t2 = temp;
+			}
+			if (t1 > tmin) tmin = t1;
+			if (t2 < tmax) tmax = t2;
+			if (tmin > tmax) {
+				return false;
+			}
+		}
+
+		return true;
+	}, output);
+}
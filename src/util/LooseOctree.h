@@ -0,0 +1,94 @@
+#pragma once
+#include "util.h"
+#include <vector>
+
+// Loose octree of axis-aligned boxes, for finding the few items near the camera or a ray without
+// testing all of them. Items are only known by index (e.g. entity indexes) and can be moved or
+// removed at any time. Each node's bounds are twice the size of its cell, so an item fits in the
+// single node whose cell contains its center, at the depth matching its size, and never has to be
+// split or reinserted when a neighbor moves.
+class LooseOctree {
+public:
+	// items outside of [-worldSize, worldSize] are still indexed, just not as efficiently
+	LooseOctree(float worldSize = 32768.0f);
+
+	// adds the item, or moves it if it was already added
+	void update(int item, vec3 mins, vec3 maxs);
+
+	void remove(int item);
+
+	// removes all items
+	void clear(float worldSize);
+
+	bool contains(int item) const;
+
+	int count() const { return itemCount; }
+
+	// these add items whose bounds touch the query shape to the output, in no particular order
+	void queryBox(vec3 mins, vec3 maxs, vector<int>& output) const;
+	void queryFrustum(const Frustum& frustum, float zFar, vector<int>& output) const;
+	void queryRay(vec3 start, vec3 dir, vector<int>& output) const;
+
+private:
+	struct Node {
+		vec3 center;
+		float size; // half the width of the cell. Items in this node are within 2x this of the center.
+		int children[8]; // -1 = no items in that octant
+		int parent;
+		int octant; // index in the parent's children
+		int count; // items in this node and all its children
+		vector<int> items;
+	};
+
+	struct Slot {
+		int node; // -1 if the item isn't in the tree
+		int pos; // index in the node's item list
+		vec3 mins;
+		vec3 maxs;
+	};
+
+	vector<Node> nodes; // the first node is the root
+	vector<int> freeNodes;
+	vector<Slot> slots; // indexed by item
+	int itemCount;
+	float worldSize;
+
+	// node the box belongs in. Returns -1 if that node doesn't exist and create is false.
+	int findNode(vec3 mins, vec3 maxs, bool create);
+
+	int addNode(int parent, int octant);
+
+	template<class F>
+	void query(F touchesBox, vector<int>& output) const;
+};
+
+template<class F>
+void LooseOctree::query(F touchesBox, vector<int>& output) const {
+	// depth is limited by the minimum node size, so this is plenty
+	int stack[512];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+
+	while (stackSize) {
+		const Node& node = nodes[stack[--stackSize]];
+
+		for (int i = 0; i < node.items.size(); i++) {
+			const Slot& slot = slots[node.items[i]];
+			if (touchesBox(slot.mins, slot.maxs)) {
+				output.push_back(node.items[i]);
+			}
+		}
+
+		for (int i = 0; i < 8; i++) {
+			if (node.children[i] == -1) {
+				continue;
+			}
+
+			const Node& child = nodes[node.children[i]];
+			vec3 looseSize = vec3(child.size, child.size, child.size) * 2.0f;
+			if (touchesBox(child.center - looseSize, child.center + looseSize)) {
+				stack[stackSize++] = node.children[i];
+			}
+		}
+	}
+}
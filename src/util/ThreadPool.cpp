@@ -0,0 +1,109 @@
+#include "ThreadPool.h"
+#include <atomic>
+
+using namespace std;
+
+ThreadPool::ThreadPool(int numThreads) {
+	if (numThreads <= 0) {
+		numThreads = thread::hardware_concurrency();
+	}
+	if (numThreads <= 0) {
+		numThreads = 1;
+	}
+
+	for (int i = 0; i < numThreads; i++) {
+		workers.push_back(thread(&ThreadPool::workerLoop, this));
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		lock_guard<mutex> lock(jobMutex);
+		stopping = true;
+	}
+	jobAdded.notify_all();
+
+	for (int i = 0; i < workers.size(); i++) {
+		workers[i].join();
+	}
+}
+
+void ThreadPool::workerLoop() {
+	while (true) {
+		function<void()> job;
+
+		{
+			unique_lock<mutex> lock(jobMutex);
+			jobAdded.wait(lock, [this] { return stopping || !jobs.empty(); });
+
+			if (jobs.empty()) {
+				return; // stopping and nothing left to do
+			}
+
+			job = move(jobs.front());
+			jobs.pop();
+		}
+
+		job();
+	}
+}
+
+struct ParallelForState {
+	atomic<int> nextIdx;
+	atomic<int> finished;
+	int count;
+	function<void(int)> func;
+	mutex doneMutex;
+	condition_variable done;
+};
+
+static void runParallelForLoop(ParallelForState* state) {
+	int completed = 0;
+
+	for (int i = state->nextIdx++; i < state->count; i = state->nextIdx++) {
+		state->func(i);
+		completed++;
+	}
+
+	if (completed && (state->finished += completed) == state->count) {
+		lock_guard<mutex> lock(state->doneMutex);
+		state->done.notify_all();
+	}
+}
+
+void ThreadPool::parallelFor(int count, const function<void(int)>& func) {
+	if (count <= 0) {
+		return;
+	}
+
+	shared_ptr<ParallelForState> state(new ParallelForState());
+	state->nextIdx = 0;
+	state->finished = 0;
+	state->count = count;
+	state->func = func;
+
+	// helpers that start after the loop is exhausted exit immediately. Only indexes are waited on,
+	// not helpers, so a nested call can't deadlock when every worker is busy.
+	int helpers = min(count - 1, (int)workers.size());
+	{
+		lock_guard<mutex> lock(jobMutex);
+		for (int i = 0; i < helpers; i++) {
+			jobs.push([state]() { runParallelForLoop(state.get()); });
+		}
+	}
+	jobAdded.notify_all();
+
+	runParallelForLoop(state.get());
+
+	unique_lock<mutex> lock(state->doneMutex);
+	state->done.wait(lock, [&state] { return state->finished == state->count; });
+}
+
+int ThreadPool::size() {
+	return workers.size();
+}
+
+int ThreadPool::pending() {
+	lock_guard<mutex> lock(jobMutex);
+	return jobs.size();
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+
+// Fixed-size pool of worker threads for CPU-bound background work (texture decoding, mesh generation, etc.)
+// Jobs must not touch OpenGL. Results are handed back to the main thread through futures.
+class ThreadPool {
+public:
+	// numThreads <= 0 creates one worker per hardware thread
+	ThreadPool(int numThreads=0);
+
+	// finishes queued jobs then joins the workers
+	~ThreadPool();
+
+	template<class F>
+	std::future<typename std::result_of<F()>::type> submit(F func) {
+		typedef typename std::result_of<F()>::type ret_type;
+
+		std::shared_ptr<std::packaged_task<ret_type()>> task(new std::packaged_task<ret_type()>(func));
+		std::future<ret_type> result = task->get_future();
+
+		{
+			std::lock_guard<std::mutex> lock(jobMutex);
+			jobs.push([task]() { (*task)(); });
+		}
+		jobAdded.notify_one();
+
+		return result;
+	}
+
+	// calls func(i) for every i in [0, count) and returns when all calls have finished.
+	// The calling thread works on the loop too, so this is safe to call from inside a job.
+	void parallelFor(int count, const std::function<void(int)>& func);
+
+	int size();
+
+	// number of jobs waiting for a worker
+	int pending();
+
+private:
+	std::vector<std::thread> workers;
+	std::queue<std::function<void()>> jobs;
+	std::mutex jobMutex;
+	std::condition_variable jobAdded;
+	bool stopping = false;
+
+	void workerLoop();
+};
@@ -0,0 +1,131 @@
+#include "Trace.h"
+#include "util.h"
+#include <vector>
+#include <mutex>
+#include <memory>
+#include <chrono>
+#include <stdio.h>
+
+std::atomic<bool> g_tracing(false);
+
+struct TraceEvent {
+	const char* name;
+	int64_t start;
+	int64_t duration; // -1 for counters
+	double value;
+};
+
+// events from a single thread. Kept after the thread exits, so its events are still saved.
+struct TraceBuffer {
+	std::mutex mutex; // only contended while the trace is being written
+	std::vector<TraceEvent> events;
+	int tid;
+};
+
+static std::mutex g_trace_buffers_mutex;
+static std::vector<std::shared_ptr<TraceBuffer>> g_trace_buffers;
+static thread_local TraceBuffer* t_trace_buffer = NULL;
+static chrono::steady_clock::time_point g_trace_start;
+
+static TraceBuffer* getTraceBuffer() {
+	if (!t_trace_buffer) {
+		std::shared_ptr<TraceBuffer> buffer(new TraceBuffer());
+		buffer->events.reserve(1024);
+
+		std::lock_guard<std::mutex> lock(g_trace_buffers_mutex);
+		buffer->tid = g_trace_buffers.size();
+		g_trace_buffers.push_back(buffer);
+		t_trace_buffer = buffer.get();
+	}
+
+	return t_trace_buffer;
+}
+
+static void addTraceEvent(const TraceEvent& evt) {
+	TraceBuffer* buffer = getTraceBuffer();
+	std::lock_guard<std::mutex> lock(buffer->mutex);
+	buffer->events.push_back(evt);
+}
+
+void traceStart() {
+	g_trace_start = chrono::steady_clock::now();
+	getTraceBuffer(); // the starting thread gets tid 0
+	g_tracing = true;
+}
+
+int64_t traceNow() {
+	return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - g_trace_start).count();
+}
+
+void traceSpan(const char* name, int64_t start, int64_t end) {
+	TraceEvent evt;
+	evt.name = name;
+	evt.start = start;
+	evt.duration = end - start;
+	evt.value = 0;
+	addTraceEvent(evt);
+}
+
+void traceCounter(const char* name, double value) {
+	TraceEvent evt;
+	evt.name = name;
+	evt.start = traceNow();
+	evt.duration = -1;
+	evt.value = value;
+	addTraceEvent(evt);
+}
+
+bool traceWrite(const string& path) {
+	g_tracing = false;
+
+	FILE* file = fopen(path.c_str(), "w");
+	if (!file) {
+		logf("ERROR: failed to write trace file %s\n", path.c_str());
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(g_trace_buffers_mutex);
+
+	int numEvents = 0;
+	fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+	for (int i = 0; i < g_trace_buffers.size(); i++) {
+		TraceBuffer& buffer = *g_trace_buffers[i];
+		std::lock_guard<std::mutex> bufferLock(buffer.mutex);
+
+		fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s %d\"}}",
+			i ? ",\n" : "", buffer.tid, buffer.tid ? "worker" : "main", buffer.tid);
+
+		for (int k = 0; k < buffer.events.size(); k++) {
+			TraceEvent& evt = buffer.events[k];
+			string name = jsonString(evt.name);
+
+			if (evt.duration >= 0) {
+				fprintf(file, ",\n{\"name\":%s,\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%lld,\"dur\":%lld}",
+					name.c_str(), buffer.tid, (long long)evt.start, (long long)evt.duration);
+			}
+			else {
+				fprintf(file, ",\n{\"name\":%s,\"ph\":\"C\",\"pid\":1,\"tid\":%d,\"ts\":%lld,\"args\":{\"value\":%g}}",
+					name.c_str(), buffer.tid, (long long)evt.start, evt.value);
+			}
+		}
+
+		numEvents += buffer.events.size();
+		buffer.events.clear();
+	}
+
+	fprintf(file, "\n]}\n");
+	fclose(file);
+
+	debugf("Wrote %d trace events to %s\n", numEvents, path.c_str());
+	return true;
+}
+
+TraceSession::TraceSession(string path) {
+	this->path = path;
+	traceStart();
+}
+
+TraceSession::~TraceSession() {
+	traceWrite(path);
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <string>
+#include <atomic>
+#include <stdint.h>
+
+// Low overhead profiler for finding where time goes in long operations. Timed spans and
+// counters are recorded into a buffer per thread, then saved as Chrome trace events, which
+// can be viewed in chrome://tracing or ui.perfetto.dev. Spans nest by time, so a span opened
+// inside another one shows up under it.
+//
+// Nothing is recorded until traceStart() is called (-trace on the command line). Builds
+// without BSPGUY_TRACE compile the TRACE_ macros to nothing.
+
+#ifdef BSPGUY_TRACE
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+
+// times the rest of the enclosing scope. The name must be a string literal.
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+
+// records a value that changes over time, drawn as a graph. The name must be a string literal.
+#define TRACE_COUNTER(name, value) do { if (g_tracing.load(std::memory_order_relaxed)) traceCounter(name, value); } while (0)
+#else
+#define TRACE_SCOPE(name)
+#define TRACE_COUNTER(name, value)
+#endif
+
+extern std::atomic<bool> g_tracing;
+
+void traceStart();
+
+// stops recording and saves everything recorded so far. Returns false if the file can't be written.
+bool traceWrite(const std::string& path);
+
+// microseconds since traceStart()
+int64_t traceNow();
+
+void traceSpan(const char* name, int64_t start, int64_t end);
+
+void traceCounter(const char* name, double value);
+
+class TraceScope {
+public:
+	TraceScope(const char* name) {
+		this->name = g_tracing.load(std::memory_order_relaxed) ? name : NULL;
+		if (this->name) {
+			start = traceNow();
+		}
+	}
+
+	~TraceScope() {
+		if (name) {
+			traceSpan(name, start, traceNow());
+		}
+	}
+
+private:
+	const char* name;
+	int64_t start;
+};
+
+// starts tracing, and writes the trace when it goes out of scope
+class TraceSession {
+public:
+	TraceSession(std::string path);
+	~TraceSession();
+
+private:
+	std::string path;
+};
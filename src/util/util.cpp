@@ -4,6 +4,9 @@
 #include "colors.h"
 #include "mat4x4.h"
 #include "globals.h"
+#include "AssetResolver.h"
+#include "LogRingBuffer.h"
+#include <chrono>
 #include <cstdarg>
 #include <iostream>
 #include <algorithm>
@@ -37,20 +40,118 @@ namespace fs = std::experimental::filesystem;
 #endif
 
 
-static char log_line[4096];
+#define LOG_REPEAT_LIMIT 8 // identical messages allowed per second in the GUI log before they're suppressed
 
-void logf(const char* format, ...) {
-	g_log_mutex.lock();
+struct LogRepeatState {
+	string lastMsg;
+	int repeats;
+	int suppressed;
+	chrono::steady_clock::time_point windowStart;
+};
+
+static LogRepeatState g_log_repeat; // only applies to the GUI log. The console gets every message.
+static mutex g_log_repeat_mutex;
+static thread_local string* t_log_capture = NULL;
+
+ScopedLogCapture::ScopedLogCapture(string& output) {
+	oldOutput = t_log_capture;
+	t_log_capture = &output;
+}
+
+ScopedLogCapture::~ScopedLogCapture() {
+	t_log_capture = oldOutput;
+}
+
+bool isLogCaptured() {
+	return t_log_capture != NULL;
+}
+
+void printCapturedLog(const string& log) {
+	size_t start = 0;
+	while (start < log.size()) {
+		size_t end = log.find('\n', start);
+		end = end == string::npos ? log.size() : end + 1;
+		logf("%s", log.substr(start, end - start).c_str());
+		start = end;
+	}
+}
+
+// queues a note about messages suppressed in the current run of repeats. Lock g_log_repeat_mutex first.
+static void pushSuppressedNote(LogRepeatState& state) {
+	if (state.suppressed) {
+		char note[128];
+		snprintf(note, sizeof(note), "(previous message repeated %d more times)\n", state.suppressed);
+		g_log_buffer->push(note);
+		state.suppressed = 0;
+	}
+}
+
+// collapses spam like an error printed every frame, which would otherwise fill the GUI log queue.
+// Partial lines (progress meters) are written in small repeated pieces, so only whole lines are counted.
+static void pushGuiLog(const char* line) {
+	int len = strlen(line);
+	if (len == 0 || line[len - 1] != '\n') {
+		g_log_buffer->push(line);
+		return;
+	}
+
+	lock_guard<mutex> lock(g_log_repeat_mutex);
+	LogRepeatState& state = g_log_repeat;
+	auto now = chrono::steady_clock::now();
+
+	if (state.lastMsg == line && now - state.windowStart < chrono::seconds(1)) {
+		if (++state.repeats > LOG_REPEAT_LIMIT) {
+			state.suppressed++;
+			return;
+		}
+	}
+	else {
+		pushSuppressedNote(state);
+		if (state.lastMsg != line) {
+			state.lastMsg = line;
+		}
+		state.repeats = 1;
+		state.windowStart = now;
+	}
+
+	g_log_buffer->push(line);
+}
 
+void flushLogRepeats() {
+	if (!g_log_buffer) {
+		return;
+	}
+
+	lock_guard<mutex> lock(g_log_repeat_mutex);
+	LogRepeatState& state = g_log_repeat;
+
+	// a run that's still going will be noted when it ends, so spam doesn't add a note every frame
+	if (state.suppressed && chrono::steady_clock::now() - state.windowStart >= chrono::seconds(1)) {
+		pushSuppressedNote(state);
+		state = LogRepeatState();
+	}
+}
+
+static void writeLog(const char* format, va_list vl) {
+	char line[4096];
+	vsnprintf(line, sizeof(line), format, vl);
+
+	if (t_log_capture) {
+		t_log_capture->append(line);
+		return;
+	}
+
+	printf("%s", line);
+	if (g_log_buffer) {
+		pushGuiLog(line);
+	}
+}
+
+void logf(const char* format, ...) {
 	va_list vl;
 	va_start(vl, format);
-	vsnprintf(log_line, 4096, format, vl);
+	writeLog(format, vl);
 	va_end(vl);
-
-	printf("%s", log_line);
-	g_log_buffer.push_back(log_line);
-
-	g_log_mutex.unlock();
 }
 
 void debugf(const char* format, ...) {
@@ -58,17 +159,66 @@ void debugf(const char* format, ...) {
 		return;
 	}
 
-	g_log_mutex.lock();
-
 	va_list vl;
 	va_start(vl, format);
-	vsnprintf(log_line, 4096, format, vl);
+	writeLog(format, vl);
 	va_end(vl);
+}
 
-	printf("%s", log_line);
-	g_log_buffer.push_back(log_line);
+string jsonString(const string& s) {
+	string out = "\"";
+	for (int i = 0; i < s.size(); i++) {
+		unsigned char c = s[i];
+		switch (c) {
+		case '"': out += "\\\""; break;
+		case '\\': out += "\\\\"; break;
+		case '\n': out += "\\n"; break;
+		case '\r': out += "\\r"; break;
+		case '\t': out += "\\t"; break;
+		default:
+			if (c < 0x20) {
+				char esc[8];
+				snprintf(esc, sizeof(esc), "\\u%04x", c);
+				out += esc;
+			}
+			else {
+				out += c;
+			}
+		}
+	}
+	return out + "\"";
+}
 
-	g_log_mutex.unlock();
+string jsonStringList(const vector<string>& list) {
+	string out = "[";
+	for (int i = 0; i < list.size(); i++) {
+		out += (i ? "," : "") + jsonString(list[i]);
+	}
+	return out + "]";
+}
+
+vector<string> getLogLines(const string& log) {
+	vector<string> lines;
+	string line;
+
+	for (int i = 0; i <= log.size(); i++) {
+		if (i == log.size() || log[i] == '\n') {
+			if (!trimSpaces(line).empty()) {
+				lines.push_back(line);
+			}
+			line.clear();
+		}
+		else if (log[i] == '\x1B') {
+			while (i < log.size() && log[i] != 'm') {
+				i++;
+			}
+		}
+		else if (log[i] != '\b') {
+			line += log[i];
+		}
+	}
+
+	return lines;
 }
 
 bool fileExists(const string& fileName)
@@ -219,6 +369,86 @@ int getBspTextureSize(BSPMIPTEX* bspTexture) {
 	return sz;
 }
 
+#define XXH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3 0x165667B19E3779F9ULL
+#define XXH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5 0x27D4EB2F165667C5ULL
+
+static inline uint64_t xxhRotl(uint64_t x, int r) {
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t xxhRound(uint64_t acc, uint64_t input) {
+	acc += input * XXH_PRIME64_2;
+	acc = xxhRotl(acc, 31);
+	return acc * XXH_PRIME64_1;
+}
+
+static inline uint64_t xxhMergeRound(uint64_t acc, uint64_t val) {
+	acc ^= xxhRound(0, val);
+	return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+uint64_t hashData(const void* data, size_t len, uint64_t seed) {
+	const byte* p = (const byte*)data;
+	const byte* end = p + len;
+	uint64_t h;
+
+	if (len >= 32) {
+		uint64_t v1 = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+		uint64_t v2 = seed + XXH_PRIME64_2;
+		uint64_t v3 = seed;
+		uint64_t v4 = seed - XXH_PRIME64_1;
+
+		for (; p + 32 <= end; p += 32) {
+			uint64_t lanes[4];
+			memcpy(lanes, p, 32);
+			v1 = xxhRound(v1, lanes[0]);
+			v2 = xxhRound(v2, lanes[1]);
+			v3 = xxhRound(v3, lanes[2]);
+			v4 = xxhRound(v4, lanes[3]);
+		}
+
+		h = xxhRotl(v1, 1) + xxhRotl(v2, 7) + xxhRotl(v3, 12) + xxhRotl(v4, 18);
+		h = xxhMergeRound(h, v1);
+		h = xxhMergeRound(h, v2);
+		h = xxhMergeRound(h, v3);
+		h = xxhMergeRound(h, v4);
+	}
+	else {
+		h = seed + XXH_PRIME64_5;
+	}
+
+	h += len;
+
+	for (; p + 8 <= end; p += 8) {
+		uint64_t k;
+		memcpy(&k, p, 8);
+		h ^= xxhRound(0, k);
+		h = xxhRotl(h, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+	}
+	if (p + 4 <= end) {
+		uint32_t k;
+		memcpy(&k, p, 4);
+		h ^= (uint64_t)k * XXH_PRIME64_1;
+		h = xxhRotl(h, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+		p += 4;
+	}
+	for (; p < end; p++) {
+		h ^= (*p) * XXH_PRIME64_5;
+		h = xxhRotl(h, 11) * XXH_PRIME64_1;
+	}
+
+	h ^= h >> 33;
+	h *= XXH_PRIME64_2;
+	h ^= h >> 29;
+	h *= XXH_PRIME64_3;
+	h ^= h >> 32;
+
+	return h;
+}
+
 float clamp(float val, float min, float max) {
 	if (val > max) {
 		return max;
@@ -537,6 +767,25 @@ bool isBoxContained(const vec3& innerMins, const vec3& innerMaxs, const vec3& ou
 			innerMaxs.x <= outerMaxs.x && innerMaxs.y <= outerMaxs.y && innerMaxs.z <= outerMaxs.z);
 }
 
+int getTouchedOctants(const vec3& nodeMin, const vec3& nodeMax, const vec3& mins, const vec3& maxs) {
+	vec3 mid = (nodeMin + nodeMax) * 0.5f;
+
+	bool lowX = mins.x <= mid.x && maxs.x >= nodeMin.x;
+	bool highX = maxs.x >= mid.x && mins.x <= nodeMax.x;
+	bool lowY = mins.y <= mid.y && maxs.y >= nodeMin.y;
+	bool highY = maxs.y >= mid.y && mins.y <= nodeMax.y;
+	bool lowZ = mins.z <= mid.z && maxs.z >= nodeMin.z;
+	bool highZ = maxs.z >= mid.z && mins.z <= nodeMax.z;
+
+	int touched = 0;
+	for (int i = 0; i < 8; i++) {
+		if (((i & 1) ? highX : lowX) && ((i & 2) ? highY : lowY) && ((i & 4) ? highZ : lowZ)) {
+			touched |= 1 << i;
+		}
+	}
+	return touched;
+}
+
 void push_unique_vec2(vector<vec2>& verts, vec2 a) {
 	for (int k = 0; k < verts.size(); k++) {
 		vec2& b = verts[k];
@@ -747,7 +996,9 @@ bool pointInsidePolygon(vector<vec2>& poly, vec2 p) {
 			inside = false;
 			break;
 		}
-		lastd = d;
+		if (d != 0) {
+			lastd = d; // a point in line with an edge says nothing about which side it's on
+		}
 	}
 	return inside;
 }
@@ -873,6 +1124,19 @@ void removeDir(const string& dirName)
 #endif
 }
 
+vector<string> getDirFiles(const string& dirName) {
+	vector<string> files;
+#ifdef USE_FILESYSTEM
+	std::error_code err;
+	for (fs::directory_iterator it(dirName, err), end; !err && it != end; it.increment(err)) {
+		if (!fs::is_directory(it->path(), err)) {
+			files.push_back(it->path().filename().string());
+		}
+	}
+#endif
+	return files;
+}
+
 
 void replaceAll(std::string& str, const std::string& from, const std::string& to) {
 	if (from.empty())
@@ -960,20 +1224,7 @@ vector<string> getAssetPaths() {
 }
 
 string findAsset(string asset) {
-	vector<string> tryPaths = getAssetPaths();
-
-	if (fileExists(asset)) {
-		return asset;
-	}
-
-	for (string path : tryPaths) {
-		string testPath = path + asset;
-		if (fileExists(testPath)) {
-			return testPath;
-		}
-	}
-
-	return "";
+	return g_asset_resolver->find(asset);
 }
 
 float rayTriangleIntersect(const vec3& rayOrigin, const vec3& rayDir, const vec3& v0, const vec3& v1, const vec3& v2) {
@@ -1038,14 +1289,11 @@ bool isBoxInView(vec3 min, vec3 max, const Frustum& frustum, float zMax) {
 		{min.x, max.y, max.z}, {max.x, max.y, max.z},
 	};
 
-	bool allTooFar = true;
-	for (const vec3& corner : corners) {
-		vec3 delta = corner - frustum.origin;
-		if (delta.length() < zMax) {
-			allTooFar = false;
-		}
-	}
-	if (allTooFar)
+	// closest point in the box. Checking only the corners would cull large boxes around the camera.
+	vec3 closest = vec3(clamp(frustum.origin.x, min.x, max.x),
+		clamp(frustum.origin.y, min.y, max.y),
+		clamp(frustum.origin.z, min.z, max.z));
+	if ((closest - frustum.origin).length() >= zMax)
 		return false;
 
 	for (int i = 0; i < 4; i++) {
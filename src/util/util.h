@@ -34,6 +34,35 @@ void logf(const char* format, ...);
 
 void debugf(const char* format, ...);
 
+// Sends logf/debugf output from the current thread to a string instead of the console, until destroyed.
+// Lets jobs running in parallel print their logs in one piece and in order afterwards.
+// Progress meters are silent on threads with a captured log.
+class ScopedLogCapture {
+public:
+	ScopedLogCapture(string& output);
+	~ScopedLogCapture();
+
+private:
+	string* oldOutput;
+};
+
+// true if the current thread's log is being captured
+bool isLogCaptured();
+
+// queues a note in the GUI log about repeated messages that were suppressed, once the repeats stop
+void flushLogRepeats();
+
+// prints a captured log with logf, a line at a time
+void printCapturedLog(const string& log);
+
+// splits a captured log into lines, dropping color codes and blank lines
+vector<string> getLogLines(const string& log);
+
+// quotes and escapes a string for JSON output
+string jsonString(const string& s);
+
+string jsonStringList(const vector<string>& list);
+
 bool fileExists(const string& fileName);
 
 char* loadFile(const string& fileName, int& length);
@@ -62,12 +91,19 @@ bool createDir(const string& dirName);
 
 void removeDir(const string& dirName);
 
+// lists the names of files (not folders) in a directory. Unreadable directories are empty.
+vector<string> getDirFiles(const string& dirName);
+
 string toLowerCase(string str);
 
 string trimSpaces(string s);
 
 int getBspTextureSize(BSPMIPTEX* bspTexture);
 
+// fast non-cryptographic 64-bit hash (XXH64). Equal data always gives equal hashes,
+// but callers still need to compare the data when hashes match.
+uint64_t hashData(const void* data, size_t len, uint64_t seed=0);
+
 float clamp(float val, float min, float max);
 
 vec3 parseVector(string s);
@@ -103,6 +139,10 @@ bool pointInBox(const vec3& p, const vec3& mins, const vec3& maxs);
 
 bool isBoxContained(const vec3& innerMins, const vec3& innerMaxs, const vec3& outerMins, const vec3& outerMaxs);
 
+// returns a bit for each child octant of the node that the box touches (bit 0/1/2 = high x/y/z half).
+// Same as testing the box against every child's bounds, but without computing them.
+int getTouchedOctants(const vec3& nodeMin, const vec3& nodeMax, const vec3& mins, const vec3& maxs);
+
 // get verts from the given set that form a triangle (no duplicates and not colinear)
 vector<vec3> getTriangularVerts(vector<vec3>& verts);
 